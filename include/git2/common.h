@@ -269,7 +269,18 @@ typedef enum {
 	GIT_OPT_GET_USER_AGENT_PRODUCT,
 	GIT_OPT_ADD_SSL_X509_CERT,
 	GIT_OPT_GET_PACK_MAX_OBJECT_SIZE,
-	GIT_OPT_SET_PACK_MAX_OBJECT_SIZE
+	GIT_OPT_SET_PACK_MAX_OBJECT_SIZE,
+	GIT_OPT_GET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_SET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_GET_PACK_CACHE_STATS,
+	GIT_OPT_GET_MWINDOW_FULL_MAP,
+	GIT_OPT_SET_MWINDOW_FULL_MAP,
+	GIT_OPT_GET_PACK_LOOKUP_CACHE_SIZE,
+	GIT_OPT_SET_PACK_LOOKUP_CACHE_SIZE,
+	GIT_OPT_GET_ODB_MISSING_CACHE_SIZE,
+	GIT_OPT_SET_ODB_MISSING_CACHE_SIZE,
+	GIT_OPT_GET_PACK_STREAM_DELTAS,
+	GIT_OPT_SET_PACK_STREAM_DELTAS
 } git_libgit2_opt_t;
 
 /**
@@ -304,6 +315,70 @@ typedef enum {
  *		> Set the maximum number of files that can be mapped at any time
  *		> by the library. The default (0) is unlimited.
  *
+ *	* opts(GIT_OPT_GET_MWINDOW_FULL_MAP, int *):
+ *
+ *		> Get whether packfiles are mapped in full
+ *
+ *	* opts(GIT_OPT_SET_MWINDOW_FULL_MAP, int enabled):
+ *
+ *		> Map each packfile that is read in full, once, instead of
+ *		> through windows of `GIT_OPT_SET_MWINDOW_SIZE`.  Reading the
+ *		> pack then needs no window bookkeeping, and the operating
+ *		> system's page cache decides what stays in memory; these
+ *		> mappings do not count towards the mapped limit and are kept
+ *		> until the pack is closed.  Packs that are mapped in full are
+ *		> not closed to honour `GIT_OPT_SET_MWINDOW_FILE_LIMIT`, so they
+ *		> may keep more files open than that limit allows.  This only
+ *		> has an effect on 64-bit platforms, where address space is
+ *		> plentiful.  The default is disabled.
+ *
+ *	* opts(GIT_OPT_GET_PACK_LOOKUP_CACHE_SIZE, size_t *):
+ *
+ *		> Get the number of object lookups that each packfile object
+ *		> database remembers.
+ *
+ *	* opts(GIT_OPT_SET_PACK_LOOKUP_CACHE_SIZE, size_t entries):
+ *
+ *		> Remember up to `entries` recent object lookups in each packfile
+ *		> object database: the pack and offset of the objects that were
+ *		> found, and the IDs of those that were not.  Repeated lookups
+ *		> then no longer search the index of every pack, which helps
+ *		> repositories with many packs.  Lookups that failed are
+ *		> forgotten when `git_odb_refresh` finds new packs.  The default
+ *		> is 0, which disables the cache.
+ *
+ *	* opts(GIT_OPT_GET_ODB_MISSING_CACHE_SIZE, size_t *):
+ *
+ *		> Get the number of missing objects that each object database
+ *		> remembers.
+ *
+ *	* opts(GIT_OPT_SET_ODB_MISSING_CACHE_SIZE, size_t entries):
+ *
+ *		> Remember up to `entries` objects that an object database did
+ *		> not find, even after refreshing its backends.  Looking them up
+ *		> again then does not refresh the backends, which saves
+ *		> rescanning the object directories when the same objects are
+ *		> repeatedly looked up, like during fetch negotiation.  They are
+ *		> forgotten when objects are added through the object database,
+ *		> or when `git_odb_refresh` is called; packs that are added by
+ *		> other processes are not seen for these objects until then.
+ *		> The default is 0, which disables the cache.
+ *
+ *	* opts(GIT_OPT_GET_PACK_STREAM_DELTAS, int *):
+ *
+ *		> Get whether packs that are received into an object database
+ *		> resolve their deltas while they are being received.
+ *
+ *	* opts(GIT_OPT_SET_PACK_STREAM_DELTAS, int enabled):
+ *
+ *		> Resolve the deltas of a pack that is written to a packfile
+ *		> object database, as by a fetch or a clone, on a background
+ *		> thread while the rest of the pack is still being received,
+ *		> as `git_indexer_options.stream_deltas` does.  This overlaps
+ *		> delta resolution with the network transfer, at the cost of
+ *		> a thread and of reading the partial pack while it is being
+ *		> written.  The default is disabled.
+ *
  *	* opts(GIT_OPT_GET_SEARCH_PATH, int level, git_buf *buf)
  *
  *		> Get the search path for a given level of config data.  "level" must
@@ -584,6 +659,26 @@ typedef enum {
  *      > a pack file when downloading a pack file from a remote.
  *      > The default is 2 GiB.
  *
+ *   opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, size_t *out)
+ *      > Gets the maximum amount of memory that the cache of delta
+ *      > bases, which is shared by all packfiles, may use.
+ *
+ *   opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, size_t max_size)
+ *      > Sets the maximum amount of memory that the cache of delta
+ *      > bases may use. Objects that were recently used to resolve
+ *      > deltas are kept in it, so that they do not have to be
+ *      > inflated again. The least recently used objects are evicted
+ *      > when it is full. Set to 0 to disable the cache. The default
+ *      > is 96 MiB. Trees that objects read from a pack still use are
+ *      > kept in the cache too, but can't be evicted; they are limited
+ *      > to 32 MiB of their own instead of counting towards this.
+ *
+ *   opts(GIT_OPT_GET_PACK_CACHE_STATS, size_t *memory_used, size_t *hits, size_t *misses)
+ *      > Gets the amount of memory that the cache of delta bases
+ *      > currently uses, not counting the trees that are in use, and
+ *      > the number of lookups in it that found and did not find the
+ *      > base that was asked for.
+ *
  * @param option Option key
  * @return 0 on success, <0 on failure
  */
@@ -99,6 +99,26 @@ typedef struct git_indexer_options {
 
 	/** Do connectivity checks for the received pack */
 	unsigned char verify;
+
+	/**
+	 * The number of threads used to resolve the deltas in the pack, or
+	 * 0 to use one thread per CPU.
+	 *
+	 * This is 0 unless it is set, so every indexer, including the ones
+	 * that fetches and clones create, resolves deltas on one thread per
+	 * CPU by default.  Set it to 1 to resolve the deltas on the calling
+	 * thread.
+	 */
+	unsigned int threads;
+
+	/**
+	 * Resolve the deltas whose bases have already been received on a
+	 * background thread, while waiting for the rest of the pack to be
+	 * appended.  This lets delta resolution overlap with the network
+	 * transfer; the deltas that are left are resolved when the pack is
+	 * committed.
+	 */
+	unsigned char stream_deltas;
 } git_indexer_options;
 
 /** Current version for the `git_indexer_options` structure */
@@ -42,6 +42,37 @@ typedef enum {
  */
 typedef int GIT_CALLBACK(git_odb_foreach_cb)(const git_oid *id, void *payload);
 
+/**
+ * Function type for callbacks from git_odb_foreach_parallel.
+ *
+ * @param id an id of an object in the object database
+ * @param thread the index of the calling thread, from 0 up to the number
+ *               of threads
+ * @param payload the payload from the initial call to
+ *                git_odb_foreach_parallel
+ * @return 0 on success, or an error code
+ */
+typedef int GIT_CALLBACK(git_odb_foreach_parallel_cb)(
+	const git_oid *id, unsigned int thread, void *payload);
+
+/**
+ * Function type for callbacks from git_odb_foreach_object.
+ *
+ * @param id the id of the object
+ * @param type the type of the object
+ * @param data the contents of the object, which are only valid until the
+ *             callback returns
+ * @param len the size of the object's contents
+ * @param payload the payload from the initial call to git_odb_foreach_object
+ * @return 0 on success, or an error code
+ */
+typedef int GIT_CALLBACK(git_odb_foreach_object_cb)(
+	const git_oid *id,
+	git_object_t type,
+	const void *data,
+	size_t len,
+	void *payload);
+
 /**
  * Options for configuring a loose object backend.
  *
@@ -213,6 +244,47 @@ GIT_EXTERN(int) git_odb_read(git_odb_object **obj, git_odb *db, const git_oid *i
  */
 GIT_EXTERN(int) git_odb_read_prefix(git_odb_object **obj, git_odb *db, const git_oid *short_id, size_t len);
 
+/**
+ * Read several objects from the database at once.
+ *
+ * This looks up all of the objects in each backend together, which lets
+ * backends that support it avoid searching their indexes and reading
+ * their packfiles once per object.  For each of the given IDs, the
+ * corresponding entry of `out` is set to the object, or to `NULL` if the
+ * object is not in the database.  As with `git_odb_read`, the returned
+ * objects must be freed with `git_odb_object_free`.
+ *
+ * @param[out] out array of `count` pointers where to store the objects
+ * @param db database to search for the objects in.
+ * @param ids array of `count` identities of the objects to read.
+ * @param count the number of objects to read
+ * @return 0 if the lookup succeeded (even if some objects were not
+ *         found), or an error code; on error, no objects are returned.
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count);
+
+/**
+ * Hint that the given objects will be read soon.
+ *
+ * Backends that support it look up where the objects are stored and ask
+ * the operating system to start reading them into memory in the
+ * background, so that later calls to `git_odb_read` do not have to wait
+ * for the disk.  Objects that are not in the database are ignored.
+ *
+ * @param db database that the objects will be read from.
+ * @param ids array of `count` identities of the objects.
+ * @param count the number of objects
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_prefetch(
+	git_odb *db,
+	const git_oid *ids,
+	size_t count);
+
 /**
  * Read the header of an object from the database, without
  * reading its full contents.
@@ -252,6 +324,27 @@ GIT_EXTERN(int) git_odb_exists(git_odb *db, const git_oid *id);
  */
 GIT_EXTERN(int) git_odb_exists_ext(git_odb *db, const git_oid *id, unsigned int flags);
 
+/**
+ * Determine which of the given objects can be found in the object
+ * database.
+ *
+ * This looks up all of the objects in each backend together, which lets
+ * backends that support it search their indexes once for the whole set
+ * rather than once per object.
+ *
+ * @param[out] found array of `count` flags, each set to 1 if the
+ *             corresponding object was found and 0 otherwise
+ * @param db database to be searched for the given objects.
+ * @param ids array of `count` objects to search for.
+ * @param count the number of objects to search for
+ * @return 0 if the lookup succeeded, or an error code
+ */
+GIT_EXTERN(int) git_odb_exists_many(
+	int *found,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count);
+
 /**
  * Determine if an object can be found in the object database by an
  * abbreviated object ID.
@@ -324,7 +417,9 @@ GIT_EXTERN(int) git_odb_expand_ids(
  * NOTE that it is not necessary to call this function at all. The
  * library will automatically attempt to refresh the ODB
  * when a lookup fails, to see if the looked up object exists
- * on disk but hasn't been loaded yet.
+ * on disk but hasn't been loaded yet.  (Unless the object was
+ * remembered as missing, see `GIT_OPT_SET_ODB_MISSING_CACHE_SIZE`;
+ * this function makes the ODB forget those objects.)
  *
  * @param db database to refresh
  * @return 0 on success, error code otherwise
@@ -349,6 +444,55 @@ GIT_EXTERN(int) git_odb_foreach(
 	git_odb_foreach_cb cb,
 	void *payload);
 
+/**
+ * List all objects available in the database, using multiple threads.
+ *
+ * Like `git_odb_foreach`, but backends that support it, such as
+ * packfiles, split their objects into parts (the packs, and ranges of
+ * large pack indexes and multi-pack-indexes) that are listed by `threads`
+ * threads at once.  The callback is called concurrently from all of them,
+ * with the index of the calling thread, so that it can keep per-thread
+ * state without locking.  The objects of other backends are listed on the
+ * calling thread, as thread 0.  An object that is stored more than once
+ * may be listed more than once.
+ *
+ * Return a non-zero value from the callback to stop looping; the other
+ * threads stop after their current object.
+ *
+ * @param db database to use
+ * @param threads the number of threads to use, or 0 for the number of CPUs
+ * @param cb the callback to call for each object
+ * @param payload data to pass to the callback
+ * @return 0 on success, non-zero callback return value, or error code
+ */
+GIT_EXTERN(int) git_odb_foreach_parallel(
+	git_odb *db,
+	unsigned int threads,
+	git_odb_foreach_parallel_cb cb,
+	void *payload);
+
+/**
+ * List all objects available in the database, along with their contents.
+ *
+ * Unlike `git_odb_foreach`, the objects are read in the order that they
+ * are stored in by backends that support it, such as packfiles, so that
+ * reading the whole database does not seek back and forth; the delta
+ * bases that are read along the way are reused for the deltas that
+ * follow them.  This is much faster than looking up each of the objects
+ * from `git_odb_foreach` for full scans of a repository.  An object that
+ * is stored more than once may be listed more than once.
+ * Return a non-zero value from the callback to stop looping.
+ *
+ * @param db database to use
+ * @param cb the callback to call for each object
+ * @param payload data to pass to the callback
+ * @return 0 on success, non-zero callback return value, or error code
+ */
+GIT_EXTERN(int) git_odb_foreach_object(
+	git_odb *db,
+	git_odb_foreach_object_cb cb,
+	void *payload);
+
 /**
  * Write an object directly into the ODB
  *
@@ -51,7 +51,15 @@ GIT_BEGIN_DECL
  */
 typedef enum {
 	GIT_PACKBUILDER_ADDING_OBJECTS = 0,
-	GIT_PACKBUILDER_DELTAFICATION = 1
+	GIT_PACKBUILDER_DELTAFICATION = 1,
+
+	/**
+	 * Reported once for each thread when a delta search that used
+	 * several threads is done: `current` is the time that the thread
+	 * spent searching and `total` the time that the whole search
+	 * took, both in milliseconds.
+	 */
+	GIT_PACKBUILDER_DELTAFICATION_THREAD = 2
 } git_packbuilder_stage_t;
 
 /**
@@ -77,6 +85,70 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  */
 GIT_EXTERN(unsigned int) git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n);
 
+/**
+ * Set whether to write a reachability bitmap alongside the pack
+ *
+ * When enabled, `git_packbuilder_write` will also write a `.bitmap`
+ * file for the new packfile, which allows later object enumeration
+ * (for example, when serving a fetch) to avoid walking the history.
+ * The packfile must be closed under reachability, as it is after a
+ * full repack; if a commit in the pack refers to objects that are not
+ * in it, writing the pack fails.  The bitmap is written once the pack
+ * and its index are in place, so when writing it fails they are kept,
+ * and `git_packbuilder_name` gives their name, but no `.bitmap` file is
+ * left beside them.
+ *
+ * Bitmaps are not written by default.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to write a bitmap
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled);
+
+/**
+ * Set whether to reuse the data of objects that are already packed
+ *
+ * When enabled, objects that are stored in a packfile of the repository
+ * are copied into the new pack as they are compressed there, without
+ * inflating them. Objects that are stored as deltas are copied as deltas
+ * when their base is also in the new pack, and are not searched for a
+ * new delta base. When every object of a pack is in the new pack, as
+ * for a full clone, that pack is copied as a whole, and the write fails
+ * when its contents don't match its checksum. Disable this to compute
+ * and compress every object from scratch, for example to repack with
+ * different settings.
+ *
+ * Packed objects are reused by default.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to reuse packed objects
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_reuse(git_packbuilder *pb, int enabled);
+
+/**
+ * Set whether to restrict deltas to the delta islands of the repository
+ *
+ * Delta islands are configured with the `pack.island` configuration
+ * variable, as in git: each value is a regular expression, and the
+ * references whose names match it are grouped into islands named after
+ * the groups that the last matching expression captures. When enabled,
+ * an object is only stored as a delta against a base that is reachable
+ * from all of the islands that the object is reachable from, so that
+ * the deltas of the pack can be reused for a pack of any one island.
+ * Packs are then not copied as a whole, since their deltas may not
+ * respect the islands.
+ *
+ * Delta islands are not used by default; they have no effect when no
+ * `pack.island` is configured.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to honor delta islands
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_delta_islands(git_packbuilder *pb, int enabled);
+
 /**
  * Insert a single object
  *
@@ -95,7 +95,26 @@ typedef enum {
 	 * Do not split commit-graph files. The other split strategy-related option
 	 * fields are ignored.
 	 */
-	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE = 0
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE = 0,
+
+	/**
+	 * Write the new commits as a new layer on top of the commit-graph chain,
+	 * merging it with the layers below it as `size_multiple` and
+	 * `max_commits` require.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE = 1,
+
+	/**
+	 * Write the new commits as a new layer on top of the commit-graph chain,
+	 * without merging any layers.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE = 2,
+
+	/**
+	 * Replace the commit-graph chain with a single layer that contains all
+	 * of its commits as well as the new ones.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_REPLACE = 3
 } git_commit_graph_split_strategy_t;
 
 /**
@@ -131,6 +150,35 @@ typedef struct {
 	 * Default is 64000.
 	 */
 	size_t max_commits;
+
+	/**
+	 * Files in the `commit-graphs` directory that are no longer part of the
+	 * chain are deleted, unless they were modified after this time. Default
+	 * is 0, which deletes all of them.
+	 */
+	git_time_t expire_time;
+
+	/**
+	 * Whether to compute and write changed-path Bloom filters, which
+	 * speed up path-limited history walks and blame. Filters that are
+	 * already present in the existing `commit-graph` file are reused.
+	 * Default is 0 (disabled).
+	 */
+	int changed_paths;
+
+	/**
+	 * The number of threads used to compute changed-path Bloom filters.
+	 * Default is 0, which uses one thread per CPU.
+	 */
+	unsigned int threads;
+
+	/**
+	 * The version of the generation numbers to write. Version 1 writes
+	 * topological levels only; version 2 also writes corrected commit
+	 * dates, which let history walks stop earlier when commit times are
+	 * skewed. Default is 0, which uses version 2.
+	 */
+	unsigned int generation_version;
 } git_commit_graph_writer_options;
 
 /** Current version for the `git_commit_graph_writer_options` structure */
@@ -160,7 +208,9 @@ GIT_EXTERN(int) git_commit_graph_writer_options_init(
  *
  * @param[out] out Location to store the writer pointer.
  * @param objects_info_dir The `objects/info` directory.
- *        The `commit-graph` file will be written in this directory.
+ *        The `commit-graph` file will be written in this directory, or
+ *        the commit-graph chain in its `commit-graphs` subdirectory when
+ *        a split strategy is used.
  * @param options The options for the commit graph writer.
  * @return 0 or an error code
  */
@@ -204,6 +254,11 @@ GIT_EXTERN(int) git_commit_graph_writer_add_revwalk(
 /**
  * Write a `commit-graph` file to a file.
  *
+ * With a split strategy, the commits that are not yet in the commit-graph
+ * are written as a new layer of the `commit-graphs/commit-graph-chain`
+ * instead. An existing `commit-graph` file becomes the bottom layer of
+ * the chain.
+ *
  * @param w The writer
  * @return 0 or an error code
  */
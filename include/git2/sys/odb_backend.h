@@ -21,6 +21,14 @@
  */
 GIT_BEGIN_DECL
 
+/**
+ * A callback that releases object data that a backend shared with
+ * libgit2 from its `read_shared` callback.
+ *
+ * @param payload the payload that the backend returned with the data
+ */
+typedef void GIT_CALLBACK(git_odb_backend_release_cb)(void *payload);
+
 /**
  * An instance for a custom backend
  */
@@ -99,6 +107,72 @@ struct git_odb_backend {
 	 */
 	int GIT_CALLBACK(freshen)(git_odb_backend *, const git_oid *);
 
+	/**
+	 * Determine which of the given objects exist in the backend, for
+	 * `git_odb_exists_many`. The backend should set the corresponding
+	 * entry of `found` to 1 for each object that it has, and leave the
+	 * others unchanged; entries that are already set may be skipped.
+	 * This is optional; backends that do not implement it are asked
+	 * about each object with `exists`.
+	 */
+	int GIT_CALLBACK(exists_many)(
+		git_odb_backend *, int *found, const git_oid *ids, size_t count);
+
+	/**
+	 * Read the given objects from the backend, for `git_odb_read_many`.
+	 * For each object that it has and whose entry of `data` is still
+	 * `NULL`, the backend should set its data, length and type as with
+	 * `read`, and leave the other entries unchanged. Objects that are
+	 * not found are not an error. This is optional; backends that do
+	 * not implement it are asked for each object with `read`.
+	 */
+	int GIT_CALLBACK(read_many)(
+		void **data, size_t *len, git_object_t *type,
+		git_odb_backend *, const git_oid *ids, size_t count);
+
+	/**
+	 * Hint that the given objects will be read soon, for
+	 * `git_odb_prefetch`. The backend may start loading them in the
+	 * background; objects that it does not have are ignored. This is
+	 * optional.
+	 */
+	int GIT_CALLBACK(prefetch)(
+		git_odb_backend *, const git_oid *ids, size_t count);
+
+	/**
+	 * List the objects in the backend along with their contents, for
+	 * `git_odb_foreach_object`, ideally in the order that they are
+	 * stored in. This is optional; for backends that do not implement
+	 * it, each object from `foreach` is read with `read`.
+	 */
+	int GIT_CALLBACK(foreach_object)(
+		git_odb_backend *, git_odb_foreach_object_cb cb, void *payload);
+
+	/**
+	 * Read an object without copying its data, for backends that may
+	 * already hold it in memory. The backend sets `release` and
+	 * `release_payload` when the data is its own; libgit2 then calls
+	 * `release` once the object is freed, and must not modify the
+	 * data. If `release` is left `NULL`, the data belongs to libgit2
+	 * as with `read`. This is optional; when implemented, it is used
+	 * instead of `read`.
+	 */
+	int GIT_CALLBACK(read_shared)(
+		const void **data, size_t *len, git_object_t *type,
+		git_odb_backend_release_cb *release, void **release_payload,
+		git_odb_backend *, const git_oid *);
+
+	/**
+	 * List the objects in the backend using up to `threads` threads,
+	 * for `git_odb_foreach_parallel`. The callback may be called from
+	 * all of them at once, and is given the index of the calling
+	 * thread. This is optional; backends that do not implement it are
+	 * listed with `foreach`, on the calling thread.
+	 */
+	int GIT_CALLBACK(foreach_parallel)(
+		git_odb_backend *, unsigned int threads,
+		git_odb_foreach_parallel_cb cb, void *payload);
+
 	/**
 	 * Frees any resources held by the odb (including the `git_odb_backend`
 	 * itself). An odb backend implementation must provide this function.
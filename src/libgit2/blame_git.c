@@ -8,8 +8,11 @@
 #include "blame_git.h"
 
 #include "commit.h"
+#include "commit_graph.h"
 #include "blob.h"
 #include "diff_xdiff.h"
+#include "odb.h"
+#include "repository.h"
 
 /*
  * Origin is refcounted and usually we keep the blob contents to be
@@ -428,9 +431,51 @@ static int paths_on_dup(void **old, void *new)
 	return -1;
 }
 
+/*
+ * Use the commit-graph's changed-path Bloom filters to prove that none of
+ * the paths we're interested in were changed between a commit and its
+ * first parent, without having to diff their trees.
+ */
+static bool paths_unchanged_from_first_parent(git_blame *blame, git_commit *commit)
+{
+	git_commit_graph_bloom_paths bloom_paths = GIT_COMMIT_GRAPH_BLOOM_PATHS_INIT;
+	git_commit_graph_file *cgraph_file;
+	git_odb *odb;
+	const char *path;
+	size_t i, j;
+	bool unchanged = false;
+
+	if (git_repository_odb__weakptr(&odb, blame->repository) < 0 ||
+	    git_odb__get_commit_graph_file(&cgraph_file, odb) < 0)
+		goto done;
+
+	git_vector_foreach(&blame->paths, i, path) {
+		/* the paths are used as a pathspec, which may match others */
+		for (j = 0; path[j]; j++) {
+			if (git__iswildcard(path[j]))
+				goto done;
+		}
+
+		if (git_commit_graph_bloom_paths_add(&bloom_paths,
+				cgraph_file, path, strlen(path)) < 0)
+			goto done;
+	}
+
+	unchanged = git_commit_graph_bloom_paths_unchanged(&bloom_paths,
+		cgraph_file, git_commit_id(commit));
+
+done:
+	if (!unchanged)
+		git_error_clear();
+
+	git_commit_graph_bloom_paths_dispose(&bloom_paths);
+	return unchanged;
+}
+
 static git_blame__origin *find_origin(
 		git_blame *blame,
 		git_commit *parent,
+		bool first_parent,
 		git_blame__origin *origin)
 {
 	git_blame__origin *porigin = NULL;
@@ -438,6 +483,12 @@ static git_blame__origin *find_origin(
 	git_diff_options diffopts = GIT_DIFF_OPTIONS_INIT;
 	git_tree *otree=NULL, *ptree=NULL;
 
+	if (first_parent && paths_unchanged_from_first_parent(blame, origin->commit)) {
+		/* No changes; copy data */
+		git_blame__get_origin(&porigin, blame, parent, origin->path);
+		goto cleanup;
+	}
+
 	/* Get the trees from this commit and its parent */
 	if (0 != git_commit_tree(&otree, origin->commit) ||
 	    0 != git_commit_tree(&ptree, parent))
@@ -550,7 +601,7 @@ static int pass_blame(git_blame *blame, git_blame__origin *origin, uint32_t opt)
 
 		if ((error = git_commit_parent(&p, origin->commit, i)) < 0)
 			goto finish;
-		porigin = find_origin(blame, p, origin);
+		porigin = find_origin(blame, p, i == 0, origin);
 
 		if (!porigin) {
 			/*
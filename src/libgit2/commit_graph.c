@@ -12,10 +12,13 @@
 #include "filebuf.h"
 #include "futils.h"
 #include "hash.h"
+#include "hashmap_str.h"
 #include "oidarray.h"
 #include "pack.h"
+#include "pool.h"
 #include "repository.h"
 #include "revwalk.h"
+#include "tree.h"
 
 #define GIT_COMMIT_GRAPH_MISSING_PARENT 0x70000000
 #define GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX 0x3FFFFFFF
@@ -41,6 +44,7 @@ struct git_commit_graph_header {
 #define COMMIT_GRAPH_BLOOM_FILTER_DATA_ID 0x42444154        /* "BDAT" */
 #define COMMIT_GRAPH_GENERATION_DATA_ID 0x47444132          /* "GDA2" */
 #define COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_ID 0x47444f32 /* "GDO2" */
+#define COMMIT_GRAPH_BASE_GRAPHS_LIST_ID 0x42415345         /* "BASE" */
 
 struct git_commit_graph_chunk {
 	off64_t offset;
@@ -55,8 +59,11 @@ struct packed_commit {
 	git_oid tree_oid;
 	uint32_t generation;
 	git_time_t commit_time;
+	git_time_t corrected_commit_date;
 	git_array_oid_t parents;
 	parent_index_array_t parent_indices;
+	unsigned char *bloom_filter;
+	size_t bloom_filter_len;
 };
 
 static void packed_commit_free(struct packed_commit *p)
@@ -66,6 +73,7 @@ static void packed_commit_free(struct packed_commit *p)
 
 	git_array_clear(p->parents);
 	git_array_clear(p->parent_indices);
+	git__free(p->bloom_filter);
 	git__free(p);
 }
 
@@ -198,6 +206,31 @@ static int commit_graph_parse_extra_edge_list(
 	return 0;
 }
 
+static int commit_graph_parse_generation_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_generation_data,
+		struct git_commit_graph_chunk *chunk_generation_data_overflow)
+{
+	if (chunk_generation_data->offset == 0)
+		return 0;
+	if (chunk_generation_data->length != file->num_commits * sizeof(uint32_t))
+		return commit_graph_error("Generation Data chunk has wrong length");
+	if (chunk_generation_data_overflow->length % sizeof(uint64_t) != 0)
+		return commit_graph_error("malformed Generation Data Overflow chunk");
+
+	file->generation_data = data + chunk_generation_data->offset;
+	file->read_generation_data = true;
+
+	if (chunk_generation_data_overflow->length > 0) {
+		file->generation_data_overflow = data + chunk_generation_data_overflow->offset;
+		file->num_generation_data_overflow =
+			chunk_generation_data_overflow->length / sizeof(uint64_t);
+	}
+
+	return 0;
+}
+
 static int commit_graph_parse_bloom_filter(
 		git_commit_graph_file *file,
 		const unsigned char *data,
@@ -230,6 +263,25 @@ static int commit_graph_parse_bloom_filter(
 	file->bloom_filter_num_hashes = ntohl(data_header[1]);
 	file->bloom_filter_bits = ntohl(data_header[2]);
 	file->bloom_filter_data = data + bloom_filter_data->offset + 12;
+	file->bloom_filter_data_len = bloom_filter_data->length - 12;
+	return 0;
+}
+
+static int commit_graph_parse_base_graphs_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_base_graphs_list)
+{
+	if (file->num_base_graphs == 0)
+		return 0;
+	if (chunk_base_graphs_list->offset == 0)
+		return commit_graph_error("missing Base Graphs List chunk");
+	if (chunk_base_graphs_list->length !=
+	    file->num_base_graphs * git_oid_size(file->oid_type))
+		return commit_graph_error("Base Graphs List chunk has wrong length");
+
+	file->base_graph_ids = data + chunk_base_graphs_list->offset;
+
 	return 0;
 }
 
@@ -248,7 +300,9 @@ int git_commit_graph_file_parse(
 	struct git_commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
 				      chunk_commit_data = {0}, chunk_extra_edge_list = {0},
 				      chunk_bloom_filter_index = {0}, chunk_bloom_filter_data = {0},
-					  chunk_unsupported = {0};
+				      chunk_generation_data = {0},
+				      chunk_generation_data_overflow = {0},
+				      chunk_base_graphs_list = {0};
 
 	GIT_ASSERT_ARG(file);
 
@@ -266,6 +320,8 @@ int git_commit_graph_file_parse(
 	if (hdr->chunks == 0)
 		return commit_graph_error("no chunks in commit-graph");
 
+	file->num_base_graphs = hdr->base_graph_files;
+
 	/*
 	 * The very first chunk's offset should be after the header, all the chunk
 	 * headers, and a special zero chunk.
@@ -321,10 +377,19 @@ int git_commit_graph_file_parse(
 			last_chunk = &chunk_bloom_filter_data;
 			break;
 
+		case COMMIT_GRAPH_BASE_GRAPHS_LIST_ID:
+			chunk_base_graphs_list.offset = last_chunk_offset;
+			last_chunk = &chunk_base_graphs_list;
+			break;
+
 		case COMMIT_GRAPH_GENERATION_DATA_ID:
+			chunk_generation_data.offset = last_chunk_offset;
+			last_chunk = &chunk_generation_data;
+			break;
+
 		case COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_ID:
-			chunk_unsupported.offset = last_chunk_offset;
-			last_chunk = &chunk_unsupported;
+			chunk_generation_data_overflow.offset = last_chunk_offset;
+			last_chunk = &chunk_generation_data_overflow;
 			break;
 
 		default:
@@ -337,13 +402,42 @@ int git_commit_graph_file_parse(
 		(error = commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup)) < 0 ||
 		(error = commit_graph_parse_commit_data(file, data, &chunk_commit_data)) < 0 ||
 		(error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list)) < 0 ||
+		(error = commit_graph_parse_generation_data(file, data,
+			&chunk_generation_data, &chunk_generation_data_overflow)) < 0 ||
 		(error = commit_graph_parse_bloom_filter(file, data,
-			&chunk_bloom_filter_index, &chunk_bloom_filter_data)) < 0)
+			&chunk_bloom_filter_index, &chunk_bloom_filter_data)) < 0 ||
+		(error = commit_graph_parse_base_graphs_list(file, data, &chunk_base_graphs_list)) < 0)
 		return error;
 
 	return 0;
 }
 
+/*
+ * Open the commit-graph file, or if there is none, the commit-graph chain,
+ * like git does.
+ */
+static int commit_graph_load(git_commit_graph *cgraph)
+{
+	int error;
+
+	cgraph->chained = false;
+
+	error = git_commit_graph_file_open(&cgraph->file,
+			git_str_cstr(&cgraph->filename), cgraph->oid_type);
+
+	if (error == GIT_ENOTFOUND) {
+		error = git_commit_graph_chain_open(&cgraph->file,
+				git_str_cstr(&cgraph->chain_filename), cgraph->oid_type);
+		cgraph->chained = (error == 0);
+	} else if (!error && cgraph->file->num_base_graphs) {
+		git_commit_graph_file_free(cgraph->file);
+		cgraph->file = NULL;
+		error = commit_graph_error("commit-graph file has base graphs");
+	}
+
+	return error;
+}
+
 int git_commit_graph_new(
 	git_commit_graph **cgraph_out,
 	const char *objects_dir,
@@ -366,9 +460,13 @@ int git_commit_graph_new(
 	if (error < 0)
 		goto error;
 
+	error = git_str_joinpath(&cgraph->chain_filename, objects_dir,
+			"info/commit-graphs/commit-graph-chain");
+	if (error < 0)
+		goto error;
+
 	if (open_file) {
-		error = git_commit_graph_file_open(&cgraph->file,
-				git_str_cstr(&cgraph->filename), oid_type);
+		error = commit_graph_load(cgraph);
 
 		if (error < 0)
 			goto error;
@@ -387,19 +485,23 @@ error:
 int git_commit_graph_validate(git_commit_graph *cgraph) {
 	unsigned char checksum[GIT_HASH_MAX_SIZE];
 	git_hash_algorithm_t checksum_type;
+	git_commit_graph_file *file;
 	size_t checksum_size, trailer_offset;
 
 	checksum_type = git_oid_algorithm(cgraph->oid_type);
 	checksum_size = git_hash_size(checksum_type);
-	trailer_offset = cgraph->file->graph_map.len - checksum_size;
 
-	if (cgraph->file->graph_map.len < checksum_size)
-		return commit_graph_error("map length too small");
+	for (file = cgraph->file; file; file = file->base) {
+		if (file->graph_map.len < checksum_size)
+			return commit_graph_error("map length too small");
 
-	if (git_hash_buf(checksum, cgraph->file->graph_map.data, trailer_offset, checksum_type) < 0)
-		return commit_graph_error("could not calculate signature");
-	if (memcmp(checksum, cgraph->file->checksum, checksum_size) != 0)
-		return commit_graph_error("index signature mismatch");
+		trailer_offset = file->graph_map.len - checksum_size;
+
+		if (git_hash_buf(checksum, file->graph_map.data, trailer_offset, checksum_type) < 0)
+			return commit_graph_error("could not calculate signature");
+		if (memcmp(checksum, file->checksum, checksum_size) != 0)
+			return commit_graph_error("index signature mismatch");
+	}
 
 	return 0;
 }
@@ -490,25 +592,142 @@ int git_commit_graph_file_open(
 	return 0;
 }
 
+/*
+ * The contents of the chain file that lists the given file and all of its
+ * base files: the checksum of each of them on a line, oldest first.
+ */
+static int commit_graph_chain_contents(
+	git_str *out,
+	const git_commit_graph_file *file)
+{
+	char hex[GIT_OID_MAX_HEXSIZE];
+	git_oid id;
+	size_t oid_hexsize;
+
+	if (!file)
+		return 0;
+
+	if (commit_graph_chain_contents(out, file->base) < 0 ||
+	    git_oid_from_raw(&id, file->checksum, file->oid_type) < 0 ||
+	    git_oid_fmt(hex, &id) < 0)
+		return -1;
+
+	oid_hexsize = git_oid_hexsize(file->oid_type);
+
+	git_str_put(out, hex, oid_hexsize);
+	git_str_putc(out, '\n');
+
+	return git_str_oom(out) ? -1 : 0;
+}
+
+static int commit_graph_layer_path(
+	git_str *out,
+	const char *dir,
+	const char *hex,
+	size_t hex_len)
+{
+	git_str_clear(out);
+
+	return git_str_printf(out, "%s/graph-%.*s.graph", dir, (int)hex_len, hex);
+}
+
+int git_commit_graph_chain_open(
+	git_commit_graph_file **file_out,
+	const char *chain_path,
+	git_oid_t oid_type)
+{
+	git_commit_graph_file *file = NULL, *layer, *base;
+	git_str chain = GIT_STR_INIT, dir = GIT_STR_INIT, path = GIT_STR_INIT;
+	size_t oid_size, oid_hexsize;
+	const char *line, *eol;
+	uint32_t num_layers = 0, i;
+	git_oid id;
+	int error;
+
+	oid_size = git_oid_size(oid_type);
+	oid_hexsize = git_oid_hexsize(oid_type);
+
+	if ((error = git_futils_readbuffer(&chain, chain_path)) < 0 ||
+	    (error = git_fs_path_dirname_r(&dir, chain_path)) < 0)
+		goto done;
+
+	/* Each line names a layer, from the bottom of the chain to its top. */
+	for (line = chain.ptr; line < chain.ptr + chain.size; line = eol + 1) {
+		if ((eol = strchr(line, '\n')) == NULL ||
+		    (size_t)(eol - line) != oid_hexsize ||
+		    git_oid_from_prefix(&id, line, oid_hexsize, oid_type) < 0) {
+			error = commit_graph_error("malformed commit-graph chain");
+			goto done;
+		}
+
+		if ((error = commit_graph_layer_path(&path, dir.ptr, line, oid_hexsize)) < 0 ||
+		    (error = git_commit_graph_file_open(&layer, path.ptr, oid_type)) < 0)
+			goto done;
+
+		layer->base = file;
+		file = layer;
+
+		if (memcmp(id.id, layer->checksum, oid_size) != 0 ||
+		    layer->num_base_graphs != num_layers) {
+			error = commit_graph_error("commit-graph chain does not match its files");
+			goto done;
+		}
+
+		for (base = layer->base, i = num_layers; base; base = base->base) {
+			if (memcmp(layer->base_graph_ids + --i * oid_size,
+					base->checksum, oid_size) != 0) {
+				error = commit_graph_error("commit-graph chain does not match its files");
+				goto done;
+			}
+		}
+
+		if ((base = layer->base) != NULL) {
+			if (base->num_commits > UINT32_MAX - base->num_commits_in_base) {
+				error = commit_graph_error("commit-graph chain is too large");
+				goto done;
+			}
+
+			layer->num_commits_in_base = base->num_commits_in_base + base->num_commits;
+
+			if (!base->read_generation_data)
+				layer->read_generation_data = false;
+		}
+
+		num_layers++;
+	}
+
+	if (!file) {
+		error = commit_graph_error("empty commit-graph chain");
+		goto done;
+	}
+
+	*file_out = file;
+	file = NULL;
+
+done:
+	git_commit_graph_file_free(file);
+	git_str_dispose(&chain);
+	git_str_dispose(&dir);
+	git_str_dispose(&path);
+	return error;
+}
+
 int git_commit_graph_get_file(
 	git_commit_graph_file **file_out,
 	git_commit_graph *cgraph)
 {
 	if (!cgraph->checked) {
 		int error = 0;
-		git_commit_graph_file *result = NULL;
 
 		/* We only check once, no matter the result. */
 		cgraph->checked = 1;
 
-		/* Best effort */
-		error = git_commit_graph_file_open(&result,
-			git_str_cstr(&cgraph->filename), cgraph->oid_type);
+		/* Best effort; an unchanged file was kept by the refresh. */
+		if (!cgraph->file)
+			error = commit_graph_load(cgraph);
 
 		if (error < 0)
 			return error;
-
-		cgraph->file = result;
 	}
 	if (!cgraph->file)
 		return GIT_ENOTFOUND;
@@ -523,7 +742,10 @@ void git_commit_graph_refresh(git_commit_graph *cgraph)
 		return;
 
 	if (cgraph->file
-	    && git_commit_graph_file_needs_refresh(cgraph->file, git_str_cstr(&cgraph->filename))) {
+	    && (cgraph->chained
+		? git_fs_path_exists(git_str_cstr(&cgraph->filename)) ||
+		  git_commit_graph_chain_needs_refresh(cgraph->file, git_str_cstr(&cgraph->chain_filename))
+		: git_commit_graph_file_needs_refresh(cgraph->file, git_str_cstr(&cgraph->filename)))) {
 		/* We just free the commit graph. The next time it is requested, it will be
 		 * re-loaded. */
 		git_commit_graph_file_free(cgraph->file);
@@ -533,22 +755,42 @@ void git_commit_graph_refresh(git_commit_graph *cgraph)
 	cgraph->checked = 0;
 }
 
+/*
+ * Find the file of a chain that holds the commit at the given position, and
+ * make the position relative to that file.
+ */
+static const git_commit_graph_file *commit_graph_file_at(
+		const git_commit_graph_file *file,
+		size_t *pos)
+{
+	while (*pos < file->num_commits_in_base && file->base)
+		file = file->base;
+
+	*pos -= file->num_commits_in_base;
+	return file;
+}
+
 static int git_commit_graph_entry_get_byindex(
 		git_commit_graph_entry *e,
 		const git_commit_graph_file *file,
-		size_t pos)
+		size_t index)
 {
 	const unsigned char *commit_data;
 	size_t oid_size = git_oid_size(file->oid_type);
+	size_t pos = index;
+	bool read_generation_data;
 
 	GIT_ASSERT_ARG(e);
 	GIT_ASSERT_ARG(file);
 
-	if (pos >= file->num_commits) {
-		git_error_set(GIT_ERROR_INVALID, "commit index %zu does not exist", pos);
+	if (index >= (size_t)file->num_commits_in_base + file->num_commits) {
+		git_error_set(GIT_ERROR_INVALID, "commit index %zu does not exist", index);
 		return GIT_ENOTFOUND;
 	}
 
+	read_generation_data = file->read_generation_data;
+	file = commit_graph_file_at(file, &pos);
+
 	commit_data = file->commit_data + pos * (oid_size + 4 * sizeof(uint32_t));
 	git_oid_from_raw(&e->tree_oid, commit_data, file->oid_type);
 	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + oid_size)));
@@ -561,6 +803,30 @@ static int git_commit_graph_entry_get_byindex(
 
 	e->commit_time |= (e->generation & UINT64_C(0x3)) << UINT64_C(32);
 	e->generation >>= 2u;
+	e->corrected_commit_date = 0;
+
+	if (read_generation_data) {
+		uint64_t offset = ntohl(*((uint32_t *)(file->generation_data + pos * sizeof(uint32_t))));
+
+		if (offset & 0x80000000u) {
+			uint32_t overflow_pos = offset & 0x7fffffff;
+			const uint32_t *overflow;
+
+			if (overflow_pos >= file->num_generation_data_overflow) {
+				git_error_set(GIT_ERROR_INVALID,
+					      "generation data overflow %u does not exist",
+					      overflow_pos);
+				return GIT_ENOTFOUND;
+			}
+
+			overflow = (const uint32_t *)(file->generation_data_overflow
+					+ overflow_pos * sizeof(uint64_t));
+			offset = (((uint64_t)ntohl(overflow[0])) << 32) | ntohl(overflow[1]);
+		}
+
+		e->corrected_commit_date = e->commit_time + (git_time_t)offset;
+	}
+
 	if (e->parent_indices[1] & 0x80000000u) {
 		uint32_t extra_edge_list_pos = e->parent_indices[1] & 0x7fffffff;
 
@@ -585,6 +851,7 @@ static int git_commit_graph_entry_get_byindex(
 	}
 
 	git_oid_from_raw(&e->sha1, &file->oid_lookup[pos * oid_size], file->oid_type);
+	e->index = index;
 	return 0;
 }
 
@@ -620,8 +887,33 @@ bool git_commit_graph_file_needs_refresh(const git_commit_graph_file *file, cons
 	return (memcmp(checksum, file->checksum, checksum_size) != 0);
 }
 
-int git_commit_graph_entry_find(
-		git_commit_graph_entry *e,
+bool git_commit_graph_chain_needs_refresh(
+		const git_commit_graph_file *file,
+		const char *chain_path)
+{
+	git_str actual = GIT_STR_INIT, expected = GIT_STR_INIT;
+	bool needs_refresh = true;
+
+	if (git_futils_readbuffer(&actual, chain_path) < 0 ||
+	    commit_graph_chain_contents(&expected, file) < 0) {
+		git_error_clear();
+		goto done;
+	}
+
+	needs_refresh = (git_str_cmp(&actual, &expected) != 0);
+
+done:
+	git_str_dispose(&actual);
+	git_str_dispose(&expected);
+	return needs_refresh;
+}
+
+/*
+ * Find the commit with the given object ID in a single file of a chain,
+ * returning its position within that file.
+ */
+static int commit_graph_file_find(
+		size_t *out,
 		const git_commit_graph_file *file,
 		const git_oid *short_oid,
 		size_t len)
@@ -631,10 +923,6 @@ int git_commit_graph_entry_find(
 	const unsigned char *current = NULL;
 	size_t oid_size, oid_hexsize;
 
-	GIT_ASSERT_ARG(e);
-	GIT_ASSERT_ARG(file);
-	GIT_ASSERT_ARG(short_oid);
-
 	oid_size = git_oid_size(file->oid_type);
 	oid_hexsize = git_oid_hexsize(file->oid_type);
 
@@ -668,6 +956,43 @@ int git_commit_graph_entry_find(
 			found = 2;
 	}
 
+	if (!found)
+		return GIT_ENOTFOUND;
+	if (found > 1)
+		return GIT_EAMBIGUOUS;
+
+	*out = (size_t)pos;
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	const git_commit_graph_file *layer;
+	size_t pos, found_pos = 0;
+	int error, found = 0;
+
+	GIT_ASSERT_ARG(e);
+	GIT_ASSERT_ARG(file);
+	GIT_ASSERT_ARG(short_oid);
+
+	/* A prefix may match commits in more than one file of a chain. */
+	for (layer = file; layer && found < 2; layer = layer->base) {
+		error = commit_graph_file_find(&pos, layer, short_oid, len);
+
+		if (error == GIT_ENOTFOUND)
+			continue;
+
+		found += (error == GIT_EAMBIGUOUS) ? 2 : 1;
+		found_pos = layer->num_commits_in_base + pos;
+
+		if (len == git_oid_hexsize(file->oid_type))
+			break;
+	}
+
 	if (!found)
 		return git_odb__error_notfound(
 				"failed to find offset for commit-graph index entry", short_oid, len);
@@ -675,7 +1000,7 @@ int git_commit_graph_entry_find(
 		return git_odb__error_ambiguous(
 				"found multiple offsets for commit-graph index entry");
 
-	return git_commit_graph_entry_get_byindex(e, file, pos);
+	return git_commit_graph_entry_get_byindex(e, file, found_pos);
 }
 
 int git_commit_graph_entry_parent(
@@ -684,6 +1009,9 @@ int git_commit_graph_entry_parent(
 		const git_commit_graph_entry *entry,
 		size_t n)
 {
+	const git_commit_graph_file *layer;
+	size_t pos;
+
 	GIT_ASSERT_ARG(parent);
 	GIT_ASSERT_ARG(file);
 
@@ -695,125 +1023,426 @@ int git_commit_graph_entry_parent(
 	if (n == 0 || (n == 1 && entry->parent_count == 2))
 		return git_commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
 
+	/* The extra parents are in the Extra Edge List of the entry's own file. */
+	pos = entry->index;
+	layer = commit_graph_file_at(file, &pos);
+
 	return git_commit_graph_entry_get_byindex(
 			parent,
 			file,
 			ntohl(
-					*(uint32_t *)(file->extra_edge_list
+					*(uint32_t *)(layer->extra_edge_list
 						      + (entry->extra_parents_index + n - 1)
 								      * sizeof(uint32_t)))
 					& 0x7fffffff);
 }
 
-int git_commit_graph_file_close(git_commit_graph_file *file)
+#define BLOOM_SEED0 0x293ae76f
+#define BLOOM_SEED1 0x7e646e2c
+
+GIT_INLINE(uint32_t) bloom_rotl(uint32_t value, int count)
 {
-	GIT_ASSERT_ARG(file);
+	return (value << count) | (value >> (32 - count));
+}
 
-	if (file->graph_map.data)
-		git_futils_mmap_free(&file->graph_map);
+/*
+ * Version 1 of the changed-path Bloom filters (the only one that git
+ * wrote before 2.46) sign-extended each byte of the path before hashing
+ * it; version 2 fixes this.  Both give the same results for ASCII paths.
+ */
+GIT_INLINE(uint32_t) bloom_byte(uint32_t hash_version, const char *data, size_t i)
+{
+	if (hash_version == 1)
+		return (uint32_t)(int32_t)(signed char)data[i];
 
-	return 0;
+	return (uint32_t)(unsigned char)data[i];
 }
 
-void git_commit_graph_free(git_commit_graph *cgraph)
+uint32_t git_commit_graph_bloom_murmur3(
+		uint32_t hash_version,
+		uint32_t seed,
+		const char *data,
+		size_t len)
 {
-	if (!cgraph)
-		return;
+	const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593, n = 0xe6546b64;
+	uint32_t k;
+	size_t i, tail = len & ~((size_t)3);
+
+	for (i = 0; i < tail; i += 4) {
+		k = bloom_byte(hash_version, data, i) |
+		    (bloom_byte(hash_version, data, i + 1) << 8) |
+		    (bloom_byte(hash_version, data, i + 2) << 16) |
+		    (bloom_byte(hash_version, data, i + 3) << 24);
+
+		k *= c1;
+		k = bloom_rotl(k, 15);
+		k *= c2;
+
+		seed ^= k;
+		seed = bloom_rotl(seed, 13) * 5 + n;
+	}
 
-	git_str_dispose(&cgraph->filename);
-	git_commit_graph_file_free(cgraph->file);
-	git__free(cgraph);
+	k = 0;
+
+	switch (len & 3) {
+	case 3:
+		k ^= bloom_byte(hash_version, data, tail + 2) << 16;
+		/* fall through */
+	case 2:
+		k ^= bloom_byte(hash_version, data, tail + 1) << 8;
+		/* fall through */
+	case 1:
+		k ^= bloom_byte(hash_version, data, tail);
+		k *= c1;
+		k = bloom_rotl(k, 15);
+		k *= c2;
+		seed ^= k;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
 }
 
-void git_commit_graph_file_free(git_commit_graph_file *file)
+bool git_commit_graph_file_has_bloom_filters(const git_commit_graph_file *file)
 {
-	if (!file)
-		return;
-
-	git_commit_graph_file_close(file);
-	git__free(file);
+	return file->bloom_filter_indexes && file->bloom_filter_data &&
+	       file->bloom_filter_num_hashes > 0 &&
+	       file->bloom_filter_num_hashes <= GIT_COMMIT_GRAPH_BLOOM_MAX_HASHES;
 }
 
-static int packed_commit__cmp(const void *a_, const void *b_)
+static void bloom_key_init(
+		git_commit_graph_bloom_key *key,
+		uint32_t hash_version,
+		uint32_t num_hashes,
+		const char *path,
+		size_t len)
 {
-	const struct packed_commit *a = a_;
-	const struct packed_commit *b = b_;
-	return git_oid_cmp(&a->sha1, &b->sha1);
+	uint32_t h0, h1, i;
+
+	h0 = git_commit_graph_bloom_murmur3(hash_version, BLOOM_SEED0, path, len);
+	h1 = git_commit_graph_bloom_murmur3(hash_version, BLOOM_SEED1, path, len);
+
+	for (i = 0; i < num_hashes; i++)
+		key->hashes[i] = h0 + i * h1;
 }
 
-int git_commit_graph_writer_options_init(
-	git_commit_graph_writer_options *opts,
-	unsigned int version)
+static int bloom_paths_add_key(
+		git_commit_graph_bloom_paths *paths,
+		const char *path,
+		size_t len)
 {
-	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
-		opts,
-		version,
-		git_commit_graph_writer_options,
-		GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT);
+	git_commit_graph_bloom_key *key;
+
+	key = git_array_alloc(paths->keys);
+	GIT_ERROR_CHECK_ALLOC(key);
+
+	bloom_key_init(key, paths->hash_version, paths->num_hashes, path, len);
 	return 0;
 }
 
-int git_commit_graph_writer_new(
-	git_commit_graph_writer **out,
-	const char *objects_info_dir,
-	const git_commit_graph_writer_options *opts
-	)
+int git_commit_graph_bloom_paths_add(
+		git_commit_graph_bloom_paths *paths,
+		const git_commit_graph_file *file,
+		const char *path,
+		size_t len)
 {
-	git_commit_graph_writer *w;
-	git_oid_t oid_type;
+	size_t *end;
 
-	GIT_ERROR_CHECK_VERSION(opts,
-		GIT_COMMIT_GRAPH_WRITER_OPTIONS_VERSION,
-		"git_commit_graph_writer_options");
+	GIT_ASSERT_ARG(paths);
+	GIT_ASSERT_ARG(file);
+	GIT_ASSERT_ARG(path);
 
-	oid_type = opts && opts->oid_type ? opts->oid_type : GIT_OID_DEFAULT;
-	GIT_ASSERT_ARG(git_oid_type_is_valid(oid_type));
-	GIT_ASSERT_ARG(out && objects_info_dir);
+	if (!git_commit_graph_file_has_bloom_filters(file))
+		return GIT_ENOTFOUND;
 
-	w = git__calloc(1, sizeof(git_commit_graph_writer));
-	GIT_ERROR_CHECK_ALLOC(w);
+	if (!git_array_size(paths->path_ends)) {
+		paths->hash_version = file->bloom_filter_hash_version;
+		paths->num_hashes = file->bloom_filter_num_hashes;
+	} else if (paths->hash_version != file->bloom_filter_hash_version ||
+	           paths->num_hashes != file->bloom_filter_num_hashes) {
+		return GIT_ENOTFOUND;
+	}
 
-	w->oid_type = oid_type;
+	/* git stores paths without a trailing slash */
+	while (len && path[len - 1] == '/')
+		len--;
 
-	if (git_str_sets(&w->objects_info_dir, objects_info_dir) < 0) {
-		git__free(w);
-		return -1;
-	}
+	if (!len)
+		return GIT_ENOTFOUND;
 
-	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
-		git_str_dispose(&w->objects_info_dir);
-		git__free(w);
+	/* the path itself, followed by each of its leading directories */
+	if (bloom_paths_add_key(paths, path, len) < 0)
 		return -1;
+
+	while (--len) {
+		if (path[len] == '/' && bloom_paths_add_key(paths, path, len) < 0)
+			return -1;
 	}
 
-	*out = w;
+	end = git_array_alloc(paths->path_ends);
+	GIT_ERROR_CHECK_ALLOC(end);
+
+	*end = git_array_size(paths->keys);
 	return 0;
 }
 
-void git_commit_graph_writer_free(git_commit_graph_writer *w)
+/*
+ * Look up the filter of the commit at the given position, as long as the
+ * file of the chain that it is in has filters with the given settings.  An
+ * empty filter means that it was not computed, and is reported as
+ * GIT_ENOTFOUND.
+ */
+static int bloom_filter_get(
+		const unsigned char **out,
+		size_t *out_len,
+		const git_commit_graph_file *file,
+		size_t pos,
+		uint32_t hash_version,
+		uint32_t num_hashes)
 {
-	struct packed_commit *packed_commit;
-	size_t i;
+	size_t start, end;
 
-	if (!w)
-		return;
+	file = commit_graph_file_at(file, &pos);
 
-	git_vector_foreach (&w->commits, i, packed_commit)
-		packed_commit_free(packed_commit);
-	git_vector_dispose(&w->commits);
-	git_str_dispose(&w->objects_info_dir);
-	git__free(w);
-}
+	if (!git_commit_graph_file_has_bloom_filters(file) ||
+	    file->bloom_filter_hash_version != hash_version ||
+	    file->bloom_filter_num_hashes != num_hashes)
+		return GIT_ENOTFOUND;
 
-struct object_entry_cb_state {
-	git_repository *repo;
-	git_odb *db;
-	git_vector *commits;
-};
+	start = pos ? ntohl(file->bloom_filter_indexes[pos - 1]) : 0;
+	end = ntohl(file->bloom_filter_indexes[pos]);
 
-static int object_entry__cb(const git_oid *id, void *data)
-{
-	struct object_entry_cb_state *state = (struct object_entry_cb_state *)data;
+	if (end <= start || end > file->bloom_filter_data_len)
+		return GIT_ENOTFOUND;
+
+	*out = file->bloom_filter_data + start;
+	*out_len = end - start;
+	return 0;
+}
+
+static bool bloom_filter_contains(
+		const unsigned char *filter,
+		size_t filter_len,
+		const git_commit_graph_bloom_key *key,
+		uint32_t num_hashes)
+{
+	uint64_t bits = (uint64_t)filter_len * 8;
+	uint64_t bit;
+	uint32_t i;
+
+	for (i = 0; i < num_hashes; i++) {
+		bit = key->hashes[i] % bits;
+
+		if (!(filter[bit / 8] & (1 << (bit % 8))))
+			return false;
+	}
+
+	return true;
+}
+
+bool git_commit_graph_bloom_paths_unchanged(
+		const git_commit_graph_bloom_paths *paths,
+		const git_commit_graph_file *file,
+		const git_oid *commit_id)
+{
+	git_commit_graph_entry e;
+	const unsigned char *filter;
+	const size_t *path_end;
+	size_t filter_len, key_idx = 0, i;
+	bool changed;
+
+	if (!git_array_size(paths->path_ends))
+		return false;
+
+	if (git_commit_graph_entry_find(&e, file, commit_id, git_oid_hexsize(file->oid_type)) < 0) {
+		git_error_clear();
+		return false;
+	}
+
+	/* without a filter, anything may have changed */
+	if (bloom_filter_get(&filter, &filter_len, file, e.index,
+			paths->hash_version, paths->num_hashes) < 0)
+		return false;
+
+	for (i = 0; i < git_array_size(paths->path_ends); i++) {
+		path_end = git_array_get(paths->path_ends, i);
+
+		/*
+		 * A path was changed only if it, and each of its leading
+		 * directories, are all in the filter.
+		 */
+		for (changed = true; key_idx < *path_end; key_idx++) {
+			if (changed && !bloom_filter_contains(filter, filter_len,
+					git_array_get(paths->keys, key_idx),
+					paths->num_hashes))
+				changed = false;
+		}
+
+		if (changed)
+			return false;
+	}
+
+	return true;
+}
+
+void git_commit_graph_bloom_paths_dispose(git_commit_graph_bloom_paths *paths)
+{
+	if (!paths)
+		return;
+
+	git_array_clear(paths->keys);
+	git_array_clear(paths->path_ends);
+	memset(paths, 0, sizeof(*paths));
+}
+
+int git_commit_graph_file_close(git_commit_graph_file *file)
+{
+	GIT_ASSERT_ARG(file);
+
+	if (file->graph_map.data)
+		git_futils_mmap_free(&file->graph_map);
+
+	return 0;
+}
+
+void git_commit_graph_free(git_commit_graph *cgraph)
+{
+	if (!cgraph)
+		return;
+
+	git_str_dispose(&cgraph->filename);
+	git_str_dispose(&cgraph->chain_filename);
+	git_commit_graph_file_free(cgraph->file);
+	git__free(cgraph);
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	git_commit_graph_file *base;
+
+	while (file) {
+		base = file->base;
+
+		git_commit_graph_file_close(file);
+		git__free(file);
+
+		file = base;
+	}
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+	return git_oid_cmp(&a->sha1, &b->sha1);
+}
+
+int git_commit_graph_writer_options_init(
+	git_commit_graph_writer_options *opts,
+	unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts,
+		version,
+		git_commit_graph_writer_options,
+		GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT);
+	return 0;
+}
+
+int git_commit_graph_writer_new(
+	git_commit_graph_writer **out,
+	const char *objects_info_dir,
+	const git_commit_graph_writer_options *opts
+	)
+{
+	git_commit_graph_writer *w;
+	git_oid_t oid_type;
+
+	GIT_ERROR_CHECK_VERSION(opts,
+		GIT_COMMIT_GRAPH_WRITER_OPTIONS_VERSION,
+		"git_commit_graph_writer_options");
+
+	oid_type = opts && opts->oid_type ? opts->oid_type : GIT_OID_DEFAULT;
+	GIT_ASSERT_ARG(git_oid_type_is_valid(oid_type));
+	GIT_ASSERT_ARG(out && objects_info_dir);
+
+	w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GIT_ERROR_CHECK_ALLOC(w);
+
+	w->oid_type = oid_type;
+
+	w->size_multiple = 2;
+	w->max_commits = 64000;
+	w->generation_version = 2;
+
+	if (opts) {
+		if (opts->generation_version > 2) {
+			git__free(w);
+			git_error_set(GIT_ERROR_INVALID,
+				"unsupported commit-graph generation version %u",
+				opts->generation_version);
+			return -1;
+		}
+
+		w->changed_paths = !!opts->changed_paths;
+		w->threads = opts->threads;
+		w->split_strategy = opts->split_strategy;
+		w->expire_time = opts->expire_time;
+
+		if (opts->size_multiple > 0)
+			w->size_multiple = opts->size_multiple;
+		if (opts->max_commits)
+			w->max_commits = opts->max_commits;
+		if (opts->generation_version)
+			w->generation_version = opts->generation_version;
+	}
+
+	if (git_str_sets(&w->objects_info_dir, objects_info_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
+		git_str_dispose(&w->objects_info_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach (&w->commits, i, packed_commit)
+		packed_commit_free(packed_commit);
+	git_vector_dispose(&w->commits);
+	git_str_dispose(&w->objects_info_dir);
+	git_odb_free(w->odb);
+	git__free(w);
+}
+
+struct object_entry_cb_state {
+	git_repository *repo;
+	git_odb *db;
+	git_vector *commits;
+};
+
+static int object_entry__cb(const git_oid *id, void *data)
+{
+	struct object_entry_cb_state *state = (struct object_entry_cb_state *)data;
 	git_commit *commit = NULL;
 	struct packed_commit *packed_commit = NULL;
 	size_t header_len;
@@ -867,6 +1496,11 @@ int git_commit_graph_writer_add_index_file(
 	if (error < 0)
 		goto cleanup;
 
+	if (!w->odb) {
+		w->odb = state.db;
+		state.db = NULL;
+	}
+
 cleanup:
 	if (p)
 		git_mwindow_put_pack(p);
@@ -882,6 +1516,9 @@ int git_commit_graph_writer_add_revwalk(git_commit_graph_writer *w, git_revwalk
 	git_commit *commit;
 	struct packed_commit *packed_commit;
 
+	if (!w->odb && (error = git_repository_odb(&w->odb, repo)) < 0)
+		return error;
+
 	while ((git_revwalk_next(&id, walk)) == 0) {
 		error = git_commit_lookup(&commit, repo, &id);
 		if (error < 0)
@@ -910,16 +1547,27 @@ enum generation_number_commit_state {
 
 GIT_HASHMAP_OID_SETUP(git_commit_graph_oidmap, struct packed_commit *);
 
-static int compute_generation_numbers(git_vector *commits)
+/*
+ * Compute the generation numbers and corrected commit dates of the commits,
+ * and the positions of their parents.  When the commits are written as a layer on top of a commit-graph
+ * chain, parents may be in the chain, and the positions of the commits
+ * themselves start after those of the chain's commits.
+ */
+static int compute_generation_numbers(
+	git_vector *commits,
+	const git_commit_graph_file *base)
 {
 	git_array_t(size_t) index_stack = GIT_ARRAY_INIT;
-	size_t i, j;
+	size_t i, j, num_base_commits;
 	size_t *parent_idx;
 	enum generation_number_commit_state *commit_states = NULL;
 	struct packed_commit *child_packed_commit;
 	git_commit_graph_oidmap packed_commit_map = GIT_HASHMAP_INIT;
+	git_commit_graph_entry base_entry;
 	int error = 0;
 
+	num_base_commits = base ? (size_t)base->num_commits_in_base + base->num_commits : 0;
+
 	/* First populate the parent indices fields */
 	git_vector_foreach (commits, i, child_packed_commit) {
 		child_packed_commit->index = i;
@@ -942,19 +1590,24 @@ static int compute_generation_numbers(git_vector *commits)
 			goto cleanup;
 		}
 		git_array_foreach (child_packed_commit->parents, parent_i, parent_id) {
-			if (git_commit_graph_oidmap_get(&parent_packed_commit, &packed_commit_map, parent_id) != 0) {
+			parent_idx_ptr = git_array_alloc(child_packed_commit->parent_indices);
+			if (!parent_idx_ptr) {
+				error = -1;
+				goto cleanup;
+			}
+
+			if (git_commit_graph_oidmap_get(&parent_packed_commit, &packed_commit_map, parent_id) == 0) {
+				*parent_idx_ptr = num_base_commits + parent_packed_commit->index;
+			} else if (base && git_commit_graph_entry_find(&base_entry, base,
+					parent_id, git_oid_hexsize(base->oid_type)) == 0) {
+				*parent_idx_ptr = base_entry.index;
+			} else {
 				git_error_set(GIT_ERROR_ODB,
 					      "parent commit %s not found in commit graph",
 					      git_oid_tostr_s(parent_id));
 				error = GIT_ENOTFOUND;
 				goto cleanup;
 			}
-			parent_idx_ptr = git_array_alloc(child_packed_commit->parent_indices);
-			if (!parent_idx_ptr) {
-				error = -1;
-				goto cleanup;
-			}
-			*parent_idx_ptr = parent_packed_commit->index;
 		}
 	}
 
@@ -994,10 +1647,28 @@ static int compute_generation_numbers(git_vector *commits)
 		if (commit_states[i] == GENERATION_NUMBER_COMMIT_STATE_EXPANDED) {
 			/* All of the commits parents have been visited. */
 			child_packed_commit->generation = 0;
+			child_packed_commit->corrected_commit_date = child_packed_commit->commit_time;
 			git_array_foreach (child_packed_commit->parent_indices, j, parent_idx) {
-				struct packed_commit *parent = git_vector_get(commits, *parent_idx);
-				if (child_packed_commit->generation < parent->generation)
-					child_packed_commit->generation = parent->generation;
+				struct packed_commit *parent;
+				size_t generation;
+				git_time_t corrected_commit_date;
+
+				if (*parent_idx < num_base_commits) {
+					error = git_commit_graph_entry_get_byindex(&base_entry, base, *parent_idx);
+					if (error < 0)
+						goto cleanup;
+					generation = base_entry.generation;
+					corrected_commit_date = base_entry.corrected_commit_date;
+				} else {
+					parent = git_vector_get(commits, *parent_idx - num_base_commits);
+					generation = parent->generation;
+					corrected_commit_date = parent->corrected_commit_date;
+				}
+
+				if (child_packed_commit->generation < generation)
+					child_packed_commit->generation = (uint32_t)generation;
+				if (child_packed_commit->corrected_commit_date <= corrected_commit_date)
+					child_packed_commit->corrected_commit_date = corrected_commit_date + 1;
 			}
 			if (child_packed_commit->generation
 			    < GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX) {
@@ -1020,32 +1691,507 @@ static int compute_generation_numbers(git_vector *commits)
 			 */
 			commit_states[i] = GENERATION_NUMBER_COMMIT_STATE_VISITED;
 			child_packed_commit->generation = 1;
+			child_packed_commit->corrected_commit_date = child_packed_commit->commit_time;
+			continue;
+		}
+
+		/*
+		 * Add this current commit again so that it is visited
+		 * again once all its children have been visited.
+		 */
+		*(size_t *)git_array_alloc(index_stack) = i;
+		git_array_foreach (child_packed_commit->parent_indices, j, parent_idx) {
+			size_t parent_i;
+
+			/* The commits of the base chain have their generation numbers. */
+			if (*parent_idx < num_base_commits)
+				continue;
+
+			parent_i = *parent_idx - num_base_commits;
+
+			if (commit_states[parent_i]
+			    != GENERATION_NUMBER_COMMIT_STATE_UNVISITED) {
+				/* This commit has already been considered. */
+				continue;
+			}
+
+			commit_states[parent_i] = GENERATION_NUMBER_COMMIT_STATE_ADDED;
+			*(size_t *)git_array_alloc(index_stack) = parent_i;
+		}
+		commit_states[i] = GENERATION_NUMBER_COMMIT_STATE_EXPANDED;
+	}
+
+cleanup:
+	git_commit_graph_oidmap_dispose(&packed_commit_map);
+	git__free(commit_states);
+	git_array_clear(index_stack);
+
+	return error;
+}
+
+/*
+ * The settings that git uses for the changed-path Bloom filters that it
+ * writes.  Commits that change more paths than this get a filter that
+ * matches everything.
+ */
+#define BLOOM_HASH_VERSION 1
+#define BLOOM_NUM_HASHES 7
+#define BLOOM_BITS_PER_ENTRY 10
+#define BLOOM_MAX_CHANGED_PATHS 512
+
+struct bloom_settings {
+	uint32_t hash_version;
+	uint32_t num_hashes;
+	uint32_t bits_per_entry;
+};
+
+struct bloom_writer {
+	git_commit_graph_writer *w;
+	struct bloom_settings settings;
+
+	/* The existing commit-graph or chain, whose filters can be reused. */
+	const git_commit_graph_file *existing;
+
+	/* The chain that the new commit-graph is layered on, if any. */
+	const git_commit_graph_file *base;
+	size_t num_base_commits;
+
+	/* The position of the next commit to compute the filter of. */
+	git_atomic32 next;
+
+	/* The first error that any of the workers ran into. */
+	git_mutex lock;
+	int error;
+	git_error *error_info;
+};
+
+/* The paths changed by a single commit, as gathered by a worker. */
+struct bloom_changes {
+	git_odb *odb;
+	git_oid_t oid_type;
+
+	git_pool pool;
+	git_hashset_str paths;
+	git_str path;
+	size_t files; /* the changed files, which are also in paths */
+	bool too_many;
+};
+
+static int bloom_read_tree(
+	git_tree **out,
+	git_odb *odb,
+	const git_oid *id,
+	git_oid_t oid_type)
+{
+	git_odb_object *obj;
+	git_tree *tree;
+	int error;
+
+	if ((error = git_odb_read(&obj, odb, id)) < 0)
+		return error;
+
+	if (git_odb_object_type(obj) != GIT_OBJECT_TREE) {
+		git_error_set(GIT_ERROR_ODB, "object %s is not a tree", git_oid_tostr_s(id));
+		git_odb_object_free(obj);
+		return -1;
+	}
+
+	tree = git__calloc(1, sizeof(git_tree));
+	GIT_ERROR_CHECK_ALLOC(tree);
+
+	if ((error = git_tree__parse(tree, obj, oid_type)) < 0) {
+		git_tree__free(tree);
+		git_odb_object_free(obj);
+		return error;
+	}
+
+	git_odb_object_free(obj);
+	*out = tree;
+	return 0;
+}
+
+/* Record the current path, and each of its leading directories. */
+static int bloom_changes_add(struct bloom_changes *c)
+{
+	size_t len = c->path.size;
+	char *path;
+	bool found;
+	char saved;
+
+	/*
+	 * Like git, give up on the filter when more files than the limit
+	 * changed, or when they and their leading directories are more
+	 * paths than the limit; stop early once either is exceeded.
+	 */
+	if (++c->files > BLOOM_MAX_CHANGED_PATHS) {
+		c->too_many = true;
+		return 0;
+	}
+
+	while (len) {
+		if (git_hashset_str_size(&c->paths) > BLOOM_MAX_CHANGED_PATHS) {
+			c->too_many = true;
+			return 0;
+		}
+
+		saved = c->path.ptr[len];
+		c->path.ptr[len] = '\0';
+		found = git_hashset_str_contains(&c->paths, c->path.ptr);
+		c->path.ptr[len] = saved;
+
+		/* the leading directories were already added, too */
+		if (found)
+			break;
+
+		path = git_pool_strndup(&c->pool, c->path.ptr, len);
+		GIT_ERROR_CHECK_ALLOC(path);
+
+		if (git_hashset_str_add(&c->paths, path) < 0)
+			return -1;
+
+		while (len && c->path.ptr[len - 1] != '/')
+			len--;
+
+		if (len)
+			len--;
+	}
+
+	return 0;
+}
+
+static int bloom_changes_diff(
+	struct bloom_changes *c,
+	const git_oid *old_id,
+	const git_oid *new_id);
+
+static int bloom_changes_entry(
+	struct bloom_changes *c,
+	const git_tree_entry *old_entry,
+	const git_tree_entry *new_entry)
+{
+	const git_tree_entry *entry = old_entry ? old_entry : new_entry;
+	size_t prefix_len = c->path.size;
+	bool old_tree, new_tree;
+	int error = 0;
+
+	if (old_entry && new_entry && old_entry->attr == new_entry->attr &&
+	    git_oid_equal(&old_entry->oid, &new_entry->oid))
+		return 0;
+
+	if (git_str_put(&c->path, entry->filename, entry->filename_len) < 0)
+		return -1;
+
+	old_tree = old_entry && git_tree_entry__is_tree(old_entry);
+	new_tree = new_entry && git_tree_entry__is_tree(new_entry);
+
+	/* like git, only the paths of the files themselves are changes */
+	if ((old_entry && !old_tree) || (new_entry && !new_tree))
+		error = bloom_changes_add(c);
+
+	if (!error && (old_tree || new_tree)) {
+		if ((error = git_str_putc(&c->path, '/')) < 0)
+			goto done;
+
+		error = bloom_changes_diff(c,
+			old_tree ? &old_entry->oid : NULL,
+			new_tree ? &new_entry->oid : NULL);
+	}
+
+done:
+	git_str_truncate(&c->path, prefix_len);
+	return error;
+}
+
+static int bloom_changes_diff(
+	struct bloom_changes *c,
+	const git_oid *old_id,
+	const git_oid *new_id)
+{
+	git_tree *old_tree = NULL, *new_tree = NULL;
+	const git_tree_entry *old_entry, *new_entry;
+	size_t i = 0, j = 0, old_len, new_len;
+	int cmp, error = 0;
+
+	if ((old_id && (error = bloom_read_tree(&old_tree, c->odb, old_id, c->oid_type)) < 0) ||
+	    (new_id && (error = bloom_read_tree(&new_tree, c->odb, new_id, c->oid_type)) < 0))
+		goto done;
+
+	old_len = old_tree ? git_array_size(old_tree->entries) : 0;
+	new_len = new_tree ? git_array_size(new_tree->entries) : 0;
+
+	/* both trees are sorted, so we can walk them side by side */
+	while ((i < old_len || j < new_len) && !c->too_many && !error) {
+		old_entry = i < old_len ? git_array_get(old_tree->entries, i) : NULL;
+		new_entry = j < new_len ? git_array_get(new_tree->entries, j) : NULL;
+
+		if (!old_entry)
+			cmp = 1;
+		else if (!new_entry)
+			cmp = -1;
+		else
+			cmp = git_fs_path_cmp(
+				old_entry->filename, old_entry->filename_len,
+				git_tree_entry__is_tree(old_entry),
+				new_entry->filename, new_entry->filename_len,
+				git_tree_entry__is_tree(new_entry),
+				git__strncmp);
+
+		if (cmp < 0) {
+			error = bloom_changes_entry(c, old_entry, NULL);
+			i++;
+		} else if (cmp > 0) {
+			error = bloom_changes_entry(c, NULL, new_entry);
+			j++;
+		} else {
+			error = bloom_changes_entry(c, old_entry, new_entry);
+			i++;
+			j++;
+		}
+	}
+
+done:
+	if (old_tree)
+		git_tree__free(old_tree);
+	if (new_tree)
+		git_tree__free(new_tree);
+	return error;
+}
+
+static int bloom_filter_compute(
+	struct bloom_writer *bw,
+	struct bloom_changes *c,
+	struct packed_commit *packed_commit)
+{
+	git_commit_graph_bloom_key key;
+	git_commit_graph_entry base_parent;
+	struct packed_commit *parent;
+	git_hashmap_iter_t iter = GIT_HASHMAP_ITER_INIT;
+	const git_oid *parent_tree = NULL;
+	const char *path;
+	size_t *parent_idx, len, i;
+	uint64_t bit;
+
+	/* the filter holds the changes from the first parent */
+	if ((parent_idx = git_array_get(packed_commit->parent_indices, 0)) == NULL) {
+		parent_tree = NULL;
+	} else if (*parent_idx < bw->num_base_commits) {
+		if (git_commit_graph_entry_get_byindex(&base_parent, bw->base, *parent_idx) < 0)
+			return -1;
+
+		parent_tree = &base_parent.tree_oid;
+	} else {
+		parent = git_vector_get(&bw->w->commits, *parent_idx - bw->num_base_commits);
+		parent_tree = &parent->tree_oid;
+	}
+
+	git_str_clear(&c->path);
+	git_hashset_str_clear(&c->paths);
+	git_pool_clear(&c->pool);
+	c->files = 0;
+	c->too_many = false;
+
+	if (bloom_changes_diff(c, parent_tree, &packed_commit->tree_oid) < 0)
+		return -1;
+
+	if (c->too_many || git_hashset_str_size(&c->paths) > BLOOM_MAX_CHANGED_PATHS) {
+		packed_commit->bloom_filter = git__malloc(1);
+		GIT_ERROR_CHECK_ALLOC(packed_commit->bloom_filter);
+
+		packed_commit->bloom_filter[0] = 0xff;
+		packed_commit->bloom_filter_len = 1;
+		return 0;
+	}
+
+	len = (git_hashset_str_size(&c->paths) * bw->settings.bits_per_entry + 7) / 8;
+
+	if (!len)
+		len = 1;
+
+	packed_commit->bloom_filter = git__calloc(1, len);
+	GIT_ERROR_CHECK_ALLOC(packed_commit->bloom_filter);
+	packed_commit->bloom_filter_len = len;
+
+	while (git_hashset_str_iterate(&iter, &path, &c->paths) == 0) {
+		bloom_key_init(&key, bw->settings.hash_version,
+			bw->settings.num_hashes, path, strlen(path));
+
+		for (i = 0; i < bw->settings.num_hashes; i++) {
+			bit = key.hashes[i] % ((uint64_t)len * 8);
+			packed_commit->bloom_filter[bit / 8] |= (1 << (bit % 8));
+		}
+	}
+
+	return 0;
+}
+
+/* Reuse the filter of a commit from the existing commit-graph, if it has one. */
+static bool bloom_filter_reuse(
+	struct bloom_writer *bw,
+	struct packed_commit *packed_commit)
+{
+	git_commit_graph_entry e;
+	const unsigned char *filter;
+	size_t filter_len, pos;
+
+	if (!bw->existing ||
+	    git_commit_graph_entry_find(&e, bw->existing, &packed_commit->sha1,
+			git_oid_hexsize(bw->w->oid_type)) < 0 ||
+	    bloom_filter_get(&filter, &filter_len, bw->existing, e.index,
+			bw->settings.hash_version, bw->settings.num_hashes) < 0)
+		return false;
+
+	pos = e.index;
+
+	if (commit_graph_file_at(bw->existing, &pos)->bloom_filter_bits !=
+	    bw->settings.bits_per_entry)
+		return false;
+
+	if ((packed_commit->bloom_filter = git__malloc(filter_len)) == NULL)
+		return false;
+
+	memcpy(packed_commit->bloom_filter, filter, filter_len);
+	packed_commit->bloom_filter_len = filter_len;
+	return true;
+}
+
+static void bloom_writer_fail(struct bloom_writer *bw, int error)
+{
+	if (git_mutex_lock(&bw->lock) < 0)
+		return;
+
+	if (!bw->error) {
+		bw->error = error;
+		git_error_save(&bw->error_info);
+	}
+
+	git_mutex_unlock(&bw->lock);
+}
+
+/*
+ * Compute the filters of commits until there are none left.  Each of the
+ * workers takes the next commit that nobody has taken yet.
+ */
+static void *bloom_filters_compute(void *payload)
+{
+	struct bloom_writer *bw = payload;
+	struct bloom_changes c = {0};
+	struct packed_commit *packed_commit;
+	size_t len = git_vector_length(&bw->w->commits);
+	int32_t pos;
+	int error = 0;
+
+	c.odb = bw->w->odb;
+	c.oid_type = bw->w->oid_type;
+
+	if ((error = git_pool_init(&c.pool, 1)) < 0)
+		goto done;
+
+	while (!bw->error && (pos = git_atomic32_inc(&bw->next) - 1) >= 0 &&
+	       (size_t)pos < len) {
+		packed_commit = git_vector_get(&bw->w->commits, (size_t)pos);
+
+		if (bloom_filter_reuse(bw, packed_commit))
 			continue;
+
+		if ((error = bloom_filter_compute(bw, &c, packed_commit)) < 0)
+			break;
+	}
+
+done:
+	if (error < 0)
+		bloom_writer_fail(bw, error);
+
+	git_hashset_str_dispose(&c.paths);
+	git_pool_clear(&c.pool);
+	git_str_dispose(&c.path);
+	return NULL;
+}
+
+static int compute_bloom_filters(
+	uint32_t *hash_version_out,
+	git_commit_graph_writer *w,
+	const git_commit_graph_file *existing,
+	const git_commit_graph_file *base)
+{
+	struct bloom_writer bw = {0};
+	const git_commit_graph_file *file;
+	size_t threads;
+	int error = 0;
+
+	*hash_version_out = BLOOM_HASH_VERSION;
+
+	if (!w->odb || !git_vector_length(&w->commits))
+		return 0;
+
+	bw.w = w;
+	bw.base = base;
+	bw.num_base_commits = base ? (size_t)base->num_commits_in_base + base->num_commits : 0;
+	bw.settings.hash_version = BLOOM_HASH_VERSION;
+	bw.settings.num_hashes = BLOOM_NUM_HASHES;
+	bw.settings.bits_per_entry = BLOOM_BITS_PER_ENTRY;
+
+	if (git_mutex_init(&bw.lock) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to initialize bloom filter lock");
+		return -1;
+	}
+
+	/*
+	 * Reuse the filters of the existing commit-graph, keeping the hash
+	 * version of its newest file that was written with the same settings.
+	 */
+	for (file = existing; file; file = file->base) {
+		if (git_commit_graph_file_has_bloom_filters(file) &&
+		    file->bloom_filter_num_hashes == BLOOM_NUM_HASHES &&
+		    file->bloom_filter_bits == BLOOM_BITS_PER_ENTRY) {
+			bw.settings.hash_version = file->bloom_filter_hash_version;
+			bw.existing = existing;
+			break;
 		}
+	}
 
-		/*
-		 * Add this current commit again so that it is visited
-		 * again once all its children have been visited.
-		 */
-		*(size_t *)git_array_alloc(index_stack) = i;
-		git_array_foreach (child_packed_commit->parent_indices, j, parent_idx) {
-			if (commit_states[*parent_idx]
-			    != GENERATION_NUMBER_COMMIT_STATE_UNVISITED) {
-				/* This commit has already been considered. */
-				continue;
+	threads = w->threads ? w->threads : (size_t)git__online_cpus();
+	threads = min(threads, git_vector_length(&w->commits));
+
+#ifdef GIT_THREADS
+	if (threads > 1) {
+		git_thread *workers = git__calloc(threads, sizeof(git_thread));
+		size_t started = 0, i;
+
+		if (!workers) {
+			error = -1;
+			goto done;
+		}
+
+		for (i = 0; i < threads; i++) {
+			if (git_thread_create(&workers[i], bloom_filters_compute, &bw) != 0) {
+				git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+				bloom_writer_fail(&bw, -1);
+				break;
 			}
 
-			commit_states[*parent_idx] = GENERATION_NUMBER_COMMIT_STATE_ADDED;
-			*(size_t *)git_array_alloc(index_stack) = *parent_idx;
+			started++;
 		}
-		commit_states[i] = GENERATION_NUMBER_COMMIT_STATE_EXPANDED;
+
+		for (i = 0; i < started; i++)
+			git_thread_join(&workers[i], NULL);
+
+		git__free(workers);
+	} else
+#endif
+	{
+		bloom_filters_compute(&bw);
 	}
 
-cleanup:
-	git_commit_graph_oidmap_dispose(&packed_commit_map);
-	git__free(commit_states);
-	git_array_clear(index_stack);
+	if (bw.error) {
+		error = bw.error;
+		git_error_restore(bw.error_info);
+		bw.error_info = NULL;
+	}
+
+done:
+	git_mutex_free(&bw.lock);
 
+	*hash_version_out = bw.settings.hash_version;
 	return error;
 }
 
@@ -1111,8 +2257,16 @@ static void packed_commit_free_dup(void *packed_commit)
 	packed_commit_free(packed_commit);
 }
 
+/*
+ * Write the commits as a commit-graph file, or as a layer on top of the
+ * base chain if one is given.  The filters of the existing commit-graph or
+ * chain are reused.
+ */
 static int commit_graph_write(
+	unsigned char *checksum_out,
 	git_commit_graph_writer *w,
+	const git_commit_graph_file *existing,
+	const git_commit_graph_file *base,
 	commit_graph_write_cb write_cb,
 	void *cb_data)
 {
@@ -1125,7 +2279,12 @@ static int commit_graph_write(
 	uint32_t oid_fanout[256];
 	off64_t offset;
 	git_str oid_lookup = GIT_STR_INIT, commit_data = GIT_STR_INIT,
-		extra_edge_list = GIT_STR_INIT;
+		generation_data = GIT_STR_INIT, generation_data_overflow = GIT_STR_INIT,
+		extra_edge_list = GIT_STR_INIT, bloom_index = GIT_STR_INIT,
+		bloom_data = GIT_STR_INIT, base_graphs_list = GIT_STR_INIT;
+	uint32_t generation_data_overflow_count;
+	bool write_generation_data;
+	uint32_t bloom_hash_version = 0, bloom_offset = 0;
 	unsigned char checksum[GIT_HASH_MAX_SIZE];
 	git_hash_algorithm_t checksum_type;
 	size_t checksum_size, oid_size;
@@ -1154,10 +2313,42 @@ static int commit_graph_write(
 	/* Sort the commits. */
 	git_vector_sort(&w->commits);
 	git_vector_uniq(&w->commits, packed_commit_free_dup);
-	error = compute_generation_numbers(&w->commits);
+	error = compute_generation_numbers(&w->commits, base);
 	if (error < 0)
 		goto cleanup;
 
+	if (w->changed_paths) {
+		error = compute_bloom_filters(&bloom_hash_version, w, existing, base);
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/*
+	 * Corrected commit dates are only written when those of the base chain
+	 * can be read, since otherwise they could not be used anyway.
+	 */
+	write_generation_data = (w->generation_version >= 2 &&
+		(!base || base->read_generation_data));
+
+	/* Fill the Base Graphs List table: the base's own bases, then the base. */
+	if (base) {
+		if (base->num_base_graphs >= UINT8_MAX) {
+			error = commit_graph_error("commit-graph chain is too long");
+			goto cleanup;
+		}
+
+		hdr.base_graph_files = (uint8_t)(base->num_base_graphs + 1);
+
+		error = git_str_put(&base_graphs_list,
+			(const char *)base->base_graph_ids,
+			base->num_base_graphs * oid_size);
+		if (error < 0)
+			goto cleanup;
+		error = git_str_put(&base_graphs_list, (const char *)base->checksum, oid_size);
+		if (error < 0)
+			goto cleanup;
+	}
+
 	/* Fill the OID Fanout table. */
 	oid_fanout_count = 0;
 	for (i = 0; i < 256; i++) {
@@ -1246,10 +2437,84 @@ static int commit_graph_write(
 			goto cleanup;
 	}
 
+	/* Fill the Generation Data and Generation Data Overflow tables. */
+	generation_data_overflow_count = 0;
+	if (write_generation_data) {
+		git_vector_foreach (&w->commits, i, packed_commit) {
+			uint64_t offset;
+			uint32_t word;
+
+			offset = (uint64_t)(packed_commit->corrected_commit_date
+					- packed_commit->commit_time);
+
+			if (offset > 0x7fffffff) {
+				word = htonl((uint32_t)(offset >> 32));
+				error = git_str_put(&generation_data_overflow, (const char *)&word, sizeof(word));
+				if (error < 0)
+					goto cleanup;
+				word = htonl((uint32_t)(offset & 0xffffffffu));
+				error = git_str_put(&generation_data_overflow, (const char *)&word, sizeof(word));
+				if (error < 0)
+					goto cleanup;
+
+				offset = 0x80000000u | generation_data_overflow_count++;
+			}
+
+			word = htonl((uint32_t)offset);
+			error = git_str_put(&generation_data, (const char *)&word, sizeof(word));
+			if (error < 0)
+				goto cleanup;
+		}
+	}
+
+	/* Fill the Bloom Filter Index and Data tables. */
+	if (w->changed_paths) {
+		uint32_t word;
+
+		word = htonl(bloom_hash_version);
+		error = git_str_put(&bloom_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+		word = htonl(BLOOM_NUM_HASHES);
+		error = git_str_put(&bloom_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+		word = htonl(BLOOM_BITS_PER_ENTRY);
+		error = git_str_put(&bloom_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+
+		git_vector_foreach (&w->commits, i, packed_commit) {
+			if (packed_commit->bloom_filter_len > UINT32_MAX - bloom_offset) {
+				error = commit_graph_error("bloom filters are too large");
+				goto cleanup;
+			}
+
+			bloom_offset += (uint32_t)packed_commit->bloom_filter_len;
+			word = htonl(bloom_offset);
+			error = git_str_put(&bloom_index, (const char *)&word, sizeof(word));
+			if (error < 0)
+				goto cleanup;
+			error = git_str_put(&bloom_data,
+				(const char *)packed_commit->bloom_filter,
+				packed_commit->bloom_filter_len);
+			if (error < 0)
+				goto cleanup;
+		}
+	}
+
 	/* Write the header. */
 	hdr.chunks = 3;
+	if (git_str_len(&generation_data) > 0)
+		hdr.chunks++;
+	if (git_str_len(&generation_data_overflow) > 0)
+		hdr.chunks++;
 	if (git_str_len(&extra_edge_list) > 0)
 		hdr.chunks++;
+	if (git_str_len(&bloom_data) > 0)
+		hdr.chunks += 2;
+	if (git_str_len(&base_graphs_list) > 0)
+		hdr.chunks++;
 	error = write_cb((const char *)&hdr, sizeof(hdr), cb_data);
 	if (error < 0)
 		goto cleanup;
@@ -1268,6 +2533,20 @@ static int commit_graph_write(
 	if (error < 0)
 		goto cleanup;
 	offset += git_str_len(&commit_data);
+	if (git_str_len(&generation_data) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_GENERATION_DATA_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&generation_data);
+	}
+	if (git_str_len(&generation_data_overflow) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&generation_data_overflow);
+	}
 	if (git_str_len(&extra_edge_list) > 0) {
 		error = write_chunk_header(
 				COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset, write_cb, cb_data);
@@ -1275,6 +2554,25 @@ static int commit_graph_write(
 			goto cleanup;
 		offset += git_str_len(&extra_edge_list);
 	}
+	if (git_str_len(&bloom_data) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_BLOOM_FILTER_INDEX_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&bloom_index);
+		error = write_chunk_header(
+				COMMIT_GRAPH_BLOOM_FILTER_DATA_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&bloom_data);
+	}
+	if (git_str_len(&base_graphs_list) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_BASE_GRAPHS_LIST_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&base_graphs_list);
+	}
 	error = write_chunk_header(0, offset, write_cb, cb_data);
 	if (error < 0)
 		goto cleanup;
@@ -1287,9 +2585,25 @@ static int commit_graph_write(
 	if (error < 0)
 		goto cleanup;
 	error = write_cb(git_str_cstr(&commit_data), git_str_len(&commit_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&generation_data), git_str_len(&generation_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&generation_data_overflow),
+			git_str_len(&generation_data_overflow), cb_data);
 	if (error < 0)
 		goto cleanup;
 	error = write_cb(git_str_cstr(&extra_edge_list), git_str_len(&extra_edge_list), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&bloom_index), git_str_len(&bloom_index), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&bloom_data), git_str_len(&bloom_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&base_graphs_list), git_str_len(&base_graphs_list), cb_data);
 	if (error < 0)
 		goto cleanup;
 
@@ -1304,10 +2618,18 @@ static int commit_graph_write(
 	if (error < 0)
 		goto cleanup;
 
+	if (checksum_out)
+		memcpy(checksum_out, checksum, checksum_size);
+
 cleanup:
 	git_str_dispose(&oid_lookup);
 	git_str_dispose(&commit_data);
+	git_str_dispose(&generation_data);
+	git_str_dispose(&generation_data_overflow);
 	git_str_dispose(&extra_edge_list);
+	git_str_dispose(&bloom_index);
+	git_str_dispose(&bloom_data);
+	git_str_dispose(&base_graphs_list);
 	git_hash_ctx_cleanup(&ctx);
 	return error;
 }
@@ -1318,12 +2640,366 @@ static int commit_graph_write_filebuf(const char *buf, size_t size, void *data)
 	return git_filebuf_write(f, buf, size);
 }
 
+/*
+ * Open the commit-graph that is already in the `objects/info` directory:
+ * the commit-graph file, or if there is none, the chain.
+ */
+static int commit_graph_writer_open_existing(
+	git_commit_graph_file **out,
+	bool *chained,
+	git_commit_graph_writer *w)
+{
+	git_str path = GIT_STR_INIT;
+	int error;
+
+	*out = NULL;
+	*chained = false;
+
+	if ((error = git_str_joinpath(&path,
+			git_str_cstr(&w->objects_info_dir), "commit-graph")) < 0)
+		goto done;
+
+	error = git_commit_graph_file_open(out, path.ptr, w->oid_type);
+
+	if (error == GIT_ENOTFOUND) {
+		if ((error = git_str_joinpath(&path, git_str_cstr(&w->objects_info_dir),
+				"commit-graphs/commit-graph-chain")) < 0)
+			goto done;
+
+		error = git_commit_graph_chain_open(out, path.ptr, w->oid_type);
+		*chained = (error == 0);
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+done:
+	git_str_dispose(&path);
+	return error;
+}
+
+static bool commit_graph_contains(
+	const git_commit_graph_file *file,
+	const git_oid *id)
+{
+	size_t pos;
+
+	for (; file; file = file->base) {
+		if (commit_graph_file_find(&pos, file, id, git_oid_hexsize(file->oid_type)) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static int packed_commit_in_graph(const git_vector *v, size_t idx, void *payload)
+{
+	struct packed_commit *packed_commit = git_vector_get(v, idx);
+
+	if (!commit_graph_contains(payload, &packed_commit->sha1))
+		return 0;
+
+	packed_commit_free(packed_commit);
+	return 1;
+}
+
+static int packed_commit_from_entry(
+	struct packed_commit **out,
+	const git_commit_graph_file *file,
+	const git_commit_graph_entry *e)
+{
+	struct packed_commit *p;
+	git_commit_graph_entry parent;
+	git_oid *parent_id;
+	size_t i;
+	int error;
+
+	p = git__calloc(1, sizeof(struct packed_commit));
+	GIT_ERROR_CHECK_ALLOC(p);
+
+	git_oid_cpy(&p->sha1, &e->sha1);
+	git_oid_cpy(&p->tree_oid, &e->tree_oid);
+	p->commit_time = e->commit_time;
+
+	for (i = 0; i < e->parent_count; i++) {
+		if ((error = git_commit_graph_entry_parent(&parent, file, e, i)) < 0)
+			goto on_error;
+
+		if ((parent_id = git_array_alloc(p->parents)) == NULL) {
+			error = -1;
+			goto on_error;
+		}
+
+		git_oid_cpy(parent_id, &parent.sha1);
+	}
+
+	*out = p;
+	return 0;
+
+on_error:
+	packed_commit_free(p);
+	return error;
+}
+
+/*
+ * Choose the part of the existing chain that the new layer is written on
+ * top of.  Like git, a layer is merged into the new one when it has at
+ * most `size_multiple` times as many commits, or when the new one has
+ * more than `max_commits`.  The commits of the merged layers are added to
+ * the writer, and the ones that are already in the base are removed.
+ */
+static int commit_graph_split_base(
+	const git_commit_graph_file **out,
+	git_commit_graph_writer *w,
+	const git_commit_graph_file *existing)
+{
+	const git_commit_graph_file *base = existing, *file;
+	struct packed_commit *packed_commit;
+	git_commit_graph_entry e;
+	size_t num_commits, i;
+	int error;
+
+	*out = NULL;
+
+	if (!existing)
+		return 0;
+
+	git_vector_remove_matching(&w->commits, packed_commit_in_graph, (void *)existing);
+	num_commits = git_vector_length(&w->commits);
+
+	/* There is nothing to add, so the chain stays as it is. */
+	if (!num_commits && w->split_strategy != GIT_COMMIT_GRAPH_SPLIT_STRATEGY_REPLACE) {
+		*out = existing;
+		return 0;
+	}
+
+	while (base && w->split_strategy != GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE) {
+		if (w->split_strategy == GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE &&
+		    (double)base->num_commits > w->size_multiple * (double)num_commits &&
+		    num_commits <= w->max_commits)
+			break;
+
+		num_commits += base->num_commits;
+		base = base->base;
+	}
+
+	for (file = existing; file != base; file = file->base) {
+		for (i = 0; i < file->num_commits; i++) {
+			if ((error = git_commit_graph_entry_get_byindex(&e, existing,
+					(size_t)file->num_commits_in_base + i)) < 0 ||
+			    (error = packed_commit_from_entry(&packed_commit, existing, &e)) < 0)
+				return error;
+
+			if ((error = git_vector_insert(&w->commits, packed_commit)) < 0) {
+				packed_commit_free(packed_commit);
+				return error;
+			}
+		}
+	}
+
+	*out = base;
+	return 0;
+}
+
+struct commit_graph_expire_state {
+	const git_str *chain;
+	size_t oid_hexsize;
+	git_time_t expire_time;
+};
+
+static bool commit_graph_chain_has_layer(
+	const git_str *chain,
+	const char *hex,
+	size_t hex_len)
+{
+	const char *line;
+
+	for (line = chain->ptr; line + hex_len < chain->ptr + chain->size; line += hex_len + 1) {
+		if (!memcmp(line, hex, hex_len))
+			return true;
+	}
+
+	return false;
+}
+
+static int commit_graph_expire_cb(void *payload, git_str *path)
+{
+	struct commit_graph_expire_state *state = payload;
+	const char *filename = path->ptr + git_fs_path_basename_offset(path);
+	size_t len = strlen(filename);
+	struct stat st;
+
+	if (!strcmp(filename, "commit-graph-chain")) {
+		/* without a chain, the commit-graph file replaces it */
+		if (!state->chain)
+			p_unlink(path->ptr);
+
+		return 0;
+	}
+
+	if (len != state->oid_hexsize + CONST_STRLEN("graph-.graph") ||
+	    git__prefixcmp(filename, "graph-") != 0 ||
+	    git__suffixcmp(filename, ".graph") != 0)
+		return 0;
+
+	if (state->chain && commit_graph_chain_has_layer(state->chain,
+			filename + CONST_STRLEN("graph-"), state->oid_hexsize))
+		return 0;
+
+	if (p_stat(path->ptr, &st) < 0 ||
+	    (state->expire_time && st.st_mtime > state->expire_time))
+		return 0;
+
+	/* This is best effort; the file may still be in use. */
+	p_unlink(path->ptr);
+	return 0;
+}
+
+/*
+ * Delete the files in the `commit-graphs` directory that are not part of
+ * the given chain, or all of them if there is no chain.
+ */
+static int commit_graph_expire(git_commit_graph_writer *w, const git_str *chain)
+{
+	struct commit_graph_expire_state state = {0};
+	git_str path = GIT_STR_INIT;
+	int error;
+
+	state.chain = chain;
+	state.oid_hexsize = git_oid_hexsize(w->oid_type);
+	state.expire_time = w->expire_time;
+
+	if ((error = git_str_joinpath(&path,
+			git_str_cstr(&w->objects_info_dir), "commit-graphs")) < 0)
+		goto done;
+
+	if (git_fs_path_isdir(path.ptr))
+		error = git_fs_path_direach(&path, 0, commit_graph_expire_cb, &state);
+
+done:
+	git_str_dispose(&path);
+	return error;
+}
+
+/*
+ * Write the commits that are not in the commit-graph yet as a new layer of
+ * the chain, merging it with the layers below it as the strategy requires.
+ */
+static int commit_graph_write_split(git_commit_graph_writer *w)
+{
+	git_commit_graph_file *existing = NULL;
+	const git_commit_graph_file *base = NULL;
+	git_str graphs_dir = GIT_STR_INIT, path = GIT_STR_INIT,
+		monolithic = GIT_STR_INIT, chain = GIT_STR_INIT;
+	git_filebuf chain_lock = GIT_FILEBUF_INIT, output = GIT_FILEBUF_INIT;
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	char hex[GIT_OID_MAX_HEXSIZE];
+	size_t oid_hexsize = git_oid_hexsize(w->oid_type);
+	int filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
+	bool chained, had_monolithic, keep_monolithic;
+	git_oid id;
+	int error;
+
+	if (git_repository__fsync_gitdir)
+		filebuf_flags |= GIT_FILEBUF_FSYNC;
+
+	/* Holding the lock on the chain keeps other writers out. */
+	if ((error = git_str_joinpath(&graphs_dir,
+			git_str_cstr(&w->objects_info_dir), "commit-graphs")) < 0 ||
+	    (error = git_futils_mkdir(graphs_dir.ptr, GIT_OBJECT_DIR_MODE, 0)) < 0 ||
+	    (error = git_str_joinpath(&path, graphs_dir.ptr, "commit-graph-chain")) < 0 ||
+	    (error = git_filebuf_open(&chain_lock, path.ptr, filebuf_flags, 0644)) < 0)
+		goto done;
+
+	if ((error = commit_graph_writer_open_existing(&existing, &chained, w)) < 0 ||
+	    (error = commit_graph_split_base(&base, w, existing)) < 0)
+		goto done;
+
+	/* All of the commits are in the commit-graph already. */
+	if (!git_vector_length(&w->commits) && base == existing)
+		goto done;
+
+	/* Write the new layer, which is named after its checksum. */
+	if ((error = git_str_joinpath(&path, graphs_dir.ptr, "graph")) < 0 ||
+	    (error = git_filebuf_open(&output, path.ptr, filebuf_flags, 0644)) < 0 ||
+	    (error = commit_graph_write(checksum, w, existing, base,
+			commit_graph_write_filebuf, &output)) < 0 ||
+	    (error = git_oid_from_raw(&id, checksum, w->oid_type)) < 0 ||
+	    (error = git_oid_fmt(hex, &id)) < 0 ||
+	    (error = commit_graph_layer_path(&path, graphs_dir.ptr, hex, oid_hexsize)) < 0 ||
+	    (error = git_filebuf_commit_at(&output, path.ptr)) < 0)
+		goto done;
+
+	if ((error = commit_graph_chain_contents(&chain, base)) < 0 ||
+	    (error = git_str_put(&chain, hex, oid_hexsize)) < 0 ||
+	    (error = git_str_putc(&chain, '\n')) < 0)
+		goto done;
+
+	/*
+	 * A commit-graph file that the new layer is written on top of becomes
+	 * the bottom layer of the chain; otherwise it was merged into the new
+	 * layer.  Either way, it must go, since it takes precedence over the
+	 * chain.
+	 */
+	had_monolithic = (existing && !chained);
+	keep_monolithic = (had_monolithic && base);
+
+	git_commit_graph_file_free(existing);
+	existing = NULL;
+	base = NULL;
+
+	if (had_monolithic) {
+		if ((error = git_str_joinpath(&monolithic,
+				git_str_cstr(&w->objects_info_dir), "commit-graph")) < 0)
+			goto done;
+
+		if (keep_monolithic) {
+			if ((error = commit_graph_layer_path(&path, graphs_dir.ptr,
+					chain.ptr, oid_hexsize)) < 0)
+				goto done;
+
+			if (p_rename(monolithic.ptr, path.ptr) < 0) {
+				git_error_set(GIT_ERROR_OS, "failed to move commit-graph into the chain");
+				error = -1;
+				goto done;
+			}
+		} else if (git_fs_path_exists(monolithic.ptr) && p_unlink(monolithic.ptr) < 0) {
+			git_error_set(GIT_ERROR_OS, "failed to remove the commit-graph file");
+			error = -1;
+			goto done;
+		}
+	}
+
+	if ((error = git_filebuf_write(&chain_lock, chain.ptr, chain.size)) < 0 ||
+	    (error = git_filebuf_commit(&chain_lock)) < 0)
+		goto done;
+
+	error = commit_graph_expire(w, &chain);
+
+done:
+	git_filebuf_cleanup(&output);
+	git_filebuf_cleanup(&chain_lock);
+	git_commit_graph_file_free(existing);
+	git_str_dispose(&graphs_dir);
+	git_str_dispose(&path);
+	git_str_dispose(&monolithic);
+	git_str_dispose(&chain);
+	return error;
+}
+
 int git_commit_graph_writer_commit(git_commit_graph_writer *w)
 {
 	int error;
 	int filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
 	git_str commit_graph_path = GIT_STR_INIT;
 	git_filebuf output = GIT_FILEBUF_INIT;
+	git_commit_graph_file *existing = NULL;
+	bool chained;
+
+	if (w->split_strategy != GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE)
+		return commit_graph_write_split(w);
 
 	error = git_str_joinpath(
 			&commit_graph_path, git_str_cstr(&w->objects_info_dir), "commit-graph");
@@ -1337,13 +3013,24 @@ int git_commit_graph_writer_commit(git_commit_graph_writer *w)
 	if (error < 0)
 		return error;
 
-	error = commit_graph_write(w, commit_graph_write_filebuf, &output);
+	/* Best effort: the existing commit-graph is only used for its filters. */
+	if (w->changed_paths &&
+	    commit_graph_writer_open_existing(&existing, &chained, w) < 0)
+		git_error_clear();
+
+	error = commit_graph_write(NULL, w, existing, NULL, commit_graph_write_filebuf, &output);
+	git_commit_graph_file_free(existing);
+
 	if (error < 0) {
 		git_filebuf_cleanup(&output);
 		return error;
 	}
 
-	return git_filebuf_commit(&output);
+	if ((error = git_filebuf_commit(&output)) < 0)
+		return error;
+
+	/* The commit-graph file replaces any chain. */
+	return commit_graph_expire(w, NULL);
 }
 
 int git_commit_graph_writer_dump(
@@ -1357,5 +3044,16 @@ int git_commit_graph__writer_dump(
 	git_str *cgraph,
 	git_commit_graph_writer *w)
 {
-	return commit_graph_write(w, commit_graph_write_buf, cgraph);
+	git_commit_graph_file *existing = NULL;
+	bool chained;
+	int error;
+
+	if (w->changed_paths &&
+	    commit_graph_writer_open_existing(&existing, &chained, w) < 0)
+		git_error_clear();
+
+	error = commit_graph_write(NULL, w, existing, NULL, commit_graph_write_buf, cgraph);
+	git_commit_graph_file_free(existing);
+
+	return error;
 }
@@ -13,6 +13,7 @@
 #include "git2/types.h"
 #include "git2/sys/commit_graph.h"
 
+#include "array.h"
 #include "map.h"
 #include "vector.h"
 #include "oid.h"
@@ -35,7 +36,7 @@ typedef struct git_commit_graph_file {
 
 	/* The OID Fanout table. */
 	const uint32_t *oid_fanout;
-	/* The total number of commits in the graph. */
+	/* The number of commits in the file, not counting its base files. */
 	uint32_t num_commits;
 
 	/* The OID Lookup table. */
@@ -72,6 +73,7 @@ typedef struct git_commit_graph_file {
 
 	/* Concatenated computed bloom filters */
 	const unsigned char *bloom_filter_data;
+	size_t bloom_filter_data_len;
 
 	/* 
 	 * Hash version used in the bloom filter
@@ -85,8 +87,41 @@ typedef struct git_commit_graph_file {
 	/* Minimum number of bits per entry */
 	uint32_t bloom_filter_bits;
 
-	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
-	unsigned char checksum[GIT_HASH_SHA1_SIZE];
+	/*
+	 * The Generation Data table. Each 4-byte entry is the offset, in network
+	 * byte order, of the commit's corrected commit date from its commit time.
+	 * If the most significant bit is set, the rest is instead the index of
+	 * the offset within the Generation Data Overflow table.
+	 */
+	const unsigned char *generation_data;
+
+	/* The Generation Data Overflow table. Each entry is 8 bytes wide. */
+	const unsigned char *generation_data_overflow;
+	size_t num_generation_data_overflow;
+
+	/*
+	 * Whether the corrected commit dates can be used: they are only
+	 * comparable if this file and all of its base files have them.
+	 */
+	bool read_generation_data;
+
+	/* The number of commit-graph files that this one is layered on. */
+	uint32_t num_base_graphs;
+
+	/* The Base Graphs List table: the checksums of those files, oldest first. */
+	const unsigned char *base_graph_ids;
+
+	/*
+	 * In a commit-graph chain, the file that this one is layered on, and the
+	 * number of commits in it and in all of its own base files. The positions
+	 * of the commits in a chain, including those of the parents in the Commit
+	 * Data table, count from the bottom of the chain.
+	 */
+	struct git_commit_graph_file *base;
+	uint32_t num_commits_in_base;
+
+	/* The trailer of the file. Contains the checksum of the whole file. */
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
 } git_commit_graph_file;
 
 /**
@@ -100,6 +135,14 @@ typedef struct git_commit_graph_entry {
 	/* Time in seconds from UNIX epoch. */
 	git_time_t commit_time;
 
+	/*
+	 * The corrected commit date of the commit, which is the generation
+	 * number v2 of the commit-graph format: the largest of its commit time
+	 * and one more than the corrected commit dates of its parents. This is
+	 * zero if the commit-graph file has no generation data.
+	 */
+	git_time_t corrected_commit_date;
+
 	/* The number of parents of the commit. */
 	size_t parent_count;
 
@@ -118,14 +161,55 @@ typedef struct git_commit_graph_entry {
 
 	/* The object ID hash of the requested commit. */
 	git_oid sha1;
+
+	/* The position of the commit within the commit-graph file or chain. */
+	size_t index;
 } git_commit_graph_entry;
 
+/*
+ * The largest number of hashes per path that we support for changed-path
+ * Bloom filters; git writes filters with seven.
+ */
+#define GIT_COMMIT_GRAPH_BLOOM_MAX_HASHES 32
+
+/* The hashes of a single path in a changed-path Bloom filter. */
+typedef struct {
+	uint32_t hashes[GIT_COMMIT_GRAPH_BLOOM_MAX_HASHES];
+} git_commit_graph_bloom_key;
+
+/*
+ * A set of paths to look up in the changed-path Bloom filters of a
+ * commit-graph file.  Each path is looked up together with all of its
+ * leading directories, since any one of them being absent from a filter
+ * proves that the path was not changed.
+ */
+typedef struct {
+	/* The filter settings that the keys were computed for. */
+	uint32_t hash_version;
+	uint32_t num_hashes;
+
+	/* The keys of each path, followed by those of its leading directories. */
+	git_array_t(git_commit_graph_bloom_key) keys;
+
+	/* For each path, the index one past its last key. */
+	git_array_t(size_t) path_ends;
+} git_commit_graph_bloom_paths;
+
+#define GIT_COMMIT_GRAPH_BLOOM_PATHS_INIT { 0 }
+
 /* A wrapper for git_commit_graph_file to enable lazy loading in the ODB. */
 struct git_commit_graph {
 	/* The path to the commit-graph file. Something like ".git/objects/info/commit-graph". */
 	git_str filename;
 
-	/* The underlying commit-graph file. */
+	/*
+	 * The path to the commit-graph chain, which is used when there is no
+	 * commit-graph file. Something like
+	 * ".git/objects/info/commit-graphs/commit-graph-chain".
+	 */
+	git_str chain_filename;
+
+	/* The underlying commit-graph file, or the top of the chain. */
 	git_commit_graph_file *file;
 
 	/* The object ID types in the commit graph. */
@@ -133,6 +217,9 @@ struct git_commit_graph {
 
 	/* Whether the commit-graph file was already checked for validity. */
 	bool checked;
+
+	/* Whether the underlying file was loaded from the chain. */
+	bool chained;
 };
 
 /** Create a new commit-graph, optionally opening the underlying file. */
@@ -151,6 +238,15 @@ int git_commit_graph_file_open(
 	const char *path,
 	git_oid_t oid_type);
 
+/*
+ * Open each of the files in a commit-graph chain, returning the top one.
+ * The files are expected in the same directory as the chain.
+ */
+int git_commit_graph_chain_open(
+	git_commit_graph_file **file_out,
+	const char *chain_path,
+	git_oid_t oid_type);
+
 /*
  * Attempt to get the git_commit_graph's commit-graph file. This object is
  * still owned by the git_commit_graph. If the repository does not contain a commit graph,
@@ -178,6 +274,22 @@ struct git_commit_graph_writer {
 
 	/* The list of packed commits. */
 	git_vector commits;
+
+	/* The object database that the commits were read from. */
+	git_odb *odb;
+
+	/* Whether to write changed-path Bloom filters, and with how many threads. */
+	bool changed_paths;
+	unsigned int threads;
+
+	/* The version of the generation numbers to write. */
+	unsigned int generation_version;
+
+	/* How new commits are added to an existing commit-graph chain. */
+	git_commit_graph_split_strategy_t split_strategy;
+	float size_multiple;
+	size_t max_commits;
+	git_time_t expire_time;
 };
 
 int git_commit_graph__writer_dump(
@@ -191,6 +303,14 @@ int git_commit_graph__writer_dump(
 bool git_commit_graph_file_needs_refresh(
 		const git_commit_graph_file *file, const char *path);
 
+/*
+ * Returns whether the chain that the git_commit_graph_file is the top of
+ * needs to be reloaded since the layers in the commit-graph chain file on
+ * disk have changed.
+ */
+bool git_commit_graph_chain_needs_refresh(
+		const git_commit_graph_file *file, const char *chain_path);
+
 int git_commit_graph_entry_find(
 		git_commit_graph_entry *e,
 		const git_commit_graph_file *file,
@@ -202,6 +322,40 @@ int git_commit_graph_entry_parent(
 		const git_commit_graph_entry *entry,
 		size_t n);
 int git_commit_graph_file_close(git_commit_graph_file *cgraph);
+
+/* Whether the commit-graph file contains usable changed-path Bloom filters. */
+bool git_commit_graph_file_has_bloom_filters(const git_commit_graph_file *file);
+
+/* The murmur3 hash used by the given version of the Bloom filters. */
+uint32_t git_commit_graph_bloom_murmur3(
+		uint32_t hash_version,
+		uint32_t seed,
+		const char *data,
+		size_t len);
+
+/*
+ * Add a path to the set, computing its keys for the filters of the given
+ * file.  Returns GIT_ENOTFOUND if the file has no usable Bloom filters, or
+ * if they differ from the ones that the set's other keys were computed for.
+ */
+int git_commit_graph_bloom_paths_add(
+		git_commit_graph_bloom_paths *paths,
+		const git_commit_graph_file *file,
+		const char *path,
+		size_t len);
+
+/*
+ * Returns true if the Bloom filter of the given commit proves that none of
+ * the paths in the set were changed relative to the commit's first parent
+ * (or, for a root commit, that none of them exist).  Returns false if any
+ * of them may have been changed, or if the filter is not available.
+ */
+bool git_commit_graph_bloom_paths_unchanged(
+		const git_commit_graph_bloom_paths *paths,
+		const git_commit_graph_file *file,
+		const git_oid *commit_id);
+
+void git_commit_graph_bloom_paths_dispose(git_commit_graph_bloom_paths *paths);
 void git_commit_graph_file_free(git_commit_graph_file *cgraph);
 
 /* This is exposed for use in the fuzzers. */
@@ -14,8 +14,8 @@
 
 int git_commit_list_generation_cmp(const void *a, const void *b)
 {
-	uint32_t generation_a = ((git_commit_list_node *) a)->generation;
-	uint32_t generation_b = ((git_commit_list_node *) b)->generation;
+	uint64_t generation_a = ((git_commit_list_node *) a)->generation;
+	uint64_t generation_b = ((git_commit_list_node *) b)->generation;
 
 	if (!generation_a || !generation_b) {
 		/* Fall back to comparing by timestamps if at least one commit lacks a generation. */
@@ -186,7 +186,14 @@ int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 
 		if (error == 0 && git__is_uint16(e.parent_count)) {
 			size_t i;
-			commit->generation = (uint32_t)e.generation;
+
+			/*
+			 * Prefer the corrected commit dates, which are not thrown
+			 * off by commits with skewed timestamps.
+			 */
+			commit->generation = cgraph_file->read_generation_data
+				? (uint64_t)e.corrected_commit_date
+				: (uint64_t)e.generation;
 			commit->time = e.commit_time;
 			commit->out_degree = (uint16_t)e.parent_count;
 			commit->parents = alloc_parents(walk, commit, commit->out_degree);
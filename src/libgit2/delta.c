@@ -537,20 +537,16 @@ int git_delta_read_header_fromstream(
 	return 0;
 }
 
-int git_delta_apply(
-	void **out,
-	size_t *out_len,
+int git_delta_reader_init(
+	git_delta_reader *reader,
+	size_t *res_len,
 	const unsigned char *base,
 	size_t base_len,
 	const unsigned char *delta,
 	size_t delta_len)
 {
 	const unsigned char *delta_end = delta + delta_len;
-	size_t base_sz, res_sz, alloc_sz;
-	unsigned char *res_dp;
-
-	*out = NULL;
-	*out_len = 0;
+	size_t base_sz, res_sz;
 
 	/*
 	 * Check that the base size matches the data we were given;
@@ -567,74 +563,138 @@ int git_delta_apply(
 		return -1;
 	}
 
-	if (res_sz > git_indexer__max_object_size) {
-		git_error_set(GIT_ERROR_INVALID,
-			"failed to apply delta: overly large object");
+	memset(reader, 0, sizeof(git_delta_reader));
+	reader->base = base;
+	reader->base_len = base_len;
+	reader->delta = delta;
+	reader->delta_end = delta_end;
+	reader->res_remain = res_sz;
+
+	*res_len = res_sz;
+	return 0;
+}
+
+/* Decode the next instruction of the delta into the pending data. */
+static int delta_reader_next(git_delta_reader *reader)
+{
+	const unsigned char *delta = reader->delta;
+	const unsigned char *delta_end = reader->delta_end;
+	unsigned char cmd;
+
+	if (delta >= delta_end)
 		return -1;
-	}
 
-	GIT_ERROR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
-	res_dp = git__malloc(alloc_sz);
-	GIT_ERROR_CHECK_ALLOC(res_dp);
+	cmd = *delta++;
 
-	res_dp[res_sz] = '\0';
-	*out = res_dp;
-	*out_len = res_sz;
+	if (cmd & 0x80) {
+		/* cmd is a copy instruction; copy from the base. */
+		size_t off = 0, len = 0, end;
 
-	while (delta < delta_end) {
-		unsigned char cmd = *delta++;
-		if (cmd & 0x80) {
-			/* cmd is a copy instruction; copy from the base. */
-			size_t off = 0, len = 0, end;
-
-#define ADD_DELTA(o, shift) { if (delta < delta_end) (o) |= ((unsigned) *delta++ << shift); else goto fail; }
-			if (cmd & 0x01) ADD_DELTA(off, 0UL);
-			if (cmd & 0x02) ADD_DELTA(off, 8UL);
-			if (cmd & 0x04) ADD_DELTA(off, 16UL);
-			if (cmd & 0x08) ADD_DELTA(off, 24UL);
-
-			if (cmd & 0x10) ADD_DELTA(len, 0UL);
-			if (cmd & 0x20) ADD_DELTA(len, 8UL);
-			if (cmd & 0x40) ADD_DELTA(len, 16UL);
-			if (!len)       len = 0x10000;
+#define ADD_DELTA(o, shift) { if (delta < delta_end) (o) |= ((unsigned) *delta++ << shift); else return -1; }
+		if (cmd & 0x01) ADD_DELTA(off, 0UL);
+		if (cmd & 0x02) ADD_DELTA(off, 8UL);
+		if (cmd & 0x04) ADD_DELTA(off, 16UL);
+		if (cmd & 0x08) ADD_DELTA(off, 24UL);
+
+		if (cmd & 0x10) ADD_DELTA(len, 0UL);
+		if (cmd & 0x20) ADD_DELTA(len, 8UL);
+		if (cmd & 0x40) ADD_DELTA(len, 16UL);
+		if (!len)       len = 0x10000;
 #undef ADD_DELTA
 
-			if (GIT_ADD_SIZET_OVERFLOW(&end, off, len) ||
-			    base_len < end || res_sz < len)
-				goto fail;
-
-			memcpy(res_dp, base + off, len);
-			res_dp += len;
-			res_sz -= len;
-
-		} else if (cmd) {
-			/*
-			 * cmd is a literal insert instruction; copy from
-			 * the delta stream itself.
-			 */
-			if (delta_end - delta < cmd || res_sz < cmd)
-				goto fail;
-			memcpy(res_dp, delta, cmd);
-			delta += cmd;
-			res_dp += cmd;
-			res_sz -= cmd;
+		if (GIT_ADD_SIZET_OVERFLOW(&end, off, len) ||
+		    reader->base_len < end || reader->res_remain < len)
+			return -1;
+
+		reader->pending = reader->base + off;
+		reader->pending_len = len;
+	} else if (cmd) {
+		/*
+		 * cmd is a literal insert instruction; copy from
+		 * the delta stream itself.
+		 */
+		if (delta_end - delta < cmd || reader->res_remain < cmd)
+			return -1;
 
-		} else {
-			/* cmd == 0 is reserved for future encodings. */
+		reader->pending = delta;
+		reader->pending_len = cmd;
+		delta += cmd;
+	} else {
+		/* cmd == 0 is reserved for future encodings. */
+		return -1;
+	}
+
+	reader->delta = delta;
+	return 0;
+}
+
+ssize_t git_delta_reader_read(git_delta_reader *reader, void *buffer, size_t len)
+{
+	unsigned char *out = buffer;
+	size_t total = 0, chunk;
+
+	while (total < len && reader->res_remain) {
+		if (!reader->pending_len && delta_reader_next(reader) < 0)
 			goto fail;
-		}
+
+		chunk = min(len - total, reader->pending_len);
+		memcpy(out + total, reader->pending, chunk);
+
+		reader->pending += chunk;
+		reader->pending_len -= chunk;
+		reader->res_remain -= chunk;
+		total += chunk;
 	}
 
-	if (delta != delta_end || res_sz)
+	/* The whole delta must have been used once the result is complete */
+	if (!reader->res_remain && reader->delta != reader->delta_end)
 		goto fail;
-	return 0;
+
+	return (ssize_t)total;
 
 fail:
-	git__free(*out);
+	git_error_set(GIT_ERROR_INVALID, "failed to apply delta");
+	return -1;
+}
+
+int git_delta_apply(
+	void **out,
+	size_t *out_len,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	git_delta_reader reader;
+	size_t res_sz, alloc_sz;
+	unsigned char *res_dp;
 
 	*out = NULL;
 	*out_len = 0;
 
-	git_error_set(GIT_ERROR_INVALID, "failed to apply delta");
-	return -1;
+	if (git_delta_reader_init(&reader, &res_sz, base, base_len, delta, delta_len) < 0)
+		return -1;
+
+	if (res_sz > git_indexer__max_object_size) {
+		git_error_set(GIT_ERROR_INVALID,
+			"failed to apply delta: overly large object");
+		return -1;
+	}
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
+	res_dp = git__malloc(alloc_sz);
+	GIT_ERROR_CHECK_ALLOC(res_dp);
+
+	res_dp[res_sz] = '\0';
+
+	if (git_delta_reader_read(&reader, res_dp, res_sz) != (ssize_t)res_sz ||
+	    reader.delta != reader.delta_end) {
+		git__free(res_dp);
+		git_error_set(GIT_ERROR_INVALID, "failed to apply delta");
+		return -1;
+	}
+
+	*out = res_dp;
+	*out_len = res_sz;
+	return 0;
 }
@@ -107,6 +107,53 @@ extern int git_delta_apply(
 	const unsigned char *delta,
 	size_t delta_len);
 
+/**
+ * A delta that is applied a piece at a time, so that the result can be
+ * read without holding all of it in memory.  The base and the delta
+ * must stay valid while the reader is in use.
+ */
+typedef struct {
+	const unsigned char *base;
+	size_t base_len;
+	const unsigned char *delta;
+	const unsigned char *delta_end;
+	size_t res_remain;
+
+	/* what is left of the current instruction's data */
+	const unsigned char *pending;
+	size_t pending_len;
+} git_delta_reader;
+
+/**
+ * Prepare to apply a git binary delta incrementally.
+ *
+ * @param reader the reader to initialize.
+ * @param res_len pointer to store the size of the result.
+ * @param base the base to copy from during copy instructions.
+ * @param base_len number of bytes available at base.
+ * @param delta the delta to execute copy/insert instructions from.
+ * @param delta_len total number of bytes in the delta.
+ * @return 0 on success or an error code
+ */
+extern int git_delta_reader_init(
+	git_delta_reader *reader,
+	size_t *res_len,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len);
+
+/**
+ * Apply the delta to produce up to `len` more bytes of the result.
+ *
+ * @return the number of bytes written to `buffer`, which is less than
+ *         `len` only at the end of the result, or an error code
+ */
+extern ssize_t git_delta_reader_read(
+	git_delta_reader *reader,
+	void *buffer,
+	size_t len);
+
 /**
 * Read the header of a git binary delta.
 *
@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "delta_islands.h"
+
+#include "git2/commit.h"
+#include "git2/config.h"
+#include "git2/refs.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+#include "git2/tree.h"
+
+#include "array.h"
+#include "hashmap_str.h"
+#include "pool.h"
+#include "regexp.h"
+#include "repository.h"
+
+/* The number of groups that are used to name an island */
+#define ISLAND_MAX_MATCHES 16
+
+GIT_HASHMAP_OID_FUNCTIONS(git_packbuilder_pobjectmap, GIT_HASHMAP_INLINE, git_pobject *);
+
+typedef git_array_t(git_regexp) island_regexp_array;
+typedef git_array_t(git_oid) island_oid_array;
+
+struct island {
+	char *name;
+	island_oid_array tips;
+};
+
+static int add_regexp(const git_config_entry *entry, void *payload)
+{
+	island_regexp_array *regexps = payload;
+	git_regexp *regexp = git_array_alloc(*regexps);
+
+	GIT_ERROR_CHECK_ALLOC(regexp);
+
+	if (git_regexp_compile(regexp, entry->value, 0) < 0) {
+		git_array_pop(*regexps);
+		git_error_set(GIT_ERROR_CONFIG,
+			"invalid regular expression in pack.island: '%s'", entry->value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int load_regexps(island_regexp_array *out, git_repository *repo)
+{
+	git_config *config;
+	int error;
+
+	if ((error = git_repository_config_snapshot(&config, repo)) < 0)
+		return error;
+
+	error = git_config_get_multivar_foreach(config,
+		"pack.island", NULL, add_regexp, out);
+
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+	git_config_free(config);
+	return error;
+}
+
+/*
+ * Name the island of the reference after the groups that are captured by
+ * the last expression that matches it, as git does.
+ */
+static int island_name(
+	git_str *out,
+	const char *refname,
+	island_regexp_array *regexps)
+{
+	git_regmatch matches[ISLAND_MAX_MATCHES];
+	size_t i = git_array_size(*regexps), m;
+
+	while (i > 0 && git_regexp_search(git_array_get(*regexps, i - 1),
+			refname, ISLAND_MAX_MATCHES, matches) != 0)
+		i--;
+
+	if (i == 0)
+		return GIT_ENOTFOUND;
+
+	git_str_clear(out);
+
+	for (m = 1; m < ISLAND_MAX_MATCHES; m++) {
+		if (matches[m].start < 0)
+			continue;
+
+		if (out->size)
+			git_str_putc(out, '-');
+
+		git_str_put(out, refname + matches[m].start,
+			matches[m].end - matches[m].start);
+	}
+
+	return git_str_oom(out) ? -1 : 0;
+}
+
+static int collect_islands(
+	git_vector *islands,
+	git_repository *repo,
+	island_regexp_array *regexps)
+{
+	git_hashmap_str names = GIT_HASHMAP_INIT;
+	git_reference_iterator *iter = NULL;
+	git_str name = GIT_STR_INIT;
+	struct island *island;
+	const char *refname;
+	git_oid id, *tip;
+	void *value;
+	int error;
+
+	if ((error = git_reference_iterator_new(&iter, repo)) < 0)
+		goto done;
+
+	while ((error = git_reference_next_name(&refname, iter)) == 0) {
+		if ((error = island_name(&name, refname, regexps)) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			goto done;
+
+		/* Symbolic references may point to unborn branches */
+		if ((error = git_reference_name_to_id(&id, repo, refname)) == GIT_ENOTFOUND) {
+			git_error_clear();
+			continue;
+		} else if (error < 0) {
+			goto done;
+		}
+
+		if (git_hashmap_str_get(&value, &names, name.ptr) == 0) {
+			island = value;
+		} else {
+			if ((island = git__calloc(1, sizeof(struct island))) == NULL ||
+			    (island->name = git__strdup(name.ptr)) == NULL ||
+			    git_vector_insert(islands, island) < 0) {
+				if (island)
+					git__free(island->name);
+				git__free(island);
+				error = -1;
+				goto done;
+			}
+
+			if ((error = git_hashmap_str_put(&names, island->name, island)) < 0)
+				goto done;
+		}
+
+		if ((tip = git_array_alloc(island->tips)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(tip, &id);
+	}
+
+	if (error == GIT_ITEROVER) {
+		git_error_clear();
+		error = 0;
+	}
+
+done:
+	git_reference_iterator_free(iter);
+	git_hashmap_str_dispose(&names);
+	git_str_dispose(&name);
+	return error;
+}
+
+/* The islands that an object in the history of the islands belongs to */
+struct island_object {
+	git_oid id;
+	bool queued;
+	uint64_t bits[GIT_FLEX_ARRAY];
+};
+
+typedef git_array_t(struct island_object *) island_object_array;
+
+GIT_HASHMAP_OID_SETUP(git_delta_islands_objectmap, struct island_object *);
+
+struct island_walk {
+	git_delta_islands *islands;
+	git_delta_islands_objectmap objects;
+	git_pool pool;
+
+	/* The tags and trees whose islands are to be given to their targets */
+	island_object_array queue;
+	size_t queue_pos;
+
+	git_revwalk *commits;
+};
+
+static void mark_object(
+	git_delta_islands *islands,
+	const git_oid *id,
+	const uint64_t *bits)
+{
+	git_pobject *po;
+	uint64_t *marks;
+	size_t i;
+
+	/* Only the objects that go into the pack need to be marked */
+	if (git_packbuilder_pobjectmap_get(&po, &islands->pb->object_ix, id) != 0)
+		return;
+
+	marks = islands->marks + (po - islands->pb->object_list) * islands->words;
+
+	for (i = 0; i < islands->words; i++)
+		marks[i] |= bits[i];
+}
+
+/*
+ * Add the islands in `bits` to those of the object; `grew` tells whether
+ * the object gained any island that it was not already known to be in.
+ */
+static int propagate(
+	struct island_object **out,
+	bool *grew,
+	struct island_walk *walk,
+	const git_oid *id,
+	const uint64_t *bits)
+{
+	struct island_object *obj;
+	uint64_t added = 0;
+	size_t i;
+	int error;
+
+	if (git_delta_islands_objectmap_get(&obj, &walk->objects, id) != 0) {
+		obj = git_pool_mallocz(&walk->pool, 1);
+		GIT_ERROR_CHECK_ALLOC(obj);
+
+		git_oid_cpy(&obj->id, id);
+
+		if ((error = git_delta_islands_objectmap_put(&walk->objects, &obj->id, obj)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < walk->islands->words; i++) {
+		added |= bits[i] & ~obj->bits[i];
+		obj->bits[i] |= bits[i];
+	}
+
+	*out = obj;
+	*grew = (added != 0);
+	return 0;
+}
+
+/* Queue the object to give its islands to its targets, unless it is already */
+static int propagate_and_queue(
+	struct island_walk *walk,
+	const git_oid *id,
+	const uint64_t *bits)
+{
+	struct island_object *obj, **entry;
+	bool grew;
+	int error;
+
+	if ((error = propagate(&obj, &grew, walk, id, bits)) < 0)
+		return error;
+
+	if (!grew || obj->queued)
+		return 0;
+
+	entry = git_array_alloc(walk->queue);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	*entry = obj;
+	obj->queued = true;
+	return 0;
+}
+
+static int process_tree(
+	struct island_walk *walk,
+	struct island_object *obj,
+	git_tree *tree)
+{
+	const git_tree_entry *entry;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; !error && i < git_tree_entrycount(tree); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+
+		/* Blobs have no references, so are neither looked up nor kept */
+		if (git_tree_entry_type(entry) == GIT_OBJECT_TREE)
+			error = propagate_and_queue(walk, git_tree_entry_id(entry), obj->bits);
+		else if (git_tree_entry_type(entry) == GIT_OBJECT_BLOB)
+			mark_object(walk->islands, git_tree_entry_id(entry), obj->bits);
+	}
+
+	return error;
+}
+
+/*
+ * Give the islands of the queued tags and trees to their targets; an
+ * object is only queued again when it gains an island, so that history
+ * shared by many islands is walked once for all of them.  Commits are
+ * left to the revision walk, which sees all of their children first.
+ */
+static int process_queue(struct island_walk *walk)
+{
+	struct island_object *obj;
+	git_object *target;
+	int error = 0;
+
+	while (!error && walk->queue_pos < git_array_size(walk->queue)) {
+		obj = walk->queue.ptr[walk->queue_pos++];
+		obj->queued = false;
+
+		mark_object(walk->islands, &obj->id, obj->bits);
+
+		if ((error = git_object_lookup(&target, walk->islands->pb->repo,
+				&obj->id, GIT_OBJECT_ANY)) < 0)
+			break;
+
+		switch (git_object_type(target)) {
+		case GIT_OBJECT_COMMIT:
+			error = git_revwalk_push(walk->commits, &obj->id);
+			break;
+		case GIT_OBJECT_TREE:
+			error = process_tree(walk, obj, (git_tree *)target);
+			break;
+		case GIT_OBJECT_TAG:
+			error = propagate_and_queue(walk,
+				git_tag_target_id((git_tag *)target), obj->bits);
+			break;
+		default:
+			break;
+		}
+
+		git_object_free(target);
+	}
+
+	git_array_clear(walk->queue);
+	walk->queue_pos = 0;
+	return error;
+}
+
+/*
+ * Walk the commits from the children to the parents, so that a commit
+ * has all of its islands by the time that it gives them to its parents
+ * and its tree.
+ */
+static int process_commits(struct island_walk *walk)
+{
+	struct island_object *obj, *parent;
+	git_commit *commit;
+	git_oid id;
+	size_t i;
+	bool grew;
+	int error;
+
+	while ((error = git_revwalk_next(&id, walk->commits)) == 0) {
+		if (git_delta_islands_objectmap_get(&obj, &walk->objects, &id) != 0)
+			continue;
+
+		mark_object(walk->islands, &id, obj->bits);
+
+		if ((error = git_commit_lookup(&commit, walk->islands->pb->repo, &id)) < 0)
+			return error;
+
+		error = propagate_and_queue(walk, git_commit_tree_id(commit), obj->bits);
+
+		for (i = 0; !error && i < git_commit_parentcount(commit); i++)
+			error = propagate(&parent, &grew, walk,
+				git_commit_parent_id(commit, i), obj->bits);
+
+		git_commit_free(commit);
+
+		if (error < 0)
+			return error;
+	}
+
+	if (error == GIT_ITEROVER) {
+		git_error_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+/*
+ * Find the islands of the objects with a single walk from the tips of all
+ * of the islands, as git does: every tip starts with its own island, and
+ * the islands are given from tags to their targets, from commits to their
+ * parents and trees, and from trees to their entries.
+ */
+static int mark_islands(git_delta_islands *islands, git_vector *tips)
+{
+	struct island_walk walk = { 0 };
+	struct island *island;
+	uint64_t *bits = NULL;
+	size_t i, j, item_len;
+	int error;
+
+	walk.islands = islands;
+
+	if (GIT_MULTIPLY_SIZET_OVERFLOW(&item_len, islands->words, sizeof(uint64_t)) ||
+	    GIT_ADD_SIZET_OVERFLOW(&item_len, item_len, sizeof(struct island_object))) {
+		git_error_set_oom();
+		return -1;
+	}
+
+	if ((error = git_pool_init(&walk.pool, item_len)) < 0 ||
+	    (error = git_revwalk_new(&walk.commits, islands->pb->repo)) < 0)
+		goto done;
+
+	git_revwalk_sorting(walk.commits, GIT_SORT_TOPOLOGICAL);
+
+	if ((bits = git__calloc(islands->words, sizeof(uint64_t))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(tips, i, island) {
+		memset(bits, 0, islands->words * sizeof(uint64_t));
+		bits[i / 64] = (uint64_t)1 << (i % 64);
+
+		for (j = 0; !error && j < git_array_size(island->tips); j++)
+			error = propagate_and_queue(&walk,
+				git_array_get(island->tips, j), bits);
+
+		if (error < 0)
+			goto done;
+	}
+
+	if ((error = process_queue(&walk)) == 0 &&
+	    (error = process_commits(&walk)) == 0)
+		error = process_queue(&walk);
+
+done:
+	git__free(bits);
+	git_revwalk_free(walk.commits);
+	git_array_clear(walk.queue);
+	git_delta_islands_objectmap_dispose(&walk.objects);
+	git_pool_clear(&walk.pool);
+	return error;
+}
+
+int git_delta_islands_new(git_delta_islands **out, git_packbuilder *pb)
+{
+	island_regexp_array regexps = GIT_ARRAY_INIT;
+	git_vector islands = GIT_VECTOR_INIT;
+	git_delta_islands *di = NULL;
+	struct island *island;
+	size_t i, marks_len;
+	int error;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(pb);
+
+	*out = NULL;
+
+	if ((error = load_regexps(&regexps, pb->repo)) < 0 ||
+	    !git_array_size(regexps))
+		goto done;
+
+	/* When no reference is in an island, there are no constraints */
+	if ((error = collect_islands(&islands, pb->repo, &regexps)) < 0 ||
+	    !islands.length)
+		goto done;
+
+	if ((di = git__calloc(1, sizeof(git_delta_islands))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	di->pb = pb;
+	di->nr_islands = islands.length;
+	di->words = (islands.length + 63) / 64;
+
+	if (GIT_MULTIPLY_SIZET_OVERFLOW(&marks_len, pb->nr_objects, di->words) ||
+	    (di->marks = git__calloc(marks_len, sizeof(uint64_t))) == NULL) {
+		git_error_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	if ((error = mark_islands(di, &islands)) < 0)
+		goto done;
+
+	*out = di;
+	di = NULL;
+
+done:
+	git_vector_foreach(&islands, i, island) {
+		git__free(island->name);
+		git_array_clear(island->tips);
+		git__free(island);
+	}
+
+	for (i = 0; i < git_array_size(regexps); i++)
+		git_regexp_dispose(git_array_get(regexps, i));
+
+	git_vector_dispose(&islands);
+	git_array_clear(regexps);
+	git_delta_islands_free(di);
+	return error;
+}
+
+void git_delta_islands_free(git_delta_islands *islands)
+{
+	if (!islands)
+		return;
+
+	git__free(islands->marks);
+	git__free(islands);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_delta_islands_h__
+#define INCLUDE_delta_islands_h__
+
+#include "common.h"
+
+#include "pack-objects.h"
+
+/*
+ * Delta islands, as configured with `pack.island`, restrict which objects
+ * may be stored as deltas against each other.
+ *
+ * Each `pack.island` value is a regular expression that is matched
+ * against the names of the references; the references whose names match
+ * are grouped into islands named after the captured groups, joined with
+ * dashes, of the last expression that matches.  An object belongs to
+ * every island with a reference that it is reachable from, and may only
+ * be stored as a delta against a base that is in all of its islands, so
+ * that a pack for any one island never needs a base from another one.
+ */
+typedef struct git_delta_islands {
+	git_packbuilder *pb;
+
+	size_t nr_islands;
+
+	/* The islands of each object in the packbuilder, as a bit set. */
+	size_t words;
+	uint64_t *marks;
+} git_delta_islands;
+
+/*
+ * Find the islands of the objects in the packbuilder. When no islands
+ * are configured, `out` is set to NULL.
+ */
+int git_delta_islands_new(git_delta_islands **out, git_packbuilder *pb);
+
+/* Whether `trg` may be stored as a delta against `base`. */
+GIT_INLINE(bool) git_delta_islands_allow(
+	const git_delta_islands *islands,
+	const git_pobject *trg,
+	const git_pobject *base)
+{
+	const uint64_t *trg_marks, *base_marks;
+	size_t i;
+
+	trg_marks = islands->marks + (trg - islands->pb->object_list) * islands->words;
+	base_marks = islands->marks + (base - islands->pb->object_list) * islands->words;
+
+	for (i = 0; i < islands->words; i++) {
+		if (trg_marks[i] & ~base_marks[i])
+			return false;
+	}
+
+	return true;
+}
+
+void git_delta_islands_free(git_delta_islands *islands);
+
+#endif
@@ -193,7 +193,7 @@ int git_graph_reachable_from_any(
 	git_commit_list *result = NULL;
 	git_commit_list_node *commit;
 	size_t i;
-	uint32_t minimum_generation = 0xffffffff;
+	uint64_t minimum_generation = UINT64_MAX;
 	int error = 0;
 
 	if (!length)
@@ -217,6 +217,9 @@ int git_graph_reachable_from_any(
 			goto done;
 		}
 
+		if ((error = git_commit_list_parse(walk, commit)) < 0)
+			goto done;
+
 		git_vector_insert(&list, commit);
 		if (minimum_generation > commit->generation)
 			minimum_generation = commit->generation;
@@ -228,6 +231,9 @@ int git_graph_reachable_from_any(
 		goto done;
 	}
 
+	if ((error = git_commit_list_parse(walk, commit)) < 0)
+		goto done;
+
 	if (minimum_generation > commit->generation)
 		minimum_generation = commit->generation;
 
@@ -23,6 +23,7 @@
 #include "zstream.h"
 #include "object.h"
 #include "hashmap_oid.h"
+#include "thread.h"
 
 #define UINT31_MAX (0x7FFFFFFF)
 
@@ -38,13 +39,37 @@ struct entry {
 	uint64_t offset_long;
 };
 
+/*
+ * A thread that resolves deltas while the pack is still being received.
+ * It only runs while the indexer is waiting for more data: the indexer
+ * takes the lock for each call to `git_indexer_append`.
+ */
+struct delta_streamer {
+	git_thread thread;
+	git_mutex lock;
+	git_cond cond;
+	bool running;
+	bool done;
+
+	/* Set while the indexer is waiting for the lock. */
+	git_atomic32 waiting;
+
+	/* The position of the next delta to try, and how many were resolved. */
+	size_t next;
+	size_t resolved;
+
+	int error;
+	git_error *error_info;
+};
+
 struct git_indexer {
 	unsigned int parsed_header :1,
 		pack_committed :1,
 		have_stream :1,
 		have_delta :1,
 		do_fsync :1,
-		do_verify :1;
+		do_verify :1,
+		do_stream_deltas :1;
 	git_oid_t oid_type;
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
@@ -65,6 +90,12 @@ struct git_indexer {
 	void *progress_payload;
 	char objbuf[8*1024];
 
+	/* The number of threads to resolve deltas with, or 0 for one per CPU. */
+	unsigned int threads;
+
+	/* Resolves deltas while we are waiting for the rest of the pack. */
+	struct delta_streamer streamer;
+
 	/* OIDs referenced from pack objects. Used for verification. */
 	git_indexer_oidmap expected_oids;
 
@@ -79,6 +110,29 @@ struct git_indexer {
 
 struct delta_info {
 	off64_t delta_off;
+	off64_t delta_end;
+
+	/*
+	 * Set by the delta resolver once the object has been unpacked: its ID,
+	 * the CRC of its entry and, when verifying, the objects it references.
+	 */
+	bool resolved;
+	git_oid id;
+	uint32_t crc;
+	git_array_oid_t references;
+};
+
+/* The state shared by the threads that resolve the deltas. */
+struct delta_resolver {
+	git_indexer *idx;
+
+	/* The position of the next delta to resolve. */
+	git_atomic32 next;
+
+	/* The first error that any of the workers ran into. */
+	git_mutex lock;
+	int error;
+	git_error *error_info;
 };
 
 #ifndef GIT_DEPRECATE_HARD
@@ -189,6 +243,8 @@ static int indexer_new(
 		goto cleanup;
 
 	idx->do_verify = opts.verify;
+	idx->threads = opts.threads;
+	idx->do_stream_deltas = !!opts.stream_deltas;
 
 	if (git_repository__fsync_gitdir)
 		idx->do_fsync = 1;
@@ -258,6 +314,7 @@ static int store_delta(git_indexer *idx)
 	delta = git__calloc(1, sizeof(struct delta_info));
 	GIT_ERROR_CHECK_ALLOC(delta);
 	delta->delta_off = idx->entry_start;
+	delta->delta_end = idx->off;
 
 	if (git_vector_insert(&idx->deltas, delta) < 0)
 		return -1;
@@ -381,10 +438,25 @@ static int add_expected_oid(git_indexer *idx, const git_oid *oid)
 	return 0;
 }
 
-static int check_object_connectivity(git_indexer *idx, const git_rawobj *obj)
+static int add_reference(git_array_oid_t *references, const git_oid *oid)
+{
+	git_oid *reference = git_array_alloc(*references);
+	GIT_ERROR_CHECK_ALLOC(reference);
+
+	git_oid_cpy(reference, oid);
+	return 0;
+}
+
+/*
+ * Parse the object and collect the IDs of the objects that it references.
+ * This does not touch the indexer, so that it can run on any thread.
+ */
+static int object_references(
+	git_array_oid_t *references,
+	git_oid_t oid_type,
+	const git_rawobj *obj)
 {
 	git_object *object;
-	git_oid *expected;
 	int error = 0;
 
 	if (obj->type != GIT_OBJECT_BLOB &&
@@ -393,27 +465,14 @@ static int check_object_connectivity(git_indexer *idx, const git_rawobj *obj)
 	    obj->type != GIT_OBJECT_TAG)
 		return 0;
 
-	if (git_object__from_raw(&object, obj->data, obj->len, obj->type, idx->oid_type) < 0) {
+	if (git_object__from_raw(&object, obj->data, obj->len, obj->type, oid_type) < 0) {
 		/*
 		 * parse_raw returns EINVALID on invalid data; downgrade
 		 * that to a normal -1 error code.
 		 */
-		error = -1;
-		goto out;
-	}
-
-	if (git_indexer_oidmap_get(&expected, &idx->expected_oids, &object->cached.oid) == 0) {
-		git_indexer_oidmap_remove(&idx->expected_oids, &object->cached.oid);
-		git__free(expected);
+		return -1;
 	}
 
-	/*
-	 * Check whether this is a known object. If so, we can just continue as
-	 * we assume that the ODB has a complete graph.
-	 */
-	if (idx->odb && git_odb_exists(idx->odb, &object->cached.oid))
-		return 0;
-
 	switch (obj->type) {
 		case GIT_OBJECT_TREE:
 		{
@@ -422,7 +481,7 @@ static int check_object_connectivity(git_indexer *idx, const git_rawobj *obj)
 			size_t i;
 
 			git_array_foreach(tree->entries, i, entry)
-				if (add_expected_oid(idx, &entry->oid) < 0)
+				if ((error = add_reference(references, &entry->oid)) < 0)
 					goto out;
 
 			break;
@@ -434,21 +493,17 @@ static int check_object_connectivity(git_indexer *idx, const git_rawobj *obj)
 			size_t i;
 
 			git_array_foreach(commit->parent_ids, i, parent_oid)
-				if (add_expected_oid(idx, parent_oid) < 0)
+				if ((error = add_reference(references, parent_oid)) < 0)
 					goto out;
 
-			if (add_expected_oid(idx, &commit->tree_id) < 0)
-				goto out;
-
+			error = add_reference(references, &commit->tree_id);
 			break;
 		}
 		case GIT_OBJECT_TAG:
 		{
 			git_tag *tag = (git_tag *) object;
 
-			if (add_expected_oid(idx, &tag->target) < 0)
-				goto out;
-
+			error = add_reference(references, &tag->target);
 			break;
 		}
 		case GIT_OBJECT_BLOB:
@@ -462,6 +517,56 @@ out:
 	return error;
 }
 
+/*
+ * Record that the object is no longer expected, and that the objects it
+ * references are, unless we know about them already.
+ */
+static int add_object_references(
+	git_indexer *idx,
+	const git_oid *id,
+	const git_array_oid_t *references)
+{
+	git_oid *expected;
+	size_t i;
+
+	if (git_indexer_oidmap_get(&expected, &idx->expected_oids, id) == 0) {
+		git_indexer_oidmap_remove(&idx->expected_oids, id);
+		git__free(expected);
+	}
+
+	/*
+	 * Check whether this is a known object. If so, we can just continue as
+	 * we assume that the ODB has a complete graph.
+	 */
+	if (idx->odb && git_odb_exists(idx->odb, id))
+		return 0;
+
+	for (i = 0; i < git_array_size(*references); i++) {
+		if (add_expected_oid(idx, git_array_get(*references, i)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int check_object_connectivity(git_indexer *idx, const git_rawobj *obj)
+{
+	git_object_id_options id_opts = GIT_OBJECT_ID_OPTIONS_INIT;
+	git_array_oid_t references = GIT_ARRAY_INIT;
+	git_oid id;
+	int error;
+
+	id_opts.object_type = obj->type;
+	id_opts.oid_type = idx->oid_type;
+
+	if ((error = object_references(&references, idx->oid_type, obj)) == 0 &&
+	    (error = git_object_id_from_buffer(&id, obj->data, obj->len, &id_opts)) == 0)
+		error = add_object_references(idx, &id, &references);
+
+	git_array_clear(references);
+	return error;
+}
+
 static int store_object(git_indexer *idx)
 {
 	int i, error;
@@ -582,45 +687,6 @@ static int save_entry(git_indexer *idx, struct entry *entry, struct git_pack_ent
 	return 0;
 }
 
-static int hash_and_save(git_indexer *idx, git_rawobj *obj, off64_t entry_start)
-{
-	git_object_id_options id_opts = GIT_OBJECT_ID_OPTIONS_INIT;
-	git_oid oid;
-	size_t entry_size;
-	struct entry *entry;
-	struct git_pack_entry *pentry = NULL;
-
-	entry = git__calloc(1, sizeof(*entry));
-	GIT_ERROR_CHECK_ALLOC(entry);
-
-	id_opts.object_type = obj->type;
-	id_opts.oid_type = idx->oid_type;
-
-	if (git_object_id_from_buffer(&oid, obj->data, obj->len, &id_opts) < 0) {
-		git_error_set(GIT_ERROR_INDEXER, "failed to hash object");
-		goto on_error;
-	}
-
-	pentry = git__calloc(1, sizeof(struct git_pack_entry));
-	GIT_ERROR_CHECK_ALLOC(pentry);
-
-	git_oid_cpy(&pentry->id, &oid);
-	git_oid_cpy(&entry->oid, &oid);
-	entry->crc = crc32(0L, Z_NULL, 0);
-
-	entry_size = (size_t)(idx->off - entry_start);
-	if (crc_object(&entry->crc, &idx->pack->mwf, entry_start, entry_size) < 0)
-		goto on_error;
-
-	return save_entry(idx, entry, pentry, entry_start);
-
-on_error:
-	git__free(pentry);
-	git__free(entry);
-	git__free(obj->data);
-	return -1;
-}
-
 static int do_progress_callback(git_indexer *idx, git_indexer_progress *stats)
 {
 	if (idx->progress_cb)
@@ -867,16 +933,12 @@ static int read_stream_object(git_indexer *idx, git_indexer_progress *stats)
 	return 0;
 }
 
-int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
+static int indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
 {
 	int error = -1;
 	struct git_pack_header *hdr = &idx->hdr;
 	git_mwindow_file *mwf = &idx->pack->mwf;
 
-	GIT_ASSERT_ARG(idx);
-	GIT_ASSERT_ARG(data);
-	GIT_ASSERT_ARG(stats);
-
 	if ((error = append_to_pack(idx, data, size)) < 0)
 		return error;
 
@@ -1117,49 +1179,229 @@ static int fix_thin_pack(git_indexer *idx, git_indexer_progress *stats)
 	return 0;
 }
 
+static void delta_resolver_fail(struct delta_resolver *resolver, int error)
+{
+	if (git_mutex_lock(&resolver->lock) < 0)
+		return;
+
+	if (!resolver->error) {
+		resolver->error = error;
+		git_error_save(&resolver->error_info);
+	}
+
+	git_mutex_unlock(&resolver->lock);
+}
+
+/*
+ * Unpack the delta, and compute everything that we need to save it.  This
+ * only reads from the indexer, so that several deltas can be resolved at
+ * the same time.  The delta is left unresolved if its base is not known yet.
+ */
+static int delta_resolve(git_indexer *idx, struct delta_info *delta)
+{
+	git_object_id_options id_opts = GIT_OBJECT_ID_OPTIONS_INIT;
+	git_rawobj obj = {0};
+	off64_t off = delta->delta_off;
+	int error;
+
+	if ((error = git_packfile_unpack(&obj, idx->pack, &off)) < 0) {
+		/* We have not seen the base object, we'll try again later. */
+		return (error == GIT_PASSTHROUGH) ? 0 : -1;
+	}
+
+	id_opts.object_type = obj.type;
+	id_opts.oid_type = idx->oid_type;
+
+	if (git_object_id_from_buffer(&delta->id, obj.data, obj.len, &id_opts) < 0)
+		goto done;
+
+	if (idx->do_verify &&
+	    object_references(&delta->references, idx->oid_type, &obj) < 0) {
+		/* TODO: error? continue? */
+		git_array_clear(delta->references);
+		goto done;
+	}
+
+	/*
+	 * The offset is not advanced when the object is found in the pack's
+	 * cache of delta bases, so use the end that we recorded when the
+	 * delta was received.
+	 */
+	if ((error = crc_object(&delta->crc, &idx->pack->mwf,
+			delta->delta_off, delta->delta_end - delta->delta_off)) < 0)
+		goto done;
+
+	delta->resolved = true;
+
+done:
+	git__free(obj.data);
+	return error;
+}
+
+/*
+ * Resolve deltas until there are none left.  Each of the workers takes the
+ * next delta that nobody has taken yet.
+ */
+static void *deltas_resolve(void *payload)
+{
+	struct delta_resolver *resolver = payload;
+	struct delta_info *delta;
+	size_t len = git_vector_length(&resolver->idx->deltas);
+	int32_t pos;
+	int error;
+
+	while (!resolver->error &&
+	       (pos = git_atomic32_inc(&resolver->next) - 1) >= 0 &&
+	       (size_t)pos < len) {
+		delta = git_vector_get(&resolver->idx->deltas, (size_t)pos);
+
+		if (!delta)
+			continue;
+
+		if ((error = delta_resolve(resolver->idx, delta)) < 0) {
+			delta_resolver_fail(resolver, error);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int resolve_deltas_parallel(
+	struct delta_resolver *resolver,
+	git_indexer *idx)
+{
+	size_t threads;
+
+	resolver->idx = idx;
+	git_atomic32_set(&resolver->next, 0);
+
+	threads = idx->threads ? idx->threads : (size_t)git__online_cpus();
+	threads = min(threads, git_vector_length(&idx->deltas));
+
+#ifdef GIT_THREADS
+	if (threads > 1) {
+		git_thread *workers = git__calloc(threads, sizeof(git_thread));
+		size_t started = 0, i;
+
+		GIT_ERROR_CHECK_ALLOC(workers);
+
+		for (i = 0; i < threads; i++) {
+			if (git_thread_create(&workers[i], deltas_resolve, resolver) != 0) {
+				git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+				delta_resolver_fail(resolver, -1);
+				break;
+			}
+
+			started++;
+		}
+
+		for (i = 0; i < started; i++)
+			git_thread_join(&workers[i], NULL);
+
+		git__free(workers);
+	} else
+#endif
+	{
+		deltas_resolve(resolver);
+	}
+
+	if (resolver->error) {
+		git_error_restore(resolver->error_info);
+		resolver->error_info = NULL;
+		return resolver->error;
+	}
+
+	return 0;
+}
+
+static int save_resolved_delta(git_indexer *idx, struct delta_info *delta)
+{
+	struct entry *entry;
+	struct git_pack_entry *pentry;
+
+	if (idx->do_verify &&
+	    add_object_references(idx, &delta->id, &delta->references) < 0)
+		return -1;
+
+	entry = git__calloc(1, sizeof(*entry));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	pentry = git__calloc(1, sizeof(struct git_pack_entry));
+	GIT_ERROR_CHECK_ALLOC(pentry);
+
+	git_oid_cpy(&pentry->id, &delta->id);
+	git_oid_cpy(&entry->oid, &delta->id);
+	entry->crc = delta->crc;
+
+	if (save_entry(idx, entry, pentry, delta->delta_off) < 0) {
+		git__free(pentry);
+		git__free(entry);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void delta_info_free(struct delta_info *delta)
+{
+	if (!delta)
+		return;
+
+	git_array_clear(delta->references);
+	git__free(delta);
+}
+
+/*
+ * Resolve the deltas in rounds.  In each round, all of the deltas whose base
+ * is known are unpacked and hashed in parallel, after which the results are
+ * saved in order; the bases that this makes known are used in the next round.
+ */
 static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 {
+	struct delta_resolver resolver = {0};
 	unsigned int i;
-	int error;
+	int error = 0;
 	struct delta_info *delta;
-	int progressed = 0, non_null = 0, progress_cb_result;
+	int progressed = 0, non_null = 0;
+
+	if (git_mutex_init(&resolver.lock) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to initialize delta resolver lock");
+		return -1;
+	}
 
 	while (idx->deltas.length > 0) {
 		progressed = 0;
 		non_null = 0;
-		git_vector_foreach(&idx->deltas, i, delta) {
-			git_rawobj obj = {0};
 
+		if ((error = resolve_deltas_parallel(&resolver, idx)) < 0)
+			goto done;
+
+		git_vector_foreach(&idx->deltas, i, delta) {
 			if (!delta)
 				continue;
 
 			non_null = 1;
-			idx->off = delta->delta_off;
-			if ((error = git_packfile_unpack(&obj, idx->pack, &idx->off)) < 0) {
-				if (error == GIT_PASSTHROUGH) {
-					/* We have not seen the base object, we'll try again later. */
-					continue;
-				}
-				return -1;
-			}
 
-			if (idx->do_verify && check_object_connectivity(idx, &obj) < 0)
-				/* TODO: error? continue? */
+			if (!delta->resolved)
 				continue;
 
-			if (hash_and_save(idx, &obj, delta->delta_off) < 0)
+			delta->resolved = false;
+
+			if (save_resolved_delta(idx, delta) < 0) {
+				git_array_clear(delta->references);
 				continue;
+			}
 
-			git__free(obj.data);
 			stats->indexed_objects++;
 			stats->indexed_deltas++;
 			progressed = 1;
-			if ((progress_cb_result = do_progress_callback(idx, stats)) < 0)
-				return progress_cb_result;
+			if ((error = do_progress_callback(idx, stats)) < 0)
+				goto done;
 
 			/* remove from the list */
 			git_vector_set(NULL, &idx->deltas, i, NULL);
-			git__free(delta);
+			delta_info_free(delta);
 		}
 
 		/* if none were actually set, we're done */
@@ -1167,13 +1409,191 @@ static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 			break;
 
 		if (!progressed && (fix_thin_pack(idx, stats) < 0)) {
-			return -1;
+			error = -1;
+			goto done;
 		}
 	}
 
+done:
+	git_mutex_free(&resolver.lock);
+	return error;
+}
+
+static void *deltas_stream_resolve(void *payload)
+{
+	git_indexer *idx = payload;
+	struct delta_streamer *streamer = &idx->streamer;
+	struct delta_info *delta;
+	int error = 0;
+
+	if (git_mutex_lock(&streamer->lock) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock delta streamer");
+		streamer->error = -1;
+		git_error_save(&streamer->error_info);
+		return NULL;
+	}
+
+	while (!streamer->done) {
+		/*
+		 * Wait for more deltas, and let the indexer append the data
+		 * that it has received as soon as it asks for the lock.
+		 */
+		if (git_atomic32_get(&streamer->waiting) ||
+		    streamer->next >= git_vector_length(&idx->deltas)) {
+			git_cond_wait(&streamer->cond, &streamer->lock);
+			continue;
+		}
+
+		delta = git_vector_get(&idx->deltas, streamer->next++);
+
+		/*
+		 * The deltas whose base we have not received yet are left
+		 * for `git_indexer_commit`.
+		 */
+		if (!delta)
+			continue;
+
+		if ((error = delta_resolve(idx, delta)) < 0)
+			break;
+
+		if (!delta->resolved)
+			continue;
+
+		delta->resolved = false;
+
+		if (save_resolved_delta(idx, delta) < 0) {
+			git_array_clear(delta->references);
+			continue;
+		}
+
+		streamer->resolved++;
+
+		git_vector_set(NULL, &idx->deltas, streamer->next - 1, NULL);
+		delta_info_free(delta);
+	}
+
+	if (error < 0) {
+		streamer->error = error;
+		git_error_save(&streamer->error_info);
+	}
+
+	git_mutex_unlock(&streamer->lock);
+	return NULL;
+}
+
+static int delta_streamer_start(git_indexer *idx)
+{
+#ifdef GIT_THREADS
+	struct delta_streamer *streamer = &idx->streamer;
+
+	if (git_mutex_init(&streamer->lock) < 0 ||
+	    git_cond_init(&streamer->cond) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to initialize delta streamer");
+		return -1;
+	}
+
+	if (git_thread_create(&streamer->thread, deltas_stream_resolve, idx) != 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+		git_cond_free(&streamer->cond);
+		git_mutex_free(&streamer->lock);
+		return -1;
+	}
+
+	streamer->running = true;
+#else
+	GIT_UNUSED(idx);
+#endif
+
+	return 0;
+}
+
+/*
+ * Stop the delta streamer, returning the error that it ran into, if any.
+ * The deltas that it did not resolve are left in place.
+ */
+static int delta_streamer_stop(git_indexer *idx)
+{
+	struct delta_streamer *streamer = &idx->streamer;
+	int error = 0;
+
+	if (!streamer->running)
+		return 0;
+
+	if (git_mutex_lock(&streamer->lock) == 0) {
+		streamer->done = true;
+		git_cond_signal(&streamer->cond);
+		git_mutex_unlock(&streamer->lock);
+	}
+
+	git_thread_join(&streamer->thread, NULL);
+	git_cond_free(&streamer->cond);
+	git_mutex_free(&streamer->lock);
+	streamer->running = false;
+
+	if (streamer->error) {
+		error = streamer->error;
+		git_error_restore(streamer->error_info);
+		streamer->error_info = NULL;
+	}
+
+	return error;
+}
+
+/* Take the indexer back from the delta streamer. */
+static int delta_streamer_pause(git_indexer *idx)
+{
+	struct delta_streamer *streamer = &idx->streamer;
+
+	git_atomic32_set(&streamer->waiting, 1);
+
+	if (git_mutex_lock(&streamer->lock) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock delta streamer");
+		return -1;
+	}
+
+	git_atomic32_set(&streamer->waiting, 0);
+
+	if (streamer->error) {
+		git_mutex_unlock(&streamer->lock);
+		return delta_streamer_stop(idx);
+	}
+
 	return 0;
 }
 
+static void delta_streamer_resume(git_indexer *idx)
+{
+	git_cond_signal(&idx->streamer.cond);
+	git_mutex_unlock(&idx->streamer.lock);
+}
+
+int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
+{
+	int error;
+
+	GIT_ASSERT_ARG(idx);
+	GIT_ASSERT_ARG(data);
+	GIT_ASSERT_ARG(stats);
+
+	if (!idx->streamer.running) {
+		error = indexer_append(idx, data, size, stats);
+
+		if (!error && idx->do_stream_deltas && idx->parsed_header &&
+		    !idx->streamer.done)
+			error = delta_streamer_start(idx);
+
+		return error;
+	}
+
+	if ((error = delta_streamer_pause(idx)) < 0)
+		return error;
+
+	error = indexer_append(idx, data, size, stats);
+
+	delta_streamer_resume(idx);
+	return error;
+}
+
 static int update_header_and_rehash(git_indexer *idx, git_indexer_progress *stats)
 {
 	void *ptr;
@@ -1237,6 +1657,9 @@ int git_indexer_commit(git_indexer *idx, git_indexer_progress *stats)
 		return -1;
 	}
 
+	if ((error = delta_streamer_stop(idx)) < 0)
+		return error;
+
 	checksum_size = git_hash_size(indexer_hash_algorithm(idx));
 	filebuf_hash = git_filebuf_hash_flags(indexer_hash_algorithm(idx));
 	GIT_ASSERT(checksum_size);
@@ -1270,6 +1693,11 @@ int git_indexer_commit(git_indexer *idx, git_indexer_progress *stats)
 	/* Freeze the number of deltas */
 	stats->total_deltas = stats->total_objects - stats->indexed_objects;
 
+	/* Count the deltas that were resolved while receiving the pack */
+	stats->indexed_objects += (unsigned int)idx->streamer.resolved;
+	stats->indexed_deltas += (unsigned int)idx->streamer.resolved;
+	idx->streamer.resolved = 0;
+
 	if ((error = resolve_deltas(idx, stats)) < 0)
 		return error;
 
@@ -1438,12 +1866,17 @@ on_error:
 void git_indexer_free(git_indexer *idx)
 {
 	struct git_pack_entry *pentry;
+	struct delta_info *delta;
 	git_oid *id;
 	git_hashmap_iter_t iter = GIT_HASHMAP_ITER_INIT;
+	size_t i;
 
 	if (idx == NULL)
 		return;
 
+	if (delta_streamer_stop(idx) < 0)
+		git_error_clear();
+
 	if (idx->have_stream)
 		git_packfile_stream_dispose(&idx->stream);
 
@@ -1454,7 +1887,10 @@ void git_indexer_free(git_indexer *idx)
 
 	git_pack_oidmap_dispose(&idx->pack->idx_cache);
 
-	git_vector_dispose_deep(&idx->deltas);
+	git_vector_foreach(&idx->deltas, i, delta)
+		delta_info_free(delta);
+
+	git_vector_dispose(&idx->deltas);
 
 	git_packfile_free(idx->pack, !idx->pack_committed);
 
@@ -15,6 +15,7 @@
 #include "pool.h"
 #include "mwindow.h"
 #include "oid.h"
+#include "pack.h"
 #include "rand.h"
 #include "refdb_reftable.h"
 #include "runtime.h"
@@ -53,6 +54,7 @@ int git_libgit2_init(void)
 		git_openssl_stream_global_init,
 		git_mbedtls_stream_global_init,
 		git_mwindow_global_init,
+		git_pack_cache_global_init,
 		git_pool_global_init,
 		git_settings_global_init,
 		git_reftable_global_init
@@ -380,7 +380,7 @@ static int paint_down_to_common(
 		git_revwalk *walk,
 		git_commit_list_node *one,
 		git_vector *twos,
-		uint32_t minimum_generation)
+		uint64_t minimum_generation)
 {
 	git_pqueue list;
 	git_commit_list *result = NULL;
@@ -428,12 +428,14 @@ static int paint_down_to_common(
 			git_commit_list_node *p = commit->parents[i];
 			if ((p->flags & flags) == flags)
 				continue;
-			if (p->generation < minimum_generation)
-				continue;
 
 			if ((error = git_commit_list_parse(walk, p)) < 0)
 				return error;
 
+			/* Commits below the minimum generation cannot reach any of the inputs. */
+			if (p->generation && p->generation < minimum_generation)
+				continue;
+
 			p->flags |= flags;
 			if (git_pqueue_insert(&list, p) < 0)
 				return -1;
@@ -445,8 +447,9 @@ static int paint_down_to_common(
 	return 0;
 }
 
-static int remove_redundant(git_revwalk *walk, git_vector *commits, uint32_t minimum_generation)
+static int remove_redundant(git_revwalk *walk, git_vector *commits, uint64_t minimum_generation)
 {
+	uint64_t commits_generation = UINT64_MAX;
 	git_vector work = GIT_VECTOR_INIT;
 	unsigned char *redundant;
 	unsigned int *filled_index;
@@ -459,10 +462,22 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits, uint32_t min
 	GIT_ERROR_CHECK_ALLOC(filled_index);
 
 	for (i = 0; i < commits->length; ++i) {
-		if ((error = git_commit_list_parse(walk, commits->contents[i])) < 0)
+		git_commit_list_node *commit = commits->contents[i];
+
+		if ((error = git_commit_list_parse(walk, commit)) < 0)
 			goto done;
+
+		if (commits_generation > commit->generation)
+			commits_generation = commit->generation;
 	}
 
+	/*
+	 * Each walk only needs to tell whether the commits reach one another,
+	 * so it can stop at the lowest generation among them.
+	 */
+	if (minimum_generation < commits_generation)
+		minimum_generation = commits_generation;
+
 	for (i = 0; i < commits->length; ++i) {
 		git_commit_list *common = NULL;
 		git_commit_list_node *commit = commits->contents[i];
@@ -518,7 +533,7 @@ int git_merge__bases_many(
 		git_revwalk *walk,
 		git_commit_list_node *one,
 		git_vector *twos,
-		uint32_t minimum_generation)
+		uint64_t minimum_generation)
 {
 	int error;
 	unsigned int i;
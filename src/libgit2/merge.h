@@ -117,7 +117,7 @@ int git_merge__bases_many(
 	git_revwalk *walk,
 	git_commit_list_node *one,
 	git_vector *twos,
-	uint32_t minimum_generation);
+	uint64_t minimum_generation);
 
 /*
  * Three-way tree differencing
@@ -35,6 +35,7 @@ struct git_midx_header {
 #define MIDX_OID_LOOKUP_ID 0x4f49444c	   /* "OIDL" */
 #define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646	   /* "OOFF" */
 #define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+#define MIDX_REVERSE_INDEX_ID 0x52494458	   /* "RIDX" */
 
 struct git_midx_chunk {
 	off64_t offset;
@@ -161,6 +162,21 @@ static int midx_parse_object_large_offsets(
 	return 0;
 }
 
+static int midx_parse_reverse_index(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_reverse_index)
+{
+	if (chunk_reverse_index->offset == 0)
+		return 0;
+	if (chunk_reverse_index->length != idx->num_objects * 4)
+		return midx_error("Reverse Index chunk has wrong length");
+
+	idx->reverse_index = data + chunk_reverse_index->offset;
+
+	return 0;
+}
+
 int git_midx_parse(
 		git_midx_file *idx,
 		const unsigned char *data,
@@ -178,6 +194,7 @@ int git_midx_parse(
 					 chunk_oid_lookup = {0},
 					 chunk_object_offsets = {0},
 					 chunk_object_large_offsets = {0},
+					 chunk_reverse_index = {0},
 					 chunk_unknown = {0};
 
 	GIT_ASSERT_ARG(idx);
@@ -256,6 +273,11 @@ int git_midx_parse(
 			last_chunk = &chunk_object_large_offsets;
 			break;
 
+		case MIDX_REVERSE_INDEX_ID:
+			chunk_reverse_index.offset = last_chunk_offset;
+			last_chunk = &chunk_reverse_index;
+			break;
+
 		default:
 			chunk_unknown.offset = last_chunk_offset;
 			last_chunk = &chunk_unknown;
@@ -278,6 +300,9 @@ int git_midx_parse(
 	if (error < 0)
 		return error;
 	error = midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets);
+	if (error < 0)
+		return error;
+	error = midx_parse_reverse_index(idx, data, &chunk_reverse_index);
 	if (error < 0)
 		return error;
 
@@ -377,17 +402,54 @@ bool git_midx_needs_refresh(
 	return (memcmp(checksum, idx->checksum, checksum_size) != 0);
 }
 
+/*
+ * Read where the object at the given position of the index is stored.
+ * Returns GIT_ENOTFOUND if its offset is out of bounds.
+ */
+static int midx_object_offset(
+		off64_t *offset_out,
+		size_t *pack_index_out,
+		git_midx_file *idx,
+		size_t pos)
+{
+	const unsigned char *object_offset;
+	off64_t offset;
+	size_t pack_index;
+
+	object_offset = idx->object_offsets + pos * 8;
+	offset = ntohl(*((uint32_t *)(object_offset + 4)));
+	if (idx->object_large_offsets && offset & 0x80000000) {
+		uint32_t object_large_offsets_pos = (uint32_t) (offset ^ 0x80000000);
+		const unsigned char *object_large_offsets_index = idx->object_large_offsets;
+
+		/* Make sure we're not being sent out of bounds */
+		if (object_large_offsets_pos >= idx->num_object_large_offsets)
+			return GIT_ENOTFOUND;
+
+		object_large_offsets_index += 8 * object_large_offsets_pos;
+
+		offset = (((uint64_t)ntohl(*((uint32_t *)(object_large_offsets_index + 0)))) << 32) |
+				ntohl(*((uint32_t *)(object_large_offsets_index + 4)));
+	}
+	pack_index = ntohl(*((uint32_t *)(object_offset + 0)));
+	if (pack_index >= git_vector_length(&idx->packfile_names))
+		return midx_error("invalid index into the packfile names table");
+
+	*offset_out = offset;
+	*pack_index_out = pack_index;
+	return 0;
+}
+
 int git_midx_entry_find(
 		git_midx_entry *e,
 		git_midx_file *idx,
 		const git_oid *short_oid,
 		size_t len)
 {
-	int pos, found = 0;
+	int pos, found = 0, error;
 	size_t pack_index, oid_size, oid_hexsize;
 	uint32_t hi, lo;
 	unsigned char *current = NULL;
-	const unsigned char *object_offset;
 	off64_t offset;
 
 	GIT_ASSERT_ARG(idx);
@@ -429,34 +491,91 @@ int git_midx_entry_find(
 	if (found > 1)
 		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
 
-	object_offset = idx->object_offsets + pos * 8;
-	offset = ntohl(*((uint32_t *)(object_offset + 4)));
-	if (idx->object_large_offsets && offset & 0x80000000) {
-		uint32_t object_large_offsets_pos = (uint32_t) (offset ^ 0x80000000);
-		const unsigned char *object_large_offsets_index = idx->object_large_offsets;
-
-		/* Make sure we're not being sent out of bounds */
-		if (object_large_offsets_pos >= idx->num_object_large_offsets)
+	if ((error = midx_object_offset(&offset, &pack_index, idx, pos)) < 0) {
+		if (error == GIT_ENOTFOUND)
 			return git_odb__error_notfound("invalid index into the object large offsets table", short_oid, len);
 
-		object_large_offsets_index += 8 * object_large_offsets_pos;
-
-		offset = (((uint64_t)ntohl(*((uint32_t *)(object_large_offsets_index + 0)))) << 32) |
-				ntohl(*((uint32_t *)(object_large_offsets_index + 4)));
+		return error;
 	}
-	pack_index = ntohl(*((uint32_t *)(object_offset + 0)));
-	if (pack_index >= git_vector_length(&idx->packfile_names))
-		return midx_error("invalid index into the packfile names table");
+
 	e->pack_index = pack_index;
 	e->offset = offset;
 	git_oid_from_raw(&e->sha1, current, idx->oid_type);
 	return 0;
 }
 
+int git_midx_entry_find_many(
+		struct git_pack_entry *entries,
+		size_t count,
+		git_midx_file *idx,
+		const git_vector *packs)
+{
+	size_t oid_size, pack_index, i;
+	uint32_t hi, lo, cursor = 0;
+	off64_t offset;
+	int pos, error;
+
+	GIT_ASSERT_ARG(idx);
+
+	oid_size = git_oid_size(idx->oid_type);
+
+	for (i = 0; i < count; i++) {
+		struct git_pack_entry *e = &entries[i];
+
+		if (e->p)
+			continue;
+
+		hi = ntohl(idx->oid_fanout[(int)e->id.id[0]]);
+		lo = ((e->id.id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)e->id.id[0] - 1]));
+
+		/* The IDs are sorted, so this one cannot come before the last */
+		lo = max(lo, cursor);
+
+		if (lo >= hi)
+			continue;
+
+		pos = git_pack__lookup_id(idx->oid_lookup, oid_size, lo, hi, e->id.id, idx->oid_type);
+
+		if (pos < 0) {
+			cursor = (uint32_t)(-1 - pos);
+			continue;
+		}
+
+		cursor = (uint32_t)pos;
+
+		if ((error = midx_object_offset(&offset, &pack_index, idx, pos)) < 0) {
+			if (error == GIT_ENOTFOUND)
+				continue;
+
+			return error;
+		}
+
+		if (pack_index >= git_vector_length(packs))
+			continue;
+
+		e->offset = offset;
+		e->p = git_vector_get(packs, pack_index);
+	}
+
+	return 0;
+}
+
 int git_midx_foreach_entry(
 		git_midx_file *idx,
 		git_odb_foreach_cb cb,
 		void *data)
+{
+	GIT_ASSERT_ARG(idx);
+
+	return git_midx_foreach_entry_range(idx, 0, idx->num_objects, cb, data);
+}
+
+int git_midx_foreach_entry_range(
+		git_midx_file *idx,
+		size_t start,
+		size_t end,
+		git_odb_foreach_cb cb,
+		void *data)
 {
 	git_oid oid;
 	size_t oid_size, i;
@@ -465,8 +584,9 @@ int git_midx_foreach_entry(
 	GIT_ASSERT_ARG(idx);
 
 	oid_size = git_oid_size(idx->oid_type);
+	end = min(end, (size_t)idx->num_objects);
 
-	for (i = 0; i < idx->num_objects; ++i) {
+	for (i = start; i < end; ++i) {
 		if ((error = git_oid_from_raw(&oid, &idx->oid_lookup[i * oid_size], idx->oid_type)) < 0)
 			return error;
 
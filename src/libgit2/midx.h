@@ -51,6 +51,13 @@ typedef struct git_midx_file {
 	/* The number of entries in the Object Large Offsets table. Each entry has an 8-byte with an offset */
 	size_t num_object_large_offsets;
 
+	/*
+	 * The (optional) Reverse Index table: the midx position of each
+	 * object, sorted by its pseudo-pack order.  This is the order in
+	 * which objects are numbered in a multi-pack reachability bitmap.
+	 */
+	const unsigned char *reverse_index;
+
 	/*
 	 * The trailer of the file. Contains the checksum of the whole
 	 * file, in the repository's object format hash.
@@ -67,6 +74,8 @@ typedef struct git_midx_file {
 /*
  * An entry in the multi-pack-index file. Similar in purpose to git_pack_entry.
  */
+struct git_pack_entry;
+
 typedef struct git_midx_entry {
 	/* The index within idx->packfile_names where the packfile name can be found. */
 	size_t pack_index;
@@ -105,10 +114,32 @@ int git_midx_entry_find(
 		git_midx_file *idx,
 		const git_oid *short_oid,
 		size_t len);
+
+/*
+ * Look up the objects of the given entries, whose IDs must be sorted, in a
+ * single pass over the index. The entries that are found, and were not
+ * found before, are pointed at their offset in one of the given packs,
+ * which are in the order of the index's packfile names.
+ */
+int git_midx_entry_find_many(
+		struct git_pack_entry *entries,
+		size_t count,
+		git_midx_file *idx,
+		const git_vector *packs);
 int git_midx_foreach_entry(
 		git_midx_file *idx,
 		git_odb_foreach_cb cb,
 		void *data);
+/*
+ * Call the callback for the objects from position `start` up to `end` in
+ * the multi-pack-index, in the order of their IDs.
+ */
+int git_midx_foreach_entry_range(
+		git_midx_file *idx,
+		size_t start,
+		size_t end,
+		git_odb_foreach_cb cb,
+		void *data);
 int git_midx_close(git_midx_file *idx);
 void git_midx_free(git_midx_file *idx);
 
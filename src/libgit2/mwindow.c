@@ -27,11 +27,15 @@
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
 size_t git_mwindow__file_limit = DEFAULT_FILE_LIMIT;
+bool git_mwindow__full_map = false;
 
-/* Mutex to control access to `git_mwindow__mem_ctl` and `git_mwindow__pack_cache`. */
+/* Mutex to control access to `git_mwindow__pack_cache`. */
 git_mutex git_mwindow__mutex;
 
-/* Whenever you want to read or modify this, grab `git_mwindow__mutex` */
+/*
+ * The counters are atomic; the windows and files of each shard are
+ * protected by the lock of that shard.
+ */
 git_mwindow_ctl git_mwindow__mem_ctl;
 
 /* Global list of mwindow files, to open packs once across repos */
@@ -40,17 +44,30 @@ git_mwindow_packmap git_mwindow__pack_cache;
 
 static void git_mwindow_global_shutdown(void)
 {
+	size_t i;
+
+	for (i = 0; i < GIT_MWINDOW_SHARDS; i++)
+		git_mutex_free(&git_mwindow__mem_ctl.shards[i].lock);
+
 	git_mutex_free(&git_mwindow__mutex);
 	git_mwindow_packmap_dispose(&git_mwindow__pack_cache);
 }
 
 int git_mwindow_global_init(void)
 {
+	size_t i;
 	int error;
 
 	if ((error = git_mutex_init(&git_mwindow__mutex)) < 0)
 	    return error;
 
+	for (i = 0; i < GIT_MWINDOW_SHARDS; i++) {
+		if ((error = git_mutex_init(&git_mwindow__mem_ctl.shards[i].lock)) < 0) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize mwindow mutex");
+			return error;
+		}
+	}
+
 	return git_runtime_shutdown_register(git_mwindow_global_shutdown);
 }
 
@@ -125,59 +142,187 @@ int git_mwindow_put_pack(struct git_pack_file *pack)
 	return 0;
 }
 
+GIT_INLINE(git_mwindow_shard *) mwindow_shard(git_mwindow_file *mwf)
+{
+	/* Files are separate allocations, so their addresses spread well. */
+	uintptr_t key = (uintptr_t)mwf >> 6;
+
+	return &git_mwindow__mem_ctl.shards[(key ^ (key >> 8)) % GIT_MWINDOW_SHARDS];
+}
+
+GIT_INLINE(size_t) mwindow_next_used(void)
+{
+	return (size_t)git_atomic_ssize_add(&git_mwindow__mem_ctl.used_ctr, 1);
+}
+
+/* Run with the shard lock held */
+static void window_lru_unlink(git_mwindow_shard *shard, git_mwindow *w)
+{
+	if (w->lru_prev)
+		w->lru_prev->lru_next = w->lru_next;
+	else
+		shard->lru_head = w->lru_next;
+
+	if (w->lru_next)
+		w->lru_next->lru_prev = w->lru_prev;
+	else
+		shard->lru_tail = w->lru_prev;
+
+	w->lru_prev = w->lru_next = NULL;
+}
+
+/* Run with the shard lock held */
+static void window_lru_append(git_mwindow_shard *shard, git_mwindow *w)
+{
+	w->lru_next = NULL;
+	w->lru_prev = shard->lru_tail;
+
+	if (shard->lru_tail)
+		shard->lru_tail->lru_next = w;
+	else
+		shard->lru_head = w;
+
+	shard->lru_tail = w;
+}
+
 /*
- * Free all the windows in a sequence, typically because we're done
- * with the file. Needs to hold the git_mwindow__mutex.
+ * Keep a file in the list of unused files exactly when it may be closed
+ * to honour the file limit: it is registered and has windows, none of
+ * which are in use. Run with the shard lock held.
  */
-static int git_mwindow_free_all_locked(git_mwindow_file *mwf)
+static void file_lru_update_locked(git_mwindow_shard *shard, git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
-	size_t i;
+	bool unused = mwf->registered && mwf->windows && !mwf->inuse_windows &&
+	              !mwf->full_window;
+
+	if (unused && !mwf->in_lru) {
+		mwf->last_used = mwindow_next_used();
+		mwf->lru_next = NULL;
+		mwf->lru_prev = shard->lru_file_tail;
+
+		if (shard->lru_file_tail)
+			shard->lru_file_tail->lru_next = mwf;
+		else
+			shard->lru_file_head = mwf;
+
+		shard->lru_file_tail = mwf;
+		mwf->in_lru = 1;
+	} else if (!unused && mwf->in_lru) {
+		if (mwf->lru_prev)
+			mwf->lru_prev->lru_next = mwf->lru_next;
+		else
+			shard->lru_file_head = mwf->lru_next;
+
+		if (mwf->lru_next)
+			mwf->lru_next->lru_prev = mwf->lru_prev;
+		else
+			shard->lru_file_tail = mwf->lru_prev;
+
+		mwf->lru_prev = mwf->lru_next = NULL;
+		mwf->in_lru = 0;
+	}
+}
 
-	/*
-	 * Remove these windows from the global list
-	 */
-	for (i = 0; i < ctl->windowfiles.length; ++i){
-		if (git_vector_get(&ctl->windowfiles, i) == mwf) {
-			git_vector_remove(&ctl->windowfiles, i);
-			break;
-		}
+/* Start using a window. Run with the shard lock held. */
+static void window_acquire_locked(git_mwindow_shard *shard, git_mwindow *w)
+{
+	if (w->inuse_cnt++ == 0) {
+		window_lru_unlink(shard, w);
+
+		if (w->mwf->inuse_windows++ == 0)
+			file_lru_update_locked(shard, w->mwf);
+	}
+}
+
+/* Stop using a window. Run with the shard lock held. */
+static void window_release_locked(git_mwindow_shard *shard, git_mwindow *w)
+{
+	if (--w->inuse_cnt == 0) {
+		w->last_used = mwindow_next_used();
+		window_lru_append(shard, w);
+
+		if (--w->mwf->inuse_windows == 0)
+			file_lru_update_locked(shard, w->mwf);
 	}
+}
+
+/* Unmap windows that have been removed from their file. */
+static void windows_free(git_mwindow *w)
+{
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+	git_mwindow *next;
+
+	for (; w; w = next) {
+		next = w->next;
 
-	if (ctl->windowfiles.length == 0) {
-		git_vector_dispose(&ctl->windowfiles);
-		ctl->windowfiles.contents = NULL;
+		if (!w->full)
+			git_atomic_ssize_add(&ctl->mapped, -(ssize_t)w->window_map.len);
+		git_atomic32_dec(&ctl->open_windows);
+
+		git_futils_mmap_free(&w->window_map);
+		git__free(w);
 	}
+}
 
-	while (mwf->windows) {
-		git_mwindow *w = mwf->windows;
+/* Run with the shard lock held */
+static void file_deregister_locked(git_mwindow_shard *shard, git_mwindow_file *mwf)
+{
+	if (!mwf->registered)
+		return;
+
+	mwf->registered = 0;
+	git_atomic32_dec(&git_mwindow__mem_ctl.open_files);
+	file_lru_update_locked(shard, mwf);
+}
+
+/*
+ * Remove all the windows of a file, typically because we're done with the
+ * file, and return them to be freed once the lock is released. Run with
+ * the shard lock held.
+ */
+static int git_mwindow_free_all_locked(
+	git_mwindow **out,
+	git_mwindow_shard *shard,
+	git_mwindow_file *mwf)
+{
+	git_mwindow *w;
+
+	for (w = mwf->windows; w; w = w->next)
 		GIT_ASSERT(w->inuse_cnt == 0);
 
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
+	for (w = mwf->windows; w; w = w->next)
+		window_lru_unlink(shard, w);
 
-		git_futils_mmap_free(&w->window_map);
+	*out = mwf->windows;
+	mwf->windows = NULL;
 
-		mwf->windows = w->next;
-		git__free(w);
+	if ((w = git_atomic_swap(mwf->full_window, NULL)) != NULL) {
+		w->next = *out;
+		*out = w;
 	}
 
+	/* Remove the file from the registered files */
+	file_deregister_locked(shard, mwf);
+
 	return 0;
 }
 
 int git_mwindow_free_all(git_mwindow_file *mwf)
 {
+	git_mwindow_shard *shard = mwindow_shard(mwf);
+	git_mwindow *windows = NULL;
 	int error;
 
-	if (git_mutex_lock(&git_mwindow__mutex)) {
+	if (git_mutex_lock(&shard->lock)) {
 		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
 		return -1;
 	}
 
-	error = git_mwindow_free_all_locked(mwf);
+	error = git_mwindow_free_all_locked(&windows, shard, mwf);
 
-	git_mutex_unlock(&git_mwindow__mutex);
+	git_mutex_unlock(&shard->lock);
 
+	windows_free(windows);
 	return error;
 }
 
@@ -194,80 +339,67 @@ int git_mwindow_contains(git_mwindow *win, off64_t offset, off64_t extra)
 		&& (offset + extra) <= (off64_t)(win_off + win->window_map.len);
 }
 
-#define GIT_MWINDOW__LRU -1
-#define GIT_MWINDOW__MRU 1
-
 /*
- * Find the least- or most-recently-used window in a file that is not currently
- * being used. The 'only_unused' flag controls whether the caller requires the
- * file to only have unused windows. If '*out_window' is non-null, it is used as
- * a starting point for the comparison.
- *
- * Returns whether such a window was found in the file.
+ * Find the shard whose least recently used window or file is the oldest
+ * one. Only the heads of the lists need to be compared, so this does not
+ * depend on the number of open windows and files.
  */
-static bool git_mwindow_scan_recently_used(
-		git_mwindow_file *mwf,
-		git_mwindow **out_window,
-		git_mwindow **out_last,
-		bool only_unused,
-		int comparison_sign)
+static git_mwindow_shard *find_lru_shard(bool files)
 {
-	git_mwindow *w, *w_last;
-	git_mwindow *lru_window = NULL, *lru_last = NULL;
-	bool found = false;
-
-	GIT_ASSERT_ARG(mwf);
-	GIT_ASSERT_ARG(out_window);
-
-	lru_window = *out_window;
-	if (out_last)
-		lru_last = *out_last;
-
-	for (w_last = NULL, w = mwf->windows; w; w_last = w, w = w->next) {
-		if (w->inuse_cnt) {
-			if (only_unused)
-				return false;
-			/* This window is currently being used. Skip it. */
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+	git_mwindow_shard *lru_shard = NULL;
+	size_t i, lru_used = 0, last_used;
+
+	for (i = 0; i < GIT_MWINDOW_SHARDS; i++) {
+		git_mwindow_shard *shard = &ctl->shards[i];
+		bool found = false;
+
+		if (git_mutex_lock(&shard->lock))
 			continue;
-		}
 
-		/*
-		 * If the current one is more (or less) recent than the last one,
-		 * store it in the output parameter. If lru_window is NULL,
-		 * it's the first loop, so store it as well.
-		 */
-		if (!lru_window || (comparison_sign * w->last_used) > lru_window->last_used) {
-			lru_window = w;
-			lru_last = w_last;
+		if (files && shard->lru_file_head) {
+			last_used = shard->lru_file_head->last_used;
+			found = true;
+		} else if (!files && shard->lru_head) {
+			last_used = shard->lru_head->last_used;
 			found = true;
 		}
-	}
 
-	if (!found)
-		return false;
+		git_mutex_unlock(&shard->lock);
+
+		if (found && (!lru_shard || last_used < lru_used)) {
+			lru_shard = shard;
+			lru_used = last_used;
+		}
+	}
 
-	*out_window = lru_window;
-	if (out_last)
-		*out_last = lru_last;
-	return true;
+	return lru_shard;
 }
 
 /*
- * Close the least recently used window (that is currently not being used) out
- * of all the files. Called under lock from new_window_locked.
+ * Close the least recently used window (that is currently not being used)
+ * out of all the files. Must be called without any shard lock held.
  */
-static int git_mwindow_close_lru_window_locked(void)
+static int git_mwindow_close_lru_window(void)
 {
-	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
-	git_mwindow_file *cur;
-	size_t i;
-	git_mwindow *lru_window = NULL, *lru_last = NULL, **list = NULL;
+	git_mwindow_shard *shard;
+	git_mwindow *lru_window = NULL, **list;
+
+	if ((shard = find_lru_shard(false)) != NULL &&
+	    git_mutex_lock(&shard->lock) == 0) {
+		/* The head may have changed since, but it is just as old. */
+		if ((lru_window = shard->lru_head) != NULL) {
+			window_lru_unlink(shard, lru_window);
 
-	git_vector_foreach(&ctl->windowfiles, i, cur) {
-		if (git_mwindow_scan_recently_used(
-				cur, &lru_window, &lru_last, false, GIT_MWINDOW__LRU)) {
-			list = &cur->windows;
+			for (list = &lru_window->mwf->windows; *list != lru_window; list = &(*list)->next)
+				/* nop */;
+			*list = lru_window->next;
+			lru_window->next = NULL;
+
+			file_lru_update_locked(shard, lru_window->mwf);
 		}
+
+		git_mutex_unlock(&shard->lock);
 	}
 
 	if (!lru_window) {
@@ -275,44 +407,28 @@ static int git_mwindow_close_lru_window_locked(void)
 		return -1;
 	}
 
-	ctl->mapped -= lru_window->window_map.len;
-	git_futils_mmap_free(&lru_window->window_map);
-
-	if (lru_last)
-		lru_last->next = lru_window->next;
-	else
-		*list = lru_window->next;
-
-	git__free(lru_window);
-	ctl->open_windows--;
-
+	windows_free(lru_window);
 	return 0;
 }
 
 /*
- * Finds the file that does not have any open windows AND whose
- * most-recently-used window is the least-recently used one across all
- * currently open files.
- *
- * Called under lock from new_window_locked.
+ * Close the windows of the file that does not have any windows in use AND
+ * whose most-recently-used window is the least-recently used one across
+ * all currently open files. Must be called without any shard lock held.
  */
-static int git_mwindow_find_lru_file_locked(git_mwindow_file **out)
+static int git_mwindow_close_lru_file(git_mwindow_file **out)
 {
-	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
-	git_mwindow_file *lru_file = NULL, *current_file = NULL;
-	git_mwindow *lru_window = NULL;
-	size_t i;
+	git_mwindow_shard *shard;
+	git_mwindow_file *lru_file = NULL;
+	git_mwindow *windows = NULL;
 
-	git_vector_foreach(&ctl->windowfiles, i, current_file) {
-		git_mwindow *mru_window = NULL;
-		if (!git_mwindow_scan_recently_used(
-				current_file, &mru_window, NULL, true, GIT_MWINDOW__MRU)) {
-			continue;
-		}
-		if (!lru_window || lru_window->last_used > mru_window->last_used) {
-			lru_window = mru_window;
-			lru_file = current_file;
-		}
+	if ((shard = find_lru_shard(true)) != NULL &&
+	    git_mutex_lock(&shard->lock) == 0) {
+		if ((lru_file = shard->lru_file_head) != NULL &&
+		    git_mwindow_free_all_locked(&windows, shard, lru_file) < 0)
+			lru_file = NULL;
+
+		git_mutex_unlock(&shard->lock);
 	}
 
 	if (!lru_file) {
@@ -320,15 +436,18 @@ static int git_mwindow_find_lru_file_locked(git_mwindow_file **out)
 		return -1;
 	}
 
+	windows_free(windows);
+
 	*out = lru_file;
 	return 0;
 }
 
-/* This gets called under lock from git_mwindow_open */
-static git_mwindow *new_window_locked(
-	git_file fd,
-	off64_t size,
-	off64_t offset)
+/*
+ * Map a new window, closing the least recently used ones until we have
+ * enough space. This is called without any lock held, so that other files
+ * can be read while the window is mapped.
+ */
+static git_mwindow *new_window(git_mwindow_file *mwf, off64_t offset)
 {
 	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t walign = git_mwindow__window_size / 2;
@@ -340,16 +459,17 @@ static git_mwindow *new_window_locked(
 	if (w == NULL)
 		return NULL;
 
+	w->mwf = mwf;
 	w->offset = (offset / walign) * walign;
 
-	len = size - w->offset;
+	len = mwf->size - w->offset;
 	if (len > (off64_t)git_mwindow__window_size)
 		len = (off64_t)git_mwindow__window_size;
 
-	ctl->mapped += (size_t)len;
+	git_atomic_ssize_add(&ctl->mapped, (ssize_t)len);
 
-	while (git_mwindow__mapped_limit < ctl->mapped &&
-			git_mwindow_close_lru_window_locked() == 0) /* nop */;
+	while (git_mwindow__mapped_limit < (size_t)git_atomic_ssize_get(&ctl->mapped) &&
+			git_mwindow_close_lru_window() == 0) /* nop */;
 
 	/*
 	 * We treat `mapped_limit` as a soft limit. If we can't find a
@@ -357,29 +477,77 @@ static git_mwindow *new_window_locked(
 	 * window.
 	 */
 
-	if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
+	if (git_futils_mmap_ro(&w->window_map, mwf->fd, w->offset, (size_t)len) < 0) {
 		/*
 		 * The first error might be down to memory fragmentation even if
 		 * we're below our soft limits, so free up what we can and try again.
 		 */
 
-		while (git_mwindow_close_lru_window_locked() == 0)
+		while (git_mwindow_close_lru_window() == 0)
 			/* nop */;
 
-		if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
+		if (git_futils_mmap_ro(&w->window_map, mwf->fd, w->offset, (size_t)len) < 0) {
+			git_atomic_ssize_add(&ctl->mapped, -(ssize_t)len);
 			git__free(w);
 			return NULL;
 		}
 	}
 
-	ctl->mmap_calls++;
-	ctl->open_windows++;
+	git_atomic32_inc(&ctl->mmap_calls);
+	git_atomic32_inc(&ctl->open_windows);
+
+	return w;
+}
+
+/*
+ * Map the whole file once, to be shared by all its readers. Returns NULL,
+ * and lets the caller fall back to windows, if that is not possible.
+ */
+static git_mwindow *full_window(git_mwindow_file *mwf, git_mwindow_shard *shard)
+{
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+	git_mwindow *w, *existing;
+
+	if ((w = git_atomic_load(mwf->full_window)) != NULL)
+		return w;
+
+	if (!git_mwindow__full_map || !mwf->read_only ||
+	    sizeof(void *) < 8 || mwf->size <= 0)
+		return NULL;
+
+	if ((w = git__calloc(1, sizeof(*w))) == NULL)
+		return NULL;
+
+	w->mwf = mwf;
+	w->full = true;
+
+	if (git_futils_mmap_ro(&w->window_map, mwf->fd, 0, (size_t)mwf->size) < 0) {
+		git_error_clear();
+		git__free(w);
+		return NULL;
+	}
+
+	git_atomic32_inc(&ctl->mmap_calls);
+	git_atomic32_inc(&ctl->open_windows);
+
+	if (git_mutex_lock(&shard->lock)) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
+		windows_free(w);
+		return NULL;
+	}
+
+	/* Another reader may have mapped the file in the meantime. */
+	if ((existing = mwf->full_window) == NULL) {
+		git_atomic_swap(mwf->full_window, w);
+		file_lru_update_locked(shard, mwf);
+	}
 
-	if (ctl->mapped > ctl->peak_mapped)
-		ctl->peak_mapped = ctl->mapped;
+	git_mutex_unlock(&shard->lock);
 
-	if (ctl->open_windows > ctl->peak_open_windows)
-		ctl->peak_open_windows = ctl->open_windows;
+	if (existing) {
+		windows_free(w);
+		w = existing;
+	}
 
 	return w;
 }
@@ -395,17 +563,29 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
-	git_mwindow *w = *cursor;
-
-	if (git_mutex_lock(&git_mwindow__mutex)) {
-		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-		return NULL;
+	git_mwindow_shard *shard = mwindow_shard(mwf);
+	git_mwindow *w = *cursor, *full;
+
+	/* A file that is mapped in full needs no bookkeeping, nor a lock. */
+	if ((!w || !(git_mwindow_contains(w, offset, extra))) &&
+	    (full = full_window(mwf, shard)) != NULL) {
+		git_mwindow_close(cursor);
+		*cursor = w = full;
 	}
 
+	/*
+	 * The window in the cursor is in use, so it cannot be closed under
+	 * us and can be read again without taking any lock.
+	 */
 	if (!w || !(git_mwindow_contains(w, offset, extra))) {
+		if (git_mutex_lock(&shard->lock)) {
+			git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
+			return NULL;
+		}
+
 		if (w) {
-			w->inuse_cnt--;
+			window_release_locked(shard, w);
+			*cursor = NULL;
 		}
 
 		for (w = mwf->windows; w; w = w->next) {
@@ -413,34 +593,43 @@ unsigned char *git_mwindow_open(
 				break;
 		}
 
+		if (w)
+			window_acquire_locked(shard, w);
+
+		git_mutex_unlock(&shard->lock);
+
 		/*
 		 * If there isn't a suitable window, we need to create a new
 		 * one.
 		 */
 		if (!w) {
-			w = new_window_locked(mwf->fd, mwf->size, offset);
-			if (w == NULL) {
-				git_mutex_unlock(&git_mwindow__mutex);
+			if ((w = new_window(mwf, offset)) == NULL)
+				return NULL;
+
+			if (git_mutex_lock(&shard->lock)) {
+				git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
+				windows_free(w);
 				return NULL;
 			}
+
 			w->next = mwf->windows;
 			mwf->windows = w;
+
+			w->inuse_cnt = 1;
+			if (mwf->inuse_windows++ == 0)
+				file_lru_update_locked(shard, mwf);
+
+			git_mutex_unlock(&shard->lock);
 		}
-	}
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
 		*cursor = w;
 	}
 
 	offset -= w->offset;
 
 	if (left)
-		*left = (unsigned int)(w->window_map.len - offset);
+		*left = (unsigned int)min(w->window_map.len - (size_t)offset, UINT_MAX);
 
-	git_mutex_unlock(&git_mwindow__mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
@@ -448,49 +637,45 @@ int git_mwindow_file_register(git_mwindow_file *mwf)
 {
 	git_vector closed_files = GIT_VECTOR_INIT;
 	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
-	int error;
+	git_mwindow_shard *shard = mwindow_shard(mwf);
+	int error = 0;
 	size_t i;
 	git_mwindow_file *closed_file = NULL;
 
-	if (git_mutex_lock(&git_mwindow__mutex)) {
-		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-		return -1;
-	}
-
-	if (ctl->windowfiles.length == 0 &&
-	    (error = git_vector_init(&ctl->windowfiles, 8, NULL)) < 0) {
-		git_mutex_unlock(&git_mwindow__mutex);
-		goto cleanup;
-	}
-
 	if (git_mwindow__file_limit) {
-		git_mwindow_file *lru_file;
-		while (git_mwindow__file_limit <= ctl->windowfiles.length &&
-				git_mwindow_find_lru_file_locked(&lru_file) == 0) {
-			if ((error = git_vector_insert(&closed_files, lru_file)) < 0) {
+		while (git_mwindow__file_limit <= (size_t)git_atomic32_get(&ctl->open_files) &&
+				git_mwindow_close_lru_file(&closed_file) == 0) {
+			if (git_vector_insert(&closed_files, closed_file) < 0) {
 				/*
 				 * Exceeding the file limit seems preferable to being open to
 				 * data races that can end up corrupting the heap.
 				 */
 				break;
 			}
-			git_mwindow_free_all_locked(lru_file);
 		}
 	}
 
-	error = git_vector_insert(&ctl->windowfiles, mwf);
-	git_mutex_unlock(&git_mwindow__mutex);
-	if (error < 0)
+	if (git_mutex_lock(&shard->lock)) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
+		error = -1;
 		goto cleanup;
+	}
+
+	if (!mwf->registered) {
+		mwf->registered = 1;
+		git_atomic32_inc(&ctl->open_files);
+		file_lru_update_locked(shard, mwf);
+	}
+
+	git_mutex_unlock(&shard->lock);
 
 	/*
-	 * Once we have released the global windowfiles lock, we can close each
-	 * individual file. Before doing so, acquire that file's lock to avoid
-	 * closing a file that is currently being used.
+	 * Once we have released the shard locks, we can close each individual
+	 * file. Before doing so, acquire that file's lock to avoid closing a
+	 * file that is currently being used.
 	 */
 	git_vector_foreach(&closed_files, i, closed_file) {
-		error = git_mutex_lock(&closed_file->lock);
-		if (error < 0)
+		if (git_mutex_lock(&closed_file->lock) < 0)
 			continue;
 		p_close(closed_file->fd);
 		closed_file->fd = -1;
@@ -504,34 +689,30 @@ cleanup:
 
 void git_mwindow_file_deregister(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
-	git_mwindow_file *cur;
-	size_t i;
+	git_mwindow_shard *shard = mwindow_shard(mwf);
 
-	if (git_mutex_lock(&git_mwindow__mutex))
+	if (git_mutex_lock(&shard->lock))
 		return;
 
-	git_vector_foreach(&ctl->windowfiles, i, cur) {
-		if (cur == mwf) {
-			git_vector_remove(&ctl->windowfiles, i);
-			git_mutex_unlock(&git_mwindow__mutex);
-			return;
-		}
-	}
-	git_mutex_unlock(&git_mwindow__mutex);
+	file_deregister_locked(shard, mwf);
+	git_mutex_unlock(&shard->lock);
 }
 
 void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
-	if (w) {
-		if (git_mutex_lock(&git_mwindow__mutex)) {
+	if (w && w->full) {
+		*window = NULL;
+	} else if (w) {
+		git_mwindow_shard *shard = mwindow_shard(w->mwf);
+
+		if (git_mutex_lock(&shard->lock)) {
 			git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
 			return;
 		}
 
-		w->inuse_cnt--;
-		git_mutex_unlock(&git_mwindow__mutex);
+		window_release_locked(shard, w);
+		git_mutex_unlock(&shard->lock);
 		*window = NULL;
 	}
 }
@@ -23,6 +23,12 @@ typedef struct git_mwindow {
 	off64_t offset;
 	size_t last_used;
 	size_t inuse_cnt;
+	bool full; /* maps the whole file, see `git_mwindow_file.full_window` */
+
+	/* The file that is mapped, and the neighbours in the unused list */
+	struct git_mwindow_file *mwf;
+	struct git_mwindow *lru_prev;
+	struct git_mwindow *lru_next;
 } git_mwindow;
 
 typedef struct git_mwindow_file {
@@ -30,16 +36,49 @@ typedef struct git_mwindow_file {
 	git_mwindow *windows;
 	int fd;
 	off64_t size;
+
+	/*
+	 * Whether the file is only ever read, so that it may be mapped in
+	 * full when `GIT_OPT_SET_MWINDOW_FULL_MAP` is enabled. Its full
+	 * window is then used by every reader, without being counted, and
+	 * only unmapped with the rest of the file's windows.
+	 */
+	bool read_only;
+	git_mwindow *full_window;
+
+	/* The following are protected by the lock of the file's shard */
+	size_t inuse_windows;
+	size_t last_used;
+	unsigned registered:1,
+	         in_lru:1;
+	struct git_mwindow_file *lru_prev;
+	struct git_mwindow_file *lru_next;
 } git_mwindow_file;
 
+/* The number of independently locked parts of the window manager. */
+#define GIT_MWINDOW_SHARDS 16
+
+/*
+ * A part of the window manager, which owns the windows of the files that
+ * hash to it. The windows and the files that are not in use are kept in
+ * lists, least recently used first, so that the next one to close is
+ * always at the head.
+ */
+typedef struct git_mwindow_shard {
+	git_mutex lock;
+	git_mwindow *lru_head;
+	git_mwindow *lru_tail;
+	git_mwindow_file *lru_file_head;
+	git_mwindow_file *lru_file_tail;
+} git_mwindow_shard;
+
 typedef struct git_mwindow_ctl {
-	size_t mapped;
-	unsigned int open_windows;
-	unsigned int mmap_calls;
-	unsigned int peak_open_windows;
-	size_t peak_mapped;
-	size_t used_ctr;
-	git_vector windowfiles;
+	git_atomic_ssize mapped;
+	git_atomic32 open_windows;
+	git_atomic32 open_files;
+	git_atomic32 mmap_calls;
+	git_atomic_ssize used_ctr;
+	git_mwindow_shard shards[GIT_MWINDOW_SHARDS];
 } git_mwindow_ctl;
 
 int git_mwindow_contains(git_mwindow *win, off64_t offset, off64_t extra);
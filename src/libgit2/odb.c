@@ -35,6 +35,11 @@ int git_odb__packed_priority = GIT_ODB_DEFAULT_PACKED_PRIORITY;
 
 bool git_odb__strict_hash_verification = true;
 
+/* The number of missing objects that each object database remembers. */
+size_t git_odb__missing_cache_size = 0;
+
+GIT_HASHMAP_OID_FUNCTIONS(git_odb_missingmap, GIT_HASHMAP_INLINE, git_odb_missing *);
+
 typedef struct
 {
 	git_odb_backend *backend;
@@ -56,6 +61,7 @@ static git_cache *odb_cache(git_odb *odb)
 static int odb_otype_fast(git_object_t *type_p, git_odb *db, const git_oid *id);
 static int load_alternates(git_odb *odb, const char *objects_dir, int alternate_depth);
 static int error_null_oid(int error, const char *message);
+static int odb_refresh(git_odb *db);
 
 static git_object_t odb_hardcoded_type(const git_oid *id)
 {
@@ -119,10 +125,16 @@ static git_odb_object *odb_object__alloc(const git_oid *oid, git_rawobj *source)
 	return object;
 }
 
-void git_odb_object__free(void *object)
+void git_odb_object__free(void *_object)
 {
+	git_odb_object *object = _object;
+
 	if (object != NULL) {
-		git__free(((git_odb_object *)object)->buffer);
+		if (object->release)
+			object->release(object->release_payload);
+		else
+			git__free(object->buffer);
+
 		git__free(object);
 	}
 }
@@ -329,7 +341,9 @@ int git_odb_new_ext(git_odb **out, const git_odb_options *opts)
 		git__free(db);
 		return -1;
 	}
-	if (git_vector_init(&db->backends, 4, backend_sort_cmp) < 0) {
+	if (git_vector_init(&db->backends, 4, backend_sort_cmp) < 0 ||
+	    git_pool_init(&db->missing_pool, sizeof(git_odb_missing)) < 0) {
+		git_vector_dispose(&db->backends);
 		git_cache_dispose(&db->own_cache);
 		git_mutex_free(&db->lock);
 		git__free(db);
@@ -380,6 +394,8 @@ static int add_backend_internal(
 	git_vector_sort(&odb->backends);
 	internal->backend->odb = odb;
 	git_mutex_unlock(&odb->lock);
+
+	git_odb__invalidate_missing(odb);
 	return 0;
 }
 
@@ -516,6 +532,11 @@ int git_odb__add_default_backends(
 		git_mutex_unlock(&db->lock);
 		return -1;
 	}
+	if (!db->bitmap &&
+	    git_pack_bitmap_new(&db->bitmap, objects_dir, db->options.oid_type) < 0) {
+		git_mutex_unlock(&db->lock);
+		return -1;
+	}
 	git_mutex_unlock(&db->lock);
 
 	return load_alternates(db, objects_dir, alternate_depth);
@@ -661,8 +682,11 @@ static void odb_free(git_odb *db)
 		git_mutex_unlock(&db->lock);
 
 	git_commit_graph_free(db->cgraph);
+	git_pack_bitmap_free(db->bitmap);
 	git_vector_dispose(&db->backends);
 	git_cache_dispose(&db->own_cache);
+	git_odb_missingmap_dispose(&db->missing);
+	git_pool_clear(&db->missing_pool);
 	git_mutex_free(&db->lock);
 
 	git__memzero(db, sizeof(*db));
@@ -728,6 +752,62 @@ done:
 	return error;
 }
 
+int git_odb__get_pack_bitmap_file(git_pack_bitmap_file **out, git_odb *db)
+{
+	int error = 0;
+	git_pack_bitmap_file *result = NULL;
+
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the db lock");
+		return error;
+	}
+	if (!db->bitmap) {
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+	error = git_pack_bitmap_get_file(&result, db->bitmap);
+	if (error)
+		goto done;
+	*out = result;
+
+done:
+	git_mutex_unlock(&db->lock);
+	return error;
+}
+
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out,
+	git_odb *db,
+	const git_oid *id)
+{
+	size_t i;
+	int error;
+
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return error;
+	}
+
+	error = GIT_ENOTFOUND;
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		error = git_odb_pack__find_entry(out, internal->backend, id);
+
+		if (error != GIT_PASSTHROUGH && error != GIT_ENOTFOUND)
+			break;
+	}
+
+	git_mutex_unlock(&db->lock);
+
+	if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
+		return git_odb__error_notfound("object is not packed", id,
+			git_oid_hexsize(db->options.oid_type));
+
+	return error;
+}
+
 static int odb_freshen_1(
 	git_odb *db,
 	const git_oid *id,
@@ -758,18 +838,96 @@ static int odb_freshen_1(
 	return (int)found;
 }
 
+void git_odb__invalidate_missing(git_odb *db)
+{
+	git_atomic32_inc(&db->generation);
+}
+
+static bool odb_missing_known(git_odb *db, const git_oid *id, int generation)
+{
+	git_odb_missing *missing;
+	bool known = false;
+
+	if (!git_odb__missing_cache_size || git_mutex_lock(&db->lock) < 0)
+		return false;
+
+	if (git_odb_missingmap_get(&missing, &db->missing, id) == 0)
+		known = (missing->generation == generation);
+
+	git_mutex_unlock(&db->lock);
+	return known;
+}
+
+/*
+ * Remember that an object was not found after refreshing the backends in
+ * the given generation. The objects are forgotten when there are too
+ * many; failing to remember one is not an error.
+ */
+static void odb_missing_add(git_odb *db, const git_oid *id, int generation)
+{
+	git_odb_missing *missing;
+
+	if (!git_odb__missing_cache_size || git_mutex_lock(&db->lock) < 0)
+		return;
+
+	if (git_odb_missingmap_get(&missing, &db->missing, id) == 0) {
+		missing->generation = generation;
+		goto done;
+	}
+
+	if (git_odb_missingmap_size(&db->missing) >= git_odb__missing_cache_size) {
+		git_odb_missingmap_clear(&db->missing);
+		git_pool_clear(&db->missing_pool);
+	}
+
+	if ((missing = git_pool_malloc(&db->missing_pool, 1)) == NULL) {
+		git_error_clear();
+		goto done;
+	}
+
+	git_oid_cpy(&missing->id, id);
+	missing->generation = generation;
+
+	if (git_odb_missingmap_put(&db->missing, &missing->id, missing) < 0)
+		git_error_clear();
+
+done:
+	git_mutex_unlock(&db->lock);
+}
+
+/*
+ * Refresh the backends after an object was not found, so that it can be
+ * looked up again; returns GIT_ENOTFOUND without refreshing if it was
+ * not found after a refresh before, and nothing was added since. The
+ * generation that a failed lookup should be remembered with is stored
+ * in `generation`.
+ */
+static int odb_refresh_missing(git_odb *db, const git_oid *id, int *generation)
+{
+	*generation = git_atomic32_get(&db->generation);
+
+	if (odb_missing_known(db, id, *generation))
+		return GIT_ENOTFOUND;
+
+	return odb_refresh(db);
+}
+
 int git_odb__freshen(git_odb *db, const git_oid *id)
 {
+	int generation;
+
 	GIT_ASSERT_ARG(db);
 	GIT_ASSERT_ARG(id);
 
 	if (odb_freshen_1(db, id, false))
 		return 1;
 
-	if (!git_odb_refresh(db))
-		return odb_freshen_1(db, id, true);
+	if (!odb_refresh_missing(db, id, &generation) &&
+	    odb_freshen_1(db, id, true))
+		return 1;
 
 	/* Failed to refresh, hence not found */
+	odb_missing_add(db, id, generation);
 	return 0;
 }
 
@@ -781,6 +939,7 @@ int git_odb_exists(git_odb *db, const git_oid *id)
 int git_odb_exists_ext(git_odb *db, const git_oid *id, unsigned int flags)
 {
 	git_odb_object *object;
+	int generation;
 
 	GIT_ASSERT_ARG(db);
 	GIT_ASSERT_ARG(id);
@@ -796,10 +955,108 @@ int git_odb_exists_ext(git_odb *db, const git_oid *id, unsigned int flags)
 	if (odb_exists_1(db, id, false))
 		return 1;
 
-	if (!(flags & GIT_ODB_LOOKUP_NO_REFRESH) && !git_odb_refresh(db))
-		return odb_exists_1(db, id, true);
+	if (flags & GIT_ODB_LOOKUP_NO_REFRESH)
+		return 0;
+
+	if (!odb_refresh_missing(db, id, &generation) &&
+	    odb_exists_1(db, id, true))
+		return 1;
 
 	/* Failed to refresh, hence not found */
+	odb_missing_add(db, id, generation);
+	return 0;
+}
+
+static int odb_exists_many_1(
+	int *found,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	bool only_refreshed)
+{
+	size_t i, j;
+	int error;
+
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return error;
+	}
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (only_refreshed && !b->refresh)
+			continue;
+
+		if (b->exists_many != NULL) {
+			if ((error = b->exists_many(b, found, ids, count)) < 0)
+				break;
+		} else if (b->exists != NULL) {
+			for (j = 0; j < count; j++) {
+				if (!found[j] && b->exists(b, &ids[j]))
+					found[j] = 1;
+			}
+		}
+	}
+	git_mutex_unlock(&db->lock);
+
+	return error;
+}
+
+int git_odb_exists_many(
+	int *found,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count)
+{
+	git_odb_object *object;
+	size_t i, missing = 0;
+	int generation, error;
+
+	GIT_ASSERT_ARG(found);
+	GIT_ASSERT_ARG(db);
+	GIT_ASSERT_ARG(ids || !count);
+
+	for (i = 0; i < count; i++) {
+		found[i] = 0;
+
+		if (git_oid_is_zero(&ids[i]))
+			found[i] = -1;
+		else if ((object = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL) {
+			git_odb_object_free(object);
+			found[i] = 1;
+		} else
+			missing++;
+	}
+
+	if (missing) {
+		if ((error = odb_exists_many_1(found, db, ids, count, false)) < 0)
+			return error;
+
+		/* Only refresh for objects that may have been added since */
+		generation = git_atomic32_get(&db->generation);
+
+		for (i = 0, missing = 0; i < count; i++) {
+			if (!found[i] && !odb_missing_known(db, &ids[i], generation))
+				missing++;
+		}
+
+		if (missing && !odb_refresh(db) &&
+		    (error = odb_exists_many_1(found, db, ids, count, true)) < 0)
+			return error;
+
+		for (i = 0; i < count; i++) {
+			if (!found[i])
+				odb_missing_add(db, &ids[i], generation);
+		}
+	}
+
+	/* The null OID was only marked to keep it from being looked up */
+	for (i = 0; i < count; i++) {
+		if (found[i] < 0)
+			found[i] = 0;
+	}
+
 	return 0;
 }
 
@@ -882,7 +1139,7 @@ int git_odb_exists_prefix(
 
 	error = odb_exists_prefix_1(out, db, &key, len, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh(db))
 		error = odb_exists_prefix_1(out, db, &key, len, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -1026,7 +1283,7 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_object_t *type_p,
 	git_odb *db, const git_oid *id)
 {
-	int error = GIT_ENOTFOUND;
+	int error = GIT_ENOTFOUND, generation = 0;
 	git_odb_object *object;
 
 	GIT_ASSERT_ARG(db);
@@ -1049,11 +1306,13 @@ int git_odb__read_header_or_object(
 
 	error = odb_read_header_1(len_p, type_p, db, id, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_missing(db, id, &generation))
 		error = odb_read_header_1(len_p, type_p, db, id, true);
 
-	if (error == GIT_ENOTFOUND)
+	if (error == GIT_ENOTFOUND) {
+		odb_missing_add(db, id, generation);
 		return git_odb__error_notfound("cannot read header for", id, git_oid_hexsize(db->options.oid_type));
+	}
 
 	/* we found the header; return early */
 	if (!error)
@@ -1084,6 +1343,8 @@ static int odb_read_1(
 	size_t i;
 	git_rawobj raw;
 	git_odb_object *object;
+	git_odb_backend_release_cb release = NULL;
+	void *release_payload = NULL;
 	git_oid hashed;
 	bool found = false;
 	int error = 0;
@@ -1104,8 +1365,14 @@ static int odb_read_1(
 		if (only_refreshed && !b->refresh)
 			continue;
 
-		if (b->read != NULL) {
-			error = b->read(&raw.data, &raw.len, &raw.type, b, id);
+		if (b->read_shared != NULL || b->read != NULL) {
+			if (b->read_shared != NULL)
+				error = b->read_shared((const void **)&raw.data,
+					&raw.len, &raw.type, &release,
+					&release_payload, b, id);
+			else
+				error = b->read(&raw.data, &raw.len, &raw.type, b, id);
+
 			if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
 				continue;
 
@@ -1144,17 +1411,22 @@ static int odb_read_1(
 		goto out;
 	}
 
+	object->release = release;
+	object->release_payload = release_payload;
+
 	*out = git_cache_store_raw(odb_cache(db), object);
 
 out:
-	if (error)
+	if (error && release)
+		release(release_payload);
+	else if (error)
 		git__free(raw.data);
 	return error;
 }
 
 int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 {
-	int error;
+	int error, generation = 0;
 
 	GIT_ASSERT_ARG(out);
 	GIT_ASSERT_ARG(db);
@@ -1169,11 +1441,244 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 
 	error = odb_read_1(out, db, id, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_missing(db, id, &generation))
 		error = odb_read_1(out, db, id, true);
 
-	if (error == GIT_ENOTFOUND)
+	if (error == GIT_ENOTFOUND) {
+		odb_missing_add(db, id, generation);
 		return git_odb__error_notfound("no match for id", id, git_oid_hexsize(git_oid_type(id)));
+	}
+
+	return error;
+}
+
+static int odb_read_many_1(
+	void **data,
+	size_t *len,
+	git_object_t *type,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	bool only_refreshed)
+{
+	size_t i, j;
+	int error;
+
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return error;
+	}
+	for (i = 0; i < db->backends.length && !error; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (only_refreshed && !b->refresh)
+			continue;
+
+		if (b->read_many != NULL) {
+			error = b->read_many(data, len, type, b, ids, count);
+			continue;
+		}
+
+		if (b->read == NULL)
+			continue;
+
+		for (j = 0; j < count; j++) {
+			if (data[j])
+				continue;
+
+			error = b->read(&data[j], &len[j], &type[j], b, &ids[j]);
+
+			if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND) {
+				data[j] = NULL;
+				error = 0;
+			} else if (error < 0) {
+				break;
+			}
+		}
+	}
+	git_mutex_unlock(&db->lock);
+
+	return error;
+}
+
+int git_odb_read_many(
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count)
+{
+	const git_oid *pending_ids = NULL;
+	git_oid *pending_buf = NULL;
+	size_t *pending = NULL, npending = 0, i, *len = NULL;
+	git_object_t *type = NULL;
+	void **data = NULL;
+	git_rawobj raw;
+	git_odb_object *object;
+	git_oid hashed;
+	bool found;
+	int generation, error = 0;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(db);
+	GIT_ASSERT_ARG(ids || !count);
+
+	memset(out, 0, count * sizeof(git_odb_object *));
+
+	if (!count)
+		return 0;
+
+	pending = git__calloc(count, sizeof(size_t));
+	GIT_ERROR_CHECK_ALLOC(pending);
+
+	for (i = 0; i < count; i++) {
+		if (git_oid_is_zero(&ids[i]))
+			continue;
+
+		if ((out[i] = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL)
+			continue;
+
+		if ((error = odb_read_hardcoded(&found, &raw, &ids[i])) < 0)
+			goto done;
+
+		if (found) {
+			if ((object = odb_object__alloc(&ids[i], &raw)) == NULL) {
+				git__free(raw.data);
+				error = -1;
+				goto done;
+			}
+
+			out[i] = git_cache_store_raw(odb_cache(db), object);
+			continue;
+		}
+
+		pending[npending++] = i;
+	}
+
+	if (!npending)
+		goto done;
+
+	/* Only pass the objects that still need to be read to the backends */
+	if (npending == count) {
+		pending_ids = ids;
+	} else {
+		pending_buf = git__calloc(npending, sizeof(git_oid));
+		GIT_ERROR_CHECK_ALLOC(pending_buf);
+
+		for (i = 0; i < npending; i++)
+			git_oid_cpy(&pending_buf[i], &ids[pending[i]]);
+
+		pending_ids = pending_buf;
+	}
+
+	data = git__calloc(npending, sizeof(void *));
+	len = git__calloc(npending, sizeof(size_t));
+	type = git__calloc(npending, sizeof(git_object_t));
+
+	if (!data || !len || !type) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = odb_read_many_1(data, len, type, db, pending_ids, npending, false)) < 0)
+		goto done;
+
+	/* Only refresh for objects that may have been added since */
+	generation = git_atomic32_get(&db->generation);
+
+	for (i = 0; i < npending; i++) {
+		if (!data[i] && !odb_missing_known(db, &pending_ids[i], generation))
+			break;
+	}
+
+	if (i < npending && !odb_refresh(db) &&
+	    (error = odb_read_many_1(data, len, type, db, pending_ids, npending, true)) < 0)
+		goto done;
+
+	for (i = 0; i < npending; i++) {
+		if (!data[i])
+			odb_missing_add(db, &pending_ids[i], generation);
+	}
+
+	for (i = 0; i < npending; i++) {
+		if (!data[i])
+			continue;
+
+		if (git_odb__strict_hash_verification) {
+			git_object_id_options id_opts = GIT_OBJECT_ID_OPTIONS_INIT;
+
+			id_opts.object_type = type[i];
+			id_opts.oid_type = db->options.oid_type;
+
+			if ((error = git_object_id_from_buffer(&hashed,
+					data[i], len[i], &id_opts)) < 0)
+				goto done;
+
+			if (!git_oid_equal(&pending_ids[i], &hashed)) {
+				error = git_odb__error_mismatch(&pending_ids[i], &hashed);
+				goto done;
+			}
+		}
+
+		raw.data = data[i];
+		raw.len = len[i];
+		raw.type = type[i];
+
+		if ((object = odb_object__alloc(&pending_ids[i], &raw)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		data[i] = NULL;
+		out[pending[i]] = git_cache_store_raw(odb_cache(db), object);
+	}
+
+	git_error_clear();
+
+done:
+	if (data) {
+		for (i = 0; i < npending; i++)
+			git__free(data[i]);
+	}
+
+	if (error < 0) {
+		for (i = 0; i < count; i++) {
+			git_odb_object_free(out[i]);
+			out[i] = NULL;
+		}
+	}
+
+	git__free(data);
+	git__free(len);
+	git__free(type);
+	git__free(pending_buf);
+	git__free(pending);
+	return error;
+}
+
+int git_odb_prefetch(git_odb *db, const git_oid *ids, size_t count)
+{
+	size_t i;
+	int error;
+
+	GIT_ASSERT_ARG(db);
+	GIT_ASSERT_ARG(ids || !count);
+
+	if (!count)
+		return 0;
+
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return error;
+	}
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (b->prefetch != NULL && (error = b->prefetch(b, ids, count)) < 0)
+			break;
+	}
+	git_mutex_unlock(&db->lock);
 
 	return error;
 }
@@ -1331,7 +1836,7 @@ int git_odb_read_prefix(
 
 	error = read_prefix_1(out, db, &key, len, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh(db))
 		error = read_prefix_1(out, db, &key, len, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -1340,6 +1845,84 @@ int git_odb_read_prefix(
 	return error;
 }
 
+struct foreach_object_data {
+	git_odb_backend *backend;
+	git_odb_foreach_object_cb cb;
+	void *payload;
+};
+
+static int foreach_object_read_cb(const git_oid *id, void *payload)
+{
+	struct foreach_object_data *data = payload;
+	git_odb_backend *b = data->backend;
+	git_rawobj raw;
+	int error;
+
+	error = b->read(&raw.data, &raw.len, &raw.type, b, id);
+
+	/* The object may have gone away since it was listed */
+	if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND) {
+		git_error_clear();
+		return 0;
+	}
+
+	if (error < 0)
+		return error;
+
+	error = data->cb(id, raw.type, raw.data, raw.len, data->payload);
+	git__free(raw.data);
+
+	return error;
+}
+
+int git_odb_foreach_object(
+	git_odb *db,
+	git_odb_foreach_object_cb cb,
+	void *payload)
+{
+	unsigned int i;
+	git_vector backends = GIT_VECTOR_INIT;
+	backend_internal *internal;
+	int error = 0;
+
+	GIT_ASSERT_ARG(db);
+	GIT_ASSERT_ARG(cb);
+
+	/* Make a copy of the backends vector to invoke the callback without holding the lock. */
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		goto cleanup;
+	}
+	error = git_vector_dup(&backends, &db->backends, NULL);
+	git_mutex_unlock(&db->lock);
+
+	if (error < 0)
+		goto cleanup;
+
+	git_vector_foreach(&backends, i, internal) {
+		git_odb_backend *b = internal->backend;
+		struct foreach_object_data data;
+
+		if (b->foreach_object != NULL) {
+			error = b->foreach_object(b, cb, payload);
+		} else if (b->foreach != NULL && b->read != NULL) {
+			data.backend = b;
+			data.cb = cb;
+			data.payload = payload;
+
+			error = b->foreach(b, foreach_object_read_cb, &data);
+		}
+
+		if (error != 0)
+			goto cleanup;
+	}
+
+cleanup:
+	git_vector_dispose(&backends);
+
+	return error;
+}
+
 int git_odb_foreach(git_odb *db, git_odb_foreach_cb cb, void *payload)
 {
 	unsigned int i;
@@ -1371,6 +1954,68 @@ cleanup:
 	return error;
 }
 
+struct foreach_parallel_data {
+	git_odb_foreach_parallel_cb cb;
+	void *payload;
+};
+
+static int foreach_parallel_cb(const git_oid *id, void *payload)
+{
+	struct foreach_parallel_data *data = payload;
+
+	return data->cb(id, 0, data->payload);
+}
+
+int git_odb_foreach_parallel(
+	git_odb *db,
+	unsigned int threads,
+	git_odb_foreach_parallel_cb cb,
+	void *payload)
+{
+	unsigned int i;
+	git_vector backends = GIT_VECTOR_INIT;
+	backend_internal *internal;
+	struct foreach_parallel_data data;
+	int error = 0;
+
+	GIT_ASSERT_ARG(db);
+	GIT_ASSERT_ARG(cb);
+
+	if (!threads)
+		threads = (unsigned int)git__online_cpus();
+
+	data.cb = cb;
+	data.payload = payload;
+
+	/* Make a copy of the backends vector to invoke the callback without holding the lock. */
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		goto cleanup;
+	}
+	error = git_vector_dup(&backends, &db->backends, NULL);
+	git_mutex_unlock(&db->lock);
+
+	if (error < 0)
+		goto cleanup;
+
+	git_vector_foreach(&backends, i, internal) {
+		git_odb_backend *b = internal->backend;
+
+		if (b->foreach_parallel != NULL)
+			error = b->foreach_parallel(b, threads, cb, payload);
+		else
+			error = b->foreach(b, foreach_parallel_cb, &data);
+
+		if (error != 0)
+			goto cleanup;
+	}
+
+cleanup:
+	git_vector_dispose(&backends);
+
+	return error;
+}
+
 int git_odb_write(
 	git_oid *oid, git_odb *db, const void *data, size_t len, git_object_t type)
 {
@@ -1682,12 +2327,18 @@ void git_odb_backend_data_free(git_odb_backend *backend, void *data)
 }
 
 int git_odb_refresh(git_odb *db)
+{
+	GIT_ASSERT_ARG(db);
+
+	git_odb__invalidate_missing(db);
+	return odb_refresh(db);
+}
+
+static int odb_refresh(git_odb *db)
 {
 	size_t i;
 	int error;
 
-	GIT_ASSERT_ARG(db);
-
 	if ((error = git_mutex_lock(&db->lock)) < 0) {
 		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
 		return error;
@@ -1706,6 +2357,8 @@ int git_odb_refresh(git_odb *db)
 	}
 	if (db->cgraph)
 		git_commit_graph_refresh(db->cgraph);
+	if (db->bitmap)
+		git_pack_bitmap_refresh(db->bitmap);
 	git_mutex_unlock(&db->lock);
 
 	return 0;
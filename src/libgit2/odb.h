@@ -14,10 +14,14 @@
 #include "git2/oid.h"
 #include "git2/types.h"
 #include "git2/sys/commit_graph.h"
+#include "git2/sys/odb_backend.h"
 
 #include "cache.h"
 #include "commit_graph.h"
+#include "pack_bitmap.h"
 #include "filter.h"
+#include "hashmap_oid.h"
+#include "pool.h"
 #include "posix.h"
 #include "vector.h"
 
@@ -28,7 +32,10 @@
 #define GIT_ODB_DEFAULT_LOOSE_PRIORITY 1
 #define GIT_ODB_DEFAULT_PACKED_PRIORITY 2
 
+struct git_pack_entry;
+
 extern bool git_odb__strict_hash_verification;
+extern size_t git_odb__missing_cache_size;
 
 /* DO NOT EXPORT */
 typedef struct {
@@ -41,17 +48,42 @@ typedef struct {
 struct git_odb_object {
 	git_cached_obj cached;
 	void *buffer;
+
+	/* Releases the buffer when it is borrowed from a backend */
+	git_odb_backend_release_cb release;
+	void *release_payload;
 };
 
+/*
+ * An object that was not found after the backends were refreshed, in the
+ * given generation of the object database.
+ */
+typedef struct {
+	git_oid id;
+	int generation;
+} git_odb_missing;
+
+GIT_HASHMAP_OID_STRUCT(git_odb_missingmap, git_odb_missing *);
+
 /* EXPORT */
 struct git_odb {
 	git_refcount rc;
-	git_mutex lock;  /* protects backends */
+	git_mutex lock;  /* protects backends and the missing objects */
 	git_odb_options options;
 	git_vector backends;
 	git_cache own_cache;
 	git_commit_graph *cgraph;
+	git_pack_bitmap *bitmap;
 	unsigned int do_fsync :1;
+
+	/*
+	 * The objects that were recently looked up and not found. The
+	 * generation changes whenever objects may have been added that a
+	 * lookup does not find without a refresh, which invalidates them.
+	 */
+	git_odb_missingmap missing;
+	git_pool missing_pool;
+	git_atomic32 generation;
 };
 
 typedef enum {
@@ -107,9 +139,38 @@ int git_odb__read_header_or_object(
  */
 int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
 
+/*
+ * Attempt to get the ODB's reachability bitmap. This object is still owned
+ * by the ODB. If the repository does not contain a bitmap, it will return
+ * GIT_ENOTFOUND.
+ */
+int git_odb__get_pack_bitmap_file(git_pack_bitmap_file **out, git_odb *odb);
+
+/*
+ * Find the pack that an object is stored in, when it is in one of the
+ * ODB's packfile backends. The pack is still owned by the ODB. If the
+ * object is not packed, it will return GIT_ENOTFOUND.
+ */
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out, git_odb *db, const git_oid *id);
+
+/*
+ * Find the pack entry of an object in the given backend, or return
+ * GIT_PASSTHROUGH when it is not a packfile backend.
+ */
+int git_odb_pack__find_entry(
+	struct git_pack_entry *out, git_odb_backend *backend, const git_oid *id);
+
 /* freshen an entry in the object database */
 int git_odb__freshen(git_odb *db, const git_oid *id);
 
+/*
+ * Forget which objects were not found, so that looking them up refreshes
+ * the backends again; used when objects were added that are not visible
+ * without a refresh, like a newly written pack.
+ */
+void git_odb__invalidate_missing(git_odb *db);
+
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
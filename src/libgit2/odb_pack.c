@@ -18,12 +18,28 @@
 #include "mwindow.h"
 #include "odb.h"
 #include "pack.h"
+#include "pool.h"
 
 #include "git2/odb_backend.h"
 
 /* re-freshen pack files no more than every 2 seconds */
 #define FRESHEN_FREQUENCY 2
 
+/*
+ * The objects are listed in parallel in parts of at least this many, and
+ * in about this many parts per thread so that they finish together.
+ */
+size_t git_odb_pack__foreach_min_part = 1024;
+#define FOREACH_PARALLEL_PARTS_PER_THREAD 4
+
+/* The number of object lookups that each backend remembers. */
+size_t git_odb_pack__lookup_cache_size = 0;
+
+/* Whether received packs resolve their deltas while they are received. */
+bool git_odb_pack__stream_deltas = false;
+
+GIT_HASHMAP_OID_SETUP(pack_backend_lookupmap, struct git_pack_entry *);
+
 struct pack_backend {
 	git_odb_backend parent;
 	git_odb_backend_pack_options opts;
@@ -31,7 +47,18 @@ struct pack_backend {
 	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
+
+	/*
+	 * The results of recent lookups by full ID: where the object was
+	 * found, or an entry without a pack if it is in none of the packs.
+	 */
+	pack_backend_lookupmap lookups;
+	git_pool lookup_pool;
+
 	char *pack_folder;
+
+	/* The pack folder when it was last scanned for new packs */
+	git_futils_filestamp pack_folder_stamp;
 };
 
 struct pack_writepack {
@@ -39,6 +66,50 @@ struct pack_writepack {
 	git_indexer *indexer;
 };
 
+/* A range of the objects of a pack, or of the multi-pack-index */
+struct foreach_part {
+	struct git_pack_file *p;
+	uint32_t start;
+	uint32_t end;
+};
+
+struct foreach_parallel {
+	git_midx_file *midx;
+	git_array_t(struct foreach_part) parts;
+	git_odb_foreach_parallel_cb cb;
+	void *payload;
+
+	/* The next part that none of the threads has taken yet */
+	git_atomic32 next;
+
+	/* The first error that any of the threads ran into */
+	git_mutex lock;
+	git_atomic32 stop;
+	int error;
+	git_error *error_info;
+};
+
+struct foreach_parallel_worker {
+	struct foreach_parallel *fp;
+	unsigned int thread;
+};
+
+struct pack_readstream {
+	git_odb_stream parent;
+	struct git_pack_file *p;
+
+	/* the data of an undeltified object, inflated as it is read */
+	git_packfile_stream data;
+
+	/* or the base and the delta that make up a deltified object */
+	bool deltified;
+	git_rawobj base;
+	void *delta;
+	git_delta_reader delta_reader;
+
+	size_t remain;
+};
+
 /**
  * The wonderful tale of a Packed Object lookup query
  * ===================================================
@@ -59,7 +130,8 @@ struct pack_writepack {
  * | preload all the known packfiles in the ODB.
  * |
  * |-# pack_backend__refresh
- *   | The `multi-pack-index` is loaded if it exists and is valid.
+ *   | Nothing is done if the pack folder was not modified since the last
+ *   | refresh. Otherwise, the `multi-pack-index` is loaded if it exists and is valid.
  *   | Then we run a `dirent` callback through every file in the pack folder,
  *   | even those present in `multi-pack-index`. The unindexed packfiles are
  *   | then sorted according to a sorting callback.
@@ -267,25 +339,71 @@ static int packfile_load__cb(void *data, git_str *path)
 
 }
 
+static void lookup_cache_clear(struct pack_backend *backend)
+{
+	pack_backend_lookupmap_clear(&backend->lookups);
+	git_pool_clear(&backend->lookup_pool);
+}
+
+/*
+ * Remember where an object was found, or that it was not found when `e`
+ * is NULL. The cache is emptied when it is full; failing to add to it is
+ * not an error.
+ */
+static void lookup_cache_add(
+	struct pack_backend *backend,
+	const git_oid *oid,
+	const struct git_pack_entry *e)
+{
+	struct git_pack_entry *cached;
+
+	if (!git_odb_pack__lookup_cache_size)
+		return;
+
+	if (pack_backend_lookupmap_size(&backend->lookups) >= git_odb_pack__lookup_cache_size)
+		lookup_cache_clear(backend);
+
+	if ((cached = git_pool_malloc(&backend->lookup_pool, 1)) == NULL) {
+		git_error_clear();
+		return;
+	}
+
+	git_oid_cpy(&cached->id, oid);
+	cached->offset = e ? e->offset : 0;
+	cached->p = e ? e->p : NULL;
+
+	if (pack_backend_lookupmap_put(&backend->lookups, &cached->id, cached) < 0)
+		git_error_clear();
+}
+
 static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
 {
 	struct git_pack_file *last_found = backend->last_found, *p;
+	struct git_pack_entry *cached;
 	git_midx_entry midx_entry;
 	size_t oid_hexsize = git_oid_hexsize(backend->opts.oid_type);
 	size_t i;
 
+	if (pack_backend_lookupmap_get(&cached, &backend->lookups, oid) == 0) {
+		if (!cached->p)
+			goto notfound;
+
+		memcpy(e, cached, sizeof(struct git_pack_entry));
+		return 0;
+	}
+
 	if (backend->midx &&
 		git_midx_entry_find(&midx_entry, backend->midx, oid, oid_hexsize) == 0 &&
 		midx_entry.pack_index < git_vector_length(&backend->midx_packs)) {
 		e->offset = midx_entry.offset;
 		git_oid_cpy(&e->id, &midx_entry.sha1);
 		e->p = git_vector_get(&backend->midx_packs, midx_entry.pack_index);
-		return 0;
+		goto found;
 	}
 
 	if (last_found &&
 		git_pack_entry_find(e, last_found, oid, oid_hexsize) == 0)
-		return 0;
+		goto found;
 
 	git_vector_foreach(&backend->packs, i, p) {
 		if (p == last_found)
@@ -293,12 +411,19 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 
 		if (git_pack_entry_find(e, p, oid, oid_hexsize) == 0) {
 			backend->last_found = p;
-			return 0;
+			goto found;
 		}
 	}
 
+	lookup_cache_add(backend, oid, NULL);
+
+notfound:
 	return git_odb__error_notfound(
 		"failed to find pack entry", oid, oid_hexsize);
+
+found:
+	lookup_cache_add(backend, oid, e);
+	return 0;
 }
 
 static int pack_entry_find_prefix(
@@ -516,13 +641,28 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	struct stat st;
 	git_str path = GIT_STR_INIT;
 	struct pack_backend *backend = (struct pack_backend *)backend_;
+	size_t pack_count;
+	time_t now;
 
 	if (backend->pack_folder == NULL)
 		return 0;
 
+	pack_count = git_vector_length(&backend->midx_packs) +
+	             git_vector_length(&backend->packs);
+
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL, 0);
 
+	/*
+	 * Packs and multi-pack-indexes are renamed into the pack folder, which
+	 * changes its modification time; there is nothing new to load when
+	 * that did not change since the last scan.
+	 */
+	if (git_futils_filestamp_check(&backend->pack_folder_stamp, backend->pack_folder) == 0)
+		return 0;
+
+	now = time(NULL);
+
 	if (refresh_multi_pack_index(backend) < 0) {
 		/*
 		 * It is okay if this fails. We will just not use the
@@ -538,6 +678,22 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	git_str_dispose(&path);
 	git_vector_sort(&backend->packs);
 
+	/*
+	 * The folder may change again within the granularity of its
+	 * modification time, without it changing; only trust the stamp
+	 * once it is older than the scan.
+	 */
+	if (error < 0 || backend->pack_folder_stamp.mtime.tv_sec >= now)
+		git_futils_filestamp_set(&backend->pack_folder_stamp, NULL);
+
+	/*
+	 * Packs are only ever added, so the objects that were found are
+	 * still where they were; those that were not may be in a new pack.
+	 */
+	if (pack_count != git_vector_length(&backend->midx_packs) +
+	                  git_vector_length(&backend->packs))
+		lookup_cache_clear(backend);
+
 	return error;
 }
 
@@ -600,6 +756,457 @@ static int pack_backend__read(
 	return 0;
 }
 
+static int oid_position_cmp(const void *a, const void *b, void *payload)
+{
+	const git_oid *ids = payload;
+
+	return git_oid__cmp(&ids[*(const size_t *)a], &ids[*(const size_t *)b]);
+}
+
+/*
+ * Look up the given objects, skipping the positions for which `skip`
+ * returns true. The objects are sorted by ID so that each index is only
+ * swept once; `positions_out` maps each entry back to its position in
+ * `ids`. Entries that are not found are left without a pack.
+ */
+static int pack_entry_find_many(
+	struct git_pack_entry **entries_out,
+	size_t **positions_out,
+	size_t *count_out,
+	struct pack_backend *backend,
+	const git_oid *ids,
+	size_t count,
+	bool (*skip)(size_t pos, const void *payload),
+	const void *payload)
+{
+	struct git_pack_entry *entries = NULL;
+	struct git_pack_file *p;
+	size_t *positions = NULL, len = 0, i;
+
+	*entries_out = NULL;
+	*positions_out = NULL;
+	*count_out = 0;
+
+	if (!count)
+		return 0;
+
+	positions = git__calloc(count, sizeof(size_t));
+	GIT_ERROR_CHECK_ALLOC(positions);
+
+	for (i = 0; i < count; i++) {
+		if (!skip(i, payload))
+			positions[len++] = i;
+	}
+
+	if (!len) {
+		git__free(positions);
+		return 0;
+	}
+
+	git__qsort_r(positions, len, sizeof(size_t), oid_position_cmp, (void *)ids);
+
+	entries = git__calloc(len, sizeof(struct git_pack_entry));
+	if (!entries) {
+		git__free(positions);
+		return -1;
+	}
+
+	for (i = 0; i < len; i++)
+		git_oid_cpy(&entries[i].id, &ids[positions[i]]);
+
+	/*
+	 * As with single lookups, a pack that cannot be read is treated as
+	 * not having the objects.
+	 */
+	if (backend->midx)
+		git_midx_entry_find_many(entries, len, backend->midx, &backend->midx_packs);
+
+	git_vector_foreach(&backend->packs, i, p)
+		git_pack_entry_find_many(entries, len, p);
+
+	*entries_out = entries;
+	*positions_out = positions;
+	*count_out = len;
+	return 0;
+}
+
+static bool exists_many_skip(size_t pos, const void *payload)
+{
+	const int *found = payload;
+	return found[pos] != 0;
+}
+
+static int pack_backend__exists_many(
+	git_odb_backend *backend, int *found, const git_oid *ids, size_t count)
+{
+	struct git_pack_entry *entries;
+	size_t *positions, len, i;
+	int error;
+
+	if ((error = pack_entry_find_many(&entries, &positions, &len,
+			(struct pack_backend *)backend, ids, count,
+			exists_many_skip, found)) < 0)
+		return error;
+
+	for (i = 0; i < len; i++) {
+		if (entries[i].p)
+			found[positions[i]] = 1;
+	}
+
+	git__free(entries);
+	git__free(positions);
+	return 0;
+}
+
+static bool read_many_skip(size_t pos, const void *payload)
+{
+	void * const *data = payload;
+	return data[pos] != NULL;
+}
+
+static int pack_entry_location_cmp(const void *a, const void *b, void *payload)
+{
+	const struct git_pack_entry *entries = payload;
+	const struct git_pack_entry *ea = &entries[*(const size_t *)a];
+	const struct git_pack_entry *eb = &entries[*(const size_t *)b];
+
+	if (ea->p != eb->p)
+		return ((uintptr_t)ea->p < (uintptr_t)eb->p) ? -1 : 1;
+
+	return (ea->offset < eb->offset) ? -1 : (ea->offset > eb->offset);
+}
+
+static int pack_backend__read_many(
+	void **data, size_t *len_p, git_object_t *type_p,
+	git_odb_backend *backend, const git_oid *ids, size_t count)
+{
+	struct git_pack_entry *entries;
+	size_t *positions, *order = NULL, len, found = 0, i;
+	git_rawobj raw;
+	off64_t offset;
+	int error;
+
+	if ((error = pack_entry_find_many(&entries, &positions, &len,
+			(struct pack_backend *)backend, ids, count,
+			read_many_skip, data)) < 0 || !len)
+		return error;
+
+	order = git__calloc(len, sizeof(size_t));
+	GIT_ERROR_CHECK_ALLOC(order);
+
+	for (i = 0; i < len; i++) {
+		if (entries[i].p)
+			order[found++] = i;
+	}
+
+	/* Unpack the objects in the order that they are stored in */
+	git__qsort_r(order, found, sizeof(size_t), pack_entry_location_cmp, entries);
+
+	for (i = 0; i < found; i++) {
+		struct git_pack_entry *e = &entries[order[i]];
+		size_t pos = positions[order[i]];
+
+		offset = e->offset;
+
+		if ((error = git_packfile_unpack(&raw, e->p, &offset)) < 0)
+			goto done;
+
+		data[pos] = raw.data;
+		len_p[pos] = raw.len;
+		type_p[pos] = raw.type;
+	}
+
+done:
+	git__free(order);
+	git__free(entries);
+	git__free(positions);
+	return error;
+}
+
+static bool prefetch_skip(size_t pos, const void *payload)
+{
+	GIT_UNUSED(pos);
+	GIT_UNUSED(payload);
+	return false;
+}
+
+static int pack_backend__prefetch(
+	git_odb_backend *backend, const git_oid *ids, size_t count)
+{
+	struct git_pack_entry *entries;
+	size_t *positions, *order = NULL, len, found = 0, start, i;
+	off64_t *offsets = NULL;
+	int error;
+
+	if ((error = pack_entry_find_many(&entries, &positions, &len,
+			(struct pack_backend *)backend, ids, count,
+			prefetch_skip, NULL)) < 0 || !len)
+		return error;
+
+	order = git__calloc(len, sizeof(size_t));
+	offsets = git__calloc(len, sizeof(off64_t));
+
+	if (!order || !offsets) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (entries[i].p)
+			order[found++] = i;
+	}
+
+	git__qsort_r(order, found, sizeof(size_t), pack_entry_location_cmp, entries);
+
+	for (i = 0; i < found; i++)
+		offsets[i] = entries[order[i]].offset;
+
+	/* Prefetch the objects of each pack together */
+	for (start = 0, i = 1; i <= found; i++) {
+		struct git_pack_file *p = entries[order[start]].p;
+
+		if (i < found && entries[order[i]].p == p)
+			continue;
+
+		/* As a hint, a pack that cannot be read is not an error */
+		if (git_packfile_prefetch(p, &offsets[start], i - start) < 0)
+			git_error_clear();
+
+		start = i;
+	}
+
+done:
+	git__free(offsets);
+	git__free(order);
+	git__free(entries);
+	git__free(positions);
+	return error;
+}
+
+/*
+ * Inflate from the pack; `GIT_EBUFS` only asks for another round while
+ * the stream is still consuming input, as a committed pack cannot grow.
+ */
+static ssize_t pack_readstream__inflate(
+	git_packfile_stream *data,
+	void *buffer,
+	size_t len)
+{
+	off64_t curpos;
+	ssize_t read;
+
+	do {
+		curpos = data->curpos;
+		read = git_packfile_stream_read(data, buffer, len);
+	} while (read == GIT_EBUFS && data->curpos != curpos);
+
+	if (read == GIT_EBUFS) {
+		git_error_set(GIT_ERROR_ODB, "packed object is truncated");
+		return -1;
+	}
+
+	return read;
+}
+
+static int pack_readstream__read(
+	git_odb_stream *_stream,
+	char *buffer,
+	size_t len)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+	ssize_t read;
+
+	len = min(min(len, INT_MAX), stream->remain);
+
+	if (!len)
+		return 0;
+
+	if (stream->deltified)
+		read = git_delta_reader_read(&stream->delta_reader, buffer, len);
+	else
+		read = pack_readstream__inflate(&stream->data, buffer, len);
+
+	if (read < 0)
+		return (int)read;
+
+	if (read == 0) {
+		git_error_set(GIT_ERROR_ODB, "packed object is shorter than its declared size");
+		return -1;
+	}
+
+	stream->remain -= (size_t)read;
+	return (int)read;
+}
+
+static void pack_readstream__free(git_odb_stream *_stream)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	git_packfile_stream_dispose(&stream->data);
+	git__free(stream->base.data);
+	git__free(stream->delta);
+	git_mwindow_put_pack(stream->p);
+	git__free(stream);
+}
+
+/* Inflate the data of a delta, which is much smaller than its result */
+static int pack_readstream__read_delta(
+	struct pack_readstream *stream,
+	off64_t curpos,
+	size_t size)
+{
+	size_t len = 0, alloc_len;
+	ssize_t read;
+	int error;
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloc_len, size, 1);
+	stream->delta = git__malloc(alloc_len);
+	GIT_ERROR_CHECK_ALLOC(stream->delta);
+
+	if ((error = git_packfile_stream_open(&stream->data, stream->p, curpos)) < 0)
+		return error;
+
+	while (len < size) {
+		read = pack_readstream__inflate(&stream->data,
+			(char *)stream->delta + len, size - len);
+
+		if (read < 0)
+			return (int)read;
+		else if (read == 0)
+			break;
+
+		len += (size_t)read;
+	}
+
+	if (len != size) {
+		git_error_set(GIT_ERROR_ODB, "delta is shorter than its declared size");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int pack_backend__readstream(
+	git_odb_stream **stream_out,
+	size_t *len_out,
+	git_object_t *type_out,
+	git_odb_backend *backend,
+	const git_oid *oid)
+{
+	struct pack_readstream *stream = NULL;
+	struct git_pack_entry e;
+	git_mwindow *w_curs = NULL;
+	off64_t curpos, base_offset;
+	git_object_t type;
+	size_t size;
+	int error;
+
+	GIT_ASSERT_ARG(stream_out);
+	GIT_ASSERT_ARG(len_out);
+	GIT_ASSERT_ARG(type_out);
+	GIT_ASSERT_ARG(backend);
+	GIT_ASSERT_ARG(oid);
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	stream = git__calloc(1, sizeof(struct pack_readstream));
+	GIT_ERROR_CHECK_ALLOC(stream);
+
+	/* The stream may outlive the backend, so keep the pack open */
+	git_atomic32_inc(&e.p->refcount);
+	stream->p = e.p;
+
+	curpos = e.offset;
+	error = git_packfile_unpack_header(&size, &type, e.p, &w_curs, &curpos);
+
+	if (!error && (type == GIT_PACKFILE_OFS_DELTA || type == GIT_PACKFILE_REF_DELTA))
+		error = get_delta_base(&base_offset, e.p, &w_curs, &curpos, type, e.offset);
+
+	git_mwindow_close(&w_curs);
+
+	if (error < 0)
+		goto done;
+
+	switch ((int)type) {
+	case GIT_OBJECT_COMMIT:
+	case GIT_OBJECT_TREE:
+	case GIT_OBJECT_BLOB:
+	case GIT_OBJECT_TAG:
+		/* Undeltified objects are inflated straight from the pack */
+		if ((error = git_packfile_stream_open(&stream->data, e.p, curpos)) < 0)
+			goto done;
+
+		stream->remain = size;
+		break;
+	case GIT_PACKFILE_OFS_DELTA:
+	case GIT_PACKFILE_REF_DELTA:
+		/*
+		 * Deltas are applied as the result is read, so only the
+		 * base and the delta itself are held in memory.
+		 */
+		if ((error = pack_readstream__read_delta(stream, curpos, size)) < 0 ||
+		    (error = git_packfile_unpack(&stream->base, e.p, &base_offset)) < 0 ||
+		    (error = git_delta_reader_init(&stream->delta_reader,
+				&stream->remain, stream->base.data, stream->base.len,
+				stream->delta, size)) < 0)
+			goto done;
+
+		stream->deltified = true;
+		type = stream->base.type;
+		break;
+	default:
+		git_error_set(GIT_ERROR_ODB, "invalid packfile type in header");
+		error = -1;
+		goto done;
+	}
+
+	stream->parent.backend = backend;
+	stream->parent.read = &pack_readstream__read;
+	stream->parent.free = &pack_readstream__free;
+
+	*stream_out = (git_odb_stream *)stream;
+	*len_out = stream->remain;
+	*type_out = type;
+
+done:
+	if (error < 0)
+		pack_readstream__free((git_odb_stream *)stream);
+
+	return error;
+}
+
+static void pack_backend__release_shared(void *payload)
+{
+	git_packfile_shared_release(payload);
+}
+
+static int pack_backend__read_shared(
+	const void **buffer_p, size_t *len_p, git_object_t *type_p,
+	git_odb_backend_release_cb *release, void **release_payload,
+	git_odb_backend *backend, const git_oid *oid)
+{
+	struct git_pack_entry e;
+	git_pack_cache_entry *shared;
+	git_rawobj raw = {NULL};
+	int error;
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0 ||
+	    (error = git_packfile_unpack_shared(&raw, &shared, e.p, e.offset)) < 0)
+		return error;
+
+	*buffer_p = raw.data;
+	*len_p = raw.len;
+	*type_p = raw.type;
+
+	if (shared) {
+		*release = pack_backend__release_shared;
+		*release_payload = shared;
+	}
+
+	return 0;
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -682,6 +1289,202 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	return 0;
 }
 
+static int foreach_parallel_add(
+	struct foreach_parallel *fp,
+	struct git_pack_file *p,
+	uint32_t count,
+	size_t part_size)
+{
+	struct foreach_part *part;
+	uint32_t start;
+
+	for (start = 0; start < count; start = part->end) {
+		part = git_array_alloc(fp->parts);
+		GIT_ERROR_CHECK_ALLOC(part);
+
+		part->p = p;
+		part->start = start;
+		part->end = (count - start > part_size) ?
+			start + (uint32_t)part_size : count;
+	}
+
+	return 0;
+}
+
+static void foreach_parallel_fail(struct foreach_parallel *fp, int error)
+{
+	if (git_mutex_lock(&fp->lock) < 0)
+		return;
+
+	if (!fp->error) {
+		fp->error = error;
+		git_error_save(&fp->error_info);
+		git_atomic32_set(&fp->stop, 1);
+	}
+
+	git_mutex_unlock(&fp->lock);
+}
+
+static int foreach_parallel_cb(const git_oid *id, void *payload)
+{
+	struct foreach_parallel_worker *worker = payload;
+	struct foreach_parallel *fp = worker->fp;
+
+	/* Another thread failed; this error is not reported */
+	if (git_atomic32_get(&fp->stop))
+		return -1;
+
+	return fp->cb(id, worker->thread, fp->payload);
+}
+
+/*
+ * List the objects of parts until there are none left.  Each of the
+ * workers takes the next part that nobody has taken yet.
+ */
+static void *foreach_parallel_list(void *payload)
+{
+	struct foreach_parallel_worker *worker = payload;
+	struct foreach_parallel *fp = worker->fp;
+	struct foreach_part *part;
+	int32_t pos;
+	int error = 0;
+
+	while (!git_atomic32_get(&fp->stop) &&
+	       (pos = git_atomic32_inc(&fp->next) - 1) >= 0 &&
+	       (size_t)pos < git_array_size(fp->parts)) {
+		part = git_array_get(fp->parts, (size_t)pos);
+
+		if (part->p)
+			error = git_pack_foreach_entry_range(part->p,
+				part->start, part->end, foreach_parallel_cb, worker);
+		else
+			error = git_midx_foreach_entry_range(fp->midx,
+				part->start, part->end, foreach_parallel_cb, worker);
+
+		if (error != 0) {
+			foreach_parallel_fail(fp, error);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int pack_backend__foreach_parallel(
+	git_odb_backend *_backend,
+	unsigned int threads,
+	git_odb_foreach_parallel_cb cb,
+	void *payload)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct foreach_parallel fp = {0};
+	struct foreach_parallel_worker *workers = NULL;
+	struct git_pack_file *p;
+	size_t total = 0, part_size, i;
+	uint32_t count;
+	int error;
+
+	GIT_ASSERT_ARG(_backend);
+	GIT_ASSERT_ARG(cb);
+
+	/* Make sure we know about the packfiles */
+	if ((error = pack_backend__refresh(_backend)) != 0)
+		return error;
+
+	fp.midx = backend->midx;
+	fp.cb = cb;
+	fp.payload = payload;
+
+	if (git_mutex_init(&fp.lock) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to initialize foreach lock");
+		return -1;
+	}
+
+	/*
+	 * Split the multi-pack-index and the packs that it does not cover
+	 * into ranges of their indexes, so that a few large packs keep all
+	 * of the threads busy as well as many small ones.
+	 */
+	if (fp.midx)
+		total += fp.midx->num_objects;
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = git_pack_num_objects(&count, p)) < 0)
+			goto done;
+
+		total += count;
+	}
+
+	threads = max(threads, 1);
+	part_size = max(total / ((size_t)threads * FOREACH_PARALLEL_PARTS_PER_THREAD),
+	                git_odb_pack__foreach_min_part);
+
+	if (fp.midx &&
+	    (error = foreach_parallel_add(&fp, NULL, fp.midx->num_objects, part_size)) < 0)
+		goto done;
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = git_pack_num_objects(&count, p)) < 0 ||
+		    (error = foreach_parallel_add(&fp, p, count, part_size)) < 0)
+			goto done;
+	}
+
+	threads = (unsigned int)min((size_t)threads, git_array_size(fp.parts));
+
+	if (!threads)
+		goto done;
+
+	workers = git__calloc(threads, sizeof(struct foreach_parallel_worker));
+	GIT_ERROR_CHECK_ALLOC(workers);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].fp = &fp;
+		workers[i].thread = (unsigned int)i;
+	}
+
+#ifdef GIT_THREADS
+	if (threads > 1) {
+		git_thread *thread_handles = git__calloc(threads, sizeof(git_thread));
+		size_t started = 0;
+
+		if (!thread_handles) {
+			error = -1;
+			goto done;
+		}
+
+		for (i = 0; i < threads; i++) {
+			if (git_thread_create(&thread_handles[i], foreach_parallel_list, &workers[i]) != 0) {
+				git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+				foreach_parallel_fail(&fp, -1);
+				break;
+			}
+
+			started++;
+		}
+
+		for (i = 0; i < started; i++)
+			git_thread_join(&thread_handles[i], NULL);
+
+		git__free(thread_handles);
+	} else
+#endif
+	{
+		foreach_parallel_list(&workers[0]);
+	}
+
+	if (fp.error) {
+		error = fp.error;
+		git_error_restore(fp.error_info);
+		fp.error_info = NULL;
+	}
+
+done:
+	git__free(workers);
+	git_array_clear(fp.parts);
+	git_mutex_free(&fp.lock);
+	return error;
+}
+
 static int pack_backend__writepack_append(struct git_odb_writepack *_writepack, const void *data, size_t size, git_indexer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
@@ -694,10 +1497,19 @@ static int pack_backend__writepack_append(struct git_odb_writepack *_writepack,
 static int pack_backend__writepack_commit(struct git_odb_writepack *_writepack, git_indexer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
+	git_odb *odb;
+	int error;
 
 	GIT_ASSERT_ARG(writepack);
 
-	return git_indexer_commit(writepack->indexer, stats);
+	if ((error = git_indexer_commit(writepack->indexer, stats)) < 0)
+		return error;
+
+	/* The new objects are only found once the packs are refreshed */
+	if ((odb = writepack->parent.backend->odb) != NULL)
+		git_odb__invalidate_missing(odb);
+
+	return 0;
 }
 
 static void pack_backend__writepack_free(struct git_odb_writepack *_writepack)
@@ -713,6 +1525,34 @@ static void pack_backend__writepack_free(struct git_odb_writepack *_writepack)
 	git__free(writepack);
 }
 
+static int pack_backend__foreach_object(
+	git_odb_backend *_backend, git_odb_foreach_object_cb cb, void *data)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct git_pack_file *p;
+	size_t i;
+	int error;
+
+	GIT_ASSERT_ARG(_backend);
+	GIT_ASSERT_ARG(cb);
+
+	/* Make sure we know about the packfiles */
+	if ((error = pack_backend__refresh(_backend)) != 0)
+		return error;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if ((error = git_pack_foreach_object(p, cb, data)) != 0)
+			return error;
+	}
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = git_pack_foreach_object(p, cb, data)) != 0)
+			return error;
+	}
+
+	return 0;
+}
+
 static int pack_backend__writepack(struct git_odb_writepack **out,
 	git_odb_backend *_backend,
         git_odb *odb,
@@ -739,6 +1579,7 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 
 	opts.odb = odb;
 	opts.oid_type = backend->opts.oid_type;
+	opts.stream_deltas = git_odb_pack__stream_deltas;
 
 	error = git_indexer_new(&writepack->indexer,
 		backend->pack_folder,
@@ -857,6 +1698,8 @@ static void pack_backend__free(git_odb_backend *_backend)
 	git_midx_free(backend->midx);
 	git_vector_dispose(&backend->midx_packs);
 	git_vector_dispose(&backend->packs);
+	pack_backend_lookupmap_dispose(&backend->lookups);
+	git_pool_clear(&backend->lookup_pool);
 	git__free(backend->pack_folder);
 	git__free(backend);
 }
@@ -887,7 +1730,9 @@ static int pack_backend__alloc(
 		return -1;
 	}
 
-	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0 ||
+	    git_pool_init(&backend->lookup_pool, sizeof(struct git_pack_entry)) < 0) {
+		git_vector_dispose(&backend->packs);
 		git_vector_dispose(&backend->midx_packs);
 		git__free(backend);
 		return -1;
@@ -902,21 +1747,39 @@ static int pack_backend__alloc(
 	backend->parent.version = GIT_ODB_BACKEND_VERSION;
 
 	backend->parent.read = &pack_backend__read;
+	backend->parent.read_shared = &pack_backend__read_shared;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
 	backend->parent.refresh = &pack_backend__refresh;
 	backend->parent.foreach = &pack_backend__foreach;
+	backend->parent.foreach_parallel = &pack_backend__foreach_parallel;
+	backend->parent.foreach_object = &pack_backend__foreach_object;
 	backend->parent.writepack = &pack_backend__writepack;
 	backend->parent.writemidx = &pack_backend__writemidx;
 	backend->parent.freshen = &pack_backend__freshen;
+	backend->parent.exists_many = &pack_backend__exists_many;
+	backend->parent.read_many = &pack_backend__read_many;
+	backend->parent.prefetch = &pack_backend__prefetch;
 	backend->parent.free = &pack_backend__free;
 
 	*out = backend;
 	return 0;
 }
 
+int git_odb_pack__find_entry(
+	struct git_pack_entry *out,
+	git_odb_backend *backend,
+	const git_oid *id)
+{
+	if (backend->read != pack_backend__read)
+		return GIT_PASSTHROUGH;
+
+	return pack_entry_find(out, (struct pack_backend *)backend, id);
+}
+
 int git_odb_backend_one_pack(
 	git_odb_backend **backend_out,
 	const char *idx,
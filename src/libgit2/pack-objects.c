@@ -9,6 +9,7 @@
 
 #include "buf.h"
 #include "zstream.h"
+#include "delta_islands.h"
 #include "delta.h"
 #include "iterator.h"
 #include "pack.h"
@@ -17,6 +18,7 @@
 #include "util.h"
 #include "revwalk.h"
 #include "commit_list.h"
+#include "pack_bitmap.h"
 
 #include "git2/pack.h"
 #include "git2/commit.h"
@@ -142,11 +144,13 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 	hash_algorithm = git_oid_algorithm(pb->oid_type);
 	GIT_ASSERT(hash_algorithm);
 
-	if (git_pool_init(&pb->object_pool, sizeof(struct walk_object)) < 0)
+	if (git_pool_init(&pb->object_pool, sizeof(struct walk_object)) < 0 ||
+	    git_vector_init(&pb->whole_packs, 0, NULL) < 0)
 		goto on_error;
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->reuse = true;
 
 	if (git_hash_ctx_init(&pb->ctx, hash_algorithm) < 0 ||
 		git_zstream_init(&pb->zstream, GIT_ZSTREAM_DEFLATE) < 0 ||
@@ -157,8 +161,7 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 #ifdef GIT_THREADS
 
 	if (git_mutex_init(&pb->cache_mutex) ||
-		git_mutex_init(&pb->progress_mutex) ||
-		git_cond_init(&pb->progress_cond))
+		git_mutex_init(&pb->progress_mutex))
 	{
 		git_error_set(GIT_ERROR_OS, "failed to initialize packbuilder mutex");
 		goto on_error;
@@ -188,6 +191,30 @@ unsigned int git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n)
 	return pb->nr_threads;
 }
 
+int git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled)
+{
+	GIT_ASSERT_ARG(pb);
+
+	pb->write_bitmap = !!enabled;
+	return 0;
+}
+
+int git_packbuilder_set_reuse(git_packbuilder *pb, int enabled)
+{
+	GIT_ASSERT_ARG(pb);
+
+	pb->reuse = !!enabled;
+	return 0;
+}
+
+int git_packbuilder_set_delta_islands(git_packbuilder *pb, int enabled)
+{
+	GIT_ASSERT_ARG(pb);
+
+	pb->delta_islands = !!enabled;
+	return 0;
+}
+
 static int rehash(git_packbuilder *pb)
 {
 	git_pobject *po;
@@ -203,16 +230,13 @@ static int rehash(git_packbuilder *pb)
 	return 0;
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+static int insert_object(git_packbuilder *pb, const git_oid *oid,
+			 uint32_t hash)
 {
 	git_pobject *po;
 	size_t newsize;
 	int ret;
 
-	GIT_ASSERT_ARG(pb);
-	GIT_ASSERT_ARG(oid);
-
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
 	if (git_packbuilder_pobjectmap_contains(&pb->object_ix, oid))
@@ -245,7 +269,7 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	if (git_packbuilder_pobjectmap_put(&pb->object_ix, &po->id, po) < 0) {
 		git_error_set_oom();
@@ -273,6 +297,15 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	GIT_ASSERT_ARG(pb);
+	GIT_ASSERT_ARG(oid);
+
+	return insert_object(pb, oid, name_hash(name));
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -311,61 +344,191 @@ on_error:
 	return -1;
 }
 
-static int write_object(
-	git_packbuilder *pb,
-	git_pobject *po,
-	int (*write_cb)(void *buf, size_t size, void *cb_data),
-	void *cb_data)
+/*
+ * Look up how the object is stored in its pack, if its compressed data can
+ * be copied from there: either it is stored whole and we did not find a
+ * delta for it, or it is stored as the delta that we decided to reuse.
+ * Returns 1 when the data can be copied.
+ */
+static int reusable_data(git_packfile_raw *raw, git_pobject *po)
+{
+	bool is_delta;
+
+	if (!po->reuse_pack || (po->delta && !po->reuse_delta))
+		return 0;
+
+	if (git_packfile_raw_info(raw, po->reuse_pack, po->reuse_offset) < 0)
+		goto not_reusable;
+
+	is_delta = (raw->type == GIT_PACKFILE_OFS_DELTA ||
+	            raw->type == GIT_PACKFILE_REF_DELTA);
+
+	/* The reused delta was dropped to break a loop */
+	if (is_delta != (po->delta != NULL))
+		return 0;
+
+	if (git_packfile_raw_verify(po->reuse_pack, raw, &po->id) < 0)
+		goto not_reusable;
+
+	return 1;
+
+not_reusable:
+	/* Fall back to writing the object from scratch */
+	git_error_clear();
+
+	if (po->reuse_delta)
+		po->delta = NULL;
+
+	po->reuse_pack = NULL;
+	po->reuse_delta = 0;
+
+	return 0;
+}
+
+struct reuse_write_context {
+	git_packbuilder *pb;
+	int (*write_cb)(void *buf, size_t size, void *cb_data);
+	void *cb_data;
+};
+
+static int write_reused_data(const void *data, size_t len, void *payload)
 {
-	git_odb_object *obj = NULL;
+	struct reuse_write_context *ctx = payload;
+	int error;
+
+	if ((error = ctx->write_cb((void *)data, len, ctx->cb_data)) < 0 ||
+	    (error = git_hash_update(&ctx->pb->ctx, data, len)) < 0)
+		return error;
+
+	return 0;
+}
+
+/* What gets written into the pack for an object. */
+struct object_data {
 	git_object_t type;
-	unsigned char hdr[10], *zbuf = NULL;
-	void *data = NULL;
-	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len, oid_size;
+	size_t len; /* the inflated size, as recorded in the header */
+
+	/* When the compressed data is copied from an existing pack */
+	int reuse;
+	git_packfile_raw raw;
+
+	/* Otherwise, the data to compress, or the compressed delta */
+	git_odb_object *obj;
+	void *data;
+};
+
+static int object_data_load(
+	struct object_data *od,
+	git_packbuilder *pb,
+	git_pobject *po)
+{
 	int error;
 
-	oid_size = git_oid_size(pb->oid_type);
+	memset(od, 0, sizeof(*od));
 
 	/*
-	 * If we have a delta base, let's use the delta to save space.
-	 * Otherwise load the whole object. 'data' ends up pointing to
-	 * whatever data we want to put into the packfile.
+	 * If the object is already compressed in a pack, copy it from
+	 * there. If we have a delta base, let's use the delta to save
+	 * space. Otherwise load the whole object. 'data' ends up pointing
+	 * to whatever data we want to put into the packfile.
 	 */
-	if (po->delta) {
+	od->reuse = reusable_data(&od->raw, po);
+
+	if (od->reuse) {
+		od->len = od->raw.size;
+		od->type = po->delta ? GIT_PACKFILE_REF_DELTA : od->raw.type;
+	} else if (po->delta) {
 		if (po->delta_data)
-			data = po->delta_data;
-		else if ((error = get_delta(&data, pb->odb, po)) < 0)
-				goto done;
+			od->data = po->delta_data;
+		else if ((error = get_delta(&od->data, pb->odb, po)) < 0)
+				return error;
 
-		data_len = po->delta_size;
-		type = GIT_PACKFILE_REF_DELTA;
+		od->len = po->delta_size;
+		od->type = GIT_PACKFILE_REF_DELTA;
 	} else {
-		if ((error = git_odb_read(&obj, pb->odb, &po->id)) < 0)
-			goto done;
+		if ((error = git_odb_read(&od->obj, pb->odb, &po->id)) < 0)
+			return error;
+
+		od->data = (void *)git_odb_object_data(od->obj);
+		od->len = git_odb_object_size(od->obj);
+		od->type = git_odb_object_type(od->obj);
+	}
+
+	return 0;
+}
+
+static void object_data_dispose(struct object_data *od, git_pobject *po)
+{
+	/*
+	 * If po->delta is true, data is a delta and it is our
+	 * responsibility to free it (otherwise it's a git_object's
+	 * data). We set po->delta_data to NULL in case we got the
+	 * data from there instead of get_delta(). If we didn't,
+	 * there's no harm.
+	 */
+	if (po->delta && !od->reuse) {
+		git__free(od->data);
+		po->delta_data = NULL;
+	}
+
+	git_odb_object_free(od->obj);
+	memset(od, 0, sizeof(*od));
+}
+
+/* The object header, followed by the delta base for a delta. */
+static int object_data_header(
+	unsigned char *hdr,
+	size_t *hdr_len,
+	git_packbuilder *pb,
+	git_pobject *po,
+	struct object_data *od)
+{
+	size_t oid_size = git_oid_size(pb->oid_type);
+	int error;
+
+	if ((error = git_packfile__object_header(hdr_len, hdr, od->len, od->type)) < 0)
+		return error;
 
-		data = (void *)git_odb_object_data(obj);
-		data_len = git_odb_object_size(obj);
-		type = git_odb_object_type(obj);
+	if (od->type == GIT_PACKFILE_REF_DELTA) {
+		memcpy(hdr + *hdr_len, po->delta->id.id, oid_size);
+		*hdr_len += oid_size;
 	}
 
+	return 0;
+}
+
+#define OBJECT_HEADER_MAX (10 + GIT_OID_MAX_SIZE)
+
+static int write_object(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct object_data od;
+	unsigned char hdr[OBJECT_HEADER_MAX], *zbuf = NULL;
+	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN;
+	int error;
+
+	if ((error = object_data_load(&od, pb, po)) < 0)
+		goto done;
+
 	/* Write header */
-	if ((error = git_packfile__object_header(&hdr_len, hdr, data_len, type)) < 0 ||
+	if ((error = object_data_header(hdr, &hdr_len, pb, po, &od)) < 0 ||
 	    (error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
 	    (error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
 		goto done;
 
-	if (type == GIT_PACKFILE_REF_DELTA) {
-		if ((error = write_cb(po->delta->id.id, oid_size, cb_data)) < 0 ||
-		    (error = git_hash_update(&pb->ctx, po->delta->id.id, oid_size)) < 0)
-			goto done;
-	}
-
 	/* Write data */
-	if (po->z_delta_size) {
-		data_len = po->z_delta_size;
+	if (od.reuse) {
+		struct reuse_write_context ctx = { pb, write_cb, cb_data };
 
-		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, data, data_len)) < 0)
+		if ((error = git_packfile_raw_copy(po->reuse_pack, &od.raw,
+				write_reused_data, &ctx)) < 0)
+			goto done;
+	} else if (po->z_delta_size) {
+		if ((error = write_cb(od.data, po->z_delta_size, cb_data)) < 0 ||
+			(error = git_hash_update(&pb->ctx, od.data, po->z_delta_size)) < 0)
 			goto done;
 	} else {
 		zbuf = git__malloc(zbuf_len);
@@ -373,7 +536,7 @@ static int write_object(
 
 		git_zstream_reset(&pb->zstream);
 
-		if ((error = git_zstream_set_input(&pb->zstream, data, data_len)) < 0)
+		if ((error = git_zstream_set_input(&pb->zstream, od.data, od.len)) < 0)
 			goto done;
 
 		while (!git_zstream_done(&pb->zstream)) {
@@ -386,23 +549,11 @@ static int write_object(
 		}
 	}
 
-	/*
-	 * If po->delta is true, data is a delta and it is our
-	 * responsibility to free it (otherwise it's a git_object's
-	 * data). We set po->delta_data to NULL in case we got the
-	 * data from there instead of get_delta(). If we didn't,
-	 * there's no harm.
-	 */
-	if (po->delta) {
-		git__free(data);
-		po->delta_data = NULL;
-	}
-
 	pb->nr_written++;
 
 done:
+	object_data_dispose(&od, po);
 	git__free(zbuf);
-	git_odb_object_free(obj);
 	return error;
 }
 
@@ -413,28 +564,28 @@ enum write_one_status {
 	WRITE_ONE_RECURSIVE = 2 /* already scheduled to be written */
 };
 
-static int write_one(
+/*
+ * Append the object to the list of objects to write, after its delta
+ * base, unless it is already in there.
+ */
+static void write_one(
 	enum write_one_status *status,
-	git_packbuilder *pb,
-	git_pobject *po,
-	int (*write_cb)(void *buf, size_t size, void *cb_data),
-	void *cb_data)
+	git_pobject **out,
+	size_t *out_len,
+	git_pobject *po)
 {
-	int error;
-
 	if (po->recursing) {
 		*status = WRITE_ONE_RECURSIVE;
-		return 0;
+		return;
 	} else if (po->written) {
 		*status = WRITE_ONE_SKIP;
-		return 0;
+		return;
 	}
 
 	if (po->delta) {
 		po->recursing = 1;
 
-		if ((error = write_one(status, pb, po->delta, write_cb, cb_data)) < 0)
-			return error;
+		write_one(status, out, out_len, po->delta);
 
 		/* we cannot depend on this one */
 		if (*status == WRITE_ONE_RECURSIVE)
@@ -445,7 +596,327 @@ static int write_one(
 	po->written = 1;
 	po->recursing = 0;
 
-	return write_object(pb, po, write_cb, cb_data);
+	out[(*out_len)++] = po;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * Objects are compressed by a pool of threads, as many as the delta
+ * search uses, while the calling thread writes them out in order. A
+ * thread only starts on an object when the objects that are written
+ * before it leave a free slot, so that the compressed data that is held
+ * in memory stays bounded.
+ */
+#define WRITE_SLOTS_PER_THREAD 4
+
+struct write_slot {
+	git_str buf; /* the header, then the compressed data */
+	struct object_data od;
+	int error;
+	git_error *error_info;
+	bool ready;
+};
+
+struct write_threads {
+	git_packbuilder *pb;
+	git_pobject **order;
+	size_t order_len;
+
+	struct write_slot *slots;
+	size_t nr_slots;
+
+	/* Protected by the lock */
+	size_t next; /* the next object to compress */
+	size_t written; /* the objects that were written out */
+	bool stop;
+
+	/* The threads that are done, so that the writer doesn't wait on them */
+	git_atomic32 exited;
+
+	git_mutex lock;
+	git_cond cond;
+};
+
+static int compress_object(
+	struct write_slot *slot,
+	git_zstream *zstream,
+	git_packbuilder *pb,
+	git_pobject *po)
+{
+	unsigned char hdr[OBJECT_HEADER_MAX];
+	size_t hdr_len, len;
+	int error;
+
+	if ((error = object_data_load(&slot->od, pb, po)) < 0 ||
+	    (error = object_data_header(hdr, &hdr_len, pb, po, &slot->od)) < 0 ||
+	    (error = git_str_put(&slot->buf, (char *)hdr, hdr_len)) < 0)
+		return error;
+
+	/* Reused data is copied as it is written out */
+	if (slot->od.reuse)
+		return 0;
+
+	if (po->z_delta_size)
+		return git_str_put(&slot->buf, slot->od.data, po->z_delta_size);
+
+	git_zstream_reset(zstream);
+
+	if ((error = git_zstream_set_input(zstream, slot->od.data, slot->od.len)) < 0)
+		return error;
+
+	while (!git_zstream_done(zstream)) {
+		if ((error = git_str_grow_by(&slot->buf,
+				git_zstream_suggest_output_len(zstream))) < 0)
+			return error;
+
+		len = slot->buf.asize - slot->buf.size;
+
+		if ((error = git_zstream_get_output(slot->buf.ptr + slot->buf.size,
+				&len, zstream)) < 0)
+			return error;
+
+		slot->buf.size += len;
+	}
+
+	return 0;
+}
+
+static void *threaded_compress(void *arg)
+{
+	struct write_threads *wt = arg;
+	git_zstream zstream = GIT_ZSTREAM_INIT;
+	struct write_slot *slot;
+	git_pobject *po;
+	bool locked = false;
+	size_t i;
+	int error;
+
+	error = git_zstream_init(&zstream, GIT_ZSTREAM_DEFLATE);
+
+	if (git_mutex_lock(&wt->lock) < 0)
+		goto done;
+
+	locked = true;
+
+	for (;;) {
+		while (!wt->stop && wt->next < wt->order_len &&
+		       wt->next >= wt->written + wt->nr_slots)
+			git_cond_wait(&wt->cond, &wt->lock);
+
+		if (wt->stop || wt->next >= wt->order_len)
+			break;
+
+		i = wt->next++;
+		git_mutex_unlock(&wt->lock);
+		locked = false;
+
+		slot = &wt->slots[i % wt->nr_slots];
+		po = wt->order[i];
+
+		if (error < 0 || (error = compress_object(slot, &zstream, wt->pb, po)) < 0) {
+			slot->error = error;
+			git_error_save(&slot->error_info);
+		}
+
+		/*
+		 * The writer waits for every object that was claimed, so
+		 * publish the slot even when the lock can't be taken.
+		 */
+		if (git_mutex_lock(&wt->lock) < 0) {
+			if (!slot->error) {
+				git_error_set(GIT_ERROR_OS, "failed to lock packbuilder mutex");
+				slot->error = -1;
+				git_error_save(&slot->error_info);
+			}
+
+			slot->ready = true;
+			goto done;
+		}
+
+		locked = true;
+		slot->ready = true;
+		git_cond_broadcast(&wt->cond);
+	}
+
+done:
+	/* Counted with the lock held, if we have it, so the writer sees it */
+	git_atomic32_inc(&wt->exited);
+	git_cond_broadcast(&wt->cond);
+
+	if (locked)
+		git_mutex_unlock(&wt->lock);
+
+	git_zstream_free(&zstream);
+	return NULL;
+}
+
+static int write_compressed(
+	git_packbuilder *pb,
+	git_pobject *po,
+	struct write_slot *slot,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	int error;
+
+	if ((error = write_cb(slot->buf.ptr, slot->buf.size, cb_data)) < 0 ||
+	    (error = git_hash_update(&pb->ctx, slot->buf.ptr, slot->buf.size)) < 0)
+		return error;
+
+	if (slot->od.reuse) {
+		struct reuse_write_context ctx = { pb, write_cb, cb_data };
+
+		if ((error = git_packfile_raw_copy(po->reuse_pack, &slot->od.raw,
+				write_reused_data, &ctx)) < 0)
+			return error;
+	}
+
+	pb->nr_written++;
+	return 0;
+}
+
+static int write_objects_threaded(
+	git_packbuilder *pb,
+	git_pobject **order,
+	size_t order_len,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct write_threads wt = {0};
+	git_thread *threads;
+	struct write_slot *slot;
+	size_t nr_threads, started = 0, i;
+	int error = 0;
+
+	nr_threads = min(pb->nr_threads, order_len);
+
+	wt.pb = pb;
+	wt.order = order;
+	wt.order_len = order_len;
+	wt.nr_slots = nr_threads * WRITE_SLOTS_PER_THREAD;
+
+	threads = git__calloc(nr_threads, sizeof(git_thread));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	wt.slots = git__calloc(wt.nr_slots, sizeof(struct write_slot));
+	if (!wt.slots) {
+		git__free(threads);
+		return -1;
+	}
+
+	if (git_mutex_init(&wt.lock) < 0 || git_cond_init(&wt.cond) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize packbuilder mutex");
+		git__free(wt.slots);
+		git__free(threads);
+		return -1;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		if (git_thread_create(&threads[i], threaded_compress, &wt) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			error = -1;
+			goto done;
+		}
+
+		started++;
+	}
+
+	for (i = 0; i < order_len; i++) {
+		slot = &wt.slots[i % wt.nr_slots];
+
+		if ((error = git_mutex_lock(&wt.lock)) < 0)
+			goto done;
+
+		while (!slot->ready &&
+		       (size_t)git_atomic32_get(&wt.exited) < started)
+			git_cond_wait(&wt.cond, &wt.lock);
+
+		git_mutex_unlock(&wt.lock);
+
+		if (!slot->ready) {
+			git_error_set(GIT_ERROR_THREAD, "compression threads exited unexpectedly");
+			error = -1;
+			goto done;
+		}
+
+		if (slot->error) {
+			git_error_restore(slot->error_info);
+			slot->error_info = NULL;
+			error = slot->error;
+		} else {
+			error = write_compressed(pb, order[i], slot, write_cb, cb_data);
+		}
+
+		object_data_dispose(&slot->od, order[i]);
+		git_str_clear(&slot->buf);
+		slot->ready = false;
+
+		if (error < 0)
+			goto done;
+
+		if ((error = git_mutex_lock(&wt.lock)) < 0)
+			goto done;
+
+		wt.written++;
+		git_cond_broadcast(&wt.cond);
+		git_mutex_unlock(&wt.lock);
+	}
+
+done:
+	if (git_mutex_lock(&wt.lock) == 0) {
+		wt.stop = true;
+		git_cond_broadcast(&wt.cond);
+		git_mutex_unlock(&wt.lock);
+	}
+
+	for (i = 0; i < started; i++)
+		git_thread_join(&threads[i], NULL);
+
+	/* Release the objects that were compressed but not written */
+	for (i = wt.written; i < wt.next; i++) {
+		slot = &wt.slots[i % wt.nr_slots];
+
+		object_data_dispose(&slot->od, order[i]);
+		git_error_free(slot->error_info);
+	}
+
+	for (i = 0; i < wt.nr_slots; i++)
+		git_str_dispose(&wt.slots[i].buf);
+
+	git_cond_free(&wt.cond);
+	git_mutex_free(&wt.lock);
+	git__free(wt.slots);
+	git__free(threads);
+	return error;
+}
+
+#endif
+
+static int write_objects(
+	git_packbuilder *pb,
+	git_pobject **order,
+	size_t order_len,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	size_t i;
+	int error;
+
+#ifdef GIT_THREADS
+	if (!pb->nr_threads)
+		pb->nr_threads = git__online_cpus();
+
+	if (pb->nr_threads > 1 && order_len > 1)
+		return write_objects_threaded(pb, order, order_len, write_cb, cb_data);
+#endif
+
+	for (i = 0; i < order_len; i++) {
+		if ((error = write_object(pb, order[i], write_cb, cb_data)) < 0)
+			return error;
+	}
+
+	return 0;
 }
 
 GIT_INLINE(void) add_to_write_order(git_pobject **wo, size_t *endp,
@@ -630,16 +1101,53 @@ static int compute_write_order(git_pobject ***out, git_packbuilder *pb)
 	return 0;
 }
 
-static int write_pack(git_packbuilder *pb,
+/*
+ * Copy the packs whose objects are all in the new pack, skipping only
+ * their headers and trailers.
+ */
+static int write_whole_packs(
+	uint32_t *copied,
+	git_packbuilder *pb,
 	int (*write_cb)(void *buf, size_t size, void *cb_data),
 	void *cb_data)
 {
-	git_pobject **write_order;
+	struct reuse_write_context ctx = { pb, write_cb, cb_data };
+	struct git_pack_file *p;
 	git_pobject *po;
+	uint32_t num_objects;
+	size_t i;
+	int error;
+
+	*copied = 0;
+
+	git_vector_foreach(&pb->whole_packs, i, p) {
+		if ((error = git_pack_num_objects(&num_objects, p)) < 0 ||
+		    (error = git_packfile_copy_objects(p, write_reused_data, &ctx)) < 0)
+			return error;
+
+		*copied += num_objects;
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (po->whole_pack)
+			po->written = 1;
+	}
+
+	return 0;
+}
+
+static int write_pack(git_packbuilder *pb,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	git_pobject **write_order, **order = NULL;
 	enum write_one_status status;
 	struct git_pack_header ph;
 	git_oid entry_oid;
-	size_t i = 0;
+	uint32_t copied;
+	size_t order_len = 0, i;
 	int error;
 
 	if ((error = compute_write_order(&write_order, pb)) < 0)
@@ -661,17 +1169,23 @@ static int write_pack(git_packbuilder *pb,
 		goto done;
 
 	pb->nr_remaining = pb->nr_objects;
-	do {
-		pb->nr_written = 0;
-		for ( ; i < pb->nr_objects; ++i) {
-			po = write_order[i];
 
-			if ((error = write_one(&status, pb, po, write_cb, cb_data)) < 0)
-				goto done;
-		}
+	if ((error = write_whole_packs(&copied, pb, write_cb, cb_data)) < 0)
+		goto done;
+
+	/* Put the delta bases before the objects that refer to them */
+	order = git__mallocarray(pb->nr_objects, sizeof(git_pobject *));
+	GIT_ERROR_CHECK_ALLOC(order);
+
+	for (i = 0; i < pb->nr_objects; i++)
+		write_one(&status, order, &order_len, write_order[i]);
+
+	pb->nr_written = copied;
+
+	if ((error = write_objects(pb, order, order_len, write_cb, cb_data)) < 0)
+		goto done;
 
-		pb->nr_remaining -= pb->nr_written;
-	} while (pb->nr_remaining && i < pb->nr_objects);
+	pb->nr_remaining -= pb->nr_written;
 
 	memset(&entry_oid, 0, sizeof(git_oid));
 
@@ -682,14 +1196,15 @@ static int write_pack(git_packbuilder *pb,
 
 done:
 	/* if callback cancelled writing, we must still free delta_data */
-	for ( ; i < pb->nr_objects; ++i) {
-		po = write_order[i];
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = write_order[i];
 		if (po->delta_data) {
 			git__free(po->delta_data);
 			po->delta_data = NULL;
 		}
 	}
 
+	git__free(order);
 	git__free(write_order);
 	return error;
 }
@@ -771,7 +1286,9 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	*ret = 0;
 
-	/* TODO: support reuse-delta */
+	/* Don't use a base that a pack for one of our islands would lack */
+	if (pb->islands && !git_delta_islands_allow(pb->islands, trg_object, src_object))
+		return 0;
 
 	/* Let's not bust the allowed depth. */
 	if (src->depth >= max_depth)
@@ -1097,99 +1614,233 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 			array[dst] = swap;
 		}
 
-		next:
-		idx++;
-		if (count + 1 < window)
-			count++;
-		if (idx >= window)
-			idx = 0;
+		next:
+		idx++;
+		if (count + 1 < window)
+			count++;
+		if (idx >= window)
+			idx = 0;
+	}
+	error = 0;
+
+on_error:
+	for (i = 0; i < window; ++i) {
+		git__free(array[i].index);
+		git__free(array[i].data);
+	}
+	git__free(array);
+	git_str_dispose(&zbuf);
+
+	return error;
+}
+
+#ifdef GIT_THREADS
+
+struct thread_params {
+	git_thread thread;
+	struct delta_search *search;
+
+	/*
+	 * The objects that are left to this thread are the `remaining`
+	 * ones before `end` in the list; both are protected by the
+	 * progress lock, as `find_deltas` takes objects off the front
+	 * while other threads steal them off the back.
+	 */
+	size_t end;
+	size_t remaining;
+
+	uint64_t busy_time;
+	bool started;
+};
+
+struct delta_search {
+	git_packbuilder *pb;
+	git_pobject **list;
+
+	/* The sum of the weights of the objects before each index */
+	uint64_t *weights;
+
+	size_t window;
+	size_t depth;
+
+	struct thread_params *threads;
+	size_t nr_threads;
+
+	int error;
+	git_error *error_info;
+};
+
+/* Objects are weighed by their size, as a rough cost of delta search. */
+GIT_INLINE(uint64_t) range_weight(
+	struct delta_search *search, size_t start, size_t end)
+{
+	return search->weights[end] - search->weights[start];
+}
+
+/* Move an index forward to the start of the next "path", if there is one. */
+static size_t path_boundary(
+	struct delta_search *search, size_t pos, size_t end)
+{
+	git_pobject **list = search->list;
+	size_t boundary = pos;
+
+	while (boundary < end && list[boundary]->hash &&
+	       list[boundary]->hash == list[boundary - 1]->hash)
+		boundary++;
+
+	/*
+	 * It is possible for some "paths" to have so many objects that
+	 * no boundary might be found; split them in that case.
+	 */
+	return boundary < end ? boundary : pos;
+}
+
+/*
+ * Give an idle thread the second half, by weight, of the work that is
+ * left to the busiest thread. Both halves keep at least a full window
+ * of objects so that deltas can still be found at the edges. Must be
+ * called with the progress lock held; returns false when there is no
+ * work left that is worth splitting.
+ */
+static bool steal_work(struct thread_params *me)
+{
+	struct delta_search *search = me->search;
+	struct thread_params *victim = NULL;
+	uint64_t victim_weight = 0, half;
+	size_t window = search->window, start, lo, hi, i;
+
+	if (search->pb->failure || search->error)
+		return false;
+
+	for (i = 0; i < search->nr_threads; i++) {
+		struct thread_params *t = &search->threads[i];
+		uint64_t weight;
+
+		if (t->remaining <= 2 * window)
+			continue;
+
+		weight = range_weight(search, t->end - t->remaining, t->end);
+
+		if (!victim || weight > victim_weight) {
+			victim = t;
+			victim_weight = weight;
+		}
 	}
-	error = 0;
 
-on_error:
-	for (i = 0; i < window; ++i) {
-		git__free(array[i].index);
-		git__free(array[i].data);
+	if (!victim)
+		return false;
+
+	/* Find the first index past half of the victim's weight */
+	start = victim->end - victim->remaining;
+	half = search->weights[start] + victim_weight / 2;
+	lo = start + window;
+	hi = victim->end - window;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (search->weights[mid] < half)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	git__free(array);
-	git_str_dispose(&zbuf);
 
-	return error;
-}
+	lo = path_boundary(search, lo, victim->end - window);
 
-#ifdef GIT_THREADS
+	me->end = victim->end;
+	me->remaining = victim->end - lo;
+	victim->remaining -= me->remaining;
+	victim->end = lo;
 
-struct thread_params {
-	git_thread thread;
-	git_packbuilder *pb;
+	return true;
+}
 
-	git_pobject **list;
+static void delta_search_fail(struct delta_search *search, int error)
+{
+	git_packbuilder *pb = search->pb;
 
-	git_cond cond;
-	git_mutex mutex;
+	if (git_packbuilder__progress_lock(pb) < 0)
+		return;
 
-	size_t list_size;
-	size_t remaining;
+	if (!search->error) {
+		search->error = error;
+		git_error_save(&search->error_info);
+	}
 
-	size_t window;
-	size_t depth;
-	size_t working;
-	size_t data_ready;
+	/* Stop the other threads */
+	if (!pb->failure)
+		pb->failure = error;
 
-	/* A pb->progress_cb can stop the packing process by returning an error.
-	   When that happens, all threads observe the error and stop voluntarily. */
-	bool stopped;
-};
+	git_packbuilder__progress_unlock(pb);
+}
 
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
+	struct delta_search *search = me->search;
+	git_packbuilder *pb = search->pb;
+	git_pobject **list;
+	uint64_t start;
+	int error;
 
-	while (me->remaining) {
-		if (find_deltas(me->pb, me->list, &me->remaining,
-				me->window, me->depth) < 0) {
-			me->stopped = true;
-			GIT_ASSERT_WITH_RETVAL(git_packbuilder__progress_lock(me->pb) == 0, NULL);
-			me->working = false;
-			git_cond_signal(&me->pb->progress_cond);
-			GIT_ASSERT_WITH_RETVAL(git_packbuilder__progress_unlock(me->pb) == 0, NULL);
-			return NULL;
+	for (;;) {
+		if (git_packbuilder__progress_lock(pb) < 0) {
+			delta_search_fail(search, -1);
+			break;
 		}
 
-		GIT_ASSERT_WITH_RETVAL(git_packbuilder__progress_lock(me->pb) == 0, NULL);
-		me->working = 0;
-		git_cond_signal(&me->pb->progress_cond);
-		GIT_ASSERT_WITH_RETVAL(git_packbuilder__progress_unlock(me->pb) == 0, NULL);
-
-		if (git_mutex_lock(&me->mutex)) {
-			git_error_set(GIT_ERROR_THREAD, "unable to lock packfile condition mutex");
-			return NULL;
+		if (!me->remaining && !steal_work(me)) {
+			git_packbuilder__progress_unlock(pb);
+			break;
 		}
 
-		while (!me->data_ready)
-			git_cond_wait(&me->cond, &me->mutex);
+		list = search->list + me->end - me->remaining;
+		git_packbuilder__progress_unlock(pb);
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		me->data_ready = 0;
-		git_mutex_unlock(&me->mutex);
+		start = git_time_monotonic();
+		error = find_deltas(pb, list, &me->remaining,
+			search->window, search->depth);
+		me->busy_time += git_time_monotonic() - start;
+
+		if (error < 0) {
+			delta_search_fail(search, error);
+			break;
+		}
 	}
-	/* leave ->working 1 so that this doesn't get more work assigned */
+
 	return NULL;
 }
 
+static int report_thread_progress(
+	struct delta_search *search, uint64_t total_time)
+{
+	git_packbuilder *pb = search->pb;
+	size_t i;
+	int ret;
+
+	if (!pb->progress_cb)
+		return 0;
+
+	for (i = 0; i < search->nr_threads; i++) {
+		ret = pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION_THREAD,
+			(uint32_t)min(search->threads[i].busy_time, UINT32_MAX),
+			(uint32_t)min(total_time, UINT32_MAX),
+			pb->progress_cb_payload);
+
+		if (ret)
+			return git_error_set_after_callback(ret);
+	}
+
+	return 0;
+}
+
 static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 			  size_t list_size, size_t window, size_t depth)
 {
-	struct thread_params *p;
-	size_t i;
-	int ret, active_threads = 0;
+	struct delta_search search = {0};
+	uint64_t start_time;
+	size_t start, i;
+	int error = 0;
 
 	if (!pb->nr_threads)
 		pb->nr_threads = git__online_cpus();
@@ -1198,142 +1849,303 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 		return find_deltas(pb, list, &list_size, window, depth);
 	}
 
-	p = git__mallocarray(pb->nr_threads, sizeof(*p));
-	GIT_ERROR_CHECK_ALLOC(p);
+	search.pb = pb;
+	search.list = list;
+	search.window = window;
+	search.depth = depth;
+	search.nr_threads = pb->nr_threads;
 
-	/* Partition the work among the threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		size_t sub_size = list_size / (pb->nr_threads - i);
+	search.weights = git__mallocarray(list_size + 1, sizeof(uint64_t));
+	search.threads = git__calloc(search.nr_threads, sizeof(struct thread_params));
 
-		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < pb->nr_threads)
-			sub_size = 0;
+	if (!search.weights || !search.threads) {
+		error = -1;
+		goto done;
+	}
 
-		p[i].pb = pb;
-		p[i].window = window;
-		p[i].depth = depth;
-		p[i].working = 1;
-		p[i].data_ready = 0;
-		p[i].stopped = 0;
+	search.weights[0] = 0;
 
-		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
+	for (i = 0; i < list_size; i++)
+		search.weights[i + 1] = search.weights[i] + list[i]->size + 1;
 
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
+	/*
+	 * Partition the work among the threads by weight, so that threads
+	 * that land on a region of large blobs get fewer of them; threads
+	 * that run out of work steal it from the others afterwards.
+	 */
+	for (i = 0, start = 0; i < search.nr_threads; i++) {
+		struct thread_params *t = &search.threads[i];
+		uint64_t share = range_weight(&search, start, list_size) /
+			(search.nr_threads - i);
+		size_t end = start;
+
+		t->search = &search;
+
+		if (i + 1 == search.nr_threads) {
+			end = list_size;
+		} else if (list_size - start > 2 * window) {
+			while (end < list_size &&
+			       (end - start < 2 * window ||
+			        range_weight(&search, start, end) < share))
+				end++;
+
+			/* try to split chunks on "path" boundaries */
+			if (end < list_size)
+				end = path_boundary(&search, end, list_size);
+		}
 
-		list += sub_size;
-		list_size -= sub_size;
+		t->end = end;
+		t->remaining = end - start;
+		start = end;
 	}
 
+	start_time = git_time_monotonic();
+
 	/* Start work threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		if (!p[i].list_size)
+	for (i = 0; i < search.nr_threads; i++) {
+		if (!search.threads[i].remaining)
 			continue;
 
-		git_mutex_init(&p[i].mutex);
-		git_cond_init(&p[i].cond);
-
-		ret = git_thread_create(&p[i].thread,
-					threaded_find_deltas, &p[i]);
-		if (ret) {
+		if (git_thread_create(&search.threads[i].thread,
+				threaded_find_deltas, &search.threads[i]) < 0) {
 			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
-			return -1;
+			delta_search_fail(&search, -1);
+			break;
 		}
-		active_threads++;
+
+		search.threads[i].started = true;
 	}
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		size_t sub_size = 0;
-
-		/* Start by locating a thread that has transitioned its
-		 * 'working' flag from 1 -> 0. This indicates that it is
-		 * ready to receive more work using our work-stealing
-		 * algorithm. */
-		GIT_ASSERT(git_packbuilder__progress_lock(pb) == 0);
-		for (;;) {
-			for (i = 0; !target && i < pb->nr_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			git_cond_wait(&pb->progress_cond, &pb->progress_mutex);
+	for (i = 0; i < search.nr_threads; i++) {
+		if (search.threads[i].started)
+			git_thread_join(&search.threads[i].thread, NULL);
+	}
+
+	if (search.error) {
+		git_error_restore(search.error_info);
+		search.error_info = NULL;
+		error = search.error;
+		goto done;
+	}
+
+	if ((error = pb->failure) != 0)
+		goto done;
+
+	error = report_thread_progress(&search,
+		git_time_monotonic() - start_time);
+
+done:
+	git__free(search.weights);
+	git__free(search.threads);
+	return error;
+}
+
+#else
+#define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
+#endif
+
+static int stored_cmp(const void *_a, const void *_b)
+{
+	const git_pobject *a = _a, *b = _b;
+
+	if (a->reuse_pack != b->reuse_pack)
+		return (uintptr_t)a->reuse_pack < (uintptr_t)b->reuse_pack ? -1 : 1;
+
+	return (a->reuse_offset < b->reuse_offset) ? -1 : (a->reuse_offset > b->reuse_offset);
+}
+
+static void drop_delta(git_packbuilder *pb, git_pobject *po)
+{
+	if (po->delta_data) {
+		git__free(po->delta_data);
+		pb->delta_cache_size -= po->z_delta_size ? po->z_delta_size : po->delta_size;
+		po->delta_data = NULL;
+	}
+
+	po->delta = NULL;
+	po->delta_size = 0;
+	po->z_delta_size = 0;
+	po->reuse_delta = 0;
+}
+
+/*
+ * Deltas that are reused from different packs may depend on each other
+ * in a loop, or make chains that are deeper than we allow. Drop the
+ * reused deltas that close a loop or bust the depth.
+ */
+static int break_delta_chains(git_packbuilder *pb)
+{
+	git_pobject **stack, *po, *base;
+	size_t *depths, i, j, n, depth;
+
+	/* The depth of each object plus one, or SIZE_MAX while walking it */
+	depths = git__calloc(pb->nr_objects, sizeof(size_t));
+	stack = git__mallocarray(pb->nr_objects, sizeof(git_pobject *));
+
+	if (!depths || !stack) {
+		git__free(depths);
+		git__free(stack);
+		return -1;
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		for (n = 0, po = pb->object_list + i;
+		     po && !depths[po - pb->object_list];
+		     po = po->delta) {
+			depths[po - pb->object_list] = SIZE_MAX;
+			stack[n++] = po;
 		}
 
-		/* At this point we hold the progress lock and have located
-		 * a thread to receive more work. We still need to locate a
-		 * thread from which to steal work (the victim). */
-		for (i = 0; i < pb->nr_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-
-		if (victim && !target->stopped) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
+		if (po && depths[po - pb->object_list] == SIZE_MAX) {
+			/* Drop a reused delta in the loop, and walk again */
+			for (j = n - 1; stack[j] != po && !stack[j]->reuse_delta; j--)
+				;
+
+			drop_delta(pb, stack[j]);
+
+			for (j = 0; j < n; j++)
+				depths[stack[j] - pb->object_list] = 0;
+
+			i--;
+			continue;
+		}
+
+		depth = po ? depths[po - pb->object_list] : 0;
+
+		while (n--) {
+			base = stack[n];
+			depth = base->delta ? depth + 1 : 1;
+
+			if (depth > GIT_PACK_DEPTH + 1 && base->reuse_delta) {
+				drop_delta(pb, base);
+				depth = 1;
 			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
+
+			depths[base - pb->object_list] = depth;
 		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1; /* even when target->stopped, so that we don't process this thread again */
-		GIT_ASSERT(git_packbuilder__progress_unlock(pb) == 0);
+	}
+
+	git__free(stack);
+	git__free(depths);
+	return 0;
+}
+
+/*
+ * Find the packs whose objects are all in the new pack, given the objects
+ * sorted by the pack that they are stored in. Such a pack can be copied
+ * as it is, since its deltas only refer to objects in the same pack;
+ * every object of it is stored in it, so it has no duplicates either.
+ * Its objects are not checked one by one, so the pack is checked against
+ * its checksum as it is copied instead, which fails the write when they
+ * don't match.
+ */
+static int find_whole_packs(git_packbuilder *pb, git_pobject **stored, size_t n)
+{
+	size_t i, start;
+	uint32_t num_objects;
+	int error;
+
+	git_vector_clear(&pb->whole_packs);
+
+	for (i = 0; i < pb->nr_objects; i++)
+		pb->object_list[i].whole_pack = 0;
+
+	for (start = 0; start < n; start = i) {
+		for (i = start; i < n && stored[i]->reuse_pack == stored[start]->reuse_pack; i++)
+			;
+
+		if ((error = git_pack_num_objects(&num_objects, stored[start]->reuse_pack)) < 0)
+			return error;
+
+		if (i - start != num_objects)
+			continue;
 
-		if (git_mutex_lock(&target->mutex)) {
-			git_error_set(GIT_ERROR_THREAD, "unable to lock packfile condition mutex");
-			git__free(p);
+		if (git_vector_insert(&pb->whole_packs, stored[start]->reuse_pack) < 0)
 			return -1;
-		}
 
-		target->data_ready = 1;
-		git_cond_signal(&target->cond);
-		git_mutex_unlock(&target->mutex);
+		while (start < i)
+			stored[start++]->whole_pack = 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the objects that are stored in the packs of the repository, so
+ * that their compressed data can be copied into the new pack, and reuse
+ * the deltas whose base is in the new pack too.
+ */
+static int find_reusable(git_packbuilder *pb)
+{
+	git_pobject **stored, *po, key;
+	struct git_pack_entry e;
+	git_packfile_raw raw;
+	size_t i, pos, n = 0;
+	int error = 0;
+
+	stored = git__mallocarray(pb->nr_objects, sizeof(*stored));
+	GIT_ERROR_CHECK_ALLOC(stored);
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (!po->reuse_pack) {
+			if ((error = git_odb__find_pack_entry(&e, pb->odb, &po->id)) == GIT_ENOTFOUND) {
+				git_error_clear();
+				error = 0;
+				continue;
+			} else if (error < 0) {
+				goto done;
+			}
 
-		if (target->stopped || !sub_size) {
-			git_thread_join(&target->thread, NULL);
-			git_cond_free(&target->cond);
-			git_mutex_free(&target->mutex);
-			active_threads--;
+			po->reuse_pack = e.p;
+			po->reuse_offset = e.offset;
 		}
+
+		stored[n++] = po;
 	}
 
-	git__free(p);
-	return pb->failure;
-}
+	git__tsort((void **)stored, n, stored_cmp);
 
-#else
-#define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
-#endif
+	/* The deltas in a whole pack may not respect our islands */
+	if (!pb->islands && (error = find_whole_packs(pb, stored, n)) < 0)
+		goto done;
+
+	for (i = 0; i < n; i++) {
+		po = stored[i];
+
+		if (po->delta || po->whole_pack)
+			continue;
+
+		if ((error = git_packfile_raw_info(&raw, po->reuse_pack, po->reuse_offset)) < 0)
+			goto done;
+
+		if (raw.type != GIT_PACKFILE_OFS_DELTA &&
+		    raw.type != GIT_PACKFILE_REF_DELTA)
+			continue;
+
+		/* Only reuse the delta if its base is in the new pack */
+		key.reuse_pack = po->reuse_pack;
+		key.reuse_offset = raw.base_offset;
+
+		if (git__bsearch((void **)stored, n, &key, stored_cmp, &pos) < 0)
+			continue;
+
+		if (pb->islands &&
+		    !git_delta_islands_allow(pb->islands, po, stored[pos]))
+			continue;
+
+		po->delta = stored[pos];
+		po->delta_size = raw.size;
+		po->reuse_delta = 1;
+	}
+
+	error = break_delta_chains(pb);
+
+done:
+	git__free(stored);
+	return error;
+}
 
 int git_packbuilder__prepare(git_packbuilder *pb)
 {
@@ -1353,12 +2165,43 @@ int git_packbuilder__prepare(git_packbuilder *pb)
 			return git_error_set_after_callback(error);
 	}
 
+	if (pb->delta_islands && !pb->islands &&
+	    (error = git_delta_islands_new(&pb->islands, pb)) < 0)
+		return error;
+
+	if (pb->reuse && (error = find_reusable(pb)) < 0)
+		return error;
+
 	delta_list = git__mallocarray(pb->nr_objects, sizeof(*delta_list));
 	GIT_ERROR_CHECK_ALLOC(delta_list);
 
+	/*
+	 * Link the objects to the deltas that depend on them, so that we
+	 * do not make the reused delta chains too deep.
+	 */
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = pb->object_list + i;
+		po->delta_child = NULL;
+		po->delta_sibling = NULL;
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = pb->object_list + i;
+
+		if (!po->reuse_delta)
+			continue;
+
+		po->delta_sibling = po->delta->delta_child;
+		po->delta->delta_child = po;
+	}
+
 	for (i = 0; i < pb->nr_objects; ++i) {
 		git_pobject *po = pb->object_list + i;
 
+		/* Reused objects are not searched for a better delta */
+		if (po->reuse_delta || po->whole_pack)
+			continue;
+
 		/* Make sure the item is within our size limits */
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
@@ -1411,6 +2254,42 @@ static int write_cb(void *buf, size_t len, void *payload)
 	return git_indexer_append(ctx->indexer, buf, len, ctx->stats);
 }
 
+static int write_bitmap(git_packbuilder *pb, const char *path, unsigned int mode)
+{
+	git_pack_bitmap_writer *writer = NULL;
+	git_str idx_path = GIT_STR_INIT, bitmap_path = GIT_STR_INIT;
+	git_pobject *po;
+	size_t i;
+	int error;
+
+	if ((error = git_str_printf(&idx_path, "%s/pack-%s.idx", path, pb->pack_name)) < 0 ||
+	    (error = git_pack_bitmap_writer_new(&writer, pb->repo, idx_path.ptr)) < 0)
+		goto done;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if ((error = git_pack_bitmap_writer_add(writer, &po->id, po->type, po->hash)) < 0)
+			goto done;
+	}
+
+	error = git_pack_bitmap_writer_commit(writer, mode ? mode : GIT_PACK_FILE_MODE);
+
+done:
+	/*
+	 * The pack and its index are already in place, and are kept; just
+	 * make sure that no bitmap is left that doesn't describe them.
+	 */
+	if (error < 0 &&
+	    git_str_printf(&bitmap_path, "%s/pack-%s.bitmap", path, pb->pack_name) == 0)
+		p_unlink(bitmap_path.ptr);
+
+	git_pack_bitmap_writer_free(writer);
+	git_str_dispose(&bitmap_path);
+	git_str_dispose(&idx_path);
+	return error;
+}
+
 int git_packbuilder_write(
 	git_packbuilder *pb,
 	const char *path,
@@ -1467,6 +2346,9 @@ int git_packbuilder_write(
 	pb->pack_name = git__strdup(git_indexer_name(indexer));
 	GIT_ERROR_CHECK_ALLOC(pb->pack_name);
 
+	if (pb->write_bitmap)
+		error = write_bitmap(pb, path, mode);
+
 cleanup:
 	git_indexer_free(indexer);
 	git_str_dispose(&object_path);
@@ -1781,6 +2663,78 @@ cleanup:
 	return error;
 }
 
+typedef git_array_t(git_oid) bitmap_tips;
+
+/*
+ * Use the repository's reachability bitmap (when there is one) to find
+ * the objects that are reachable from the interesting commits but not
+ * from the uninteresting ones, without walking the trees. Returns
+ * GIT_PASSTHROUGH when the bitmap cannot answer the query, in which
+ * case the caller should fall back to walking the history.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	git_pack_bitmap_file *file;
+	git_bitmap wants = GIT_BITMAP_INIT, haves = GIT_BITMAP_INIT;
+	bitmap_tips want_ids = GIT_ARRAY_INIT, have_ids = GIT_ARRAY_INIT;
+	git_commit_list *list;
+	const git_oid *id;
+	git_oid *tip;
+	uint32_t hash;
+	size_t pos = 0;
+	int error;
+
+	if (walk->hide_cb || walk->first_parent || !walk->user_input ||
+	    git_repository_is_shallow(pb->repo) != 0)
+		return GIT_PASSTHROUGH;
+
+	if (git_odb__get_pack_bitmap_file(&file, pb->odb) < 0) {
+		git_error_clear();
+		return GIT_PASSTHROUGH;
+	}
+
+	for (list = walk->user_input; list; list = list->next) {
+		tip = list->item->uninteresting ?
+			git_array_alloc(have_ids) : git_array_alloc(want_ids);
+		GIT_ERROR_CHECK_ALLOC(tip);
+
+		git_oid_cpy(tip, &list->item->oid);
+	}
+
+	if (!git_array_size(want_ids)) {
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	if ((error = git_pack_bitmap_file_reachable(&wants, file, pb->repo,
+			want_ids.ptr, git_array_size(want_ids))) < 0 ||
+	    (error = git_pack_bitmap_file_reachable(&haves, file, pb->repo,
+			have_ids.ptr, git_array_size(have_ids))) < 0)
+		goto done;
+
+	git_bitmap_and_not(&wants, &haves);
+
+	while (git_bitmap_next(&pos, &wants) == 0) {
+		if ((error = git_pack_bitmap_file_object(&id, NULL, &hash, file, (uint32_t)pos)) < 0 ||
+		    (error = insert_object(pb, id, hash)) < 0)
+			goto done;
+
+		pos++;
+	}
+
+done:
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = GIT_PASSTHROUGH;
+	}
+
+	git_array_clear(want_ids);
+	git_array_clear(have_ids);
+	git_bitmap_dispose(&wants);
+	git_bitmap_dispose(&haves);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1790,6 +2744,9 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 	GIT_ASSERT_ARG(pb);
 	GIT_ASSERT_ARG(walk);
 
+	if ((error = insert_walk_bitmap(pb, walk)) != GIT_PASSTHROUGH)
+		return error;
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
@@ -1838,7 +2795,6 @@ void git_packbuilder_free(git_packbuilder *pb)
 
 	git_mutex_free(&pb->cache_mutex);
 	git_mutex_free(&pb->progress_mutex);
-	git_cond_free(&pb->progress_cond);
 
 #endif
 
@@ -1852,6 +2808,8 @@ void git_packbuilder_free(git_packbuilder *pb)
 
 	git_packbuilder_walk_objectmap_dispose(&pb->walk_objects);
 	git_pool_clear(&pb->object_pool);
+	git_vector_dispose(&pb->whole_packs);
+	git_delta_islands_free(pb->islands);
 
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
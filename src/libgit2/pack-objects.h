@@ -16,6 +16,7 @@
 #include "pool.h"
 #include "indexer.h"
 #include "hashmap_oid.h"
+#include "vector.h"
 
 #include "git2/oid.h"
 #include "git2/pack.h"
@@ -45,10 +46,16 @@ typedef struct git_pobject {
 	size_t delta_size;
 	size_t z_delta_size;
 
+	/* where the object is stored, when it can be copied from a pack */
+	struct git_pack_file *reuse_pack;
+	off64_t reuse_offset;
+
 	unsigned int written:1,
 	             recursing:1,
 	             tagged:1,
-	             filled:1;
+	             filled:1,
+	             reuse_delta:1, /* the delta is copied from reuse_pack */
+	             whole_pack:1; /* copied along with all of reuse_pack */
 } git_pobject;
 
 typedef struct walk_object walk_object;
@@ -78,6 +85,11 @@ struct git_packbuilder {
 	git_packbuilder_walk_objectmap walk_objects;
 	git_pool object_pool;
 
+	git_vector whole_packs; /* packs whose objects are all copied */
+
+	/* which objects may be deltas of each other, when islands are used */
+	struct git_delta_islands *islands;
+
 #ifndef GIT_DEPRECATE_HARD
 	git_oid pack_oid; /* hash of written pack */
 #endif
@@ -86,7 +98,6 @@ struct git_packbuilder {
 	/* synchronization objects */
 	git_mutex cache_mutex;
 	git_mutex progress_mutex;
-	git_cond progress_cond;
 
 	/* configs */
 	size_t delta_cache_size;
@@ -97,6 +108,10 @@ struct git_packbuilder {
 
 	unsigned int nr_threads; /* nr of threads to use */
 
+	bool write_bitmap; /* write a .bitmap alongside the pack */
+	bool reuse; /* copy objects and deltas from existing packs */
+	bool delta_islands; /* honor the islands of pack.island */
+
 	git_packbuilder_progress progress_cb;
 	void *progress_cb_payload;
 
@@ -14,6 +14,7 @@
 #include "oid.h"
 #include "oidarray.h"
 #include "hashmap_oid.h"
+#include "runtime.h"
 
 /* Option to bypass checking existence of '.keep' files */
 bool git_disable_pack_keep_file_checks = false;
@@ -42,10 +43,16 @@ static int pack_entry_find_offset(
 		const git_oid *short_oid,
 		size_t len);
 
+typedef struct {
+	uint64_t pack_id;
+	off64_t offset;
+} pack_cache_key;
+
 #define off64_hash(key) (uint32_t)((key)>>33^(key)^(key)<<11)
-#define off64_equal(a, b) ((a) == (b))
+#define pack_cache_key_hash(key) (off64_hash((key).offset) ^ (uint32_t)((key).pack_id * 0x9e3779b1))
+#define pack_cache_key_equal(a, b) ((a).pack_id == (b).pack_id && (a).offset == (b).offset)
 
-GIT_HASHMAP_FUNCTIONS(git_pack_offsetmap, GIT_HASHMAP_INLINE, off64_t, git_pack_cache_entry *, off64_hash, off64_equal);
+GIT_HASHMAP_SETUP(git_pack_cachemap, pack_cache_key, git_pack_cache_entry *, pack_cache_key_hash, pack_cache_key_equal);
 GIT_HASHMAP_OID_FUNCTIONS(git_pack_oidmap, , struct git_pack_entry *);
 
 static int packfile_error(const char *message)
@@ -58,7 +65,33 @@ static int packfile_error(const char *message)
  * Delta base cache
  ********************/
 
-static git_pack_cache_entry *new_cache_object(git_rawobj *source)
+/*
+ * The delta base cache is shared by all packs, and split into shards that
+ * are locked independently. Each shard keeps its entries in a list, most
+ * recently used first, and may use an equal part of the memory limit.
+ * The entries that are borrowed by objects are accounted for separately,
+ * in `borrowed_used`, since they can't be evicted until they are released.
+ */
+typedef struct {
+	git_mutex lock;
+	git_pack_cachemap entries;
+	git_pack_cache_entry *head;
+	git_pack_cache_entry *tail;
+	size_t memory_used;
+	size_t borrowed_used;
+	size_t hits;
+	size_t misses;
+} pack_cache_shard;
+
+size_t git_pack__cache_max_size = GIT_PACK_CACHE_MEMORY_LIMIT;
+
+static pack_cache_shard pack_cache[GIT_PACK_CACHE_SHARDS];
+static git_atomic64 pack_cache_next_id;
+
+static git_pack_cache_entry *new_cache_object(
+	git_rawobj *source,
+	uint64_t pack_id,
+	off64_t offset)
 {
 	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
 	if (!e)
@@ -66,6 +99,8 @@ static git_pack_cache_entry *new_cache_object(git_rawobj *source)
 
 	git_atomic32_inc(&e->refcount);
 	memcpy(&e->raw, source, sizeof(git_rawobj));
+	e->pack_id = pack_id;
+	e->offset = offset;
 
 	return e;
 }
@@ -80,101 +115,328 @@ static void free_cache_object(void *o)
 	}
 }
 
-static void cache_free(git_pack_cache *cache)
+GIT_INLINE(pack_cache_shard *) cache_shard(pack_cache_key key)
 {
-	git_hashmap_iter_t iter = GIT_HASHMAP_ITER_INIT;
-	git_pack_cache_entry *entry;
+	return &pack_cache[pack_cache_key_hash(key) % GIT_PACK_CACHE_SHARDS];
+}
+
+/* Run with the shard lock held */
+static void cache_unlink(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		shard->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		shard->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+/* Run with the shard lock held */
+static void cache_link_head(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = shard->head;
+
+	if (shard->head)
+		shard->head->prev = entry;
+	else
+		shard->tail = entry;
+
+	shard->head = entry;
+}
+
+/*
+ * Take an entry out of the cache. Entries that are still borrowed are
+ * freed by their last borrower. Run with the shard lock held.
+ */
+static void cache_remove(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	pack_cache_key key;
+
+	key.pack_id = entry->pack_id;
+	key.offset = entry->offset;
+
+	git_pack_cachemap_remove(&shard->entries, key);
+	cache_unlink(shard, entry);
+
+	if (entry->borrowers)
+		shard->borrowed_used -= entry->raw.len;
+	else
+		shard->memory_used -= entry->raw.len;
 
-	while (git_pack_offsetmap_iterate(&iter, NULL, &entry, &cache->entries) == 0)
+	if (git_atomic32_get(&entry->refcount) == 0)
 		free_cache_object(entry);
+	else
+		entry->detached = true;
+}
+
+/*
+ * Evict the least recently used entries that are not in use until the
+ * shard has room for `size` more bytes. Run with the shard lock held.
+ */
+static bool cache_make_room(pack_cache_shard *shard, size_t size, size_t limit)
+{
+	git_pack_cache_entry *entry = shard->tail, *prev;
+
+	while (entry && shard->memory_used + size > limit) {
+		prev = entry->prev;
+
+		if (git_atomic32_get(&entry->refcount) == 0)
+			cache_remove(shard, entry);
+
+		entry = prev;
+	}
 
-	git_pack_offsetmap_dispose(&cache->entries);
+	return shard->memory_used + size <= limit;
 }
 
-static int cache_init(git_pack_cache *cache)
+/*
+ * Whether an entry may be lent to `size` more bytes of borrowers. Run
+ * with the shard lock held.
+ */
+GIT_INLINE(bool) cache_can_lend(pack_cache_shard *shard, size_t size)
 {
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+	return shard->borrowed_used + size <=
+		GIT_PACK_CACHE_BORROWED_LIMIT / GIT_PACK_CACHE_SHARDS;
+}
 
-	if (git_mutex_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize pack cache mutex");
-		return -1;
+/* Run with the shard lock held */
+static void cache_lend(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	if (entry->borrowers++ == 0) {
+		shard->memory_used -= entry->raw.len;
+		shard->borrowed_used += entry->raw.len;
 	}
+}
 
-	return 0;
+/* Run with the shard lock held */
+static void cache_return(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	if (--entry->borrowers == 0) {
+		shard->borrowed_used -= entry->raw.len;
+		shard->memory_used += entry->raw.len;
+	}
+}
+
+/* Evict the entries of a pack, which is no longer looked up. */
+static void cache_evict_pack(uint64_t pack_id)
+{
+	git_pack_cache_entry *entry, *next;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		if (git_mutex_lock(&pack_cache[i].lock) < 0)
+			continue;
+
+		for (entry = pack_cache[i].head; entry; entry = next) {
+			next = entry->next;
+
+			if (entry->pack_id == pack_id)
+				cache_remove(&pack_cache[i], entry);
+		}
+
+		git_mutex_unlock(&pack_cache[i].lock);
+	}
+}
+
+static void cache_global_shutdown(void)
+{
+	git_pack_cache_entry *entry, *next;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		/* Entries that are still in use are freed by their last borrower */
+		for (entry = pack_cache[i].head; entry; entry = next) {
+			next = entry->next;
+
+			if (git_atomic32_get(&entry->refcount) == 0)
+				free_cache_object(entry);
+			else
+				entry->detached = true;
+		}
+
+		git_pack_cachemap_dispose(&pack_cache[i].entries);
+		git_mutex_free(&pack_cache[i].lock);
+		memset(&pack_cache[i], 0, sizeof(pack_cache_shard));
+	}
+}
+
+int git_pack_cache_global_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		if (git_mutex_init(&pack_cache[i].lock)) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize pack cache mutex");
+			return -1;
+		}
+	}
+
+	return git_runtime_shutdown_register(cache_global_shutdown);
+}
+
+void git_pack_cache_set_max_size(size_t max_size)
+{
+	size_t i;
+
+	git_pack__cache_max_size = max_size;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		if (git_mutex_lock(&pack_cache[i].lock) < 0)
+			continue;
+
+		cache_make_room(&pack_cache[i], 0, max_size / GIT_PACK_CACHE_SHARDS);
+		git_mutex_unlock(&pack_cache[i].lock);
+	}
 }
 
-static git_pack_cache_entry *cache_get(git_pack_cache *cache, off64_t offset)
+void git_pack_cache_stats(size_t *memory_used, size_t *hits, size_t *misses)
+{
+	size_t i;
+
+	*memory_used = *hits = *misses = 0;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		if (git_mutex_lock(&pack_cache[i].lock) < 0)
+			continue;
+
+		*memory_used += pack_cache[i].memory_used;
+		*hits += pack_cache[i].hits;
+		*misses += pack_cache[i].misses;
+		git_mutex_unlock(&pack_cache[i].lock);
+	}
+}
+
+static git_pack_cache_entry *cache_get(struct git_pack_file *p, off64_t offset)
 {
 	git_pack_cache_entry *entry = NULL;
+	pack_cache_key key;
+	pack_cache_shard *shard;
+
+	key.pack_id = p->cache_id;
+	key.offset = offset;
+	shard = cache_shard(key);
 
-	if (git_mutex_lock(&cache->lock) < 0)
+	if (git_mutex_lock(&shard->lock) < 0)
 		return NULL;
 
-	if (git_pack_offsetmap_get(&entry, &cache->entries, offset) == 0) {
+	if (git_pack_cachemap_get(&entry, &shard->entries, key) == 0) {
 		git_atomic32_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
+
+		cache_unlink(shard, entry);
+		cache_link_head(shard, entry);
+		shard->hits++;
+	} else {
+		shard->misses++;
 	}
 
-	git_mutex_unlock(&cache->lock);
+	git_mutex_unlock(&shard->lock);
 
 	return entry;
 }
 
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
+/*
+ * Look up an entry to lend to an object that keeps its data, taking a
+ * reference to it. Entries that can't be lent any more are not returned.
+ */
+static git_pack_cache_entry *cache_borrow(struct git_pack_file *p, off64_t offset)
 {
-	git_hashmap_iter_t iter = GIT_HASHMAP_ITER_INIT;
-	git_pack_cache_entry *entry;
-	off64_t offset;
+	git_pack_cache_entry *entry = NULL;
+	pack_cache_key key;
+	pack_cache_shard *shard;
 
-	while (git_pack_offsetmap_iterate(&iter, &offset, &entry, &cache->entries) == 0) {
-		if (entry && git_atomic32_get(&entry->refcount) == 0) {
-			cache->memory_used -= entry->raw.len;
-			git_pack_offsetmap_remove(&cache->entries, offset);
-			free_cache_object(entry);
-		}
+	key.pack_id = p->cache_id;
+	key.offset = offset;
+	shard = cache_shard(key);
+
+	if (git_mutex_lock(&shard->lock) < 0)
+		return NULL;
+
+	if (git_pack_cachemap_get(&entry, &shard->entries, key) == 0 &&
+	    (entry->borrowers || cache_can_lend(shard, entry->raw.len))) {
+		git_atomic32_inc(&entry->refcount);
+		cache_lend(shard, entry);
+
+		cache_unlink(shard, entry);
+		cache_link_head(shard, entry);
+		shard->hits++;
+	} else {
+		entry = NULL;
 	}
+
+	git_mutex_unlock(&shard->lock);
+
+	return entry;
 }
 
-static int cache_add(
+/*
+ * Add an object to the cache, with a reference for the caller. When
+ * `lend` is set, the caller borrows the entry, as with `cache_borrow`.
+ */
+static int cache_insert(
 		git_pack_cache_entry **cached_out,
-		git_pack_cache *cache,
+		struct git_pack_file *p,
 		git_rawobj *base,
-		off64_t offset)
+		off64_t offset,
+		bool lend)
 {
 	git_pack_cache_entry *entry;
-	int exists;
+	pack_cache_key key;
+	pack_cache_shard *shard;
+	size_t limit = git_pack__cache_max_size / GIT_PACK_CACHE_SHARDS;
+	int error = -1;
 
-	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
+	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT || base->len > limit)
 		return -1;
 
-	entry = new_cache_object(base);
+	key.pack_id = p->cache_id;
+	key.offset = offset;
+	shard = cache_shard(key);
+
+	entry = new_cache_object(base, key.pack_id, key.offset);
 	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
+		if (git_mutex_lock(&shard->lock) < 0) {
 			git_error_set(GIT_ERROR_OS, "failed to lock cache");
 			git__free(entry);
 			return -1;
 		}
-		/* Add it to the cache if nobody else has */
-		exists = git_pack_offsetmap_contains(&cache->entries, offset);
-		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
 
-			git_pack_offsetmap_put(&cache->entries, offset, entry);
-			cache->memory_used += entry->raw.len;
+		/* Add it to the cache if nobody else has, and if it fits */
+		if (!git_pack_cachemap_contains(&shard->entries, key) &&
+		    (lend ? cache_can_lend(shard, base->len) :
+		            cache_make_room(shard, base->len, limit)) &&
+		    git_pack_cachemap_put(&shard->entries, key, entry) == 0) {
+			cache_link_head(shard, entry);
+			shard->memory_used += entry->raw.len;
+
+			if (lend)
+				cache_lend(shard, entry);
 
 			*cached_out = entry;
+			error = 0;
 		}
-		git_mutex_unlock(&cache->lock);
-		/* Somebody beat us to adding it into the cache */
-		if (exists) {
+
+		git_mutex_unlock(&shard->lock);
+
+		if (error < 0)
 			git__free(entry);
-			return -1;
-		}
 	}
 
-	return 0;
+	return error;
+}
+
+GIT_INLINE(int) cache_add(
+		git_pack_cache_entry **cached_out,
+		struct git_pack_file *p,
+		git_rawobj *base,
+		off64_t offset)
+{
+	return cache_insert(cached_out, p, base, offset, false);
 }
 
 /***********************************************************
@@ -189,6 +451,10 @@ static void pack_index_free(struct git_pack_file *p)
 		git__free(p->ids);
 		p->ids = NULL;
 	}
+	if (p->offsets) {
+		git__free(p->offsets);
+		p->offsets = NULL;
+	}
 	if (p->index_map.data) {
 		git_futils_mmap_free(&p->index_map);
 		p->index_map.data = NULL;
@@ -598,7 +864,7 @@ static int pack_dependency_chain(git_dependency_chain *chain_out,
 		git_pack_cache_entry *cached = NULL;
 
 		/* if we have a base cached, we can stop here instead */
-		if ((cached = cache_get(&p->bases, obj_offset)) != NULL) {
+		if ((cached = cache_get(p, obj_offset)) != NULL) {
 			*cached_out = cached;
 			*cached_off = obj_offset;
 			break;
@@ -771,7 +1037,7 @@ int git_packfile_unpack(
 		 * long as it's not already the cached one.
 		 */
 		if (!cached)
-			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+			free_base = !!cache_add(&cached, p, obj, elem->base_key);
 
 		elem = &stack[elem_pos - 1];
 		curpos = elem->offset;
@@ -830,6 +1096,71 @@ cleanup:
 	return error;
 }
 
+int git_packfile_unpack_shared(
+	git_rawobj *obj,
+	git_pack_cache_entry **shared_out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	git_pack_cache_entry *entry;
+	off64_t curpos = offset;
+	int error;
+
+	*shared_out = NULL;
+
+	if ((entry = cache_borrow(p, offset)) == NULL) {
+		if ((error = git_packfile_unpack(obj, p, &curpos)) < 0)
+			return error;
+
+		/*
+		 * Trees are read over and over while walking history, so
+		 * keep them where later reads can share them; anything
+		 * else is handed to the caller.
+		 */
+		if (obj->type != GIT_OBJECT_TREE ||
+		    cache_insert(&entry, p, obj, offset, true) < 0)
+			return 0;
+	}
+
+	memcpy(obj, &entry->raw, sizeof(git_rawobj));
+	*shared_out = entry;
+	return 0;
+}
+
+void git_packfile_shared_release(git_pack_cache_entry *shared)
+{
+	pack_cache_key key;
+	pack_cache_shard *shard;
+	bool detached = false;
+
+	if (!shared)
+		return;
+
+	key.pack_id = shared->pack_id;
+	key.offset = shared->offset;
+	shard = cache_shard(key);
+
+	if (git_mutex_lock(&shard->lock) < 0) {
+		git_atomic32_dec(&shared->refcount);
+		return;
+	}
+
+	if (shared->detached) {
+		detached = (--shared->borrowers == 0);
+		git_atomic32_dec(&shared->refcount);
+	} else {
+		/* The entry can be evicted again, so it counts towards the limit */
+		cache_return(shard, shared);
+		git_atomic32_dec(&shared->refcount);
+		cache_make_room(shard, 0, git_pack__cache_max_size / GIT_PACK_CACHE_SHARDS);
+	}
+
+	git_mutex_unlock(&shard->lock);
+
+	if (detached)
+		free_cache_object(shared);
+}
+
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, off64_t curpos)
 {
 	memset(obj, 0, sizeof(git_packfile_stream));
@@ -1054,7 +1385,8 @@ void git_packfile_free(struct git_pack_file *p, bool unlink_packfile)
 	if (!p)
 		return;
 
-	cache_free(&p->bases);
+	/* The pack's objects in the delta base cache are never looked up again */
+	cache_evict_pack(p->cache_id);
 
 	if (git_mutex_lock(&p->lock) < 0) {
 		git_error_set(GIT_ERROR_OS, "failed to lock packfile");
@@ -1075,7 +1407,6 @@ void git_packfile_free(struct git_pack_file *p, bool unlink_packfile)
 
 	git__free(p->bad_object_ids);
 
-	git_mutex_free(&p->bases.lock);
 	git_mutex_free(&p->mwf.lock);
 	git_mutex_free(&p->lock);
 	git__free(p);
@@ -1143,6 +1474,8 @@ static int packfile_open_locked(struct git_pack_file *p)
 	if (git_oid_raw_cmp(checksum, idx_checksum, p->oid_size) != 0)
 		goto cleanup;
 
+	p->mwf.read_only = true;
+
 	if (git_mwindow_file_register(&p->mwf) < 0)
 		goto cleanup;
 
@@ -1243,12 +1576,7 @@ int git_packfile_alloc(
 		return -1;
 	}
 
-	if (cache_init(&p->bases) < 0) {
-		git_mutex_free(&p->mwf.lock);
-		git_mutex_free(&p->lock);
-		git__free(p);
-		return -1;
-	}
+	p->cache_id = (uint64_t)git_atomic64_add(&pack_cache_next_id, 1);
 
 	*pack_out = p;
 
@@ -1286,106 +1614,559 @@ static off64_t nth_packed_object_offset_locked(struct git_pack_file *p, uint32_t
 	       ntohl(*((uint32_t *)(index + 4)));
 }
 
-static int git__memcmp4(const void *a, const void *b) {
-	return memcmp(a, b, 4);
+static int offset_cmp(const void *a, const void *b)
+{
+	off64_t offset_a = *(const off64_t *)a, offset_b = *(const off64_t *)b;
+
+	return (offset_a < offset_b) ? -1 : (offset_a > offset_b);
 }
 
-int git_pack_foreach_entry(
-	struct git_pack_file *p,
-	git_odb_foreach_cb cb,
-	void *data)
+/* Run with the packfile lock held */
+static int pack_offsets_load_locked(struct git_pack_file *p)
 {
-	const unsigned char *index, *current;
+	off64_t *offsets;
 	uint32_t i;
-	int error = 0;
-	git_array_oid_t oids = GIT_ARRAY_INIT;
-	git_oid *oid;
+	int error;
 
-	if (git_mutex_lock(&p->lock) < 0)
-		return packfile_error("failed to get lock for git_pack_foreach_entry");
+	if (p->offsets)
+		return 0;
 
-	if ((error = pack_index_open_locked(p)) < 0) {
-		git_mutex_unlock(&p->lock);
+	if ((error = pack_index_open_locked(p)) < 0)
 		return error;
-	}
 
-	if (!p->index_map.data) {
-		git_error_set(GIT_ERROR_INTERNAL, "internal error: p->index_map.data == NULL");
-		git_mutex_unlock(&p->lock);
-		return -1;
-	}
+	offsets = git__calloc(p->num_objects + 1, sizeof(off64_t));
+	GIT_ERROR_CHECK_ALLOC(offsets);
 
-	index = p->index_map.data;
+	for (i = 0; i < p->num_objects; i++) {
+		if ((offsets[i] = nth_packed_object_offset_locked(p, i)) < 0) {
+			git__free(offsets);
+			return packfile_error("packfile index is corrupt");
+		}
+	}
 
-	if (p->index_version > 1)
-		index += 8;
+	qsort(offsets, p->num_objects, sizeof(off64_t), offset_cmp);
 
-	index += 4 * 256;
+	p->offsets = offsets;
+	return 0;
+}
 
-	if (p->ids == NULL) {
-		git_vector offsets, oids;
+/* Run with the packfile lock held, once the pack has been opened */
+static off64_t pack_object_end_locked(struct git_pack_file *p, off64_t offset)
+{
+	size_t lo = 0, hi = p->num_objects;
 
-		if ((error = git_vector_init(&oids, p->num_objects, NULL))) {
-			git_mutex_unlock(&p->lock);
-			return error;
-		}
+	/* Objects end where the next one in the pack starts */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
 
-		if ((error = git_vector_init(&offsets, p->num_objects, git__memcmp4))) {
-			git_mutex_unlock(&p->lock);
-			return error;
-		}
+		if (p->offsets[mid] <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-		if (p->index_version > 1) {
-			const unsigned char *off = index +
-				(p->oid_size + 4) * p->num_objects;
+	return (lo < p->num_objects) ? p->offsets[lo] : p->mwf.size - p->oid_size;
+}
 
-			for (i = 0; i < p->num_objects; i++)
-				git_vector_insert(&offsets, (void*)&off[4 * i]);
+int git_packfile_prefetch(
+	struct git_pack_file *p,
+	const off64_t *offsets,
+	size_t count)
+{
+	off64_t start = 0, end = 0, object_end;
+	size_t i;
+	int error;
 
-			git_vector_sort(&offsets);
-			git_vector_foreach(&offsets, i, current)
-				git_vector_insert(&oids, (void*)&index[5 * (current - off)]);
-		} else {
-			for (i = 0; i < p->num_objects; i++)
-				git_vector_insert(&offsets, (void*)&index[(p->oid_size + 4) * i]);
-			git_vector_sort(&offsets);
-			git_vector_foreach(&offsets, i, current)
-				git_vector_insert(&oids, (void*)&current[4]);
-		}
+	GIT_ASSERT_ARG(p);
+	GIT_ASSERT_ARG(offsets || !count);
 
-		git_vector_dispose(&offsets);
-		p->ids = (unsigned char **)git_vector_detach(NULL, NULL, &oids);
-	}
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_packfile_prefetch");
 
-	/*
-	 * We need to copy the OIDs to another array before we
-	 * relinquish the lock to avoid races.  We can also take
-	 * this opportunity to put them into normal form.
-	 */
-	git_array_init_to_size(oids, p->num_objects);
-	if (!oids.ptr) {
+	if (git_mutex_lock(&p->mwf.lock) < 0) {
 		git_mutex_unlock(&p->lock);
-		git_array_clear(oids);
-		GIT_ERROR_CHECK_ARRAY(oids);
-	}
-	for (i = 0; i < p->num_objects; i++) {
-		oid = git_array_alloc(oids);
-		if (!oid) {
-			git_mutex_unlock(&p->lock);
-			git_array_clear(oids);
-			GIT_ERROR_CHECK_ALLOC(oid);
-		}
-		git_oid_from_raw(oid, p->ids[i], p->oid_type);
+		return packfile_error("failed to get lock for git_packfile_prefetch");
 	}
 
-	git_mutex_unlock(&p->lock);
+	if ((error = pack_offsets_load_locked(p)) < 0 ||
+	    (p->mwf.fd == -1 && (error = packfile_open_locked(p)) < 0))
+		goto cleanup;
 
-	git_array_foreach(oids, i, oid) {
-		if ((error = cb(oid, data)) != 0) {
-			git_error_set_after_callback(error);
-			break;
+	/* Read adjacent objects with a single request */
+	for (i = 0; i < count; i++) {
+		if (offsets[i] < 0 || offsets[i] >= p->mwf.size - p->oid_size)
+			continue;
+
+		object_end = pack_object_end_locked(p, offsets[i]);
+
+		if (end && offsets[i] <= end) {
+			end = max(end, object_end);
+			continue;
 		}
-	}
+
+		if (end)
+			p_readahead(p->mwf.fd, start, (size_t)(end - start));
+
+		start = offsets[i];
+		end = object_end;
+	}
+
+	if (end)
+		p_readahead(p->mwf.fd, start, (size_t)(end - start));
+
+cleanup:
+	git_mutex_unlock(&p->mwf.lock);
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+int git_packfile_raw_info(
+	git_packfile_raw *out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	off64_t curpos = offset;
+	int error;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(p);
+
+	memset(out, 0, sizeof(*out));
+	out->offset = offset;
+
+	if ((error = git_packfile_unpack_header(&out->size, &out->type, p, &w_curs, &curpos)) < 0)
+		return error;
+
+	if (out->type == GIT_PACKFILE_OFS_DELTA || out->type == GIT_PACKFILE_REF_DELTA) {
+		error = get_delta_base(&out->base_offset, p, &w_curs, &curpos, out->type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			return error;
+	}
+
+	out->data_offset = curpos;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_packfile_raw_info");
+
+	if (git_mutex_lock(&p->mwf.lock) < 0) {
+		git_mutex_unlock(&p->lock);
+		return packfile_error("failed to get lock for git_packfile_raw_info");
+	}
+
+	if ((error = pack_offsets_load_locked(p)) == 0)
+		out->end = pack_object_end_locked(p, offset);
+
+	git_mutex_unlock(&p->mwf.lock);
+	git_mutex_unlock(&p->lock);
+
+	if (!error && out->end <= out->data_offset)
+		return packfile_error("object is truncated");
+
+	return error;
+}
+
+static int pack_foreach_window(
+	struct git_pack_file *p,
+	off64_t start,
+	off64_t end,
+	int (*cb)(const void *data, size_t len, void *payload),
+	void *payload)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *data;
+	unsigned int left;
+	int error;
+
+	while (start < end) {
+		if ((data = pack_window_open(p, &w_curs, start, &left)) == NULL)
+			return packfile_error("object is truncated");
+
+		if ((off64_t)left > end - start)
+			left = (unsigned int)(end - start);
+
+		error = cb(data, left, payload);
+		git_mwindow_close(&w_curs);
+
+		if (error)
+			return error;
+
+		start += left;
+	}
+
+	return 0;
+}
+
+static int raw_crc_cb(const void *data, size_t len, void *payload)
+{
+	uint32_t *crc = payload;
+
+	*crc = crc32(*crc, data, (uInt)len);
+	return 0;
+}
+
+/* Run with the packfile lock held, once a version 2 index has been opened */
+static int pack_entry_crc_locked(
+	uint32_t *out,
+	struct git_pack_file *p,
+	const git_oid *id)
+{
+	const uint32_t *level1_ofs = p->index_map.data;
+	const unsigned char *index = p->index_map.data;
+	unsigned lo, hi;
+	int pos;
+
+	level1_ofs += 2;
+	index += 8 + 4 * 256;
+
+	hi = ntohl(level1_ofs[(int)id->id[0]]);
+	lo = ((id->id[0] == 0x0) ? 0 : ntohl(level1_ofs[(int)id->id[0] - 1]));
+
+	pos = git_pack__lookup_id(index, p->oid_size, lo, hi, id->id, p->oid_type);
+
+	if (pos < 0)
+		return git_odb__error_notfound("failed to find pack entry", id, p->oid_hexsize);
+
+	/* The CRCs follow the object IDs */
+	index += (size_t)p->num_objects * p->oid_size;
+	*out = ntohl(*((uint32_t *)(index + 4 * (size_t)pos)));
+	return 0;
+}
+
+int git_packfile_raw_verify(
+	struct git_pack_file *p,
+	const git_packfile_raw *raw,
+	const git_oid *id)
+{
+	git_mwindow *w_curs = NULL;
+	git_rawobj obj;
+	off64_t curpos = raw->data_offset;
+	uint32_t expected = 0, crc;
+	int version = 0, error;
+
+	GIT_ASSERT_ARG(p);
+	GIT_ASSERT_ARG(raw);
+	GIT_ASSERT_ARG(id);
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_packfile_raw_verify");
+
+	if ((error = pack_index_open_locked(p)) == 0 &&
+	    (version = p->index_version) > 1)
+		error = pack_entry_crc_locked(&expected, p, id);
+
+	git_mutex_unlock(&p->lock);
+
+	if (error < 0)
+		return error;
+
+	/* Indexes of the first version have no CRCs */
+	if (version < 2) {
+		if ((error = packfile_unpack_compressed(&obj, p, &w_curs, &curpos, raw->size, raw->type)) < 0)
+			return error;
+
+		git__free(obj.data);
+		return 0;
+	}
+
+	crc = crc32(0L, Z_NULL, 0);
+
+	if ((error = pack_foreach_window(p, raw->offset, raw->end, raw_crc_cb, &crc)) < 0)
+		return error;
+
+	if (crc != expected) {
+		git_error_set(GIT_ERROR_ODB, "invalid pack file - CRC mismatch for %s",
+			git_oid_tostr_s(id));
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_packfile_raw_copy(
+	struct git_pack_file *p,
+	const git_packfile_raw *raw,
+	int (*cb)(const void *data, size_t len, void *payload),
+	void *payload)
+{
+	GIT_ASSERT_ARG(p);
+	GIT_ASSERT_ARG(raw);
+	GIT_ASSERT_ARG(cb);
+
+	return pack_foreach_window(p, raw->data_offset, raw->end, cb, payload);
+}
+
+struct copy_objects_context {
+	git_hash_ctx hash;
+	int (*cb)(const void *data, size_t len, void *payload);
+	void *payload;
+};
+
+static int copy_objects_hash_cb(const void *data, size_t len, void *payload)
+{
+	struct copy_objects_context *ctx = payload;
+
+	return git_hash_update(&ctx->hash, data, len);
+}
+
+static int copy_objects_cb(const void *data, size_t len, void *payload)
+{
+	struct copy_objects_context *ctx = payload;
+	int error;
+
+	if ((error = git_hash_update(&ctx->hash, data, len)) < 0)
+		return error;
+
+	return ctx->cb(data, len, ctx->payload);
+}
+
+int git_packfile_copy_objects(
+	struct git_pack_file *p,
+	int (*cb)(const void *data, size_t len, void *payload),
+	void *payload)
+{
+	struct copy_objects_context ctx;
+	git_mwindow *w_curs = NULL;
+	unsigned char checksum[GIT_HASH_MAX_SIZE], *trailer;
+	off64_t end;
+	int error = 0;
+
+	GIT_ASSERT_ARG(p);
+	GIT_ASSERT_ARG(cb);
+
+	ctx.cb = cb;
+	ctx.payload = payload;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_packfile_copy_objects");
+
+	if (git_mutex_lock(&p->mwf.lock) < 0) {
+		git_mutex_unlock(&p->lock);
+		return packfile_error("failed to get lock for git_packfile_copy_objects");
+	}
+
+	if (p->mwf.fd == -1)
+		error = packfile_open_locked(p);
+
+	end = p->mwf.size - p->oid_size;
+
+	git_mutex_unlock(&p->mwf.lock);
+	git_mutex_unlock(&p->lock);
+
+	if (error < 0 ||
+	    (error = git_hash_ctx_init(&ctx.hash, git_oid_algorithm(p->oid_type))) < 0)
+		return error;
+
+	/* The header is part of the checksum, although it is not copied */
+	if ((error = pack_foreach_window(p, 0, sizeof(struct git_pack_header), copy_objects_hash_cb, &ctx)) < 0 ||
+	    (error = pack_foreach_window(p, sizeof(struct git_pack_header), end, copy_objects_cb, &ctx)) < 0 ||
+	    (error = git_hash_final(checksum, &ctx.hash)) < 0)
+		goto done;
+
+	if ((trailer = pack_window_open(p, &w_curs, end, NULL)) == NULL) {
+		error = packfile_error("pack trailer is truncated");
+		goto done;
+	}
+
+	if (git_oid_raw_cmp(checksum, trailer, p->oid_size) != 0) {
+		git_error_set(GIT_ERROR_ODB, "invalid pack file - checksum mismatch in '%s'",
+			p->pack_name);
+		error = -1;
+	}
+
+	git_mwindow_close(&w_curs);
+
+done:
+	git_hash_ctx_cleanup(&ctx.hash);
+	return error;
+}
+
+static int git__memcmp4(const void *a, const void *b) {
+	return memcmp(a, b, 4);
+}
+
+int git_pack_foreach_entry(
+	struct git_pack_file *p,
+	git_odb_foreach_cb cb,
+	void *data)
+{
+	const unsigned char *index, *current;
+	uint32_t i;
+	int error = 0;
+	git_array_oid_t oids = GIT_ARRAY_INIT;
+	git_oid *oid;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_pack_foreach_entry");
+
+	if ((error = pack_index_open_locked(p)) < 0) {
+		git_mutex_unlock(&p->lock);
+		return error;
+	}
+
+	if (!p->index_map.data) {
+		git_error_set(GIT_ERROR_INTERNAL, "internal error: p->index_map.data == NULL");
+		git_mutex_unlock(&p->lock);
+		return -1;
+	}
+
+	index = p->index_map.data;
+
+	if (p->index_version > 1)
+		index += 8;
+
+	index += 4 * 256;
+
+	if (p->ids == NULL) {
+		git_vector offsets, oids;
+
+		if ((error = git_vector_init(&oids, p->num_objects, NULL))) {
+			git_mutex_unlock(&p->lock);
+			return error;
+		}
+
+		if ((error = git_vector_init(&offsets, p->num_objects, git__memcmp4))) {
+			git_mutex_unlock(&p->lock);
+			return error;
+		}
+
+		if (p->index_version > 1) {
+			const unsigned char *off = index +
+				(p->oid_size + 4) * p->num_objects;
+
+			for (i = 0; i < p->num_objects; i++)
+				git_vector_insert(&offsets, (void*)&off[4 * i]);
+
+			git_vector_sort(&offsets);
+			git_vector_foreach(&offsets, i, current)
+				git_vector_insert(&oids, (void*)&index[5 * (current - off)]);
+		} else {
+			for (i = 0; i < p->num_objects; i++)
+				git_vector_insert(&offsets, (void*)&index[(p->oid_size + 4) * i]);
+			git_vector_sort(&offsets);
+			git_vector_foreach(&offsets, i, current)
+				git_vector_insert(&oids, (void*)&current[4]);
+		}
+
+		git_vector_dispose(&offsets);
+		p->ids = (unsigned char **)git_vector_detach(NULL, NULL, &oids);
+	}
+
+	/*
+	 * We need to copy the OIDs to another array before we
+	 * relinquish the lock to avoid races.  We can also take
+	 * this opportunity to put them into normal form.
+	 */
+	git_array_init_to_size(oids, p->num_objects);
+	if (!oids.ptr) {
+		git_mutex_unlock(&p->lock);
+		git_array_clear(oids);
+		GIT_ERROR_CHECK_ARRAY(oids);
+	}
+	for (i = 0; i < p->num_objects; i++) {
+		oid = git_array_alloc(oids);
+		if (!oid) {
+			git_mutex_unlock(&p->lock);
+			git_array_clear(oids);
+			GIT_ERROR_CHECK_ALLOC(oid);
+		}
+		git_oid_from_raw(oid, p->ids[i], p->oid_type);
+	}
+
+	git_mutex_unlock(&p->lock);
+
+	git_array_foreach(oids, i, oid) {
+		if ((error = cb(oid, data)) != 0) {
+			git_error_set_after_callback(error);
+			break;
+		}
+	}
+
+	git_array_clear(oids);
+	return error;
+}
+
+int git_pack_num_objects(uint32_t *out, struct git_pack_file *p)
+{
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_pack_num_objects");
+
+	if ((error = pack_index_open_locked(p)) == 0)
+		*out = p->num_objects;
+
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+int git_pack_foreach_entry_range(
+	struct git_pack_file *p,
+	uint32_t start,
+	uint32_t end,
+	git_odb_foreach_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	size_t stride;
+	uint32_t i;
+	int error = 0;
+	git_array_oid_t oids = GIT_ARRAY_INIT;
+	git_oid *oid;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_pack_foreach_entry_range");
+
+	if ((error = pack_index_open_locked(p)) < 0) {
+		git_mutex_unlock(&p->lock);
+		return error;
+	}
+
+	if (!p->index_map.data) {
+		git_error_set(GIT_ERROR_INTERNAL, "internal error: p->index_map.data == NULL");
+		git_mutex_unlock(&p->lock);
+		return -1;
+	}
+
+	end = min(end, p->num_objects);
+
+	if (start >= end) {
+		git_mutex_unlock(&p->lock);
+		return 0;
+	}
+
+	/* Version 1 indexes interleave the offsets with the IDs */
+	index = p->index_map.data;
+
+	if (p->index_version > 1) {
+		index += 8 + 4 * 256;
+		stride = p->oid_size;
+	} else {
+		index += 4 * 256 + 4;
+		stride = p->oid_size + 4;
+	}
+
+	git_array_init_to_size(oids, end - start);
+	if (!oids.ptr) {
+		git_mutex_unlock(&p->lock);
+		GIT_ERROR_CHECK_ARRAY(oids);
+	}
+
+	for (i = start; i < end; i++) {
+		oid = git_array_alloc(oids);
+		git_oid_from_raw(oid, index + stride * i, p->oid_type);
+	}
+
+	git_mutex_unlock(&p->lock);
+
+	git_array_foreach(oids, i, oid) {
+		if ((error = cb(oid, data)) != 0) {
+			git_error_set_after_callback(error);
+			break;
+		}
+	}
 
 	git_array_clear(oids);
 	return error;
@@ -1466,6 +2247,112 @@ cleanup:
 	return error;
 }
 
+struct pack_object_position {
+	off64_t offset;
+	uint32_t n;
+};
+
+static int object_position_cmp(const void *a, const void *b)
+{
+	const struct pack_object_position *pos_a = a, *pos_b = b;
+
+	return (pos_a->offset < pos_b->offset) ? -1 : (pos_a->offset > pos_b->offset);
+}
+
+/* Run with the packfile lock held */
+static void nth_packed_object_id_locked(git_oid *out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index = p->index_map.data;
+
+	index += 4 * 256;
+
+	if (p->index_version > 1)
+		git_oid_from_raw(out, index + 8 + p->oid_size * n, p->oid_type);
+	else
+		git_oid_from_raw(out, index + (p->oid_size + 4) * n + 4, p->oid_type);
+}
+
+int git_pack_foreach_object(
+	struct git_pack_file *p,
+	git_odb_foreach_object_cb cb,
+	void *data)
+{
+	struct pack_object_position *objects = NULL;
+	git_pack_cache_entry *cached;
+	git_rawobj obj;
+	git_oid id;
+	off64_t offset;
+	uint32_t num_objects = 0, i;
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_pack_foreach_object");
+
+	if ((error = pack_index_open_locked(p)) < 0)
+		goto unlock;
+
+	num_objects = p->num_objects;
+	objects = git__calloc(num_objects + 1, sizeof(struct pack_object_position));
+
+	if (!objects) {
+		error = -1;
+		goto unlock;
+	}
+
+	for (i = 0; i < num_objects; i++) {
+		objects[i].n = i;
+
+		if ((objects[i].offset = nth_packed_object_offset_locked(p, i)) < 0) {
+			error = packfile_error("packfile index is corrupt");
+			goto unlock;
+		}
+	}
+
+unlock:
+	git_mutex_unlock(&p->lock);
+
+	if (error < 0)
+		goto cleanup;
+
+	qsort(objects, num_objects, sizeof(struct pack_object_position), object_position_cmp);
+
+	for (i = 0; i < num_objects; i++) {
+		if (git_mutex_lock(&p->lock) < 0) {
+			error = packfile_error("failed to get lock for git_pack_foreach_object");
+			goto cleanup;
+		}
+
+		nth_packed_object_id_locked(&id, p, objects[i].n);
+		git_mutex_unlock(&p->lock);
+
+		offset = objects[i].offset;
+
+		if ((error = git_packfile_unpack(&obj, p, &offset)) < 0)
+			goto cleanup;
+
+		error = cb(&id, obj.type, obj.data, obj.len, data);
+
+		/*
+		 * The objects that come next in the pack are often deltas
+		 * against this one, so hand it to the delta base cache
+		 * rather than freeing it.
+		 */
+		if (cache_add(&cached, p, &obj, objects[i].offset) == 0)
+			git_atomic32_dec(&cached->refcount);
+		else
+			git__free(obj.data);
+
+		if (error != 0) {
+			error = git_error_set_after_callback(error);
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	git__free(objects);
+	return error;
+}
+
 int git_pack__lookup_id(
 	const void *oid_lookup_table,
 	size_t stride,
@@ -1614,6 +2501,110 @@ cleanup:
 	return error;
 }
 
+int git_pack_entry_find_many(
+		struct git_pack_entry *entries,
+		size_t count,
+		struct git_pack_file *p)
+{
+	const uint32_t *level1_ofs;
+	const unsigned char *index;
+	unsigned hi, lo, stride, cursor = 0;
+	size_t i, j, found = 0;
+	off64_t offset;
+	int pos, error = 0;
+
+	GIT_ASSERT_ARG(p);
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for git_pack_entry_find_many");
+
+	if ((error = pack_index_open_locked(p)) < 0)
+		goto cleanup;
+
+	index = p->index_map.data;
+	level1_ofs = p->index_map.data;
+
+	if (p->index_version > 1) {
+		level1_ofs += 2;
+		index += 8;
+	}
+
+	index += 4 * 256;
+
+	if (p->index_version > 1) {
+		stride = p->oid_size;
+	} else {
+		stride = p->oid_size + 4;
+		index += 4;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct git_pack_entry *e = &entries[i];
+
+		if (e->p)
+			continue;
+
+		hi = ntohl(level1_ofs[(int)e->id.id[0]]);
+		lo = ((e->id.id[0] == 0x0) ? 0 : ntohl(level1_ofs[(int)e->id.id[0] - 1]));
+
+		/* The IDs are sorted, so this one cannot come before the last */
+		lo = max(lo, cursor);
+
+		if (lo >= hi)
+			continue;
+
+		pos = git_pack__lookup_id(index, stride, lo, hi, e->id.id, p->oid_type);
+
+		if (pos < 0) {
+			cursor = (unsigned)(-1 - pos);
+			continue;
+		}
+
+		cursor = (unsigned)pos;
+
+		for (j = 0; j < p->num_bad_objects; j++)
+			if (git_oid__cmp(&e->id, &p->bad_object_ids[j]) == 0)
+				break;
+
+		if (j < p->num_bad_objects)
+			continue;
+
+		if ((offset = nth_packed_object_offset_locked(p, pos)) < 0) {
+			git_error_set(GIT_ERROR_ODB, "packfile index is corrupt");
+			error = -1;
+			goto cleanup;
+		}
+
+		e->offset = offset;
+		e->p = p;
+		found++;
+	}
+
+	/* make sure the packfile backing the index still exists on disk */
+	if (found) {
+		if ((error = git_mutex_lock(&p->mwf.lock)) < 0) {
+			git_error_set(GIT_ERROR_OS, "failed to lock packfile reader");
+			goto cleanup;
+		}
+
+		if (p->mwf.fd == -1)
+			error = packfile_open_locked(p);
+
+		git_mutex_unlock(&p->mwf.lock);
+	}
+
+cleanup:
+	/* don't leave entries pointing into a pack that cannot be read */
+	if (error < 0) {
+		for (i = 0; i < count; i++)
+			if (entries[i].p == p)
+				entries[i].p = NULL;
+	}
+
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
 int git_pack_entry_find(
 		struct git_pack_entry *e,
 		struct git_pack_file *p,
@@ -68,10 +68,34 @@ struct git_pack_idx_header {
 	uint32_t idx_version;
 };
 
+/*
+ * An object in the delta base cache, which is shared by all packs. The
+ * entry is not evicted while its refcount is nonzero.
+ */
 typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
 	git_atomic32 refcount;
 	git_rawobj raw;
+
+	/*
+	 * The number of objects that borrow the data of the entry, as
+	 * given out by `git_packfile_unpack_shared`. Protected by the
+	 * lock of the entry's shard.
+	 */
+	unsigned int borrowers;
+
+	/*
+	 * Whether the entry was taken out of the cache while it was
+	 * borrowed, when its pack was freed; the last borrower frees it.
+	 */
+	bool detached;
+
+	/* The pack and offset of the object. */
+	uint64_t pack_id;
+	off64_t offset;
+
+	/* The neighbours of the entry in its shard, most recently used first. */
+	struct git_pack_cache_entry *prev;
+	struct git_pack_cache_entry *next;
 } git_pack_cache_entry;
 
 struct pack_chain_elem {
@@ -83,28 +107,31 @@ struct pack_chain_elem {
 
 typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
+#define GIT_PACK_CACHE_MEMORY_LIMIT 96 * 1024 * 1024
 #define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
 
+/*
+ * The memory that the entries which are borrowed by objects may use.
+ * They can't be evicted, so they are kept apart from the memory limit
+ * of the cache and don't crowd out the delta bases.
+ */
+#define GIT_PACK_CACHE_BORROWED_LIMIT 32 * 1024 * 1024
+
+/* The number of independently locked parts of the delta base cache. */
+#define GIT_PACK_CACHE_SHARDS 16
+
+/* The total amount of memory that the delta base cache may use. */
+extern size_t git_pack__cache_max_size;
+
 struct git_pack_entry {
 	off64_t offset;
 	git_oid id;
 	struct git_pack_file *p;
 };
 
-GIT_HASHMAP_STRUCT(git_pack_offsetmap, off64_t, git_pack_cache_entry *);
-
 GIT_HASHMAP_OID_STRUCT(git_pack_oidmap, struct git_pack_entry *);
 GIT_HASHMAP_OID_PROTOTYPES(git_pack_oidmap, struct git_pack_entry *);
 
-typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
-	git_pack_offsetmap entries;
-} git_pack_cache;
-
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
@@ -127,8 +154,9 @@ struct git_pack_file {
 
 	git_pack_oidmap idx_cache;
 	unsigned char **ids;
+	off64_t *offsets; /* object offsets in pack order, loaded on demand */
 
-	git_pack_cache bases; /* delta base cache */
+	uint64_t cache_id; /* identifies the pack in the delta base cache */
 
 	time_t last_freshen; /* last time the packfile was freshened */
 
@@ -162,6 +190,17 @@ typedef struct git_packfile_stream {
 	git_mwindow *mw;
 } git_packfile_stream;
 
+int git_pack_cache_global_init(void);
+
+/*
+ * Set the total amount of memory that the delta base cache may use,
+ * evicting the least recently used objects that no longer fit.
+ */
+void git_pack_cache_set_max_size(size_t max_size);
+
+/* The memory used by the delta base cache, and how often it was used. */
+void git_pack_cache_stats(size_t *memory_used, size_t *hits, size_t *misses);
+
 int git_packfile__object_header(size_t *out, unsigned char *hdr, size_t size, git_object_t type);
 
 int git_packfile__name(char **out, const char *path);
@@ -181,6 +220,70 @@ int git_packfile_resolve_header(
 
 int git_packfile_unpack(git_rawobj *obj, struct git_pack_file *p, off64_t *obj_offset);
 
+/*
+ * Unpack an object without copying it when it is in the delta base
+ * cache. If `shared_out` is set, the data belongs to the cache and stays
+ * valid until it is released with `git_packfile_shared_release`;
+ * otherwise the caller owns it, as with `git_packfile_unpack`.
+ */
+int git_packfile_unpack_shared(
+	git_rawobj *obj,
+	git_pack_cache_entry **shared_out,
+	struct git_pack_file *p,
+	off64_t offset);
+void git_packfile_shared_release(git_pack_cache_entry *shared);
+
+/*
+ * Ask the operating system to start reading the objects at the given
+ * offsets, which must be sorted, into memory in the background.
+ */
+int git_packfile_prefetch(struct git_pack_file *p, const off64_t *offsets, size_t count);
+
+/*
+ * How an object is stored in a pack, so that its compressed data can be
+ * copied into another pack without inflating it.
+ */
+typedef struct {
+	git_object_t type; /* the object type, or the kind of delta */
+	size_t size; /* the inflated size of the object or delta */
+	off64_t offset; /* where the object header starts */
+	off64_t data_offset; /* where the compressed data starts */
+	off64_t end; /* where the compressed data ends */
+	off64_t base_offset; /* the delta base, when the object is a delta */
+} git_packfile_raw;
+
+int git_packfile_raw_info(
+	git_packfile_raw *out,
+	struct git_pack_file *p,
+	off64_t offset);
+
+/*
+ * Check that the stored data of the object has not been corrupted, with
+ * the CRC in the pack index or, when the index has none, by inflating it.
+ */
+int git_packfile_raw_verify(
+	struct git_pack_file *p,
+	const git_packfile_raw *raw,
+	const git_oid *id);
+
+/* Pass the compressed data of the object to the callback, as it is mapped. */
+int git_packfile_raw_copy(
+	struct git_pack_file *p,
+	const git_packfile_raw *raw,
+	int (*cb)(const void *data, size_t len, void *payload),
+	void *payload);
+
+/*
+ * Pass all of the objects in the pack to the callback as they are stored,
+ * without the pack header and trailer, as they are mapped.  The objects
+ * are hashed as they are passed on, and an error is returned at the end
+ * when they don't match the checksum in the trailer.
+ */
+int git_packfile_copy_objects(
+	struct git_pack_file *p,
+	int (*cb)(const void *data, size_t len, void *payload),
+	void *payload);
+
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, off64_t curpos);
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
 void git_packfile_stream_dispose(git_packfile_stream *obj);
@@ -204,10 +307,43 @@ int git_pack_entry_find(
 		struct git_pack_file *p,
 		const git_oid *short_id,
 		size_t len);
+/*
+ * Look up the objects of the given entries, whose IDs must be sorted, in a
+ * single pass over the pack index. The entries that are found, and were
+ * not found before, are pointed at their offset in the pack.
+ */
+int git_pack_entry_find_many(
+		struct git_pack_entry *entries,
+		size_t count,
+		struct git_pack_file *p);
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		git_odb_foreach_cb cb,
 		void *data);
+/*
+ * Get the number of objects in the pack, opening its index if needed.
+ */
+int git_pack_num_objects(uint32_t *out, struct git_pack_file *p);
+/*
+ * Call the callback for the objects from position `start` up to `end` in
+ * the pack index, in the order of their IDs. Unlike
+ * git_pack_foreach_entry, only the IDs of the range are copied, so that
+ * the ranges of a large pack can be listed independently.
+ */
+int git_pack_foreach_entry_range(
+		struct git_pack_file *p,
+		uint32_t start,
+		uint32_t end,
+		git_odb_foreach_cb cb,
+		void *data);
+/*
+ * Read each object in the pack, in the order that they are stored in,
+ * and pass its contents to the callback.
+ */
+int git_pack_foreach_object(
+		struct git_pack_file *p,
+		git_odb_foreach_object_cb cb,
+		void *data);
 /**
  * Similar to git_pack_foreach_entry, but:
  * - It also provides the offset of the object within the
@@ -0,0 +1,1278 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack_bitmap.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "fs_path.h"
+#include "midx.h"
+#include "mwindow.h"
+#include "pack.h"
+#include "repository.h"
+
+#include "git2/commit.h"
+#include "git2/refs.h"
+#include "git2/tag.h"
+#include "git2/tree.h"
+
+GIT_HASHMAP_OID_FUNCTIONS(git_pack_bitmap_posmap, GIT_HASHMAP_INLINE, uint32_t);
+GIT_HASHMAP_OID_FUNCTIONS(git_pack_bitmap_commitmap, GIT_HASHMAP_INLINE, size_t);
+
+static int bitmap_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid bitmap file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) read_be32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+	       ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+struct pack_entry_position {
+	git_oid id;
+	off64_t offset;
+	uint32_t index;
+};
+
+typedef git_array_t(struct pack_entry_position) pack_entry_position_array;
+
+static int pack_collect_cb(const git_oid *id, off64_t offset, void *payload)
+{
+	pack_entry_position_array *entries = payload;
+	struct pack_entry_position *entry;
+	size_t index = git_array_size(*entries);
+
+	entry = git_array_alloc(*entries);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->id, id);
+	entry->offset = offset;
+	entry->index = (uint32_t)index;
+
+	return 0;
+}
+
+static int pack_entry_position_cmp(const void *a, const void *b, void *payload)
+{
+	const struct pack_entry_position *one = a, *two = b;
+
+	GIT_UNUSED(payload);
+
+	if (one->offset < two->offset)
+		return -1;
+	return (one->offset > two->offset) ? 1 : 0;
+}
+
+/*
+ * Build the bit position -> object ID table for a single-pack bitmap,
+ * where objects are numbered in pack (offset) order.  `index_to_pos`
+ * maps positions in the (OID-sorted) `.idx` to bit positions.
+ */
+static int load_pack_objects(
+	git_pack_bitmap_file *file,
+	uint32_t **index_to_pos,
+	unsigned char *checksum_out,
+	const char *idx_path)
+{
+	struct git_pack_file *pack = NULL;
+	pack_entry_position_array entries = GIT_ARRAY_INIT;
+	uint32_t i, count;
+	int error;
+
+	if ((error = git_mwindow_get_pack(&pack, idx_path, file->oid_type)) < 0)
+		return error;
+
+	if ((error = git_pack_foreach_entry_offset(pack, pack_collect_cb, &entries)) < 0)
+		goto done;
+
+	count = (uint32_t)git_array_size(entries);
+
+	if (pack->index_version < 2 || count != pack->num_objects) {
+		error = GIT_ENOTFOUND;
+		git_error_set(GIT_ERROR_ODB, "unsupported pack index for bitmap '%s'",
+			pack->pack_name);
+		goto done;
+	}
+
+	/* The index trailer holds the pack checksum followed by its own. */
+	memcpy(checksum_out, (unsigned char *)pack->index_map.data +
+		pack->index_map.len - 2 * pack->oid_size, pack->oid_size);
+
+	git__qsort_r(entries.ptr, count, sizeof(struct pack_entry_position),
+		pack_entry_position_cmp, NULL);
+
+	file->num_objects = count;
+	file->objects = git__calloc(count ? count : 1, sizeof(git_oid));
+	*index_to_pos = git__calloc(count ? count : 1, sizeof(uint32_t));
+
+	if (!file->objects || !*index_to_pos) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct pack_entry_position *entry = git_array_get(entries, i);
+
+		git_oid_cpy(&file->objects[i], &entry->id);
+		(*index_to_pos)[entry->index] = i;
+	}
+
+done:
+	git_array_clear(entries);
+	git_mwindow_put_pack(pack);
+	return error;
+}
+
+/*
+ * Build the bit position -> object ID table for a multi-pack-index
+ * bitmap, where objects are numbered in the pseudo-pack order given by
+ * the multi-pack-index's reverse index.
+ */
+static int load_midx_objects(
+	git_pack_bitmap_file *file,
+	uint32_t **index_to_pos,
+	const char *midx_path,
+	const unsigned char *checksum)
+{
+	git_midx_file *midx = NULL;
+	size_t oid_size = git_oid_size(file->oid_type);
+	uint32_t i, n;
+	int error;
+
+	if ((error = git_midx_open(&midx, midx_path, file->oid_type)) < 0)
+		return error;
+
+	if (!midx->reverse_index ||
+	    memcmp(midx->checksum, checksum, oid_size) != 0) {
+		error = GIT_ENOTFOUND;
+		git_error_set(GIT_ERROR_ODB, "bitmap does not match multi-pack-index '%s'",
+			midx_path);
+		goto done;
+	}
+
+	file->num_objects = midx->num_objects;
+	file->objects = git__calloc(midx->num_objects ? midx->num_objects : 1, sizeof(git_oid));
+	*index_to_pos = git__calloc(midx->num_objects ? midx->num_objects : 1, sizeof(uint32_t));
+
+	if (!file->objects || !*index_to_pos) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < midx->num_objects; i++) {
+		n = read_be32(midx->reverse_index + i * 4);
+
+		if (n >= midx->num_objects) {
+			error = bitmap_error("invalid multi-pack-index reverse index");
+			goto done;
+		}
+
+		git_oid_from_raw(&file->objects[i],
+			midx->oid_lookup + n * oid_size, file->oid_type);
+		(*index_to_pos)[n] = i;
+	}
+
+done:
+	git_midx_free(midx);
+	return error;
+}
+
+static int read_type_bitmap(
+	git_bitmap *out,
+	const unsigned char **data,
+	const unsigned char *end)
+{
+	size_t consumed;
+	int error;
+
+	if ((error = git_ewah_read(out, &consumed, *data, end - *data)) < 0)
+		return error;
+
+	*data += consumed;
+	return 0;
+}
+
+static int bitmap_file_parse(
+	git_pack_bitmap_file *file,
+	const unsigned char *data,
+	size_t size,
+	const char *index_path)
+{
+	const unsigned char *end, *checksum;
+	uint32_t *index_to_pos = NULL;
+	size_t oid_size = git_oid_size(file->oid_type), consumed, i;
+	uint32_t index;
+	int error;
+
+	if (size < 12 + 2 * oid_size)
+		return bitmap_error("file is too short");
+
+	if (memcmp(data, GIT_PACK_BITMAP_SIGNATURE, 4) != 0 ||
+	    ((data[4] << 8) | data[5]) != GIT_PACK_BITMAP_VERSION)
+		return bitmap_error("unsupported signature or version");
+
+	file->flags = (uint16_t)((data[6] << 8) | data[7]);
+	file->num_entries = read_be32(data + 8);
+	checksum = data + 12;
+
+	if (!(file->flags & GIT_PACK_BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmap is not a full closure");
+
+	if (file->midx) {
+		error = load_midx_objects(file, &index_to_pos, index_path, checksum);
+	} else {
+		unsigned char pack_checksum[GIT_HASH_MAX_SIZE];
+
+		if ((error = load_pack_objects(file, &index_to_pos,
+				pack_checksum, index_path)) == 0 &&
+		    memcmp(pack_checksum, checksum, oid_size) != 0) {
+			git_error_set(GIT_ERROR_ODB, "bitmap does not match packfile '%s'",
+				index_path);
+			error = GIT_ENOTFOUND;
+		}
+	}
+
+	if (error < 0)
+		goto done;
+
+	data += 12 + oid_size;
+	end = (const unsigned char *)file->map.data + size - oid_size;
+
+	if ((error = read_type_bitmap(&file->commits, &data, end)) < 0 ||
+	    (error = read_type_bitmap(&file->trees, &data, end)) < 0 ||
+	    (error = read_type_bitmap(&file->blobs, &data, end)) < 0 ||
+	    (error = read_type_bitmap(&file->tags, &data, end)) < 0)
+		goto done;
+
+	file->entries = git__calloc(file->num_entries ? file->num_entries : 1,
+		sizeof(git_pack_bitmap_entry));
+
+	if (!file->entries) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < file->num_entries; i++) {
+		git_pack_bitmap_entry *entry = &file->entries[i];
+		git_bitmap scratch = GIT_BITMAP_INIT;
+
+		if (end - data < 6) {
+			error = bitmap_error("truncated bitmap entry");
+			goto done;
+		}
+
+		index = read_be32(data);
+		entry->xor_offset = data[4];
+		entry->flags = data[5];
+		data += 6;
+
+		if (index >= file->num_objects || entry->xor_offset > i) {
+			error = bitmap_error("invalid bitmap entry");
+			goto done;
+		}
+
+		entry->pos = index_to_pos[index];
+
+		/*
+		 * Validate the compressed bitmap up-front, but defer the
+		 * decompression until it's actually needed.
+		 */
+		error = git_ewah_read(&scratch, &consumed, data, end - data);
+		git_bitmap_dispose(&scratch);
+
+		if (error < 0)
+			goto done;
+
+		entry->data = data;
+		entry->len = consumed;
+		data += consumed;
+
+		if ((error = git_pack_bitmap_commitmap_put(&file->entry_map,
+				&file->objects[entry->pos], i)) < 0)
+			goto done;
+	}
+
+	if (file->flags & GIT_PACK_BITMAP_OPT_HASH_CACHE) {
+		if ((size_t)(end - data) < (size_t)file->num_objects * 4) {
+			error = bitmap_error("truncated name-hash cache");
+			goto done;
+		}
+
+		file->name_hashes = data;
+	}
+
+	for (i = 0; i < file->num_objects; i++) {
+		if ((error = git_pack_bitmap_posmap_put(&file->positions,
+				&file->objects[i], (uint32_t)i)) < 0)
+			goto done;
+	}
+
+done:
+	git__free(index_to_pos);
+	return error;
+}
+
+struct find_bitmap_data {
+	git_str *out;
+	git_str *index_path;
+};
+
+static int find_pack_bitmap_cb(void *payload, git_str *path)
+{
+	struct find_bitmap_data *data = payload;
+	size_t len = path->size;
+	char *basename;
+	bool is_pack;
+
+	if (data->out->size || git__suffixcmp(path->ptr, ".bitmap") != 0)
+		return 0;
+
+	basename = git_fs_path_basename(path->ptr);
+	GIT_ERROR_CHECK_ALLOC(basename);
+
+	is_pack = git__prefixcmp(basename, "pack-") == 0;
+	git__free(basename);
+
+	if (!is_pack)
+		return 0;
+
+	if (git_str_set(data->out, path->ptr, len) < 0 ||
+	    git_str_set(data->index_path, path->ptr, len - strlen(".bitmap")) < 0 ||
+	    git_str_puts(data->index_path, ".idx") < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Locate the bitmap to use in the given pack directory.  git only ever
+ * uses a single bitmap, preferring one for the multi-pack-index.
+ */
+static int find_bitmap(
+	git_str *out,
+	git_str *index_path,
+	bool *midx,
+	const char *pack_dir,
+	git_oid_t oid_type)
+{
+	struct find_bitmap_data data;
+	git_str path = GIT_STR_INIT;
+	git_midx_file *midx_file = NULL;
+	int error;
+
+	*midx = false;
+
+	if ((error = git_str_joinpath(index_path, pack_dir, "multi-pack-index")) < 0)
+		return error;
+
+	if (git_fs_path_exists(index_path->ptr) &&
+	    git_midx_open(&midx_file, index_path->ptr, oid_type) == 0) {
+		char checksum[GIT_OID_MAX_HEXSIZE + 1];
+		git_oid id;
+
+		git_oid_from_raw(&id, midx_file->checksum, oid_type);
+		git_oid_tostr(checksum, sizeof(checksum), &id);
+
+		error = git_str_printf(out, "%s/multi-pack-index-%s.bitmap",
+			pack_dir, checksum);
+
+		if (!error && midx_file->reverse_index &&
+		    git_fs_path_exists(out->ptr))
+			*midx = true;
+		else
+			git_str_clear(out);
+
+		git_midx_free(midx_file);
+
+		if (error < 0 || *midx)
+			return error;
+	}
+
+	git_error_clear();
+	git_str_clear(out);
+	git_str_clear(index_path);
+
+	if ((error = git_str_sets(&path, pack_dir)) < 0)
+		goto done;
+
+	data.out = out;
+	data.index_path = index_path;
+
+	error = git_fs_path_direach(&path, 0, find_pack_bitmap_cb, &data);
+
+	if (!error && !out->size) {
+		git_error_set(GIT_ERROR_ODB, "no bitmap found in '%s'", pack_dir);
+		error = GIT_ENOTFOUND;
+	}
+
+done:
+	git_str_dispose(&path);
+	return error;
+}
+
+int git_pack_bitmap_file_open(
+	git_pack_bitmap_file **file_out,
+	const char *pack_dir,
+	git_oid_t oid_type)
+{
+	git_pack_bitmap_file *file;
+	git_str index_path = GIT_STR_INIT;
+	bool midx;
+	int error;
+
+	GIT_ASSERT_ARG(file_out && pack_dir && oid_type);
+
+	file = git__calloc(1, sizeof(git_pack_bitmap_file));
+	GIT_ERROR_CHECK_ALLOC(file);
+
+	file->oid_type = oid_type;
+
+	if (git_mutex_init(&file->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize bitmap mutex");
+		git__free(file);
+		return -1;
+	}
+
+	if ((error = find_bitmap(&file->filename, &index_path, &midx, pack_dir, oid_type)) < 0)
+		goto done;
+
+	file->midx = midx;
+
+	if ((error = git_futils_filestamp_check(&file->stamp, file->filename.ptr)) < 0 ||
+	    (error = git_futils_mmap_ro_file(&file->map, file->filename.ptr)) < 0)
+		goto done;
+
+	error = bitmap_file_parse(file, file->map.data, file->map.len, index_path.ptr);
+
+done:
+	git_str_dispose(&index_path);
+
+	if (error < 0)
+		git_pack_bitmap_file_free(file);
+	else
+		*file_out = file;
+
+	return error;
+}
+
+bool git_pack_bitmap_file_needs_refresh(const git_pack_bitmap_file *file)
+{
+	git_futils_filestamp stamp;
+
+	git_futils_filestamp_set(&stamp, &file->stamp);
+	return git_futils_filestamp_check(&stamp, file->filename.ptr) != 0;
+}
+
+void git_pack_bitmap_file_free(git_pack_bitmap_file *file)
+{
+	size_t i;
+
+	if (!file)
+		return;
+
+	for (i = 0; file->entries && i < file->num_entries; i++) {
+		git_bitmap_dispose(file->entries[i].bitmap);
+		git__free(file->entries[i].bitmap);
+	}
+
+	git__free(file->entries);
+	git__free(file->objects);
+	git_pack_bitmap_posmap_dispose(&file->positions);
+	git_pack_bitmap_commitmap_dispose(&file->entry_map);
+	git_bitmap_dispose(&file->commits);
+	git_bitmap_dispose(&file->trees);
+	git_bitmap_dispose(&file->blobs);
+	git_bitmap_dispose(&file->tags);
+
+	if (file->map.data)
+		git_futils_mmap_free(&file->map);
+
+	git_str_dispose(&file->filename);
+	git_mutex_free(&file->lock);
+	git__free(file);
+}
+
+int git_pack_bitmap_file_position(
+	uint32_t *pos_out,
+	git_pack_bitmap_file *file,
+	const git_oid *id)
+{
+	return git_pack_bitmap_posmap_get(pos_out, &file->positions, id);
+}
+
+int git_pack_bitmap_file_object(
+	const git_oid **id_out,
+	git_object_t *type_out,
+	uint32_t *name_hash_out,
+	git_pack_bitmap_file *file,
+	uint32_t pos)
+{
+	if (pos >= file->num_objects) {
+		git_error_set(GIT_ERROR_INVALID, "bitmap position %u does not exist", pos);
+		return GIT_ENOTFOUND;
+	}
+
+	if (id_out)
+		*id_out = &file->objects[pos];
+
+	if (type_out) {
+		if (git_bitmap_get(&file->commits, pos))
+			*type_out = GIT_OBJECT_COMMIT;
+		else if (git_bitmap_get(&file->trees, pos))
+			*type_out = GIT_OBJECT_TREE;
+		else if (git_bitmap_get(&file->blobs, pos))
+			*type_out = GIT_OBJECT_BLOB;
+		else if (git_bitmap_get(&file->tags, pos))
+			*type_out = GIT_OBJECT_TAG;
+		else
+			*type_out = GIT_OBJECT_INVALID;
+	}
+
+	if (name_hash_out)
+		*name_hash_out = file->name_hashes ?
+			read_be32(file->name_hashes + pos * 4) : 0;
+
+	return 0;
+}
+
+/* Resolve the given entry's bitmap; called with the file lock held. */
+static int resolve_entry_locked(
+	git_bitmap **out,
+	git_pack_bitmap_file *file,
+	size_t idx)
+{
+	git_pack_bitmap_entry *entry = &file->entries[idx];
+	git_bitmap *bitmap, *base;
+	size_t consumed;
+	int error;
+
+	if (entry->bitmap) {
+		*out = entry->bitmap;
+		return 0;
+	}
+
+	bitmap = git__calloc(1, sizeof(git_bitmap));
+	GIT_ERROR_CHECK_ALLOC(bitmap);
+
+	if ((error = git_ewah_read(bitmap, &consumed, entry->data, entry->len)) < 0)
+		goto on_error;
+
+	/*
+	 * XOR offsets only ever point backwards, so the recursion is
+	 * bounded by the number of entries (and in practice by git's
+	 * maximum XOR chain length of 160).
+	 */
+	if (entry->xor_offset) {
+		if ((error = resolve_entry_locked(&base, file, idx - entry->xor_offset)) < 0 ||
+		    (error = git_bitmap_xor(bitmap, base)) < 0)
+			goto on_error;
+	}
+
+	entry->bitmap = bitmap;
+	*out = bitmap;
+	return 0;
+
+on_error:
+	git_bitmap_dispose(bitmap);
+	git__free(bitmap);
+	return error;
+}
+
+int git_pack_bitmap_file_commit(
+	const git_bitmap **out,
+	git_pack_bitmap_file *file,
+	const git_oid *id)
+{
+	git_bitmap *bitmap;
+	size_t idx;
+	int error;
+
+	if ((error = git_pack_bitmap_commitmap_get(&idx, &file->entry_map, id)) < 0)
+		return error;
+
+	if (git_mutex_lock(&file->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock bitmap file");
+		return -1;
+	}
+
+	error = resolve_entry_locked(&bitmap, file, idx);
+	git_mutex_unlock(&file->lock);
+
+	if (!error)
+		*out = bitmap;
+
+	return error;
+}
+
+typedef git_array_t(git_oid) bitmap_oid_stack;
+
+static int reachable_push(
+	bitmap_oid_stack *stack,
+	git_bitmap *out,
+	git_pack_bitmap_file *file,
+	const git_oid *id)
+{
+	git_oid *entry;
+	uint32_t pos;
+
+	if (git_pack_bitmap_file_position(&pos, file, id) < 0) {
+		git_error_set(GIT_ERROR_ODB, "object not covered by bitmap");
+		return GIT_ENOTFOUND;
+	}
+
+	if (git_bitmap_get(out, pos))
+		return 0;
+
+	entry = git_array_alloc(*stack);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(entry, id);
+	return 0;
+}
+
+static int reachable_tree(
+	git_bitmap *out,
+	git_pack_bitmap_file *file,
+	git_repository *repo,
+	bitmap_oid_stack *stack,
+	const git_oid *id)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+	uint32_t pos;
+	size_t i;
+	int error;
+
+	if ((error = git_tree_lookup(&tree, repo, id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJECT_TREE:
+			error = reachable_push(stack, out, file, git_tree_entry_id(entry));
+			break;
+		case GIT_OBJECT_BLOB:
+			if ((error = git_pack_bitmap_file_position(&pos, file,
+					git_tree_entry_id(entry))) < 0) {
+				git_error_set(GIT_ERROR_ODB, "object not covered by bitmap");
+				error = GIT_ENOTFOUND;
+			} else {
+				error = git_bitmap_set(out, pos);
+			}
+			break;
+		default:
+			/* submodules are not part of the closure */
+			break;
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+static int reachable_commit(
+	git_pack_bitmap_file *file,
+	git_repository *repo,
+	bitmap_oid_stack *stack,
+	git_bitmap *out,
+	const git_oid *id)
+{
+	git_commit *commit;
+	size_t i;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, repo, id)) < 0)
+		return error;
+
+	error = reachable_push(stack, out, file, git_commit_tree_id(commit));
+
+	for (i = 0; !error && i < git_commit_parentcount(commit); i++)
+		error = reachable_push(stack, out, file, git_commit_parent_id(commit, i));
+
+	git_commit_free(commit);
+	return error;
+}
+
+static int reachable_tag(
+	git_pack_bitmap_file *file,
+	git_repository *repo,
+	bitmap_oid_stack *stack,
+	git_bitmap *out,
+	const git_oid *id)
+{
+	git_tag *tag;
+	int error;
+
+	if ((error = git_tag_lookup(&tag, repo, id)) < 0)
+		return error;
+
+	error = reachable_push(stack, out, file, git_tag_target_id(tag));
+
+	git_tag_free(tag);
+	return error;
+}
+
+int git_pack_bitmap_file_reachable(
+	git_bitmap *out,
+	git_pack_bitmap_file *file,
+	git_repository *repo,
+	const git_oid *tips,
+	size_t tips_len)
+{
+	bitmap_oid_stack stack = GIT_ARRAY_INIT;
+	const git_bitmap *stored;
+	git_object_t type;
+	git_oid *top, id;
+	uint32_t pos;
+	size_t i;
+	int error = 0;
+
+	GIT_ASSERT_ARG(out && file && repo);
+
+	git_bitmap_clear(out);
+
+	for (i = 0; !error && i < tips_len; i++)
+		error = reachable_push(&stack, out, file, &tips[i]);
+
+	while (!error && (top = git_array_pop(stack)) != NULL) {
+		git_oid_cpy(&id, top);
+
+		if ((error = git_pack_bitmap_file_position(&pos, file, &id)) < 0)
+			break;
+
+		if (git_bitmap_get(out, pos))
+			continue;
+
+		/* A stored bitmap already contains the full closure. */
+		if ((error = git_pack_bitmap_file_commit(&stored, file, &id)) == 0) {
+			error = git_bitmap_or(out, stored);
+			continue;
+		} else if (error != GIT_ENOTFOUND) {
+			break;
+		}
+
+		if ((error = git_bitmap_set(out, pos)) < 0 ||
+		    (error = git_pack_bitmap_file_object(NULL, &type, NULL, file, pos)) < 0)
+			break;
+
+		switch (type) {
+		case GIT_OBJECT_COMMIT:
+			error = reachable_commit(file, repo, &stack, out, &id);
+			break;
+		case GIT_OBJECT_TREE:
+			error = reachable_tree(out, file, repo, &stack, &id);
+			break;
+		case GIT_OBJECT_TAG:
+			error = reachable_tag(file, repo, &stack, out, &id);
+			break;
+		default:
+			break;
+		}
+	}
+
+	git_array_clear(stack);
+	return error;
+}
+
+int git_pack_bitmap_new(
+	git_pack_bitmap **bitmap_out,
+	const char *objects_dir,
+	git_oid_t oid_type)
+{
+	git_pack_bitmap *bitmap;
+
+	GIT_ASSERT_ARG(bitmap_out && objects_dir && oid_type);
+
+	bitmap = git__calloc(1, sizeof(git_pack_bitmap));
+	GIT_ERROR_CHECK_ALLOC(bitmap);
+
+	bitmap->oid_type = oid_type;
+
+	if (git_str_joinpath(&bitmap->pack_dir, objects_dir, "pack") < 0) {
+		git_pack_bitmap_free(bitmap);
+		return -1;
+	}
+
+	*bitmap_out = bitmap;
+	return 0;
+}
+
+int git_pack_bitmap_get_file(
+	git_pack_bitmap_file **file_out,
+	git_pack_bitmap *bitmap)
+{
+	if (!bitmap->checked) {
+		int error = 0;
+		git_pack_bitmap_file *result = NULL;
+
+		/* We only check once, no matter the result. */
+		bitmap->checked = 1;
+
+		/* Best effort */
+		error = git_pack_bitmap_file_open(&result,
+			git_str_cstr(&bitmap->pack_dir), bitmap->oid_type);
+
+		if (error < 0)
+			return error;
+
+		bitmap->file = result;
+	}
+	if (!bitmap->file)
+		return GIT_ENOTFOUND;
+
+	*file_out = bitmap->file;
+	return 0;
+}
+
+void git_pack_bitmap_refresh(git_pack_bitmap *bitmap)
+{
+	if (!bitmap->checked)
+		return;
+
+	if (bitmap->file && !git_pack_bitmap_file_needs_refresh(bitmap->file))
+		return;
+
+	/*
+	 * The bitmap has changed or was never found; free it so that it
+	 * will be looked up again the next time that it is requested.
+	 */
+	git_pack_bitmap_file_free(bitmap->file);
+	bitmap->file = NULL;
+	bitmap->checked = 0;
+}
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git_str_dispose(&bitmap->pack_dir);
+	git_pack_bitmap_file_free(bitmap->file);
+	git__free(bitmap);
+}
+
+int git_pack_bitmap_writer_new(
+	git_pack_bitmap_writer **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_pack_bitmap_writer *w;
+	uint32_t *index_to_pos = NULL, i;
+	size_t path_len;
+	int error;
+
+	GIT_ASSERT_ARG(out && repo && idx_path);
+
+	path_len = strlen(idx_path);
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		git_error_set(GIT_ERROR_INVALID, "invalid pack index path '%s'", idx_path);
+		return -1;
+	}
+
+	w = git__calloc(1, sizeof(git_pack_bitmap_writer));
+	GIT_ERROR_CHECK_ALLOC(w);
+
+	w->repo = repo;
+
+	if ((error = git_str_put(&w->bitmap_path, idx_path, path_len - strlen(".idx"))) < 0 ||
+	    (error = git_str_puts(&w->bitmap_path, ".bitmap")) < 0)
+		goto on_error;
+
+	w->index = git__calloc(1, sizeof(git_pack_bitmap_file));
+	GIT_ERROR_CHECK_ALLOC(w->index);
+
+	w->index->oid_type = repo->oid_type;
+
+	if (git_mutex_init(&w->index->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize bitmap mutex");
+		git__free(w->index);
+		w->index = NULL;
+		error = -1;
+		goto on_error;
+	}
+
+	if ((error = load_pack_objects(w->index, &index_to_pos, w->checksum, idx_path)) < 0)
+		goto on_error;
+
+	w->pos_to_index = git__calloc(w->index->num_objects ? w->index->num_objects : 1, sizeof(uint32_t));
+	w->name_hashes = git__calloc(w->index->num_objects ? w->index->num_objects : 1, sizeof(uint32_t));
+
+	if (!w->pos_to_index || !w->name_hashes) {
+		error = -1;
+		goto on_error;
+	}
+
+	for (i = 0; i < w->index->num_objects; i++) {
+		w->pos_to_index[index_to_pos[i]] = i;
+
+		if ((error = git_pack_bitmap_posmap_put(&w->index->positions,
+				&w->index->objects[i], i)) < 0)
+			goto on_error;
+	}
+
+	git__free(index_to_pos);
+	*out = w;
+	return 0;
+
+on_error:
+	git__free(index_to_pos);
+	git_pack_bitmap_writer_free(w);
+	return error;
+}
+
+int git_pack_bitmap_writer_add(
+	git_pack_bitmap_writer *w,
+	const git_oid *id,
+	git_object_t type,
+	uint32_t name_hash)
+{
+	git_bitmap *type_bitmap;
+	uint32_t pos;
+
+	GIT_ASSERT_ARG(w && id);
+
+	switch (type) {
+	case GIT_OBJECT_COMMIT:
+		type_bitmap = &w->index->commits;
+		break;
+	case GIT_OBJECT_TREE:
+		type_bitmap = &w->index->trees;
+		break;
+	case GIT_OBJECT_BLOB:
+		type_bitmap = &w->index->blobs;
+		break;
+	case GIT_OBJECT_TAG:
+		type_bitmap = &w->index->tags;
+		break;
+	default:
+		git_error_set(GIT_ERROR_INVALID, "invalid object type for bitmap");
+		return -1;
+	}
+
+	if (git_pack_bitmap_file_position(&pos, w->index, id) < 0) {
+		git_error_set(GIT_ERROR_INVALID, "object is not in the packfile");
+		return GIT_ENOTFOUND;
+	}
+
+	w->name_hashes[pos] = name_hash;
+	return git_bitmap_set(type_bitmap, pos);
+}
+
+struct bitmap_commit {
+	uint32_t pos;
+	git_time_t time;
+};
+
+static int bitmap_commit_cmp(const void *a, const void *b, void *payload)
+{
+	const struct bitmap_commit *one = a, *two = b;
+
+	GIT_UNUSED(payload);
+
+	/* newest first, ties broken by pack order for stability */
+	if (one->time != two->time)
+		return (one->time > two->time) ? -1 : 1;
+
+	return (one->pos < two->pos) ? -1 : (one->pos > two->pos);
+}
+
+/*
+ * The number of commits to skip before selecting the next one, when
+ * the commits are sorted newest first; this is the same spacing that
+ * git uses: every recent commit, then every 100th and finally every
+ * 5000th commit.
+ */
+static size_t next_commit_index(size_t idx)
+{
+	size_t offset, next;
+
+	if (idx <= 100)
+		return 0;
+
+	if (idx <= 20000) {
+		offset = idx - 100;
+		return (offset < 100) ? offset : 100;
+	}
+
+	offset = idx - 20000;
+	next = (offset < 5000) ? offset : 5000;
+	return (next > 100) ? next : 100;
+}
+
+static int mark_ref_tips(git_bitmap *tips, git_pack_bitmap_writer *w)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_object *obj;
+	uint32_t pos;
+	int error;
+
+	if ((error = git_reference_iterator_new(&iter, w->repo)) < 0)
+		return error;
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		if (git_reference_peel(&obj, ref, GIT_OBJECT_COMMIT) == 0) {
+			if (git_pack_bitmap_file_position(&pos, w->index, git_object_id(obj)) == 0)
+				error = git_bitmap_set(tips, pos);
+
+			git_object_free(obj);
+		}
+
+		git_reference_free(ref);
+
+		if (error < 0)
+			break;
+	}
+
+	if (error == GIT_ITEROVER) {
+		git_error_clear();
+		error = 0;
+	}
+
+	git_reference_iterator_free(iter);
+	return error;
+}
+
+typedef git_array_t(struct bitmap_commit) bitmap_commit_array;
+
+static int select_commits(bitmap_commit_array *selected, git_pack_bitmap_writer *w)
+{
+	bitmap_commit_array commits = GIT_ARRAY_INIT;
+	struct bitmap_commit *commit, *entry;
+	git_bitmap tips = GIT_BITMAP_INIT;
+	git_commit *obj;
+	size_t pos = 0, count, i, j, next;
+	int error = 0;
+
+	while (git_bitmap_next(&pos, &w->index->commits) == 0) {
+		if ((error = git_commit_lookup(&obj, w->repo, &w->index->objects[pos])) < 0)
+			goto done;
+
+		commit = git_array_alloc(commits);
+		GIT_ERROR_CHECK_ALLOC(commit);
+
+		commit->pos = (uint32_t)pos++;
+		commit->time = git_commit_time(obj);
+
+		git_commit_free(obj);
+	}
+
+	count = git_array_size(commits);
+	git__qsort_r(commits.ptr, count, sizeof(struct bitmap_commit),
+		bitmap_commit_cmp, NULL);
+
+	if ((error = mark_ref_tips(&tips, w)) < 0)
+		goto done;
+
+	for (i = 0; i < count; i += next + 1) {
+		next = next_commit_index(i);
+
+		if (next > count - i - 1)
+			next = count - i - 1;
+
+		/* prefer a commit that a reference points to */
+		commit = git_array_get(commits, i);
+
+		for (j = 0; j <= next; j++) {
+			struct bitmap_commit *candidate = git_array_get(commits, i + j);
+
+			if (git_bitmap_get(&tips, candidate->pos)) {
+				commit = candidate;
+				break;
+			}
+		}
+
+		entry = git_array_alloc(*selected);
+		GIT_ERROR_CHECK_ALLOC(entry);
+
+		memcpy(entry, commit, sizeof(struct bitmap_commit));
+	}
+
+done:
+	git_bitmap_dispose(&tips);
+	git_array_clear(commits);
+	return error;
+}
+
+/*
+ * Compute the bitmaps of the selected commits, oldest first, so that
+ * each one can reuse the bitmaps of the commits that it builds upon.
+ */
+static int compute_bitmaps(git_pack_bitmap_writer *w, bitmap_commit_array *selected)
+{
+	git_pack_bitmap_file *index = w->index;
+	git_pack_bitmap_entry *entry;
+	struct bitmap_commit *commit;
+	size_t i = git_array_size(*selected);
+	int error;
+
+	index->entries = git__calloc(i ? i : 1, sizeof(git_pack_bitmap_entry));
+	GIT_ERROR_CHECK_ALLOC(index->entries);
+
+	while (i--) {
+		commit = git_array_get(*selected, i);
+		entry = &index->entries[index->num_entries];
+
+		entry->pos = commit->pos;
+		entry->bitmap = git__calloc(1, sizeof(git_bitmap));
+		GIT_ERROR_CHECK_ALLOC(entry->bitmap);
+
+		/* count the entry now so that it's freed on failure */
+		index->num_entries++;
+
+		error = git_pack_bitmap_file_reachable(entry->bitmap, index,
+			w->repo, &index->objects[commit->pos], 1);
+
+		if (error == GIT_ENOTFOUND) {
+			git_error_set(GIT_ERROR_INVALID,
+				"cannot write bitmap: packfile is missing objects reachable from %s",
+				git_oid_tostr_s(&index->objects[commit->pos]));
+			return -1;
+		} else if (error < 0) {
+			return error;
+		}
+
+		if ((error = git_pack_bitmap_commitmap_put(&index->entry_map,
+				&index->objects[entry->pos], index->num_entries - 1)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+GIT_INLINE(int) put_be32(git_str *out, uint32_t val)
+{
+	unsigned char buf[4];
+
+	buf[0] = (unsigned char)(val >> 24);
+	buf[1] = (unsigned char)(val >> 16);
+	buf[2] = (unsigned char)(val >> 8);
+	buf[3] = (unsigned char)val;
+
+	return git_str_put(out, (const char *)buf, sizeof(buf));
+}
+
+int git_pack_bitmap_writer_dump(git_str *out, git_pack_bitmap_writer *w)
+{
+	git_pack_bitmap_file *index;
+	bitmap_commit_array selected = GIT_ARRAY_INIT;
+	unsigned char header[8], checksum[GIT_HASH_MAX_SIZE];
+	size_t oid_size, typed, start = out->size, i;
+	uint16_t flags = GIT_PACK_BITMAP_OPT_FULL_DAG | GIT_PACK_BITMAP_OPT_HASH_CACHE;
+	int error;
+
+	GIT_ASSERT_ARG(out && w);
+
+	index = w->index;
+	oid_size = git_oid_size(index->oid_type);
+
+	typed = git_bitmap_popcount(&index->commits) +
+		git_bitmap_popcount(&index->trees) +
+		git_bitmap_popcount(&index->blobs) +
+		git_bitmap_popcount(&index->tags);
+
+	if (typed != index->num_objects) {
+		git_error_set(GIT_ERROR_INVALID,
+			"cannot write bitmap: not all objects in the packfile were described");
+		return -1;
+	}
+
+	if ((error = select_commits(&selected, w)) < 0 ||
+	    (error = compute_bitmaps(w, &selected)) < 0)
+		goto done;
+
+	memcpy(header, GIT_PACK_BITMAP_SIGNATURE, 4);
+	header[4] = 0;
+	header[5] = GIT_PACK_BITMAP_VERSION;
+	header[6] = (unsigned char)(flags >> 8);
+	header[7] = (unsigned char)flags;
+
+	if ((error = git_str_put(out, (const char *)header, sizeof(header))) < 0 ||
+	    (error = put_be32(out, (uint32_t)index->num_entries)) < 0 ||
+	    (error = git_str_put(out, (const char *)w->checksum, oid_size)) < 0 ||
+	    (error = git_ewah_write(out, &index->commits)) < 0 ||
+	    (error = git_ewah_write(out, &index->trees)) < 0 ||
+	    (error = git_ewah_write(out, &index->blobs)) < 0 ||
+	    (error = git_ewah_write(out, &index->tags)) < 0)
+		goto done;
+
+	for (i = 0; i < index->num_entries; i++) {
+		git_pack_bitmap_entry *entry = &index->entries[i];
+
+		/* no XOR compression and no flags */
+		if ((error = put_be32(out, w->pos_to_index[entry->pos])) < 0 ||
+		    (error = git_str_put(out, "\0\0", 2)) < 0 ||
+		    (error = git_ewah_write(out, entry->bitmap)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < index->num_objects; i++) {
+		if ((error = put_be32(out, w->name_hashes[i])) < 0)
+			goto done;
+	}
+
+	if ((error = git_hash_buf(checksum, out->ptr + start, out->size - start,
+			git_oid_algorithm(index->oid_type))) < 0)
+		goto done;
+
+	error = git_str_put(out, (const char *)checksum, oid_size);
+
+done:
+	git_array_clear(selected);
+	return error;
+}
+
+int git_pack_bitmap_writer_commit(git_pack_bitmap_writer *w, mode_t mode)
+{
+	git_filebuf output = GIT_FILEBUF_INIT;
+	git_str data = GIT_STR_INIT;
+	int filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
+	int error;
+
+	GIT_ASSERT_ARG(w);
+
+	if ((error = git_pack_bitmap_writer_dump(&data, w)) < 0)
+		goto done;
+
+	if (git_repository__fsync_gitdir)
+		filebuf_flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_filebuf_open(&output, w->bitmap_path.ptr, filebuf_flags, mode)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_write(&output, data.ptr, data.size)) < 0) {
+		git_filebuf_cleanup(&output);
+		goto done;
+	}
+
+	error = git_filebuf_commit(&output);
+
+done:
+	git_str_dispose(&data);
+	return error;
+}
+
+void git_pack_bitmap_writer_free(git_pack_bitmap_writer *w)
+{
+	if (!w)
+		return;
+
+	git_pack_bitmap_file_free(w->index);
+	git_str_dispose(&w->bitmap_path);
+	git__free(w->pos_to_index);
+	git__free(w->name_hashes);
+	git__free(w);
+}
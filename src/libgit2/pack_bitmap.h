@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+
+#include "ewah.h"
+#include "futils.h"
+#include "hashmap_oid.h"
+#include "thread.h"
+
+#define GIT_PACK_BITMAP_SIGNATURE "BITM"
+#define GIT_PACK_BITMAP_VERSION 1
+
+#define GIT_PACK_BITMAP_OPT_FULL_DAG     0x1
+#define GIT_PACK_BITMAP_OPT_HASH_CACHE   0x4
+#define GIT_PACK_BITMAP_OPT_LOOKUP_TABLE 0x10
+
+GIT_HASHMAP_OID_STRUCT(git_pack_bitmap_posmap, uint32_t);
+GIT_HASHMAP_OID_STRUCT(git_pack_bitmap_commitmap, size_t);
+
+/*
+ * A stored reachability bitmap for a single commit.  The bitmap may
+ * be XOR'ed against that of an earlier entry; it is decompressed and
+ * resolved lazily the first time that it is needed.
+ */
+typedef struct {
+	/* The bit position of the commit. */
+	uint32_t pos;
+
+	/* The distance to the entry that this bitmap is XOR'ed against. */
+	uint8_t xor_offset;
+	uint8_t flags;
+
+	/* The EWAH-compressed bitmap data. */
+	const unsigned char *data;
+	size_t len;
+
+	/* The decompressed and resolved bitmap, once loaded. */
+	git_bitmap *bitmap;
+} git_pack_bitmap_entry;
+
+/*
+ * A reachability bitmap (`.bitmap`) file.
+ *
+ * This accompanies either a single packfile (`pack-<checksum>.bitmap`) or
+ * a multi-pack-index (`multi-pack-index-<checksum>.bitmap`) and stores,
+ * for a selection of commits, the set of all objects that are reachable
+ * from each of them.  Objects are numbered by their position in the
+ * packfile (or, for a multi-pack-index, the pseudo-pack order given by
+ * its reverse index).
+ */
+typedef struct git_pack_bitmap_file {
+	git_map map;
+
+	/* The path to the bitmap file. */
+	git_str filename;
+	git_futils_filestamp stamp;
+
+	/* The object ID type of the bitmap. */
+	git_oid_t oid_type;
+
+	uint16_t flags;
+
+	/* Whether this bitmap covers a multi-pack-index. */
+	unsigned int midx : 1;
+
+	/* The number of objects in the pack (or multi-pack-index). */
+	uint32_t num_objects;
+
+	/* The object IDs of each object, indexed by bit position. */
+	git_oid *objects;
+	git_pack_bitmap_posmap positions;
+
+	/* The type bitmaps. */
+	git_bitmap commits;
+	git_bitmap trees;
+	git_bitmap blobs;
+	git_bitmap tags;
+
+	/* The stored commit bitmaps, in file order. */
+	git_pack_bitmap_entry *entries;
+	size_t num_entries;
+	git_pack_bitmap_commitmap entry_map;
+
+	/* The optional name-hash cache, one 4-byte entry per object. */
+	const unsigned char *name_hashes;
+
+	/* Protects the lazy resolution of commit bitmaps. */
+	git_mutex lock;
+} git_pack_bitmap_file;
+
+/* A wrapper for git_pack_bitmap_file to enable lazy loading in the ODB. */
+typedef struct git_pack_bitmap {
+	/* The path to the packfile directory. */
+	git_str pack_dir;
+
+	/* The underlying bitmap file. */
+	git_pack_bitmap_file *file;
+
+	/* The object ID type of the repository. */
+	git_oid_t oid_type;
+
+	/* Whether the bitmap file was already looked for. */
+	bool checked;
+} git_pack_bitmap;
+
+/** Create a new (lazily-loaded) bitmap for the given objects directory. */
+int git_pack_bitmap_new(
+	git_pack_bitmap **bitmap_out,
+	const char *objects_dir,
+	git_oid_t oid_type);
+
+/*
+ * Attempt to get the git_pack_bitmap's bitmap file.  This object is still
+ * owned by the git_pack_bitmap.  If the repository does not contain a
+ * reachability bitmap, it will return GIT_ENOTFOUND.
+ *
+ * This function is not thread-safe.
+ */
+int git_pack_bitmap_get_file(
+	git_pack_bitmap_file **file_out,
+	git_pack_bitmap *bitmap);
+
+/* Marks the bitmap file as needing a refresh. */
+void git_pack_bitmap_refresh(git_pack_bitmap *bitmap);
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap);
+
+/*
+ * Find and open the reachability bitmap in the given pack directory.  A
+ * multi-pack-index bitmap is preferred over a single-pack bitmap, as git
+ * does.  Returns GIT_ENOTFOUND if there is no usable bitmap.
+ */
+int git_pack_bitmap_file_open(
+	git_pack_bitmap_file **file_out,
+	const char *pack_dir,
+	git_oid_t oid_type);
+
+/*
+ * Returns whether the git_pack_bitmap_file needs to be reloaded since the
+ * file has changed (or been removed) on disk.
+ */
+bool git_pack_bitmap_file_needs_refresh(const git_pack_bitmap_file *file);
+
+void git_pack_bitmap_file_free(git_pack_bitmap_file *file);
+
+/** Look up the bit position of an object, or GIT_ENOTFOUND. */
+int git_pack_bitmap_file_position(
+	uint32_t *pos_out,
+	git_pack_bitmap_file *file,
+	const git_oid *id);
+
+/*
+ * Look up the object at the given bit position.  The name hash is only
+ * available when the file has a hash cache, and is zero otherwise.
+ */
+int git_pack_bitmap_file_object(
+	const git_oid **id_out,
+	git_object_t *type_out,
+	uint32_t *name_hash_out,
+	git_pack_bitmap_file *file,
+	uint32_t pos);
+
+/*
+ * Get the stored reachability bitmap of a commit, or GIT_ENOTFOUND if
+ * the commit was not selected for a bitmap.  The returned bitmap is
+ * owned by the file.
+ */
+int git_pack_bitmap_file_commit(
+	const git_bitmap **out,
+	git_pack_bitmap_file *file,
+	const git_oid *id);
+
+/*
+ * Compute the set of objects reachable from the given tips, filling in
+ * any gaps between stored bitmaps by walking the objects themselves.
+ * Returns GIT_ENOTFOUND if any reachable object is not covered by the
+ * bitmap, in which case the caller should fall back to a regular walk.
+ */
+int git_pack_bitmap_file_reachable(
+	git_bitmap *out,
+	git_pack_bitmap_file *file,
+	git_repository *repo,
+	const git_oid *tips,
+	size_t tips_len);
+
+/*
+ * A writer for the `.bitmap` file of a single packfile.
+ */
+typedef struct git_pack_bitmap_writer {
+	git_repository *repo;
+
+	/* The path of the `.bitmap` file to write. */
+	git_str bitmap_path;
+
+	/* The bitmap that is being built. */
+	git_pack_bitmap_file *index;
+
+	/* The position of each object within the `.idx`, by bit position. */
+	uint32_t *pos_to_index;
+
+	/* The name hash of each object, by bit position. */
+	uint32_t *name_hashes;
+
+	/* The checksum of the packfile. */
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+} git_pack_bitmap_writer;
+
+/** Create a new bitmap writer for the pack with the given `.idx` file. */
+int git_pack_bitmap_writer_new(
+	git_pack_bitmap_writer **out,
+	git_repository *repo,
+	const char *idx_path);
+
+/*
+ * Describe an object in the pack.  Every object in the pack must be
+ * added before the bitmap can be written.
+ */
+int git_pack_bitmap_writer_add(
+	git_pack_bitmap_writer *w,
+	const git_oid *id,
+	git_object_t type,
+	uint32_t name_hash);
+
+/*
+ * Select the commits to store bitmaps for, compute their reachability
+ * and serialize the bitmap file into `out`.
+ */
+int git_pack_bitmap_writer_dump(git_str *out, git_pack_bitmap_writer *w);
+
+/* Compute the bitmap and write it alongside the packfile. */
+int git_pack_bitmap_writer_commit(git_pack_bitmap_writer *w, mode_t mode);
+
+void git_pack_bitmap_writer_free(git_pack_bitmap_writer *w);
+
+#endif
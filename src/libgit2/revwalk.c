@@ -8,6 +8,7 @@
 #include "revwalk.h"
 
 #include "commit.h"
+#include "commit_graph.h"
 #include "odb.h"
 #include "pathspec.h"
 #include "pool.h"
@@ -42,13 +43,34 @@ git_commit_list_node *git_revwalk__commit_lookup(
 	return commit;
 }
 
-int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_revwalk__push_options *opts)
+/*
+ * Whether the object is a commit in the commit-graph, which tells us that
+ * it needs neither to be read nor peeled.  We only check that the object
+ * still exists, which is much cheaper than reading it.
+ */
+static bool commit_graph_has_commit(git_revwalk *walk, const git_oid *oid)
+{
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
+
+	if (git_odb__get_commit_graph_file(&cgraph_file, walk->odb) < 0 ||
+	    git_commit_graph_entry_find(&e, cgraph_file, oid,
+			git_oid_hexsize(walk->repo->oid_type)) < 0) {
+		git_error_clear();
+		return false;
+	}
+
+	return git_odb_exists(walk->odb, oid);
+}
+
+static int peel_commit(
+	git_oid *out,
+	git_revwalk *walk,
+	const git_oid *oid,
+	const git_revwalk__push_options *opts)
 {
-	git_oid commit_id;
-	int error;
 	git_object *obj, *oobj;
-	git_commit_list_node *commit;
-	git_commit_list *list;
+	int error;
 
 	if ((error = git_object_lookup(&oobj, walk->repo, oid, GIT_OBJECT_ANY)) < 0)
 		return error;
@@ -59,7 +81,7 @@ int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_re
 	if (error == GIT_ENOTFOUND || error == GIT_EINVALIDSPEC || error == GIT_EPEEL) {
 		/* If this comes from e.g. push_glob("tags"), ignore this */
 		if (opts->from_glob)
-			return 0;
+			return GIT_PASSTHROUGH;
 
 		git_error_set(GIT_ERROR_INVALID, "object is not a committish");
 		return error;
@@ -67,8 +89,23 @@ int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_re
 	if (error < 0)
 		return error;
 
-	git_oid_cpy(&commit_id, git_object_id(obj));
+	git_oid_cpy(out, git_object_id(obj));
 	git_object_free(obj);
+	return 0;
+}
+
+int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_revwalk__push_options *opts)
+{
+	git_oid commit_id;
+	int error;
+	git_commit_list_node *commit;
+	git_commit_list *list;
+
+	if (commit_graph_has_commit(walk, oid)) {
+		git_oid_cpy(&commit_id, oid);
+	} else if ((error = peel_commit(&commit_id, walk, oid, opts)) < 0) {
+		return (error == GIT_PASSTHROUGH) ? 0 : error;
+	}
 
 	commit = git_revwalk__commit_lookup(walk, &commit_id);
 	if (commit == NULL)
@@ -497,9 +534,35 @@ static bool include_path_delta(git_revwalk *walk,
 	return include;
 }
 
-static bool include_path_wildcard(git_revwalk *walk, git_commit *commit, git_tree *commit_tree)
+/*
+ * Look up the root tree of a commit, taking its ID from the commit-graph
+ * when possible so that the commit itself need not be read.
+ */
+static int commit_tree_lookup(git_tree **out, git_revwalk *walk, const git_oid *commit_id)
 {
-	unsigned int parents = git_commit_parentcount(commit);
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
+	git_commit *commit;
+	int error;
+
+	if (git_odb__get_commit_graph_file(&cgraph_file, walk->odb) == 0 &&
+	    git_commit_graph_entry_find(&e, cgraph_file, commit_id,
+			git_oid_hexsize(walk->repo->oid_type)) == 0)
+		return git_tree_lookup(out, walk->repo, &e.tree_oid);
+
+	git_error_clear();
+
+	if ((error = git_commit_lookup(&commit, walk->repo, commit_id)) < 0)
+		return error;
+
+	error = git_commit_tree(out, commit);
+	git_commit_free(commit);
+	return error;
+}
+
+static bool include_path_wildcard(git_revwalk *walk, git_commit_list_node *commit, git_tree *commit_tree)
+{
+	unsigned int parents = commit->out_degree;
 	git_diff_options diffopts = GIT_DIFF_OPTIONS_INIT;
 	bool include = false;
 
@@ -521,17 +584,14 @@ static bool include_path_wildcard(git_revwalk *walk, git_commit *commit, git_tre
 		 *  parents before including the commit
 		 */
 		for (i = 0; i < parents && include; i++) {
-			git_commit *parent = NULL;
 			git_tree *parent_tree = NULL;
 			/*Assume it's to be excluded unless the delta matches*/
 			include = false;
-			if (git_commit_parent(&parent, commit, i) == 0
-				&& git_commit_tree(&parent_tree, parent) == 0) {
+			if (commit_tree_lookup(&parent_tree, walk, &commit->parents[i]->oid) == 0) {
 				if (include_path_delta(walk, commit_tree, parent_tree, &diffopts))
 					include = true;
 			}
 			git_tree_free(parent_tree);
-			git_commit_free(parent);
 		}
 	}
 	return include;
@@ -587,8 +647,8 @@ static bool include_path_exact_parent(git_revwalk *walk, git_tree *commit_tree,
 	return false;
 }
 
-static bool include_path_exact(git_revwalk *walk, git_commit *commit, git_tree *commit_tree) {
-	unsigned int parents = git_commit_parentcount(commit);
+static bool include_path_exact(git_revwalk *walk, git_commit_list_node *commit, git_tree *commit_tree) {
+	unsigned int parents = commit->out_degree;
 	if (parents == 0) {
 		return include_path_exact_root(walk, commit_tree);
 	}
@@ -599,52 +659,113 @@ static bool include_path_exact(git_revwalk *walk, git_commit *commit, git_tree *
 		 *  parents before including the commit
 		 */
 		for (p = 0; p < parents && include_commit; p++) {
-			git_commit *parent = NULL;
 			git_tree *parent_tree = NULL;
-			if (git_commit_parent(&parent, commit, p) == 0
-				&& git_commit_tree(&parent_tree, parent) == 0) {
+			if (commit_tree_lookup(&parent_tree, walk, &commit->parents[p]->oid) == 0) {
 				if (!include_path_exact_parent(walk, commit_tree, parent_tree))
 					include_commit = false;
 			}
 			git_tree_free(parent_tree);
-			git_commit_free(parent);
 		}
 		return include_commit;
 	}
 }
 
-static bool include_path(git_revwalk *walk, git_commit_list_node *commit_node)
+/*
+ * Compute the keys to look up the pathspec in the commit-graph's
+ * changed-path Bloom filters with.  These can prove that a commit did not
+ * change any path that we are limited to without loading its trees.  If the
+ * commit-graph has no Bloom filters, or the pathspec cannot be expressed
+ * with them, `out` is left empty.
+ */
+static int bloom_paths_init(git_commit_graph_bloom_paths *out, git_revwalk *walk)
 {
-	git_commit *commit = NULL;
+	git_commit_graph_file *cgraph_file;
+	git_attr_fnmatch *match;
+	const char *prefix, *slash;
+	size_t i;
+	int error = 0;
+
+	if (git_odb__get_commit_graph_file(&cgraph_file, walk->odb) < 0) {
+		git_error_clear();
+		return 0;
+	}
+
+	if (walk->pathspec_wildcard) {
+		/*
+		 * The paths matched by a wildcard can only be looked up by the
+		 * leading directory of the pathspec's prefix.
+		 */
+		prefix = walk->pathspec->prefix;
+
+		if (prefix && *prefix != '!' && *prefix != '/' &&
+		    (slash = strrchr(prefix, '/')) != NULL)
+			error = git_commit_graph_bloom_paths_add(out, cgraph_file,
+				prefix, slash - prefix);
+	} else {
+		git_vector_foreach(&walk->pathspec->pathspec, i, match) {
+			if ((error = git_commit_graph_bloom_paths_add(out, cgraph_file,
+					match->pattern, strlen(match->pattern))) < 0)
+				break;
+		}
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		git_commit_graph_bloom_paths_dispose(out);
+		error = 0;
+	}
+
+	return error;
+}
+
+static bool include_path(
+	git_revwalk *walk,
+	git_commit_list_node *commit_node,
+	const git_commit_graph_bloom_paths *bloom_paths)
+{
+	git_commit_graph_file *cgraph_file;
 	git_tree *commit_tree = NULL;
 	bool include = false;
 
-	if (git_commit_lookup(&commit, walk->repo, &commit_node->oid) == 0
-		&& git_commit_tree(&commit_tree, commit) == 0) {
+	/*
+	 * A commit is only included when it changes the paths relative to
+	 * all of its parents, so it's enough to know that it didn't change
+	 * them relative to the first one.
+	 */
+	if (git_array_size(bloom_paths->path_ends) &&
+	    git_odb__get_commit_graph_file(&cgraph_file, walk->odb) == 0 &&
+	    git_commit_graph_bloom_paths_unchanged(bloom_paths, cgraph_file, &commit_node->oid))
+		return false;
+
+	if (commit_tree_lookup(&commit_tree, walk, &commit_node->oid) == 0) {
 		if (walk->pathspec_wildcard)
-			include = include_path_wildcard(walk, commit, commit_tree);
+			include = include_path_wildcard(walk, commit_node, commit_tree);
 		else
-			include = include_path_exact(walk, commit, commit_tree);
+			include = include_path_exact(walk, commit_node, commit_tree);
 	}
 
 	git_tree_free(commit_tree);
-	git_commit_free(commit);
 	return include;
 }
 
 static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list *commits)
 {
+	git_commit_graph_bloom_paths bloom_paths = GIT_COMMIT_GRAPH_BLOOM_PATHS_INIT;
 	int error, slop = SLOP;
 	int64_t time = INT64_MAX;
 	git_commit_list *list = commits;
 	git_commit_list *newlist = NULL;
 	git_commit_list **p = &newlist;
 
+	if (walk->pathspec && (error = bloom_paths_init(&bloom_paths, walk)) < 0)
+		return error;
+
 	while (list) {
 		git_commit_list_node *commit = git_commit_list_pop(&list);
 
-		if ((error = add_parents_to_list(walk, commit, &list)) < 0)
+		if ((error = add_parents_to_list(walk, commit, &list)) < 0) {
+			git_commit_graph_bloom_paths_dispose(&bloom_paths);
 			return error;
+		}
 
 		if (commit->uninteresting) {
 			mark_parents_uninteresting(commit);
@@ -656,7 +777,7 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 			break;
 		}
 
-		if (walk->pathspec && !include_path(walk, commit))
+		if (walk->pathspec && !include_path(walk, commit, &bloom_paths))
 			continue;
 
 		if (walk->hide_cb && walk->hide_cb(&commit->oid, walk->hide_cb_payload))
@@ -666,6 +787,7 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 		p = &git_commit_list_insert(commit, p)->next;
 	}
 
+	git_commit_graph_bloom_paths_dispose(&bloom_paths);
 	git_commit_list_free(&list);
 	*out = newlist;
 	return 0;
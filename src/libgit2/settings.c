@@ -21,6 +21,7 @@
 #include "mwindow.h"
 #include "object.h"
 #include "odb.h"
+#include "pack.h"
 #include "rand.h"
 #include "refs.h"
 #include "runtime.h"
@@ -43,6 +44,9 @@
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
 extern size_t git_mwindow__file_limit;
+extern bool git_mwindow__full_map;
+extern size_t git_odb_pack__lookup_cache_size;
+extern bool git_odb_pack__stream_deltas;
 extern size_t git_indexer__max_objects;
 extern size_t git_indexer__max_object_size;
 extern bool git_disable_pack_keep_file_checks;
@@ -134,6 +138,38 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, size_t *)) = git_mwindow__file_limit;
 		break;
 
+	case GIT_OPT_SET_MWINDOW_FULL_MAP:
+		git_mwindow__full_map = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_GET_MWINDOW_FULL_MAP:
+		*(va_arg(ap, int *)) = git_mwindow__full_map;
+		break;
+
+	case GIT_OPT_SET_PACK_LOOKUP_CACHE_SIZE:
+		git_odb_pack__lookup_cache_size = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_PACK_LOOKUP_CACHE_SIZE:
+		*(va_arg(ap, size_t *)) = git_odb_pack__lookup_cache_size;
+		break;
+
+	case GIT_OPT_SET_PACK_STREAM_DELTAS:
+		git_odb_pack__stream_deltas = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_GET_PACK_STREAM_DELTAS:
+		*(va_arg(ap, int *)) = git_odb_pack__stream_deltas;
+		break;
+
+	case GIT_OPT_SET_ODB_MISSING_CACHE_SIZE:
+		git_odb__missing_cache_size = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_ODB_MISSING_CACHE_SIZE:
+		*(va_arg(ap, size_t *)) = git_odb__missing_cache_size;
+		break;
+
 	case GIT_OPT_GET_SEARCH_PATH:
 		{
 			int sysdir = va_arg(ap, int);
@@ -366,6 +402,24 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, size_t *)) = git_indexer__max_object_size;
 		break;
 
+	case GIT_OPT_SET_PACK_CACHE_MAX_SIZE:
+		git_pack_cache_set_max_size(va_arg(ap, size_t));
+		break;
+
+	case GIT_OPT_GET_PACK_CACHE_MAX_SIZE:
+		*(va_arg(ap, size_t *)) = git_pack__cache_max_size;
+		break;
+
+	case GIT_OPT_GET_PACK_CACHE_STATS:
+		{
+			size_t *memory_used = va_arg(ap, size_t *);
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+
+			git_pack_cache_stats(memory_used, hits, misses);
+		}
+		break;
+
 	case GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS:
 		git_disable_pack_keep_file_checks = (va_arg(ap, int) != 0);
 		break;
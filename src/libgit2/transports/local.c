@@ -529,6 +529,8 @@ static int local_counting(int stage, unsigned int current, unsigned int total, v
 		else
 			git_str_putc(&progress_info, '\r');
 
+	} else {
+		return 0;
 	}
 
 	if (git_str_oom(&progress_info))
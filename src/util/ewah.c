@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+/*
+ * A run-length word (RLW) in an EWAH stream describes a run of
+ * identical (all-zero or all-one) words, followed by a number of
+ * literal words that are copied verbatim:
+ *
+ * - bit 0: the value of the bits in the run
+ * - bits 1-32: the number of words in the run
+ * - bits 33-63: the number of literal words that follow
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_LARGEST_RUNNING_COUNT ((UINT64_C(1) << RLW_RUNNING_BITS) - 1)
+
+#define RLW_LITERAL_BITS (64 - 1 - RLW_RUNNING_BITS)
+#define RLW_LARGEST_LITERAL_COUNT ((UINT64_C(1) << RLW_LITERAL_BITS) - 1)
+
+#define rlw_run_bit(w) ((w) & 1)
+#define rlw_running_len(w) (((w) >> 1) & RLW_LARGEST_RUNNING_COUNT)
+#define rlw_literal_words(w) ((w) >> (1 + RLW_RUNNING_BITS))
+
+static int ewah_error(const char *message)
+{
+	git_error_set(GIT_ERROR_INVALID, "invalid ewah bitmap - %s", message);
+	return -1;
+}
+
+static int bitmap_grow(git_bitmap *bitmap, size_t words)
+{
+	size_t new_alloc;
+	uint64_t *new_words;
+
+	if (words <= bitmap->word_len)
+		return 0;
+
+	if (words > bitmap->word_alloc) {
+		new_alloc = bitmap->word_alloc ? bitmap->word_alloc : 8;
+
+		while (new_alloc < words)
+			GIT_ERROR_CHECK_ALLOC_MULTIPLY(&new_alloc, new_alloc, 2);
+
+		new_words = git__reallocarray(bitmap->words, new_alloc, sizeof(uint64_t));
+		GIT_ERROR_CHECK_ALLOC(new_words);
+
+		bitmap->words = new_words;
+		bitmap->word_alloc = new_alloc;
+	}
+
+	memset(bitmap->words + bitmap->word_len, 0,
+		(words - bitmap->word_len) * sizeof(uint64_t));
+	bitmap->word_len = words;
+
+	return 0;
+}
+
+int git_bitmap_init(git_bitmap *bitmap, size_t bits)
+{
+	memset(bitmap, 0, sizeof(*bitmap));
+
+	if (!bits)
+		return 0;
+
+	bitmap->word_alloc = (bits + 63) / 64;
+	bitmap->words = git__calloc(bitmap->word_alloc, sizeof(uint64_t));
+	GIT_ERROR_CHECK_ALLOC(bitmap->words);
+
+	return 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t word = pos / 64;
+
+	if (word >= bitmap->word_len && bitmap_grow(bitmap, word + 1) < 0)
+		return -1;
+
+	bitmap->words[word] |= ((uint64_t)1 << (pos % 64));
+	return 0;
+}
+
+void git_bitmap_unset(git_bitmap *bitmap, size_t pos)
+{
+	size_t word = pos / 64;
+
+	if (word < bitmap->word_len)
+		bitmap->words[word] &= ~((uint64_t)1 << (pos % 64));
+}
+
+void git_bitmap_clear(git_bitmap *bitmap)
+{
+	bitmap->word_len = 0;
+}
+
+int git_bitmap_copy(git_bitmap *dst, const git_bitmap *src)
+{
+	git_bitmap_clear(dst);
+
+	if (bitmap_grow(dst, src->word_len) < 0)
+		return -1;
+
+	if (src->word_len)
+		memcpy(dst->words, src->words, src->word_len * sizeof(uint64_t));
+
+	return 0;
+}
+
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_len) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_len; i++)
+		dst->words[i] |= src->words[i];
+
+	return 0;
+}
+
+int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_len) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_len; i++)
+		dst->words[i] ^= src->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	for (i = 0; i < dst->word_len; i++)
+		dst->words[i] &= (i < src->word_len) ? src->words[i] : 0;
+}
+
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i, len = min(dst->word_len, src->word_len);
+
+	for (i = 0; i < len; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+GIT_INLINE(size_t) word_popcount(uint64_t w)
+{
+	w = w - ((w >> 1) & UINT64_C(0x5555555555555555));
+	w = (w & UINT64_C(0x3333333333333333)) +
+	    ((w >> 2) & UINT64_C(0x3333333333333333));
+	w = (w + (w >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+	return (size_t)((w * UINT64_C(0x0101010101010101)) >> 56);
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_len; i++)
+		count += word_popcount(bitmap->words[i]);
+
+	return count;
+}
+
+int git_bitmap_next(size_t *pos, const git_bitmap *bitmap)
+{
+	size_t word = *pos / 64;
+	uint64_t w;
+
+	if (word >= bitmap->word_len)
+		return GIT_ITEROVER;
+
+	/* mask off the bits before the starting position */
+	w = bitmap->words[word] & (~(uint64_t)0 << (*pos % 64));
+
+	while (!w) {
+		if (++word >= bitmap->word_len)
+			return GIT_ITEROVER;
+
+		w = bitmap->words[word];
+	}
+
+	*pos = word * 64;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		(*pos)++;
+	}
+
+	return 0;
+}
+
+void git_bitmap_dispose(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	memset(bitmap, 0, sizeof(*bitmap));
+}
+
+GIT_INLINE(uint32_t) read_be32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+	       ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+GIT_INLINE(uint64_t) read_be64(const unsigned char *data)
+{
+	return ((uint64_t)read_be32(data) << 32) | read_be32(data + 4);
+}
+
+/*
+ * The serialized format is:
+ *
+ * - 4-byte number of bits in the (uncompressed) bitmap
+ * - 4-byte number of 64-bit words in the compressed stream
+ * - the compressed words themselves
+ * - 4-byte position of the last RLW in the stream
+ *
+ * all in network byte order.
+ */
+int git_ewah_read(
+	git_bitmap *out,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len)
+{
+	uint32_t bit_size, buffer_size, i = 0;
+	size_t max_words, pos = 0, total_len;
+	const unsigned char *words;
+
+	if (len < 8)
+		return ewah_error("truncated header");
+
+	bit_size = read_be32(data);
+	buffer_size = read_be32(data + 4);
+
+	if (GIT_MULTIPLY_SIZET_OVERFLOW(&total_len, buffer_size, 8) ||
+	    GIT_ADD_SIZET_OVERFLOW(&total_len, total_len, 12) ||
+	    total_len > len)
+		return ewah_error("truncated bitmap");
+
+	words = data + 8;
+	max_words = ((size_t)bit_size + 63) / 64;
+
+	git_bitmap_clear(out);
+
+	if (bitmap_grow(out, max_words) < 0)
+		return -1;
+
+	while (i < buffer_size) {
+		uint64_t rlw = read_be64(words + (size_t)i * 8);
+		uint64_t run_len = rlw_running_len(rlw);
+		uint64_t literals = rlw_literal_words(rlw);
+
+		i++;
+
+		if (run_len > max_words - pos ||
+		    literals > max_words - pos - run_len ||
+		    literals > (uint64_t)(buffer_size - i))
+			return ewah_error("bitmap overflows its size");
+
+		if (rlw_run_bit(rlw))
+			memset(out->words + pos, 0xff, (size_t)run_len * sizeof(uint64_t));
+
+		pos += (size_t)run_len;
+
+		while (literals--) {
+			out->words[pos++] = read_be64(words + (size_t)i * 8);
+			i++;
+		}
+	}
+
+	/* trim any trailing bits past the declared size */
+	if (bit_size % 64 && pos == max_words)
+		out->words[max_words - 1] &= (~(uint64_t)0 >> (64 - (bit_size % 64)));
+
+	*consumed = total_len;
+	return 0;
+}
+
+GIT_INLINE(int) put_be32(git_str *out, uint32_t val)
+{
+	unsigned char buf[4];
+
+	buf[0] = (unsigned char)(val >> 24);
+	buf[1] = (unsigned char)(val >> 16);
+	buf[2] = (unsigned char)(val >> 8);
+	buf[3] = (unsigned char)val;
+
+	return git_str_put(out, (const char *)buf, sizeof(buf));
+}
+
+GIT_INLINE(int) put_be64(git_str *out, uint64_t val)
+{
+	if (put_be32(out, (uint32_t)(val >> 32)) < 0)
+		return -1;
+
+	return put_be32(out, (uint32_t)val);
+}
+
+int git_ewah_write(git_str *out, const git_bitmap *bitmap)
+{
+	size_t len = bitmap->word_len, i = 0, j, start, rlw_pos = 0;
+	uint32_t word_count = 0;
+	uint64_t run_len, literals, rlw;
+
+	/* trailing empty words don't need to be stored */
+	while (len && !bitmap->words[len - 1])
+		len--;
+
+	if (len > UINT32_MAX / 64) {
+		git_error_set(GIT_ERROR_INVALID, "bitmap is too large to compress");
+		return -1;
+	}
+
+	start = out->size;
+
+	if (put_be32(out, (uint32_t)(len * 64)) < 0 ||
+	    put_be32(out, 0) < 0)
+		return -1;
+
+	do {
+		uint64_t w = i < len ? bitmap->words[i] : 0;
+		bool run_bit = (w == ~(uint64_t)0);
+
+		run_len = 0;
+
+		while (i < len && run_len < RLW_LARGEST_RUNNING_COUNT &&
+		       (bitmap->words[i] == 0 || bitmap->words[i] == ~(uint64_t)0) &&
+		       (bitmap->words[i] == ~(uint64_t)0) == run_bit) {
+			run_len++;
+			i++;
+		}
+
+		for (j = i, literals = 0;
+		     j < len && literals < RLW_LARGEST_LITERAL_COUNT &&
+		     bitmap->words[j] != 0 && bitmap->words[j] != ~(uint64_t)0;
+		     j++)
+			literals++;
+
+		rlw = (literals << (1 + RLW_RUNNING_BITS)) | (run_len << 1) |
+		      (run_bit ? 1 : 0);
+
+		rlw_pos = word_count;
+
+		if (put_be64(out, rlw) < 0)
+			return -1;
+
+		for (word_count++; i < j; i++, word_count++) {
+			if (put_be64(out, bitmap->words[i]) < 0)
+				return -1;
+		}
+	} while (i < len);
+
+	if (put_be32(out, (uint32_t)rlw_pos) < 0)
+		return -1;
+
+	/* now that we know the number of words, fill it in */
+	out->ptr[start + 4] = (char)(word_count >> 24);
+	out->ptr[start + 5] = (char)(word_count >> 16);
+	out->ptr[start + 6] = (char)(word_count >> 8);
+	out->ptr[start + 7] = (char)word_count;
+
+	return 0;
+}
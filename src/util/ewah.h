@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "git2_util.h"
+
+#include "str.h"
+
+/*
+ * An uncompressed, growable bitmap.  Bit `n` is stored in word `n / 64`
+ * at position `n % 64`, which matches the layout that git uses for the
+ * (decompressed) contents of its EWAH-compressed reachability bitmaps.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+	size_t word_len;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT { NULL, 0, 0 }
+
+/** Initialize a bitmap with room for at least `bits` bits. */
+extern int git_bitmap_init(git_bitmap *bitmap, size_t bits);
+
+/** Set the given bit, growing the bitmap as necessary. */
+extern int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+
+/** Clear the given bit. */
+extern void git_bitmap_unset(git_bitmap *bitmap, size_t pos);
+
+/** Return whether the given bit is set. */
+GIT_INLINE(bool) git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t word = pos / 64;
+
+	if (word >= bitmap->word_len)
+		return false;
+
+	return (bitmap->words[word] & ((uint64_t)1 << (pos % 64))) != 0;
+}
+
+/** Clear all bits in the bitmap, retaining its allocation. */
+extern void git_bitmap_clear(git_bitmap *bitmap);
+
+/** Copy `src` into `dst`, replacing its contents. */
+extern int git_bitmap_copy(git_bitmap *dst, const git_bitmap *src);
+
+/** Set `dst` to `dst | src`. */
+extern int git_bitmap_or(git_bitmap *dst, const git_bitmap *src);
+
+/** Set `dst` to `dst ^ src`. */
+extern int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src);
+
+/** Set `dst` to `dst & src`. */
+extern void git_bitmap_and(git_bitmap *dst, const git_bitmap *src);
+
+/** Set `dst` to `dst & ~src`. */
+extern void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src);
+
+/** Count the number of bits that are set. */
+extern size_t git_bitmap_popcount(const git_bitmap *bitmap);
+
+/**
+ * Find the next set bit at or after `*pos`.  Returns 0 and updates `*pos`
+ * when one is found, or GIT_ITEROVER when there are no more bits set.
+ */
+extern int git_bitmap_next(size_t *pos, const git_bitmap *bitmap);
+
+/** Free the memory held by the bitmap. */
+extern void git_bitmap_dispose(git_bitmap *bitmap);
+
+/**
+ * Decompress an EWAH-encoded bitmap (as found in git's `.bitmap` files)
+ * into `out`.  The number of bytes consumed from `data` is stored in
+ * `consumed`.
+ */
+extern int git_ewah_read(
+	git_bitmap *out,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len);
+
+/**
+ * Compress a bitmap into the EWAH format used by git's `.bitmap` files,
+ * appending it to `out`.
+ */
+extern int git_ewah_write(git_str *out, const git_bitmap *bitmap);
+
+#endif
@@ -398,6 +398,7 @@ typedef uint32_t git_hashmap_iter_t;
 			if (GIT_HASHMAP_IS_EITHER(h->flags, *iter)) \
 				continue; \
 			*key = h->keys[*iter]; \
+			(*iter)++; \
 			return 0; \
 		} \
 		return GIT_ITEROVER; \
@@ -302,6 +302,33 @@ int p_munmap(git_map *map)
 
 #endif
 
+#ifdef GIT_IO_FADVISE
+
+int p_readahead(int fd, off64_t offset, size_t len)
+{
+	int error;
+
+	if ((error = posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED)) != 0) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+#else
+
+int p_readahead(int fd, off64_t offset, size_t len)
+{
+	GIT_UNUSED(fd);
+	GIT_UNUSED(offset);
+	GIT_UNUSED(len);
+
+	return 0;
+}
+
+#endif
+
 #if defined(GIT_IO_POLL) || defined(GIT_IO_WSAPOLL)
 
 /* Handled by posix.h; this test simplifies the final else */
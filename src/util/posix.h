@@ -131,6 +131,13 @@ extern int p_write(git_file fd, const void *buf, size_t cnt);
 extern ssize_t p_pread(int fd, void *data, size_t size, off64_t offset);
 extern ssize_t p_pwrite(int fd, const void *data, size_t size, off64_t offset);
 
+/*
+ * Advise the operating system that the given range of the file will be
+ * read soon, so that it can start reading it in the background.  This is
+ * only a hint; it does nothing on platforms that do not support it.
+ */
+extern int p_readahead(int fd, off64_t offset, size_t len);
+
 #define p_close(fd) close(fd)
 #define p_umask(m) umask(m)
 
@@ -32,6 +32,17 @@ void test_blame_simple__trivial_testrepo(void)
 	check_blame_hunk_index(g_repo, g_blame, 1, 2, 1, 0, "a65fedf3", "branch_file.txt");
 }
 
+/* The `bloom` repository has the same history, with Bloom filters. */
+void test_blame_simple__trivial_bloom_filters(void)
+{
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("bloom.git")));
+	cl_git_pass(git_blame_file(&g_blame, g_repo, "branch_file.txt", NULL));
+
+	cl_assert_equal_i(2, git_blame_hunkcount(g_blame));
+	check_blame_hunk_index(g_repo, g_blame, 0, 1, 1, 0, "c47800c7", "branch_file.txt");
+	check_blame_hunk_index(g_repo, g_blame, 1, 2, 1, 0, "a65fedf3", "branch_file.txt");
+}
+
 /*
  * $ git blame -n b.txt
  *    orig line no                          final line no
@@ -91,6 +91,97 @@ void test_graph_commitgraph__parse_octopus_merge(void)
 	git_str_dispose(&commit_graph_path);
 }
 
+void test_graph_commitgraph__bloom_murmur3(void)
+{
+	const char *high_bits = "\x99\xaa\xbb\xcc\xdd\xee\xff";
+
+	cl_assert_equal_i(0x00000000, git_commit_graph_bloom_murmur3(2, 0, "", 0));
+	cl_assert_equal_i(0x627b0c2c, git_commit_graph_bloom_murmur3(2, 0, "Hello world!", 12));
+	cl_assert_equal_i(0x2e4ff723, git_commit_graph_bloom_murmur3(2, 0,
+		"The quick brown fox jumps over the lazy dog", 43));
+
+	/* version 1 sign-extends bytes with the high bit set */
+	cl_assert_equal_i(0xa183ccfd, git_commit_graph_bloom_murmur3(2, 0, high_bits, 7));
+	cl_assert_equal_i(0xdd92776e, git_commit_graph_bloom_murmur3(1, 0, high_bits, 7));
+}
+
+static bool bloom_unchanged(
+	struct git_commit_graph_file *file,
+	const git_oid *id,
+	const char *path)
+{
+	git_commit_graph_bloom_paths paths = GIT_COMMIT_GRAPH_BLOOM_PATHS_INIT;
+	bool unchanged;
+
+	cl_git_pass(git_commit_graph_bloom_paths_add(&paths, file, path, strlen(path)));
+	unchanged = git_commit_graph_bloom_paths_unchanged(&paths, file, id);
+
+	git_commit_graph_bloom_paths_dispose(&paths);
+	return unchanged;
+}
+
+void test_graph_commitgraph__bloom_filters(void)
+{
+	git_repository *repo;
+	struct git_commit_graph_file *file;
+	git_revwalk *walk;
+	git_commit *commit, *parent;
+	git_tree *tree, *parent_tree;
+	git_diff *diff;
+	git_oid id;
+	git_str path = GIT_STR_INIT;
+	size_t i, commits = 0;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("bloom.git")));
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&file, git_str_cstr(&path), GIT_OID_SHA1));
+	cl_assert(git_commit_graph_file_has_bloom_filters(file));
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+
+	/* every path changed from the first parent must be in the filter */
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, repo, &id));
+		cl_git_pass(git_commit_tree(&tree, commit));
+
+		parent = NULL;
+		parent_tree = NULL;
+
+		if (git_commit_parentcount(commit) > 0) {
+			cl_git_pass(git_commit_parent(&parent, commit, 0));
+			cl_git_pass(git_commit_tree(&parent_tree, parent));
+		}
+
+		cl_git_pass(git_diff_tree_to_tree(&diff, repo, parent_tree, tree, NULL));
+
+		for (i = 0; i < git_diff_num_deltas(diff); i++) {
+			const git_diff_delta *delta = git_diff_get_delta(diff, i);
+			cl_assert(!bloom_unchanged(file, &id, delta->new_file.path));
+		}
+
+		cl_assert(bloom_unchanged(file, &id, "does/not/exist"));
+
+		git_diff_free(diff);
+		git_tree_free(parent_tree);
+		git_commit_free(parent);
+		git_tree_free(tree);
+		git_commit_free(commit);
+		commits++;
+	}
+
+	cl_assert_equal_i(14, commits);
+
+	/* commits outside of the commit-graph are never proven unchanged */
+	cl_git_pass(git_oid_from_string(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef", GIT_OID_SHA1));
+	cl_assert(!bloom_unchanged(file, &id, "does/not/exist"));
+
+	git_revwalk_free(walk);
+	git_commit_graph_file_free(file);
+	git_repository_free(repo);
+	git_str_dispose(&path);
+}
+
 void test_graph_commitgraph__writer(void)
 {
 	git_repository *repo;
@@ -106,6 +197,9 @@ void test_graph_commitgraph__writer(void)
 
 	opts.oid_type = GIT_OID_SHA1;
 
+	/* The fixture predates corrected commit dates. */
+	opts.generation_version = 1;
+
 	cl_git_pass(git_commit_graph_writer_new(&w, git_str_cstr(&path), &opts));
 
 	/* This is equivalent to `git commit-graph write --reachable`. */
@@ -129,6 +223,460 @@ void test_graph_commitgraph__writer(void)
 	git_repository_free(repo);
 }
 
+static void write_bloom_filters(
+	git_buf *out,
+	git_repository *repo,
+	const char *objects_info_dir,
+	unsigned int threads)
+{
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_revwalk *walk;
+
+	opts.oid_type = GIT_OID_SHA1;
+	opts.changed_paths = 1;
+	opts.threads = threads;
+
+	cl_git_pass(git_commit_graph_writer_new(&w, objects_info_dir, &opts));
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+
+	cl_git_pass(git_commit_graph_writer_dump(out, w));
+	git_commit_graph_writer_free(w);
+}
+
+static void assert_bloom_filters_equal(git_buf *cgraph, git_str *expected)
+{
+	git_commit_graph_file actual_file = {0}, expected_file = {0};
+	size_t index_len;
+
+	actual_file.oid_type = GIT_OID_SHA1;
+	expected_file.oid_type = GIT_OID_SHA1;
+
+	cl_git_pass(git_commit_graph_file_parse(&actual_file,
+		(const unsigned char *)cgraph->ptr, cgraph->size));
+	cl_git_pass(git_commit_graph_file_parse(&expected_file,
+		(const unsigned char *)expected->ptr, expected->size));
+
+	cl_assert(git_commit_graph_file_has_bloom_filters(&actual_file));
+	cl_assert_equal_i(expected_file.num_commits, actual_file.num_commits);
+	cl_assert_equal_i(expected_file.bloom_filter_hash_version, actual_file.bloom_filter_hash_version);
+	cl_assert_equal_i(expected_file.bloom_filter_num_hashes, actual_file.bloom_filter_num_hashes);
+	cl_assert_equal_i(expected_file.bloom_filter_bits, actual_file.bloom_filter_bits);
+
+	index_len = actual_file.num_commits * sizeof(uint32_t);
+	cl_assert_equal_i(0, memcmp(expected_file.bloom_filter_indexes, actual_file.bloom_filter_indexes, index_len));
+	cl_assert_equal_i(expected_file.bloom_filter_data_len, actual_file.bloom_filter_data_len);
+	cl_assert_equal_i(0, memcmp(expected_file.bloom_filter_data, actual_file.bloom_filter_data,
+		actual_file.bloom_filter_data_len));
+}
+
+void test_graph_commitgraph__writer_bloom_filters(void)
+{
+	git_repository *repo;
+	git_buf cgraph = GIT_BUF_INIT;
+	git_str expected = GIT_STR_INIT, path = GIT_STR_INIT;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("bloom.git")));
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_futils_readbuffer(&expected, path.ptr));
+
+	/* compute all of the filters; this must match what git wrote */
+	write_bloom_filters(&cgraph, repo, clar_sandbox_path(), 1);
+	assert_bloom_filters_equal(&cgraph, &expected);
+	git_buf_dispose(&cgraph);
+
+	write_bloom_filters(&cgraph, repo, clar_sandbox_path(), 4);
+	assert_bloom_filters_equal(&cgraph, &expected);
+	git_buf_dispose(&cgraph);
+
+	/* reuse the filters from the existing commit-graph */
+	git_str_rtruncate_at_char(&path, '/');
+	write_bloom_filters(&cgraph, repo, path.ptr, 0);
+	assert_bloom_filters_equal(&cgraph, &expected);
+
+	git_buf_dispose(&cgraph);
+	git_str_dispose(&expected);
+	git_str_dispose(&path);
+	git_repository_free(repo);
+}
+
+void test_graph_commitgraph__bloom_filter_limit_counts_directories(void)
+{
+	git_repository *repo;
+	git_commit_graph_file file = {0};
+	git_treebuilder *root, *dir;
+	git_signature *sig;
+	git_commit *head;
+	git_tree *tree;
+	git_buf cgraph = GIT_BUF_INIT;
+	git_str name = GIT_STR_INIT;
+	git_oid blob_id, dir_id, tree_id, id;
+	int i;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	/* 400 files, each in a directory of its own: 800 paths in all */
+	cl_git_pass(git_blob_create_from_buffer(&blob_id, repo, "file\n", 5));
+	cl_git_pass(git_treebuilder_new(&dir, repo, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, dir, "file", &blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&dir_id, dir));
+
+	cl_git_pass(git_treebuilder_new(&root, repo, NULL));
+	for (i = 0; i < 400; i++) {
+		git_str_clear(&name);
+		cl_git_pass(git_str_printf(&name, "dir%d", i));
+		cl_git_pass(git_treebuilder_insert(NULL, root, name.ptr, &dir_id, GIT_FILEMODE_TREE));
+	}
+	cl_git_pass(git_treebuilder_write(&tree_id, root));
+	cl_git_pass(git_tree_lookup(&tree, repo, &tree_id));
+
+	cl_git_pass(git_signature_new(&sig, "me", "me@example.com", 1234567890, 0));
+	cl_git_pass(git_revparse_single((git_object **)&head, repo, "HEAD"));
+	cl_git_pass(git_commit_create(&id, repo, "HEAD", sig, sig, NULL, "many",
+		tree, 1, (const git_commit **)&head));
+
+	/*
+	 * As in git, the directories count towards the limit too, so the
+	 * filter is too large and matches every path.
+	 */
+	write_bloom_filters(&cgraph, repo, clar_sandbox_path(), 1);
+
+	file.oid_type = GIT_OID_SHA1;
+	cl_git_pass(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, cgraph.size));
+
+	cl_assert(!bloom_unchanged(&file, &id, "dir0/file"));
+	cl_assert(!bloom_unchanged(&file, &id, "does/not/exist"));
+
+	git_buf_dispose(&cgraph);
+	git_str_dispose(&name);
+	git_commit_free(head);
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_treebuilder_free(root);
+	git_treebuilder_free(dir);
+	cl_git_sandbox_cleanup();
+}
+
+void test_graph_commitgraph__parse_generation_data(void)
+{
+	git_repository *repo;
+	struct git_commit_graph_file *file;
+	struct git_commit_graph_entry e, parent;
+	git_oid id;
+	git_str commit_graph_path = GIT_STR_INIT;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("bloom.git")));
+	cl_git_pass(git_str_joinpath(&commit_graph_path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&file, git_str_cstr(&commit_graph_path), GIT_OID_SHA1));
+	cl_assert(file->read_generation_data);
+
+	cl_git_pass(git_oid_from_string(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644", GIT_OID_SHA1));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(e.commit_time, 1274813907);
+	cl_assert_equal_i(e.corrected_commit_date, 1274813907);
+
+	/* git could not parse the committer date of this commit */
+	cl_git_pass(git_oid_from_string(&id, "258f0e2a959a364e40ed6603d5d44fbb24765b10", GIT_OID_SHA1));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(e.commit_time, 0);
+	cl_assert_equal_i(e.corrected_commit_date, 1274813908);
+
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert_equal_s(git_oid_tostr_s(&parent.sha1), "be3563ae3f795b2b4353bcce3a527ad0a4f7f644");
+
+	git_commit_graph_file_free(file);
+	git_repository_free(repo);
+	git_str_dispose(&commit_graph_path);
+}
+
+static void create_commit(
+	git_oid *out,
+	git_repository *repo,
+	git_time_t time,
+	const git_oid *parent_id)
+{
+	git_signature *sig;
+	git_commit *head, *parent = NULL;
+	git_tree *tree;
+
+	cl_git_pass(git_signature_new(&sig, "Skewed", "skewed@example.com", time, 0));
+	cl_git_pass(git_revparse_single((git_object **)&head, repo, "HEAD"));
+	cl_git_pass(git_commit_tree(&tree, head));
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, repo, parent_id));
+
+	cl_git_pass(git_commit_create(out, repo, NULL, sig, sig, NULL, "skewed",
+		tree, parent ? 1 : 0, (const git_commit **)&parent));
+
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_commit_free(head);
+	git_signature_free(sig);
+}
+
+static void write_generation_data(
+	git_buf *out,
+	git_repository *repo,
+	unsigned int generation_version,
+	const git_oid *tip)
+{
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_revwalk *walk;
+	git_str path = GIT_STR_INIT;
+
+	opts.oid_type = GIT_OID_SHA1;
+	opts.generation_version = generation_version;
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, path.ptr, &opts));
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_revwalk_push(walk, tip));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+
+	if (out)
+		cl_git_pass(git_commit_graph_writer_dump(out, w));
+	else
+		cl_git_pass(git_commit_graph_writer_commit(w));
+
+	git_commit_graph_writer_free(w);
+	git_str_dispose(&path);
+}
+
+void test_graph_commitgraph__writer_generation_data(void)
+{
+	git_repository *repo;
+	git_commit_graph_file file = {0};
+	git_commit_graph_entry e;
+	git_buf cgraph = GIT_BUF_INIT;
+	git_oid root, child, tip;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	/*
+	 * A history whose commit times go backwards, so far that the offset
+	 * of the corrected commit dates overflows.
+	 */
+	create_commit(&root, repo, INT64_C(4000000000), NULL);
+	create_commit(&child, repo, 1000, &root);
+	create_commit(&tip, repo, 2000, &child);
+
+	write_generation_data(&cgraph, repo, 0, &tip);
+
+	file.oid_type = GIT_OID_SHA1;
+	cl_git_pass(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, cgraph.size));
+	cl_assert(file.read_generation_data);
+	cl_assert_equal_i(2, file.num_generation_data_overflow);
+
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &root, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(1, e.generation);
+	cl_assert_equal_i(INT64_C(4000000000), e.corrected_commit_date);
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &child, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(2, e.generation);
+	cl_assert_equal_i(INT64_C(4000000001), e.corrected_commit_date);
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &tip, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(3, e.generation);
+	cl_assert_equal_i(2000, e.commit_time);
+	cl_assert_equal_i(INT64_C(4000000002), e.corrected_commit_date);
+	git_buf_dispose(&cgraph);
+
+	/* version 1 only writes the topological levels */
+	write_generation_data(&cgraph, repo, 1, &tip);
+
+	memset(&file, 0, sizeof(file));
+	file.oid_type = GIT_OID_SHA1;
+	cl_git_pass(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, cgraph.size));
+	cl_assert(!file.read_generation_data);
+
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &tip, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(3, e.generation);
+	cl_assert_equal_i(0, e.corrected_commit_date);
+	git_buf_dispose(&cgraph);
+
+	/* walks that use the commit-graph are not misled by the commit times */
+	write_generation_data(NULL, repo, 0, &tip);
+
+	cl_assert_equal_i(1, git_graph_descendant_of(repo, &tip, &root));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &root, &tip));
+	cl_assert_equal_i(1, git_graph_descendant_of(repo, &tip, &child));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &child, &tip));
+
+	cl_git_sandbox_cleanup();
+}
+
+static void write_split(
+	git_repository *repo,
+	git_commit_graph_split_strategy_t split_strategy,
+	const char *push)
+{
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_revwalk *walk;
+	git_str path = GIT_STR_INIT;
+
+	opts.oid_type = GIT_OID_SHA1;
+	opts.split_strategy = split_strategy;
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, path.ptr, &opts));
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	if (strchr(push, '*'))
+		cl_git_pass(git_revwalk_push_glob(walk, push));
+	else
+		cl_git_pass(git_revwalk_push_ref(walk, push));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+
+	cl_git_pass(git_commit_graph_writer_commit(w));
+
+	git_commit_graph_writer_free(w);
+	git_str_dispose(&path);
+}
+
+static size_t chain_length(git_repository *repo)
+{
+	git_str path = GIT_STR_INIT, chain = GIT_STR_INIT;
+	size_t i, lines = 0;
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo),
+		"objects/info/commit-graphs/commit-graph-chain"));
+
+	if (git_fs_path_exists(path.ptr)) {
+		cl_git_pass(git_futils_readbuffer(&chain, path.ptr));
+
+		for (i = 0; i < chain.size; i++)
+			lines += (chain.ptr[i] == '\n');
+	}
+
+	git_str_dispose(&chain);
+	git_str_dispose(&path);
+	return lines;
+}
+
+static size_t layer_count(git_repository *repo)
+{
+	git_str path = GIT_STR_INIT;
+	git_vector contents = GIT_VECTOR_INIT;
+	char *entry;
+	size_t i, count = 0;
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info/commit-graphs"));
+
+	if (git_fs_path_isdir(path.ptr)) {
+		cl_git_pass(git_fs_path_dirload(&contents, path.ptr, 0, 0));
+
+		git_vector_foreach(&contents, i, entry)
+			count += (git__suffixcmp(entry, ".graph") == 0);
+	}
+
+	git_vector_dispose_deep(&contents);
+	git_str_dispose(&path);
+	return count;
+}
+
+/* Check the commit-graph in the repository against the one git wrote. */
+static void assert_graph_matches(git_repository *repo, git_commit_graph_file *expected)
+{
+	git_commit_graph *cgraph;
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, actual, e_parent, actual_parent;
+	git_commit_graph_open_options opts = GIT_COMMIT_GRAPH_OPEN_OPTIONS_INIT;
+	git_str objects_dir = GIT_STR_INIT;
+	git_oid id;
+	size_t i, n, num_commits;
+
+	cl_git_pass(git_str_joinpath(&objects_dir, git_repository_path(repo), "objects"));
+	cl_git_pass(git_commit_graph_open(&cgraph, objects_dir.ptr, &opts));
+	cl_git_pass(git_commit_graph_get_file(&file, cgraph));
+
+	num_commits = file->num_commits_in_base + file->num_commits;
+	cl_assert_equal_i(expected->num_commits, num_commits);
+
+	for (i = 0; i < expected->num_commits; i++) {
+		cl_git_pass(git_oid_from_raw(&id, expected->oid_lookup + i * GIT_OID_SHA1_SIZE, GIT_OID_SHA1));
+		cl_git_pass(git_commit_graph_entry_find(&e, expected, &id, GIT_OID_SHA1_HEXSIZE));
+		cl_git_pass(git_commit_graph_entry_find(&actual, file, &id, GIT_OID_SHA1_HEXSIZE));
+
+		cl_assert_equal_oid(&e.tree_oid, &actual.tree_oid);
+		cl_assert_equal_i(e.generation, actual.generation);
+		cl_assert_equal_i(e.commit_time, actual.commit_time);
+		cl_assert_equal_i(e.parent_count, actual.parent_count);
+
+		for (n = 0; n < e.parent_count; n++) {
+			cl_git_pass(git_commit_graph_entry_parent(&e_parent, expected, &e, n));
+			cl_git_pass(git_commit_graph_entry_parent(&actual_parent, file, &actual, n));
+			cl_assert_equal_oid(&e_parent.sha1, &actual_parent.sha1);
+		}
+	}
+
+	git_commit_graph_free(cgraph);
+	git_str_dispose(&objects_dir);
+}
+
+void test_graph_commitgraph__writer_split(void)
+{
+	git_repository *repo;
+	git_commit_graph_file *expected;
+	git_str path = GIT_STR_INIT;
+
+	cl_fixture_sandbox("testrepo.git");
+	cl_git_pass(git_repository_open(&repo, cl_git_sandbox_path(1, "testrepo.git", NULL)));
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&expected, path.ptr, GIT_OID_SHA1));
+
+	/* an existing commit-graph file becomes the bottom of the chain */
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE, "refs/heads/br2");
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE, "refs/heads/master");
+	cl_assert(!git_fs_path_exists(path.ptr));
+	cl_assert_equal_i(2, chain_length(repo));
+
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE, "refs/heads/haacked");
+	cl_assert_equal_i(3, chain_length(repo));
+
+	/* adding no new commits keeps the chain as it is */
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE, "refs/heads/master");
+	cl_assert_equal_i(3, chain_length(repo));
+
+	/* the small layers are merged into the new one */
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE, "refs/heads/subtrees");
+	cl_assert(chain_length(repo) < 4);
+	cl_assert_equal_i(chain_length(repo), layer_count(repo));
+
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_REPLACE, "refs/heads/test");
+	cl_assert_equal_i(1, chain_length(repo));
+	cl_assert_equal_i(1, layer_count(repo));
+
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE, "refs/heads/chomped");
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE, "refs/tags/e90810b");
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE, "refs/*");
+	cl_assert_equal_i(chain_length(repo), layer_count(repo));
+	assert_graph_matches(repo, expected);
+
+	/* writing a single file removes the chain */
+	write_split(repo, GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE, "refs/heads/master");
+	cl_assert(git_fs_path_exists(path.ptr));
+	cl_assert_equal_i(0, chain_length(repo));
+	cl_assert_equal_i(0, layer_count(repo));
+
+	git_commit_graph_file_free(expected);
+	git_str_dispose(&path);
+	git_repository_free(repo);
+	cl_fixture_cleanup("testrepo.git");
+}
+
 void test_graph_commitgraph__validate(void)
 {
 	git_repository *repo;
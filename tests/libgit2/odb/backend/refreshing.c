@@ -15,6 +15,7 @@ static const fake_object _objects[] = {
 
 static git_oid _nonexisting_oid;
 static git_oid _existing_oid;
+static size_t _orig_missing_cache_size;
 
 static void setup_repository_and_backend(void)
 {
@@ -36,11 +37,14 @@ void test_odb_backend_refreshing__initialize(void)
 	git_oid_from_string(&_nonexisting_oid, NONEXISTING_HASH, GIT_OID_SHA1);
 	git_oid_from_string(&_existing_oid, EXISTING_HASH, GIT_OID_SHA1);
 	setup_repository_and_backend();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_ODB_MISSING_CACHE_SIZE, &_orig_missing_cache_size));
 }
 
 void test_odb_backend_refreshing__cleanup(void)
 {
 	cl_git_sandbox_cleanup();
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_MISSING_CACHE_SIZE, _orig_missing_cache_size));
 }
 
 void test_odb_backend_refreshing__exists_is_invoked_twice_on_failure(void)
@@ -174,3 +178,84 @@ void test_odb_backend_refreshing__refresh_suppressed_with_no_refresh(void)
 
 	cl_assert_equal_i(0, _fake->refresh_calls);
 }
+
+void test_odb_backend_refreshing__refresh_is_repeated_for_missing_objects(void)
+{
+	git_odb *odb;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+
+	cl_assert_equal_i(4, _fake->exists_calls);
+	cl_assert_equal_i(2, _fake->refresh_calls);
+}
+
+void test_odb_backend_refreshing__missing_objects_are_remembered(void)
+{
+	git_odb *odb;
+	git_object *obj;
+	size_t len;
+	git_object_t type;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_MISSING_CACHE_SIZE, (size_t)16));
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+
+	/* The backend is still asked, but not refreshed again */
+	cl_assert_equal_i(3, _fake->exists_calls);
+	cl_assert_equal_i(1, _fake->refresh_calls);
+
+	cl_git_fail_with(
+		git_object_lookup(&obj, _repo, &_nonexisting_oid, GIT_OBJECT_ANY),
+		GIT_ENOTFOUND);
+	cl_git_fail_with(
+		git_odb_read_header(&len, &type, odb, &_nonexisting_oid),
+		GIT_ENOTFOUND);
+
+	cl_assert_equal_i(1, _fake->read_calls);
+	cl_assert_equal_i(1, _fake->read_header_calls);
+	cl_assert_equal_i(1, _fake->refresh_calls);
+}
+
+void test_odb_backend_refreshing__refresh_forgets_missing_objects(void)
+{
+	git_odb *odb;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_MISSING_CACHE_SIZE, (size_t)16));
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+	cl_assert_equal_i(1, _fake->refresh_calls);
+
+	cl_git_pass(git_odb_refresh(odb));
+	cl_assert_equal_i(2, _fake->refresh_calls);
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+	cl_assert_equal_i(3, _fake->refresh_calls);
+}
+
+void test_odb_backend_refreshing__exists_many_remembers_missing_objects(void)
+{
+	git_odb *odb;
+	git_oid ids[2];
+	int found[2];
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_MISSING_CACHE_SIZE, (size_t)16));
+
+	git_oid_cpy(&ids[0], &_existing_oid);
+	git_oid_cpy(&ids[1], &_nonexisting_oid);
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_exists_many(found, odb, ids, 2));
+	cl_assert_equal_i(1, found[0]);
+	cl_assert_equal_i(0, found[1]);
+	cl_assert_equal_i(1, _fake->refresh_calls);
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &_nonexisting_oid));
+	cl_git_pass(git_odb_exists_many(found, odb, ids, 2));
+	cl_assert_equal_i(0, found[1]);
+	cl_assert_equal_i(1, _fake->refresh_calls);
+}
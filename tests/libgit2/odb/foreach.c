@@ -3,6 +3,8 @@
 #include "git2/odb_backend.h"
 #include "pack.h"
 
+extern size_t git_odb_pack__foreach_min_part;
+
 static git_odb *_odb;
 static git_repository *_repo;
 
@@ -13,6 +15,8 @@ void test_odb_foreach__cleanup(void)
 
 	_odb = NULL;
 	_repo = NULL;
+
+	git_odb_pack__foreach_min_part = 1024;
 }
 
 static int foreach_cb(const git_oid *oid, void *data)
@@ -145,3 +149,214 @@ void test_odb_foreach__files_in_objects_dir(void)
 	git_repository_free(repo);
 	cl_fixture_cleanup("testrepo.git");
 }
+
+static int foreach_object_cb(
+	const git_oid *oid,
+	git_object_t type,
+	const void *data,
+	size_t len,
+	void *payload)
+{
+	git_object_id_options id_opts = GIT_OBJECT_ID_OPTIONS_INIT;
+	int *nobj = payload;
+	git_oid actual;
+
+	id_opts.object_type = type;
+	id_opts.oid_type = GIT_OID_SHA1;
+
+	cl_git_pass(git_object_id_from_buffer(&actual, data, len, &id_opts));
+	cl_assert_equal_oid(oid, &actual);
+
+	(*nobj)++;
+	return (*nobj == 1000) ? -321 : 0;
+}
+
+void test_odb_foreach__foreach_object(void)
+{
+	git_odb_backend *backend = NULL;
+	git_odb_options odb_opts = GIT_ODB_OPTIONS_INIT;
+	int nobj = 0;
+
+	odb_opts.oid_type = GIT_OID_SHA1;
+
+	cl_git_pass(git_odb_new_ext(&_odb, &odb_opts));
+
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"),
+		NULL));
+
+	cl_git_pass(git_odb_add_backend(_odb, backend, 1));
+
+	cl_assert_equal_i(-321, git_odb_foreach_object(_odb, foreach_object_cb, &nobj));
+	cl_assert_equal_i(1000, nobj);
+
+	/* Start past the stopping point to count all of the objects */
+	nobj = 1000;
+	cl_git_pass(git_odb_foreach_object(_odb, foreach_object_cb, &nobj));
+	cl_assert_equal_i(1000 + 1628, nobj);
+}
+
+void test_odb_foreach__foreach_object_loose(void)
+{
+	git_oid id;
+	int nobj = 0;
+
+	cl_git_pass(git_repository_init(&_repo, "onlyloose.git", true));
+	git_repository_odb(&_odb, _repo);
+
+	cl_git_pass(git_odb_write(&id, _odb, "", 0, GIT_OBJECT_BLOB));
+	cl_git_pass(git_odb_write(&id, _odb, "hello\n", 6, GIT_OBJECT_BLOB));
+
+	cl_git_pass(git_odb_foreach_object(_odb, foreach_object_cb, &nobj));
+	cl_assert_equal_i(2, nobj);
+}
+
+#define PARALLEL_THREADS 4
+
+struct parallel_ids {
+	git_array_t(git_oid) ids[PARALLEL_THREADS];
+
+	/* Failures on the listing threads, which can't use clar's asserts */
+	git_atomic32 failures;
+};
+
+static int foreach_parallel_cb(const git_oid *oid, unsigned int thread, void *payload)
+{
+	struct parallel_ids *ids = payload;
+	git_oid *id;
+
+	if (thread >= PARALLEL_THREADS ||
+	    (id = git_array_alloc(ids->ids[thread])) == NULL) {
+		git_atomic32_inc(&ids->failures);
+		return 0;
+	}
+
+	git_oid_cpy(id, oid);
+	return 0;
+}
+
+static int foreach_collect_cb(const git_oid *oid, void *payload)
+{
+	git_array_t(git_oid) *ids = payload;
+	git_oid *id = git_array_alloc(*ids);
+
+	cl_assert(id);
+	git_oid_cpy(id, oid);
+
+	return 0;
+}
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static void assert_foreach_parallel_lists_all(unsigned int threads)
+{
+	git_array_t(git_oid) expected = GIT_ARRAY_INIT, actual = GIT_ARRAY_INIT;
+	struct parallel_ids ids = {{ GIT_ARRAY_INIT }};
+	git_oid *id;
+	size_t i, j;
+
+	cl_git_pass(git_odb_foreach(_odb, foreach_collect_cb, &expected));
+	cl_git_pass(git_odb_foreach_parallel(_odb, threads, foreach_parallel_cb, &ids));
+	cl_assert_equal_i(0, git_atomic32_get(&ids.failures));
+
+	for (i = 0; i < PARALLEL_THREADS; i++) {
+		git_array_foreach(ids.ids[i], j, id) {
+			git_oid *copy = git_array_alloc(actual);
+			cl_assert(copy);
+			git_oid_cpy(copy, id);
+		}
+
+		git_array_clear(ids.ids[i]);
+	}
+
+	cl_assert_equal_sz(git_array_size(expected), git_array_size(actual));
+
+	qsort(expected.ptr, expected.size, sizeof(git_oid), oid_cmp);
+	qsort(actual.ptr, actual.size, sizeof(git_oid), oid_cmp);
+
+	for (i = 0; i < git_array_size(expected); i++)
+		cl_assert_equal_oid(git_array_get(expected, i), git_array_get(actual, i));
+
+	git_array_clear(expected);
+	git_array_clear(actual);
+}
+
+void test_odb_foreach__foreach_parallel(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+
+	assert_foreach_parallel_lists_all(PARALLEL_THREADS);
+	assert_foreach_parallel_lists_all(1);
+}
+
+void test_odb_foreach__foreach_parallel_one_pack(void)
+{
+	git_odb_backend *backend = NULL;
+	git_odb_options odb_opts = GIT_ODB_OPTIONS_INIT;
+
+	odb_opts.oid_type = GIT_OID_SHA1;
+
+	cl_git_pass(git_odb_new_ext(&_odb, &odb_opts));
+
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"),
+		NULL));
+
+	cl_git_pass(git_odb_add_backend(_odb, backend, 1));
+
+	assert_foreach_parallel_lists_all(PARALLEL_THREADS);
+}
+
+void test_odb_foreach__foreach_parallel_small_parts(void)
+{
+	git_odb_backend *backend = NULL;
+	git_odb_options odb_opts = GIT_ODB_OPTIONS_INIT;
+
+	/* Split the packs, and the multi-pack-index, into many ranges */
+	git_odb_pack__foreach_min_part = 100;
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+
+	assert_foreach_parallel_lists_all(PARALLEL_THREADS);
+	assert_foreach_parallel_lists_all(1);
+
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	odb_opts.oid_type = GIT_OID_SHA1;
+	cl_git_pass(git_odb_new_ext(&_odb, &odb_opts));
+
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"),
+		NULL));
+
+	cl_git_pass(git_odb_add_backend(_odb, backend, 1));
+
+	assert_foreach_parallel_lists_all(PARALLEL_THREADS);
+}
+
+static int foreach_parallel_stop_cb(const git_oid *oid, unsigned int thread, void *payload)
+{
+	GIT_UNUSED(oid);
+	GIT_UNUSED(thread);
+	GIT_UNUSED(payload);
+
+	return -321;
+}
+
+void test_odb_foreach__interrupt_foreach_parallel(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+
+	cl_assert_equal_i(-321, git_odb_foreach_parallel(_odb, PARALLEL_THREADS,
+		foreach_parallel_stop_cb, NULL));
+	cl_assert_equal_i(-321, git_odb_foreach_parallel(_odb, 1,
+		foreach_parallel_stop_cb, NULL));
+}
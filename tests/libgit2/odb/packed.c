@@ -1,5 +1,7 @@
 #include "clar_libgit2.h"
 #include "odb.h"
+#include "hash.h"
+#include "futils.h"
 #include "pack_data.h"
 
 static git_odb *_odb;
@@ -77,3 +79,195 @@ void test_odb_packed__read_header_1(void)
 	}
 }
 
+
+void test_odb_packed__read_many(void)
+{
+	git_oid ids[ARRAY_SIZE(packed_objects) + 4];
+	git_odb_object *objs[ARRAY_SIZE(ids)], *obj;
+	size_t count = 0, i;
+
+	/* Read the objects backwards, so that they are not in ID order */
+	for (i = ARRAY_SIZE(packed_objects); i > 0; i--)
+		cl_git_pass(git_oid_from_string(&ids[count++], packed_objects[i - 1], GIT_OID_SHA1));
+
+	cl_git_pass(git_oid_from_string(&ids[count++], loose_objects[0], GIT_OID_SHA1));
+	cl_git_pass(git_oid_from_string(&ids[count++], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef", GIT_OID_SHA1));
+	git_oid_clear(&ids[count++], GIT_OID_SHA1);
+	git_oid_cpy(&ids[count++], &ids[0]);
+
+	cl_git_pass(git_odb_read_many(objs, _odb, ids, count));
+
+	for (i = 0; i < count; i++) {
+		if (git_odb_read(&obj, _odb, &ids[i]) < 0) {
+			cl_assert(objs[i] == NULL);
+			continue;
+		}
+
+		cl_assert(objs[i] != NULL);
+		cl_assert_equal_oid(&ids[i], git_odb_object_id(objs[i]));
+		cl_assert_equal_i(git_odb_object_type(obj), git_odb_object_type(objs[i]));
+		cl_assert_equal_i(git_odb_object_size(obj), git_odb_object_size(objs[i]));
+		cl_assert(memcmp(git_odb_object_data(obj), git_odb_object_data(objs[i]),
+			git_odb_object_size(obj)) == 0);
+
+		git_odb_object_free(obj);
+		git_odb_object_free(objs[i]);
+	}
+
+	cl_assert(objs[count - 3] == NULL);
+	cl_assert(objs[count - 2] == NULL);
+}
+
+void test_odb_packed__exists_many(void)
+{
+	git_oid ids[ARRAY_SIZE(packed_objects) + 4];
+	int found[ARRAY_SIZE(ids)];
+	size_t count = 0, i;
+
+	for (i = ARRAY_SIZE(packed_objects); i > 0; i--)
+		cl_git_pass(git_oid_from_string(&ids[count++], packed_objects[i - 1], GIT_OID_SHA1));
+
+	cl_git_pass(git_oid_from_string(&ids[count++], loose_objects[0], GIT_OID_SHA1));
+	cl_git_pass(git_oid_from_string(&ids[count++], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef", GIT_OID_SHA1));
+	git_oid_clear(&ids[count++], GIT_OID_SHA1);
+	git_oid_cpy(&ids[count++], &ids[0]);
+
+	cl_git_pass(git_odb_exists_many(found, _odb, ids, count));
+
+	for (i = 0; i < count; i++)
+		cl_assert_equal_i(git_odb_exists(_odb, &ids[i]), found[i]);
+
+	cl_assert_equal_i(1, found[0]);
+	cl_assert_equal_i(0, found[count - 3]);
+	cl_assert_equal_i(0, found[count - 2]);
+	cl_assert_equal_i(1, found[count - 1]);
+}
+
+void test_odb_packed__prefetch(void)
+{
+	git_oid ids[ARRAY_SIZE(packed_objects) + 1];
+	git_odb_object *obj;
+	size_t count = 0, i;
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); i++)
+		cl_git_pass(git_oid_from_string(&ids[count++], packed_objects[i], GIT_OID_SHA1));
+
+	cl_git_pass(git_oid_from_string(&ids[count++], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef", GIT_OID_SHA1));
+
+	cl_git_pass(git_odb_prefetch(_odb, ids, count));
+	cl_git_pass(git_odb_prefetch(_odb, ids, 0));
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); i++) {
+		cl_git_pass(git_odb_read(&obj, _odb, &ids[i]));
+		git_odb_object_free(obj);
+	}
+}
+
+void test_odb_packed__readstream(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_oid id;
+		git_odb_object *obj;
+		git_odb_stream *stream;
+		git_str buf = GIT_STR_INIT;
+		char chunk[7];
+		size_t len;
+		git_object_t type;
+		int read;
+
+		cl_git_pass(git_oid_from_string(&id, packed_objects[i], GIT_OID_SHA1));
+		cl_git_pass(git_odb_read(&obj, _odb, &id));
+		cl_git_pass(git_odb_open_rstream(&stream, &len, &type, _odb, &id));
+
+		cl_assert_equal_i(git_odb_object_size(obj), len);
+		cl_assert_equal_i(git_odb_object_type(obj), type);
+
+		while ((read = git_odb_stream_read(stream, chunk, sizeof(chunk))) > 0)
+			cl_git_pass(git_str_put(&buf, chunk, read));
+
+		cl_git_pass(read);
+		cl_assert_equal_i(len, buf.size);
+		cl_assert(memcmp(git_odb_object_data(obj), buf.ptr, len) == 0);
+
+		git_str_dispose(&buf);
+		git_odb_stream_free(stream);
+		git_odb_object_free(obj);
+	}
+}
+
+void test_odb_packed__readstream_truncated_pack(void)
+{
+	git_odb *odb;
+	git_odb_writepack *writepack;
+	git_indexer_progress stats = { 0 };
+	git_odb_stream *stream;
+	git_str pack = GIT_STR_INIT, path = GIT_STR_INIT;
+	unsigned char data[1000], adler[4], trailer[GIT_HASH_SHA1_SIZE];
+	char chunk[256], name[GIT_OID_SHA1_HEXSIZE + 1];
+	unsigned int a = 1, b = 0;
+	git_oid id, pack_id;
+	git_object_t type;
+	size_t i, len;
+	int read;
+
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = 'a' + (i % 26);
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	adler[0] = (unsigned char)(b >> 8);
+	adler[1] = (unsigned char)b;
+	adler[2] = (unsigned char)(a >> 8);
+	adler[3] = (unsigned char)a;
+
+	/*
+	 * A pack of one 1000 byte blob in a stored deflate block, which
+	 * inflates whatever bytes it is given; cutting the block short
+	 * leaves a stream that runs into the end of the pack.
+	 */
+	cl_git_pass(git_str_put(&pack, "PACK\0\0\0\2\0\0\0\1", 12));
+	cl_git_pass(git_str_put(&pack, "\xb8\x3e", 2));
+	cl_git_pass(git_str_put(&pack, "\x78\x01\x01\xe8\x03\x17\xfc", 7));
+	cl_git_pass(git_str_put(&pack, (char *)data, sizeof(data)));
+	cl_git_pass(git_str_put(&pack, (char *)adler, sizeof(adler)));
+	cl_git_pass(git_hash_buf(trailer, pack.ptr, pack.size, GIT_HASH_ALGORITHM_SHA1));
+	cl_git_pass(git_str_put(&pack, (char *)trailer, sizeof(trailer)));
+
+	cl_git_pass(git_futils_mkdir("truncated/pack", 0777, GIT_MKDIR_PATH));
+	cl_git_pass(git_odb_open_ext(&odb, "truncated", NULL));
+	cl_git_pass(git_odb_write_pack(&writepack, odb, NULL, NULL));
+	cl_git_pass(writepack->append(writepack, pack.ptr, pack.size, &stats));
+	cl_git_pass(writepack->commit(writepack, &stats));
+	writepack->free(writepack);
+	git_odb_free(odb);
+
+	/* Keep the trailer, so that the pack still matches its index */
+	git_oid_from_raw(&pack_id, trailer, GIT_OID_SHA1);
+	git_oid_tostr(name, sizeof(name), &pack_id);
+	cl_git_pass(git_str_printf(&path, "truncated/pack/pack-%s.pack", name));
+
+	len = 12 + 2 + 7 + sizeof(data) / 2;
+	memmove(pack.ptr + len, trailer, sizeof(trailer));
+	cl_must_pass(p_unlink(path.ptr));
+	cl_git_write2file(path.ptr, pack.ptr, len + sizeof(trailer),
+		O_WRONLY | O_CREAT | O_TRUNC, 0444);
+
+	cl_git_pass(git_object_id_from_buffer(&id, data, sizeof(data), NULL));
+	cl_git_pass(git_odb_open_ext(&odb, "truncated", NULL));
+	cl_git_pass(git_odb_open_rstream(&stream, &len, &type, odb, &id));
+	cl_assert_equal_i(sizeof(data), len);
+
+	while ((read = git_odb_stream_read(stream, chunk, sizeof(chunk))) > 0)
+		;
+
+	cl_git_fail(read);
+
+	git_odb_stream_free(stream);
+	git_odb_free(odb);
+	git_str_dispose(&path);
+	git_str_dispose(&pack);
+	cl_fixture_cleanup("truncated");
+}
@@ -0,0 +1,138 @@
+#include "clar_libgit2.h"
+#include "futils.h"
+
+#include "git2/sys/odb_backend.h"
+
+#define PACK_FIXTURE "testrepo.git/objects/pack/"
+#define PACK_A81E "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+#define PACK_D85F "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a"
+
+/* A tree in the first pack, and one that is only in the second */
+#define IN_A81E "e2401d52544ebf052730a63e8acfe4ccfb8fa0d0"
+#define IN_D85F "53fc32d17276939fc79ed05badaef2db09990016"
+#define NONEXISTING "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"
+
+static size_t _orig_cache_size;
+static git_odb *_odb;
+
+static void copy_pack(const char *name)
+{
+	git_str from = GIT_STR_INIT, to = GIT_STR_INIT;
+	const char *exts[] = { ".idx", ".pack" };
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		cl_git_pass(git_str_printf(&from, "%s%s%s",
+			cl_fixture(PACK_FIXTURE), name, exts[i]));
+		cl_git_pass(git_str_printf(&to, "lookup/pack/%s%s", name, exts[i]));
+		cl_git_pass(git_futils_cp(from.ptr, to.ptr, 0644));
+
+		git_str_clear(&from);
+		git_str_clear(&to);
+	}
+
+	git_str_dispose(&from);
+	git_str_dispose(&to);
+}
+
+static int exists(const char *hex, unsigned int flags)
+{
+	git_oid id;
+
+	cl_git_pass(git_oid_from_string(&id, hex, GIT_OID_SHA1));
+	return git_odb_exists_ext(_odb, &id, flags);
+}
+
+void test_odb_packedlookup__initialize(void)
+{
+	git_odb_backend *backend;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_LOOKUP_CACHE_SIZE, &_orig_cache_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_LOOKUP_CACHE_SIZE, (size_t)16));
+
+	cl_git_pass(git_futils_mkdir("lookup/pack", 0755, GIT_MKDIR_PATH));
+	copy_pack(PACK_A81E);
+
+	cl_git_pass(git_odb_new(&_odb));
+	cl_git_pass(git_odb_backend_pack(&backend, "lookup", NULL));
+	cl_git_pass(git_odb_add_backend(_odb, backend, 1));
+}
+
+void test_odb_packedlookup__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_git_pass(git_futils_rmdir_r("lookup", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_LOOKUP_CACHE_SIZE, _orig_cache_size));
+}
+
+void test_odb_packedlookup__option(void)
+{
+	size_t size;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_LOOKUP_CACHE_SIZE, &size));
+	cl_assert_equal_sz(16, size);
+}
+
+void test_odb_packedlookup__repeated_lookups(void)
+{
+	git_odb_object *obj;
+	git_oid id;
+	int i;
+
+	cl_git_pass(git_oid_from_string(&id, IN_A81E, GIT_OID_SHA1));
+
+	for (i = 0; i < 3; i++) {
+		cl_assert_equal_i(1, exists(IN_A81E, 0));
+		cl_assert_equal_i(0, exists(NONEXISTING, 0));
+
+		cl_git_pass(git_odb_read(&obj, _odb, &id));
+		cl_assert_equal_i(GIT_OBJECT_TREE, git_odb_object_type(obj));
+		git_odb_object_free(obj);
+	}
+}
+
+void test_odb_packedlookup__more_lookups_than_entries(void)
+{
+	git_oid id;
+	unsigned char i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_LOOKUP_CACHE_SIZE, (size_t)2));
+
+	cl_git_pass(git_oid_from_string(&id, NONEXISTING, GIT_OID_SHA1));
+
+	for (i = 0; i < 8; i++) {
+		id.id[0] = i;
+		cl_assert_equal_i(0, git_odb_exists(_odb, &id));
+		cl_assert_equal_i(1, exists(IN_A81E, 0));
+	}
+}
+
+void test_odb_packedlookup__refresh_finds_new_packs(void)
+{
+	/* Remember that the object is in none of the packs */
+	cl_assert_equal_i(0, exists(IN_D85F, GIT_ODB_LOOKUP_NO_REFRESH));
+	cl_assert_equal_i(1, exists(IN_A81E, GIT_ODB_LOOKUP_NO_REFRESH));
+
+	copy_pack(PACK_D85F);
+
+	/* Until the packs are refreshed, it is still missing */
+	cl_assert_equal_i(0, exists(IN_D85F, GIT_ODB_LOOKUP_NO_REFRESH));
+
+	cl_git_pass(git_odb_refresh(_odb));
+
+	cl_assert_equal_i(1, exists(IN_D85F, GIT_ODB_LOOKUP_NO_REFRESH));
+	cl_assert_equal_i(1, exists(IN_A81E, GIT_ODB_LOOKUP_NO_REFRESH));
+	cl_assert_equal_i(0, exists(NONEXISTING, GIT_ODB_LOOKUP_NO_REFRESH));
+}
+
+void test_odb_packedlookup__missing_lookup_refreshes(void)
+{
+	cl_assert_equal_i(0, exists(IN_D85F, 0));
+
+	copy_pack(PACK_D85F);
+
+	/* Failing to find the object refreshes the packs */
+	cl_assert_equal_i(1, exists(IN_D85F, 0));
+}
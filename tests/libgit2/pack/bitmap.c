@@ -0,0 +1,217 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+
+#include "odb.h"
+#include "repository.h"
+#include "pack_bitmap.h"
+#include "pack-objects.h"
+
+static git_repository *_repo;
+
+void test_pack_bitmap__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+}
+
+static git_pack_bitmap_file *open_bitmap(const char *fixture)
+{
+	git_odb *odb;
+	git_pack_bitmap_file *file;
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture(fixture)));
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb__get_pack_bitmap_file(&file, odb));
+
+	return file;
+}
+
+static size_t reachable_count_in(
+	git_repository *repo,
+	git_pack_bitmap_file *file,
+	const char *spec)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_object *obj;
+	size_t count;
+
+	cl_git_pass(git_revparse_single(&obj, repo, spec));
+	cl_git_pass(git_pack_bitmap_file_reachable(&bitmap, file, repo,
+		git_object_id(obj), 1));
+	count = git_bitmap_popcount(&bitmap);
+
+	git_bitmap_dispose(&bitmap);
+	git_object_free(obj);
+	return count;
+}
+
+static size_t reachable_count(git_pack_bitmap_file *file, const char *spec)
+{
+	return reachable_count_in(_repo, file, spec);
+}
+
+void test_pack_bitmap__parse(void)
+{
+	git_pack_bitmap_file *file = open_bitmap("bitmap.git");
+	const git_bitmap *stored;
+	const git_oid *id;
+	git_object_t type;
+	git_oid oid;
+	uint32_t pos;
+
+	cl_assert_equal_i(50, file->num_objects);
+	cl_assert_equal_i(14, file->num_entries);
+	cl_assert(!file->midx);
+	cl_assert(file->name_hashes);
+
+	cl_git_pass(git_oid_from_string(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", GIT_OID_SHA1));
+	cl_git_pass(git_pack_bitmap_file_position(&pos, file, &oid));
+	cl_git_pass(git_pack_bitmap_file_object(&id, &type, NULL, file, pos));
+	cl_assert_equal_oid(&oid, id);
+	cl_assert_equal_i(GIT_OBJECT_COMMIT, type);
+
+	cl_git_pass(git_pack_bitmap_file_commit(&stored, file, &oid));
+	cl_assert_equal_i(20, git_bitmap_popcount(stored));
+
+	cl_git_pass(git_oid_from_string(&oid, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef", GIT_OID_SHA1));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_pack_bitmap_file_position(&pos, file, &oid));
+}
+
+void test_pack_bitmap__reachable(void)
+{
+	git_pack_bitmap_file *file = open_bitmap("bitmap.git");
+
+	cl_assert_equal_i(20, reachable_count(file, "master"));
+	cl_assert_equal_i(17, reachable_count(file, "master~1"));
+	cl_assert_equal_i(12, reachable_count(file, "master~2"));
+	cl_assert_equal_i(17, reachable_count(file, "br2"));
+	cl_assert_equal_i(19, reachable_count(file, "subtrees"));
+}
+
+void test_pack_bitmap__midx(void)
+{
+	git_pack_bitmap_file *file = open_bitmap("bitmap_midx.git");
+
+	cl_assert(file->midx);
+	cl_assert_equal_i(50, file->num_objects);
+
+	cl_assert_equal_i(20, reachable_count(file, "master"));
+	cl_assert_equal_i(12, reachable_count(file, "master~2"));
+	cl_assert_equal_i(19, reachable_count(file, "haacked"));
+}
+
+void test_pack_bitmap__no_bitmap(void)
+{
+	git_odb *odb;
+	git_pack_bitmap_file *file;
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb__get_pack_bitmap_file(&file, odb));
+}
+
+static size_t packbuilder_count(const char *fixture, const char *push, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	size_t count;
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture(fixture)));
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	cl_git_pass(git_revwalk_push_ref(walk, push));
+	if (hide)
+		cl_git_pass(git_revwalk_hide_ref(walk, hide));
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	count = git_packbuilder_object_count(pb);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	return count;
+}
+
+void test_pack_bitmap__packbuilder(void)
+{
+	cl_assert_equal_i(20, packbuilder_count("bitmap.git", "refs/heads/master", NULL));
+	/* this matches `git rev-list --objects --use-bitmap-index` */
+	cl_assert_equal_i(4, packbuilder_count("bitmap.git", "refs/heads/master", "refs/heads/br2"));
+	cl_assert_equal_i(10, packbuilder_count("bitmap_midx.git", "refs/heads/subtrees", "refs/heads/master"));
+}
+
+void test_pack_bitmap__write(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_pack_bitmap_file *file;
+	git_str path = GIT_STR_INIT;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/heads/*"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_git_pass(git_packbuilder_set_write_bitmap(pb, 1));
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/pack"));
+	cl_git_pass(git_pack_bitmap_file_open(&file, path.ptr, GIT_OID_SHA1));
+
+	cl_assert(!file->midx);
+	cl_assert(file->name_hashes);
+	cl_assert(file->num_entries > 0);
+	cl_assert_equal_i(git_packbuilder_object_count(pb), file->num_objects);
+
+	cl_assert_equal_i(20, reachable_count_in(repo, file, "master"));
+	cl_assert_equal_i(12, reachable_count_in(repo, file, "master~2"));
+	cl_assert_equal_i(17, reachable_count_in(repo, file, "br2"));
+
+	git_pack_bitmap_file_free(file);
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_str_dispose(&path);
+	cl_git_sandbox_cleanup();
+}
+
+void test_pack_bitmap__write_failure_keeps_pack(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_oid id;
+	git_str path = GIT_STR_INIT;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	/* A commit without its tree is not closed under reachability */
+	cl_git_pass(git_reference_name_to_id(&id, repo, "refs/heads/master"));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_packbuilder_insert(pb, &id, NULL));
+
+	cl_git_pass(git_packbuilder_set_write_bitmap(pb, 1));
+	cl_git_fail(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+	cl_assert(git_packbuilder_name(pb));
+
+	cl_git_pass(git_str_printf(&path, "%sobjects/pack/pack-%s.pack",
+		git_repository_path(repo), git_packbuilder_name(pb)));
+	cl_assert(git_fs_path_exists(path.ptr));
+
+	git_str_shorten(&path, strlen(".pack"));
+	cl_git_pass(git_str_puts(&path, ".idx"));
+	cl_assert(git_fs_path_exists(path.ptr));
+
+	git_str_shorten(&path, strlen(".idx"));
+	cl_git_pass(git_str_puts(&path, ".bitmap"));
+	cl_assert(!git_fs_path_exists(path.ptr));
+
+	git_packbuilder_free(pb);
+	git_str_dispose(&path);
+	cl_git_sandbox_cleanup();
+}
@@ -0,0 +1,75 @@
+#include "clar_libgit2.h"
+#include "mwindow.h"
+
+#include "git2/sys/odb_backend.h"
+
+extern git_mwindow_ctl git_mwindow__mem_ctl;
+
+static int _orig_full_map;
+
+void test_pack_fullmap__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FULL_MAP, &_orig_full_map));
+}
+
+void test_pack_fullmap__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, _orig_full_map));
+}
+
+void test_pack_fullmap__option(void)
+{
+	int enabled;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FULL_MAP, &enabled));
+	cl_assert_equal_i(1, enabled);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FULL_MAP, &enabled));
+	cl_assert_equal_i(0, enabled);
+}
+
+void test_pack_fullmap__read_objects(void)
+{
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+	git_odb_backend *backend;
+	git_odb_object *obj;
+	git_odb *odb;
+	git_oid id;
+	int64_t mapped;
+	int open_windows;
+
+	if (sizeof(void *) < 8)
+		cl_skip();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, 1));
+
+	mapped = (int64_t)git_atomic_ssize_get(&ctl->mapped);
+	open_windows = git_atomic32_get(&ctl->open_windows);
+
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"),
+		NULL));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	/* A tree and a commit, at different places in the pack */
+	cl_git_pass(git_oid_from_string(&id, "e2401d52544ebf052730a63e8acfe4ccfb8fa0d0", GIT_OID_SHA1));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_i(GIT_OBJECT_TREE, git_odb_object_type(obj));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_oid_from_string(&id, "44181c23ea6c39d51a4b481dc59ecf2cc3967e76", GIT_OID_SHA1));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_i(GIT_OBJECT_COMMIT, git_odb_object_type(obj));
+	git_odb_object_free(obj);
+
+	/* The pack is mapped once, and not counted towards the mapped limit */
+	cl_assert_equal_i(open_windows + 1, git_atomic32_get(&ctl->open_windows));
+	cl_assert_equal_i(mapped, (int64_t)git_atomic_ssize_get(&ctl->mapped));
+
+	git_odb_free(odb);
+
+	cl_assert_equal_i(open_windows, git_atomic32_get(&ctl->open_windows));
+}
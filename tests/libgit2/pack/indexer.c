@@ -7,6 +7,11 @@
 #include "posix.h"
 
 
+void test_pack_indexer__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_STREAM_DELTAS, 0));
+}
+
 /*
  * This is a packfile with three objects. The second is a delta which
  * depends on the third, which is also a delta.
@@ -332,3 +337,161 @@ void test_pack_indexer__no_tmp_files(void)
 	cl_assert(git_str_len(&first_tmp_file) == 0);
 	git_str_dispose(&first_tmp_file);
 }
+
+static void index_pack(
+	git_str *idx_contents,
+	const char *pack_path,
+	git_indexer_options *opts,
+	size_t chunk_size)
+{
+	git_indexer *idx = NULL;
+	git_indexer_progress stats = { 0 };
+	git_str pack_contents = GIT_STR_INIT, idx_path = GIT_STR_INIT;
+	size_t i;
+
+	opts->verify = 1;
+
+	cl_git_pass(git_futils_readbuffer(&pack_contents, pack_path));
+
+	cl_git_pass(git_indexer_new(&idx, ".", opts));
+
+	for (i = 0; i < pack_contents.size; i += chunk_size)
+		cl_git_pass(git_indexer_append(idx, pack_contents.ptr + i,
+			min(chunk_size, pack_contents.size - i), &stats));
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert(stats.total_deltas > 0);
+	cl_assert_equal_i(stats.total_deltas, stats.indexed_deltas);
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+
+	cl_git_pass(git_str_printf(&idx_path, "pack-%s.idx", git_indexer_name(idx)));
+	cl_git_pass(git_futils_readbuffer(idx_contents, idx_path.ptr));
+
+	git_indexer_free(idx);
+	git_str_dispose(&idx_path);
+	git_str_dispose(&pack_contents);
+}
+
+void test_pack_indexer__resolve_deltas_in_parallel(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_str expected = GIT_STR_INIT, single = GIT_STR_INIT, parallel = GIT_STR_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&expected,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+
+	opts.threads = 1;
+	index_pack(&single,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack"),
+		&opts, SIZE_MAX);
+
+	opts.threads = 4;
+	index_pack(&parallel,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack"),
+		&opts, SIZE_MAX);
+
+	/* The index does not depend on the order that the deltas were resolved in */
+	cl_assert_equal_i(expected.size, single.size);
+	cl_assert(memcmp(expected.ptr, single.ptr, expected.size) == 0);
+	cl_assert_equal_i(expected.size, parallel.size);
+	cl_assert(memcmp(expected.ptr, parallel.ptr, expected.size) == 0);
+
+	git_str_dispose(&expected);
+	git_str_dispose(&single);
+	git_str_dispose(&parallel);
+}
+
+void test_pack_indexer__stream_deltas(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_str expected = GIT_STR_INIT, streamed = GIT_STR_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&expected,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+
+	opts.stream_deltas = 1;
+	index_pack(&streamed,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack"),
+		&opts, 512);
+
+	cl_assert_equal_i(expected.size, streamed.size);
+	cl_assert(memcmp(expected.ptr, streamed.ptr, expected.size) == 0);
+
+	git_str_dispose(&expected);
+	git_str_dispose(&streamed);
+}
+
+static void write_pack_to_odb(git_str *idx, git_repository *repo)
+{
+	git_odb *odb;
+	git_odb_writepack *writepack;
+	git_indexer_progress stats = {0};
+	git_str pack = GIT_STR_INIT, path = GIT_STR_INIT;
+	size_t offset, len;
+
+	cl_git_pass(git_futils_readbuffer(&pack,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack")));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_write_pack(&writepack, odb, NULL, NULL));
+
+	for (offset = 0; offset < pack.size; offset += len) {
+		len = min(512, pack.size - offset);
+		cl_git_pass(writepack->append(writepack, pack.ptr + offset, len, &stats));
+	}
+
+	cl_git_pass(writepack->commit(writepack, &stats));
+	writepack->free(writepack);
+
+	cl_assert(stats.total_deltas > 0);
+	cl_assert_equal_i(stats.total_deltas, stats.indexed_deltas);
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+
+	/* The new pack is named after its checksum */
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo),
+		"objects/pack/pack-cdd21f629208e17df859e487d2117c0a3939fa10.idx"));
+	cl_git_pass(git_futils_readbuffer(idx, path.ptr));
+
+	git_str_dispose(&path);
+	git_str_dispose(&pack);
+	git_odb_free(odb);
+}
+
+void test_pack_indexer__writepack_stream_deltas(void)
+{
+	git_repository *repo;
+	git_str expected = GIT_STR_INIT, idx = GIT_STR_INIT;
+	int enabled;
+
+	cl_git_pass(git_futils_readbuffer(&expected,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+
+	/* Received packs resolve their deltas when they are committed by default */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_STREAM_DELTAS, &enabled));
+	cl_assert_equal_i(0, enabled);
+
+	cl_git_pass(git_repository_init(&repo, "writepack.git", true));
+	write_pack_to_odb(&idx, repo);
+	git_repository_free(repo);
+	cl_fixture_cleanup("writepack.git");
+
+	cl_assert_equal_i(expected.size, idx.size);
+	cl_assert(memcmp(expected.ptr, idx.ptr, expected.size) == 0);
+	git_str_clear(&idx);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_STREAM_DELTAS, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_STREAM_DELTAS, &enabled));
+	cl_assert_equal_i(1, enabled);
+
+	cl_git_pass(git_repository_init(&repo, "writepack.git", true));
+	write_pack_to_odb(&idx, repo);
+	git_repository_free(repo);
+	cl_fixture_cleanup("writepack.git");
+
+	cl_assert_equal_i(expected.size, idx.size);
+	cl_assert(memcmp(expected.ptr, idx.ptr, expected.size) == 0);
+
+	git_str_dispose(&expected);
+	git_str_dispose(&idx);
+}
@@ -0,0 +1,268 @@
+#include "clar_libgit2.h"
+#include "pack-objects.h"
+#include "delta_islands.h"
+
+static git_repository *_repo;
+static git_packbuilder *_packbuilder;
+static git_oid _shared, _fork_a, _fork_b;
+
+static void write_commit(git_oid *out, const git_oid *parent, const char *content)
+{
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_commit *parent_commit = NULL;
+	git_tree *tree;
+	git_oid blob_id, tree_id;
+
+	cl_git_pass(git_blob_create_from_buffer(&blob_id, _repo, content, strlen(content)));
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "file", &blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+
+	if (parent)
+		cl_git_pass(git_commit_lookup(&parent_commit, _repo, parent));
+
+	cl_git_pass(git_signature_new(&sig, "me", "me@example.com", 1234567890, 0));
+	cl_git_pass(git_commit_create_v(out, _repo, NULL, sig, sig, NULL,
+		"commit", tree, parent ? 1 : 0, parent_commit));
+
+	git_signature_free(sig);
+	git_commit_free(parent_commit);
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+}
+
+/*
+ * A commit that is shared by two forks, each with its own change to the
+ * same file, under refs/fork-a/ and refs/fork-b/.
+ */
+void test_pack_islands__initialize(void)
+{
+	git_str base = GIT_STR_INIT, content = GIT_STR_INIT;
+	git_reference *ref;
+	git_config *cfg;
+	int i;
+
+	cl_git_pass(git_repository_init(&_repo, "islands.git", true));
+
+	for (i = 0; i < 100; i++)
+		cl_git_pass(git_str_printf(&base, "this is line %d of the file\n", i));
+
+	write_commit(&_shared, NULL, base.ptr);
+
+	cl_git_pass(git_str_printf(&content, "%sfork a\n", base.ptr));
+	write_commit(&_fork_a, &_shared, content.ptr);
+
+	git_str_clear(&content);
+	cl_git_pass(git_str_printf(&content, "%sfork b\nwith more\n", base.ptr));
+	write_commit(&_fork_b, &_shared, content.ptr);
+
+	cl_git_pass(git_reference_create(&ref, _repo, "refs/fork-a/heads/main", &_fork_a, 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, _repo, "refs/fork-b/heads/main", &_fork_b, 0, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_string(cfg, "pack.island", "refs/([^/]+)/"));
+	git_config_free(cfg);
+
+	git_str_dispose(&base);
+	git_str_dispose(&content);
+}
+
+void test_pack_islands__cleanup(void)
+{
+	git_packbuilder_free(_packbuilder);
+	_packbuilder = NULL;
+
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_fixture_cleanup("islands.git");
+}
+
+static git_pobject *file_object(const git_oid *commit_id)
+{
+	git_commit *commit;
+	git_tree *tree;
+	git_pobject *po = NULL;
+	const git_oid *id;
+	size_t i;
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, commit_id));
+	cl_git_pass(git_commit_tree(&tree, commit));
+
+	id = git_tree_entry_id(git_tree_entry_byname(tree, "file"));
+
+	for (i = 0; !po && i < _packbuilder->nr_objects; i++) {
+		if (git_oid_equal(&_packbuilder->object_list[i].id, id))
+			po = &_packbuilder->object_list[i];
+	}
+
+	cl_assert(po);
+
+	git_tree_free(tree);
+	git_commit_free(commit);
+	return po;
+}
+
+static void prepare_packbuilder(int islands)
+{
+	git_packbuilder_free(_packbuilder);
+
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	cl_git_pass(git_packbuilder_set_delta_islands(_packbuilder, islands));
+	cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &_shared));
+	cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &_fork_a));
+	cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &_fork_b));
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+}
+
+void test_pack_islands__deltas_across_forks_without_islands(void)
+{
+	prepare_packbuilder(0);
+
+	cl_assert(file_object(&_fork_a)->delta == file_object(&_fork_b));
+	cl_assert(file_object(&_shared)->delta != NULL);
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, NULL, 0, NULL, NULL));
+}
+
+void test_pack_islands__no_deltas_across_islands(void)
+{
+	prepare_packbuilder(1);
+
+	cl_assert(_packbuilder->islands);
+
+	/* Neither fork has the other's file, and the shared one can't use either */
+	cl_assert(file_object(&_fork_a)->delta == NULL);
+	cl_assert(file_object(&_fork_b)->delta == NULL);
+	cl_assert(file_object(&_shared)->delta == NULL);
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, NULL, 0, NULL, NULL));
+}
+
+void test_pack_islands__no_reused_deltas_across_islands(void)
+{
+	git_odb *odb;
+
+	/* Pack the repository with deltas across the forks */
+	prepare_packbuilder(0);
+	cl_git_pass(git_packbuilder_write(_packbuilder, NULL, 0, NULL, NULL));
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+	git_odb_free(odb);
+
+	prepare_packbuilder(1);
+
+	cl_assert_equal_sz(0, git_vector_length(&_packbuilder->whole_packs));
+	cl_assert(file_object(&_fork_a)->reuse_pack != NULL);
+	cl_assert(file_object(&_fork_a)->delta == NULL);
+	cl_assert(file_object(&_shared)->delta == NULL);
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, NULL, 0, NULL, NULL));
+}
+
+void test_pack_islands__no_islands_configured(void)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_delete_entry(cfg, "pack.island"));
+	git_config_free(cfg);
+
+	prepare_packbuilder(1);
+
+	cl_assert(_packbuilder->islands == NULL);
+	cl_assert(file_object(&_fork_a)->delta == file_object(&_fork_b));
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, NULL, 0, NULL, NULL));
+}
+
+static size_t island_count(const git_pobject *po, uint64_t *all)
+{
+	const git_delta_islands *islands = _packbuilder->islands;
+	const uint64_t *marks;
+	size_t i, count = 0;
+
+	marks = islands->marks + (po - _packbuilder->object_list) * islands->words;
+
+	for (i = 0; i < islands->nr_islands; i++) {
+		if (marks[i / 64] & ((uint64_t)1 << (i % 64)))
+			count++;
+	}
+
+	for (i = 0; all && i < islands->words; i++)
+		all[i] |= marks[i];
+
+	return count;
+}
+
+void test_pack_islands__many_islands_share_history(void)
+{
+	git_oid forks[70], tag_id;
+	git_str name = GIT_STR_INIT, content = GIT_STR_INIT;
+	git_reference *ref;
+	git_signature *sig;
+	git_object *target;
+	uint64_t all[2] = { 0 };
+	size_t i, count;
+
+	/* Many forks of fork-a, each in its own island, and a tag of fork-b */
+	for (i = 0; i < ARRAY_SIZE(forks); i++) {
+		git_str_clear(&content);
+		cl_git_pass(git_str_printf(&content, "fork %d\n", (int)i));
+		write_commit(&forks[i], &_fork_a, content.ptr);
+
+		git_str_clear(&name);
+		cl_git_pass(git_str_printf(&name, "refs/fork-%d/heads/main", (int)i));
+		cl_git_pass(git_reference_create(&ref, _repo, name.ptr, &forks[i], 0, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_git_pass(git_signature_new(&sig, "me", "me@example.com", 1234567890, 0));
+	cl_git_pass(git_object_lookup(&target, _repo, &_fork_b, GIT_OBJECT_COMMIT));
+	cl_git_pass(git_tag_create(&tag_id, _repo, "v1", target, sig, "tag", 0));
+
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	cl_git_pass(git_packbuilder_set_delta_islands(_packbuilder, 1));
+	cl_git_pass(git_packbuilder_insert(_packbuilder, &tag_id, NULL));
+	cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &_shared));
+	cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &_fork_a));
+	cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &_fork_b));
+
+	for (i = 0; i < ARRAY_SIZE(forks); i++)
+		cl_git_pass(git_packbuilder_insert_commit(_packbuilder, &forks[i]));
+
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+
+	/* fork-a, fork-b, the tags and each of the forks */
+	cl_assert(_packbuilder->islands);
+	cl_assert_equal_sz(ARRAY_SIZE(forks) + 3, _packbuilder->islands->nr_islands);
+
+	/* The shared history is in the union of the islands that it is in */
+	cl_assert_equal_sz(ARRAY_SIZE(forks) + 3, island_count(file_object(&_shared), NULL));
+	cl_assert_equal_sz(ARRAY_SIZE(forks) + 1, island_count(file_object(&_fork_a), NULL));
+	cl_assert_equal_sz(2, island_count(file_object(&_fork_b), NULL));
+
+	/* Each fork is only in its own island */
+	for (i = 0; i < ARRAY_SIZE(forks); i++)
+		cl_assert_equal_sz(1, island_count(file_object(&forks[i]), all));
+
+	for (i = 0, count = 0; i < _packbuilder->islands->nr_islands; i++) {
+		if (all[i / 64] & ((uint64_t)1 << (i % 64)))
+			count++;
+	}
+
+	cl_assert_equal_sz(ARRAY_SIZE(forks), count);
+	cl_assert(file_object(&_shared)->delta == NULL);
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, NULL, 0, NULL, NULL));
+
+	git_object_free(target);
+	git_signature_free(sig);
+	git_str_dispose(&content);
+	git_str_dispose(&name);
+}
@@ -1,6 +1,7 @@
 #include "clar_libgit2.h"
 #include "futils.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -289,3 +290,313 @@ void test_pack_packbuilder__keep_file_check(void)
 	cl_git_pass(git_libgit2_opts(GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS, true));
 	assert(git_disable_pack_keep_file_checks);
 }
+
+static void assert_pack_has_objects(const char *name, git_odb *expected)
+{
+	git_odb_backend *backend;
+	git_odb *odb;
+	git_str idx_path = GIT_STR_INIT;
+	git_odb_object *obj, *expected_obj;
+	git_pobject *po;
+	size_t i;
+
+	cl_git_pass(git_str_printf(&idx_path, "pack-%s.idx", name));
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend, idx_path.ptr, NULL));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++) {
+		po = _packbuilder->object_list + i;
+
+		cl_git_pass(git_odb_read(&obj, odb, &po->id));
+		cl_git_pass(git_odb_read(&expected_obj, expected, &po->id));
+
+		cl_assert_equal_i(git_odb_object_type(expected_obj), git_odb_object_type(obj));
+		cl_assert_equal_sz(git_odb_object_size(expected_obj), git_odb_object_size(obj));
+		cl_assert(memcmp(git_odb_object_data(expected_obj),
+			git_odb_object_data(obj), git_odb_object_size(obj)) == 0);
+
+		git_odb_object_free(expected_obj);
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+	git_str_dispose(&idx_path);
+}
+
+#define PACK_A81E "objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+
+static int insert_cb(const git_oid *id, void *payload)
+{
+	size_t *skip = payload;
+
+	if (*skip) {
+		(*skip)--;
+		return 0;
+	}
+
+	return git_packbuilder_insert(_packbuilder, id, NULL);
+}
+
+/* Insert the objects of a pack, except for the first ones */
+static void insert_packed_objects(size_t skip)
+{
+	git_odb_backend *backend;
+
+	cl_git_pass(git_odb_backend_one_pack(&backend, PACK_A81E ".idx", NULL));
+	cl_git_pass(backend->foreach(backend, insert_cb, &skip));
+	backend->free(backend);
+}
+
+void test_pack_packbuilder__reuse_packed_objects(void)
+{
+	git_odb *odb;
+	git_pobject *po;
+	size_t i, reused = 0, reused_deltas = 0;
+
+	insert_packed_objects(1);
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+	cl_assert_equal_sz(0, git_vector_length(&_packbuilder->whole_packs));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++) {
+		po = _packbuilder->object_list + i;
+
+		if (po->reuse_pack)
+			reused++;
+		if (po->reuse_delta) {
+			cl_assert(po->delta && po->delta->reuse_pack);
+			reused_deltas++;
+		}
+	}
+
+	cl_assert_equal_sz(1627, reused);
+	cl_assert(reused_deltas > 0);
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+	assert_pack_has_objects(git_packbuilder_name(_packbuilder), odb);
+
+	git_odb_free(odb);
+}
+
+void test_pack_packbuilder__reuse_whole_pack(void)
+{
+	git_str expected = GIT_STR_INIT, actual = GIT_STR_INIT;
+	size_t i, hdr_len = sizeof(struct git_pack_header), oid_size = GIT_OID_SHA1_SIZE;
+	git_odb *odb;
+
+	insert_packed_objects(0);
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+	cl_assert_equal_sz(1, git_vector_length(&_packbuilder->whole_packs));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++)
+		cl_assert(_packbuilder->object_list[i].whole_pack);
+
+	/* The objects are copied verbatim, between a new header and trailer */
+	cl_git_pass(git_packbuilder__write_buf(&actual, _packbuilder));
+	cl_git_pass(git_futils_readbuffer(&expected, PACK_A81E ".pack"));
+
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr + hdr_len, actual.ptr + hdr_len,
+		expected.size - hdr_len - oid_size) == 0);
+
+	cl_git_pass(git_indexer_new(&_indexer, ".", NULL));
+	cl_git_pass(git_indexer_append(_indexer, actual.ptr, actual.size, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+	cl_assert_equal_i(1628, _stats.indexed_objects);
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	assert_pack_has_objects(git_indexer_name(_indexer), odb);
+
+	git_odb_free(odb);
+	git_str_dispose(&expected);
+	git_str_dispose(&actual);
+}
+
+void test_pack_packbuilder__reuse_whole_pack_with_other_objects(void)
+{
+	git_odb *odb;
+
+	insert_packed_objects(0);
+	seed_packbuilder();
+
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+	cl_assert_equal_sz(1, git_vector_length(&_packbuilder->whole_packs));
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+	assert_pack_has_objects(git_packbuilder_name(_packbuilder), odb);
+
+	git_odb_free(odb);
+}
+
+static int discard_cb(void *buf, size_t len, void *payload)
+{
+	GIT_UNUSED(buf);
+	GIT_UNUSED(len);
+	GIT_UNUSED(payload);
+	return 0;
+}
+
+void test_pack_packbuilder__reuse_whole_pack_checks_checksum(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_odb *odb;
+	git_str contents = GIT_STR_INIT, path = GIT_STR_INIT;
+	git_oid ids[2];
+	size_t i;
+
+	cl_git_pass(git_repository_open(&repo, "."));
+
+	for (i = 0; i < 2; i++) {
+		git_str_clear(&contents);
+		cl_git_pass(git_str_printf(&contents, "this is blob %d of the corrupted pack\n", (int)i));
+		cl_git_pass(git_blob_create_from_buffer(&ids[i], repo, contents.ptr, contents.size));
+	}
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_packbuilder_insert(pb, &ids[0], NULL));
+	cl_git_pass(git_packbuilder_insert(pb, &ids[1], NULL));
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	cl_git_pass(git_str_printf(&path, "objects/pack/pack-%s.pack", git_packbuilder_name(pb)));
+	git_packbuilder_free(pb);
+
+	/* Flip a bit in the data of the last object, keeping the trailer */
+	cl_git_pass(git_futils_readbuffer(&contents, path.ptr));
+	contents.ptr[contents.size - GIT_OID_SHA1_SIZE - 3] ^= 0x01;
+	cl_must_pass(p_chmod(path.ptr, 0644));
+	cl_git_pass(git_futils_writebuffer(&contents, path.ptr, O_RDWR | O_TRUNC, 0644));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_packbuilder_insert(pb, &ids[0], NULL));
+	cl_git_pass(git_packbuilder_insert(pb, &ids[1], NULL));
+	cl_git_pass(git_packbuilder__prepare(pb));
+
+	/* The pack is copied as a whole, and found to be corrupt as it is */
+	cl_assert_equal_sz(1, git_vector_length(&pb->whole_packs));
+	cl_git_fail(git_packbuilder_foreach(pb, discard_cb, NULL));
+	cl_assert(strstr(git_error_last()->message, "checksum mismatch") != NULL);
+
+	git_packbuilder_free(pb);
+	git_odb_free(odb);
+	git_repository_free(repo);
+	git_str_dispose(&contents);
+	git_str_dispose(&path);
+}
+
+void test_pack_packbuilder__disable_reuse(void)
+{
+	git_odb *odb;
+	size_t i;
+
+	cl_git_pass(git_packbuilder_set_reuse(_packbuilder, 0));
+	insert_packed_objects(0);
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++)
+		cl_assert(_packbuilder->object_list[i].reuse_pack == NULL);
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+	assert_pack_has_objects(git_packbuilder_name(_packbuilder), odb);
+
+	git_odb_free(odb);
+}
+
+struct thread_progress {
+	unsigned int calls;
+	uint32_t busy;
+};
+
+static int thread_progress_cb(int stage, uint32_t current, uint32_t total, void *payload)
+{
+	struct thread_progress *progress = payload;
+
+	if (stage == GIT_PACKBUILDER_DELTAFICATION_THREAD) {
+		cl_assert(current <= total);
+		progress->calls++;
+		progress->busy += current;
+	}
+
+	return 0;
+}
+
+void test_pack_packbuilder__threaded_delta_search(void)
+{
+	struct thread_progress progress = {0};
+	unsigned int threads;
+	git_odb *odb;
+	size_t i, deltas = 0;
+
+	threads = git_packbuilder_set_threads(_packbuilder, 4);
+	cl_git_pass(git_packbuilder_set_reuse(_packbuilder, 0));
+	cl_git_pass(git_packbuilder_set_callbacks(_packbuilder,
+		thread_progress_cb, &progress));
+
+	insert_packed_objects(0);
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++)
+		if (_packbuilder->object_list[i].delta)
+			deltas++;
+
+	cl_assert(deltas > 0);
+
+	/* Each thread reports how long it was busy, when there are several */
+	cl_assert_equal_i(threads > 1 ? threads : 0, progress.calls);
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+	assert_pack_has_objects(git_packbuilder_name(_packbuilder), odb);
+
+	git_odb_free(odb);
+}
+
+void test_pack_packbuilder__threaded_compression(void)
+{
+	git_packbuilder *serial;
+	git_str expected = GIT_STR_INIT, actual = GIT_STR_INIT;
+	size_t skip = 0;
+	git_odb_backend *backend;
+
+	/* Search for deltas on one thread, so that both packs have the same */
+	cl_git_pass(git_packbuilder_set_reuse(_packbuilder, 0));
+	insert_packed_objects(0);
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+	git_packbuilder_set_threads(_packbuilder, 4);
+	cl_git_pass(git_packbuilder__write_buf(&actual, _packbuilder));
+
+	cl_git_pass(git_packbuilder_new(&serial, _repo));
+	cl_git_pass(git_packbuilder_set_reuse(serial, 0));
+	cl_git_pass(git_odb_backend_one_pack(&backend, PACK_A81E ".idx", NULL));
+	git_packbuilder_free(_packbuilder);
+	_packbuilder = serial;
+	cl_git_pass(backend->foreach(backend, insert_cb, &skip));
+	backend->free(backend);
+	cl_git_pass(git_packbuilder__write_buf(&expected, serial));
+
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, expected.size) == 0);
+
+	git_str_dispose(&expected);
+	git_str_dispose(&actual);
+}
+
+void test_pack_packbuilder__threaded_compression_with_cancel(void)
+{
+	git_indexer *idx;
+
+	git_packbuilder_set_threads(_packbuilder, 4);
+	seed_packbuilder();
+
+	cl_git_pass(git_indexer_new(&idx, ".", NULL));
+
+	cl_git_fail_with(
+		git_packbuilder_foreach(_packbuilder, foreach_cancel_cb, idx), -1111);
+	git_indexer_free(idx);
+}
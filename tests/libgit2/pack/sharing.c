@@ -6,6 +6,12 @@
 
 extern git_mwindow_packmap git_mwindow__pack_cache;
 
+void test_pack_sharing__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)GIT_PACK_CACHE_MEMORY_LIMIT));
+}
+
 void test_pack_sharing__open_two_repos(void)
 {
 	git_repository *repo1, *repo2;
@@ -35,3 +41,147 @@ void test_pack_sharing__open_two_repos(void)
 	/* we don't want to keep the packs open after the repos go away */
 	cl_assert_equal_i(0, git_mwindow_packmap_size(&git_mwindow__pack_cache));
 }
+
+static void read_object(git_repository *repo, const char *id_str)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+
+	git_oid_from_string(&id, id_str, GIT_OID_SHA1);
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+
+	git_odb_object_free(obj);
+	git_odb_free(odb);
+}
+
+void test_pack_sharing__delta_base_cache(void)
+{
+	git_repository *repo1, *repo2;
+	size_t max_size, memory_used, hits, misses, prev_hits, prev_misses;
+
+	/* Read the objects from the packs every time */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &prev_hits, &prev_misses));
+	cl_assert_equal_i(0, memory_used);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)(1024 * 1024)));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, &max_size));
+	cl_assert_equal_i(1024 * 1024, max_size);
+
+	cl_git_pass(git_repository_open(&repo1, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_open(&repo2, cl_fixture("testrepo.git")));
+
+	/* This is a delta against e34dee0c7f0ac8abf228369e1016eb6016c40758 */
+	read_object(repo1, "acf362a92101202f5f09c9b51db352be27b5bf7e");
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert(memory_used > 0);
+	cl_assert_equal_i(prev_hits, hits);
+	cl_assert(misses > prev_misses);
+
+	/* The base is shared between repositories */
+	read_object(repo2, "acf362a92101202f5f09c9b51db352be27b5bf7e");
+
+	prev_hits = hits;
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(prev_hits + 1, hits);
+
+	/* Shrinking the cache evicts the bases that no longer fit */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(0, memory_used);
+
+	read_object(repo1, "acf362a92101202f5f09c9b51db352be27b5bf7e");
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(0, memory_used);
+
+	git_repository_free(repo1);
+	git_repository_free(repo2);
+}
+
+void test_pack_sharing__shared_trees(void)
+{
+	git_odb *odb1, *odb2;
+	git_odb_object *obj1, *obj2;
+	git_oid id;
+	size_t memory_used, hits, misses;
+
+	/* Read the objects from the packs every time */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	cl_git_pass(git_odb_open_ext(&odb1, cl_fixture("testrepo.git/objects"), NULL));
+	cl_git_pass(git_odb_open_ext(&odb2, cl_fixture("testrepo.git/objects"), NULL));
+
+	git_oid_from_string(&id, "e2401d52544ebf052730a63e8acfe4ccfb8fa0d0", GIT_OID_SHA1);
+
+	cl_git_pass(git_odb_read(&obj1, odb1, &id));
+	cl_git_pass(git_odb_read(&obj2, odb2, &id));
+
+	/* Both objects point at the tree in the delta base cache */
+	cl_assert_equal_i(GIT_OBJECT_TREE, git_odb_object_type(obj1));
+	cl_assert_equal_i(1404, git_odb_object_size(obj1));
+	cl_assert(git_odb_object_data(obj1) == git_odb_object_data(obj2));
+
+	git_odb_object_free(obj1);
+	git_odb_free(odb1);
+
+	/* The data stays valid until the last object that uses it is freed */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)0));
+	cl_assert_equal_i(1404, git_odb_object_size(obj2));
+	cl_assert(memcmp(git_odb_object_data(obj2), "100644 ", 7) == 0 ||
+		memcmp(git_odb_object_data(obj2), "40000 ", 6) == 0);
+
+	/* Borrowed trees don't take up the room of the delta bases */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(0, memory_used);
+
+	git_odb_object_free(obj2);
+	git_odb_free(odb2);
+
+	/* and are evicted once they are no longer borrowed */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(0, memory_used);
+}
+
+void test_pack_sharing__freed_packs_leave_the_cache(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+	size_t initial_used, memory_used, hits, misses;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &initial_used, &hits, &misses));
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	read_object(repo, "acf362a92101202f5f09c9b51db352be27b5bf7e");
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert(memory_used > initial_used);
+
+	git_repository_free(repo);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(initial_used, memory_used);
+
+	/* A tree that is still borrowed outlives its pack */
+	cl_git_pass(git_odb_open_ext(&odb, cl_fixture("testrepo.git/objects"), NULL));
+	git_oid_from_string(&id, "e2401d52544ebf052730a63e8acfe4ccfb8fa0d0", GIT_OID_SHA1);
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_free(odb);
+
+	cl_assert_equal_i(1404, git_odb_object_size(obj));
+	cl_assert(memcmp(git_odb_object_data(obj), "100644 ", 7) == 0 ||
+		memcmp(git_odb_object_data(obj), "40000 ", 6) == 0);
+
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &memory_used, &hits, &misses));
+	cl_assert_equal_i(initial_used, memory_used);
+}
@@ -0,0 +1,91 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "array.h"
+
+/* This test reads every object of a large repository, so that it
+ * reaches across its packfiles.
+ *
+ * For now, we use the LibGit2 repo containing the
+ * source tree because it is already here.
+ */
+#define SRC_REPO (cl_fixture("../.."))
+
+#define WINDOW_SIZE (1024 * 1024)
+#define MAPPED_LIMIT (8 * 1024 * 1024)
+
+typedef git_array_t(git_oid) oid_array;
+
+static size_t _orig_window_size;
+static size_t _orig_mapped_limit;
+static int _orig_full_map;
+
+void test_perf_packread__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &_orig_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &_orig_mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FULL_MAP, &_orig_full_map));
+}
+
+void test_perf_packread__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, _orig_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, _orig_mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, _orig_full_map));
+}
+
+static int collect_ids(const git_oid *id, void *payload)
+{
+	oid_array *ids = payload;
+	git_oid *out = git_array_alloc(*ids);
+
+	GIT_ERROR_CHECK_ALLOC(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+static void read_all_objects(const char *test_name, int full_map)
+{
+	oid_array ids = GIT_ARRAY_INIT;
+	perf_timer t_read = PERF_TIMER_INIT;
+	git_repository *repo;
+	git_odb_object *obj;
+	git_odb *odb;
+	git_oid *id;
+	size_t i, read = 0;
+
+	/* Small windows, so that the windowed reads have to slide them */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)WINDOW_SIZE));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)MAPPED_LIMIT));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, full_map));
+
+	cl_git_pass(git_repository_open(&repo, SRC_REPO));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_foreach(odb, collect_ids, &ids));
+
+	perf__timer__start(&t_read);
+
+	git_array_foreach(ids, i, id) {
+		if (git_odb_read(&obj, odb, id) < 0)
+			continue;
+
+		git_odb_object_free(obj);
+		read++;
+	}
+
+	perf__timer__stop(&t_read);
+	perf__timer__report(&t_read, "%s: read %"PRIuZ" objects", test_name, read);
+
+	git_array_clear(ids);
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_perf_packread__windowed(void)
+{
+	read_all_objects("windowed", 0);
+}
+
+void test_perf_packread__full_map(void)
+{
+	read_all_objects("full map", 1);
+}
@@ -648,3 +648,75 @@ void test_revwalk_basic__newer_hidden_commit_hides_old_commits(void)
 
 	cl_git_fail_with(GIT_ITEROVER, git_revwalk_next(&oid, _walk));
 }
+
+/*
+ * The commits of `master` in testrepo.git are loose objects; corrupt them
+ * so that they can only be walked from the commit-graph.
+ */
+static void corrupt_loose_commit(const char *id)
+{
+	git_str path = GIT_STR_INIT;
+
+	cl_git_pass(git_str_printf(&path, "testrepo.git/objects/%.2s/%s", id, id + 2));
+	cl_must_pass(p_chmod(path.ptr, 0644));
+	cl_git_rewritefile(path.ptr, "corrupt");
+
+	git_str_dispose(&path);
+}
+
+void test_revwalk_basic__from_commit_graph(void)
+{
+	static const char *master_ids[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a",
+		"4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644",
+		"8496071c1b46c854b31185ea97743be6a8774479",
+	};
+	git_pathspec *ps;
+	git_commit *commit;
+	git_oid id, br2;
+	char *path = "README";
+	git_strarray paths = { &path, 1 };
+	size_t i, ahead, behind;
+
+	revwalk_basic_setup_walk("testrepo.git");
+
+	for (i = 0; i < ARRAY_SIZE(master_ids); i++)
+		corrupt_loose_commit(master_ids[i]);
+
+	cl_git_pass(git_oid_from_string(&id, master_ids[0], GIT_OID_SHA1));
+	cl_git_fail(git_commit_lookup(&commit, _repo, &id));
+
+	git_revwalk_sorting(_walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_head(_walk));
+	cl_git_pass(git_oid_from_string(&id, master_ids[5], GIT_OID_SHA1));
+	cl_git_pass(git_revwalk_hide(_walk, &id));
+
+	for (i = 0; i < 5; i++) {
+		cl_git_pass(git_revwalk_next(&id, _walk));
+		cl_assert_equal_s(master_ids[i], git_oid_tostr_s(&id));
+	}
+	cl_git_fail_with(GIT_ITEROVER, git_revwalk_next(&id, _walk));
+
+	/* the trees to limit the walk with come from the commit-graph, too */
+	git_revwalk_reset(_walk);
+	cl_git_pass(git_pathspec_new(&ps, &paths));
+	cl_git_pass(git_revwalk_pathspec(_walk, ps));
+	cl_git_pass(git_revwalk_push_head(_walk));
+
+	cl_git_pass(git_revwalk_next(&id, _walk));
+	cl_assert_equal_s(master_ids[4], git_oid_tostr_s(&id));
+	cl_git_pass(git_revwalk_next(&id, _walk));
+	cl_assert_equal_s(master_ids[6], git_oid_tostr_s(&id));
+	cl_git_fail_with(GIT_ITEROVER, git_revwalk_next(&id, _walk));
+	git_pathspec_free(ps);
+
+	cl_git_pass(git_oid_from_string(&id, master_ids[0], GIT_OID_SHA1));
+	cl_git_pass(git_oid_from_string(&br2, "a4a7dce85cf63874e984719f4fdd239f5145052f", GIT_OID_SHA1));
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &id, &br2));
+	cl_assert_equal_sz(2, ahead);
+	cl_assert_equal_sz(1, behind);
+}
@@ -103,3 +103,81 @@ void test_revwalk_pathspec__wildcard(void)
 	git_revwalk_free(walk);
 	git_pathspec_free(ps);
 }
+
+/* The branches of the `bloom` repository. */
+static const char *bloom_tips[] = {
+	"258f0e2a959a364e40ed6603d5d44fbb24765b10",
+	"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9",
+	"4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+	"763d71aadf09a7951596c9746c024e7eece7c7af",
+	"8496071c1b46c854b31185ea97743be6a8774479",
+	"9fd738e8f7967c078dceed8190330fc8648ee56a",
+	"a4a7dce85cf63874e984719f4fdd239f5145052f",
+	"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+	"e90810b8df3e80c413d903f631643c716887138d",
+};
+
+static size_t walk_pathspec(git_oid *out, size_t max, git_repository *r, char *path)
+{
+	git_revwalk *walk;
+	git_pathspec *ps = NULL;
+	git_strarray paths = { NULL, 1 };
+	git_oid id;
+	size_t i, count = 0;
+	int error;
+
+	paths.strings = &path;
+
+	cl_git_pass(git_revwalk_new(&walk, r));
+	cl_git_pass(git_pathspec_new(&ps, &paths));
+	cl_git_pass(git_revwalk_pathspec(walk, ps));
+
+	for (i = 0; i < ARRAY_SIZE(bloom_tips); i++) {
+		cl_git_pass(git_oid_from_string(&id, bloom_tips[i], GIT_OID_SHA1));
+		cl_git_pass(git_revwalk_push(walk, &id));
+	}
+
+	while ((error = git_revwalk_next(&out[count], walk)) == 0)
+		cl_assert(++count < max);
+
+	cl_assert_equal_i(error, GIT_ITEROVER);
+
+	git_revwalk_free(walk);
+	git_pathspec_free(ps);
+	return count;
+}
+
+/*
+ * The `bloom` repository has the same history as `testrepo`, with
+ * changed-path Bloom filters in its commit-graph; the results of a
+ * path-limited walk must not depend on them.
+ */
+void test_revwalk_pathspec__bloom_filters(void)
+{
+	git_repository *bloom_repo;
+	git_oid expected[16], actual[16];
+	char *paths[] = {
+		"README", "new.txt", "branch_file.txt", "ab", "ab/de/fgh/1.txt",
+		"ab/c/", "does/not/exist", "*.txt", "ab/*.txt", "ab/de/f*"
+	};
+	size_t i, j, k, count;
+
+	cl_git_pass(git_repository_open(&bloom_repo, cl_fixture("bloom.git")));
+
+	for (i = 0; i < ARRAY_SIZE(paths); i++) {
+		count = walk_pathspec(expected, ARRAY_SIZE(expected), repo, paths[i]);
+		cl_assert_equal_i(count, walk_pathspec(actual, ARRAY_SIZE(actual), bloom_repo, paths[i]));
+
+		/* the two commit-graphs may yield the commits in a different order */
+		for (j = 0; j < count; j++) {
+			for (k = 0; k < count; k++) {
+				if (git_oid_equal(&expected[j], &actual[k]))
+					break;
+			}
+
+			cl_assert(k < count);
+		}
+	}
+
+	git_repository_free(bloom_repo);
+}
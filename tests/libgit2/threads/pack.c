@@ -0,0 +1,79 @@
+#include "clar_libgit2.h"
+#include "thread_helpers.h"
+#include "git2/sys/odb_backend.h"
+#include "array.h"
+
+static size_t _orig_window_size;
+static size_t _orig_mapped_limit;
+static int _orig_full_map;
+
+void test_threads_pack__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &_orig_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &_orig_mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FULL_MAP, &_orig_full_map));
+
+	/* Use tiny windows, so that reading the pack keeps closing them. */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)8192));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)32768));
+}
+
+void test_threads_pack__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, _orig_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, _orig_mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, _orig_full_map));
+}
+
+typedef git_array_t(git_oid) oid_array;
+
+static int collect_ids(const git_oid *id, void *payload)
+{
+	oid_array *ids = payload;
+	git_oid *out = git_array_alloc(*ids);
+
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+static void *read_pack(void *arg)
+{
+	oid_array ids = GIT_ARRAY_INIT;
+	git_odb_backend *backend;
+	git_odb_object *obj;
+	git_odb *odb;
+	git_oid *id;
+	size_t i;
+
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"),
+		NULL));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	cl_git_pass(git_odb_foreach(odb, collect_ids, &ids));
+	cl_assert_equal_sz(1628, git_array_size(ids));
+
+	git_array_foreach(ids, i, id) {
+		cl_git_pass(git_odb_read(&obj, odb, id));
+		git_odb_object_free(obj);
+	}
+
+	git_array_clear(ids);
+	git_odb_free(odb);
+	git_error_clear();
+	return arg;
+}
+
+void test_threads_pack__concurrent_reads_with_small_windows(void)
+{
+	run_in_parallel(1, 8, read_pack, NULL, NULL);
+}
+
+void test_threads_pack__concurrent_reads_with_full_map(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FULL_MAP, 1));
+
+	run_in_parallel(1, 8, read_pack, NULL, NULL);
+}
@@ -0,0 +1,113 @@
+#include "clar_libgit2.h"
+#include "ewah.h"
+
+static void put_be32(unsigned char *out, uint32_t val)
+{
+	out[0] = (unsigned char)(val >> 24);
+	out[1] = (unsigned char)(val >> 16);
+	out[2] = (unsigned char)(val >> 8);
+	out[3] = (unsigned char)val;
+}
+
+static void put_be64(unsigned char *out, uint64_t val)
+{
+	put_be32(out, (uint32_t)(val >> 32));
+	put_be32(out + 4, (uint32_t)val);
+}
+
+void test_ewah__bitmap(void)
+{
+	git_bitmap one = GIT_BITMAP_INIT, two = GIT_BITMAP_INIT;
+	size_t pos = 0, count = 0;
+
+	cl_git_pass(git_bitmap_set(&one, 3));
+	cl_git_pass(git_bitmap_set(&one, 64));
+	cl_git_pass(git_bitmap_set(&one, 1000));
+	cl_git_pass(git_bitmap_set(&two, 64));
+
+	cl_assert(git_bitmap_get(&one, 1000));
+	cl_assert(!git_bitmap_get(&one, 999));
+	cl_assert(!git_bitmap_get(&two, 1000));
+	cl_assert_equal_i(3, git_bitmap_popcount(&one));
+
+	while (git_bitmap_next(&pos, &one) == 0) {
+		cl_assert(pos == 3 || pos == 64 || pos == 1000);
+		count++;
+		pos++;
+	}
+	cl_assert_equal_i(3, count);
+
+	git_bitmap_and_not(&one, &two);
+	cl_assert_equal_i(2, git_bitmap_popcount(&one));
+	cl_assert(!git_bitmap_get(&one, 64));
+
+	cl_git_pass(git_bitmap_or(&two, &one));
+	cl_assert_equal_i(3, git_bitmap_popcount(&two));
+
+	cl_git_pass(git_bitmap_xor(&two, &one));
+	cl_assert_equal_i(1, git_bitmap_popcount(&two));
+	cl_assert(git_bitmap_get(&two, 64));
+
+	git_bitmap_dispose(&one);
+	git_bitmap_dispose(&two);
+}
+
+void test_ewah__read(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	unsigned char data[8 + 3 * 8 + 4];
+	size_t consumed;
+
+	/*
+	 * 200 bits: a run of two words of ones followed by a single
+	 * literal word.
+	 */
+	memset(data, 0, sizeof(data));
+	put_be32(data, 200);
+	put_be32(data + 4, 2);
+	put_be64(data + 8, ((uint64_t)1 << 33) | (2 << 1) | 1);
+	put_be64(data + 16, 0x5);
+	put_be32(data + 24, 0);
+
+	cl_git_fail(git_ewah_read(&bitmap, &consumed, data, 20));
+
+	cl_git_pass(git_ewah_read(&bitmap, &consumed, data, sizeof(data)));
+	cl_assert_equal_i(8 + 2 * 8 + 4, consumed);
+	cl_assert_equal_i(130, git_bitmap_popcount(&bitmap));
+	cl_assert(git_bitmap_get(&bitmap, 127));
+	cl_assert(git_bitmap_get(&bitmap, 128));
+	cl_assert(!git_bitmap_get(&bitmap, 129));
+	cl_assert(git_bitmap_get(&bitmap, 130));
+
+	/* a run that overflows the declared size is rejected */
+	put_be32(data, 64);
+	cl_git_fail(git_ewah_read(&bitmap, &consumed, data, sizeof(data)));
+
+	git_bitmap_dispose(&bitmap);
+}
+
+void test_ewah__roundtrip(void)
+{
+	git_bitmap in = GIT_BITMAP_INIT, out = GIT_BITMAP_INIT;
+	git_str buf = GIT_STR_INIT;
+	size_t consumed, i;
+
+	/* a literal word, a run of ones, a run of zeros and a literal */
+	cl_git_pass(git_bitmap_set(&in, 5));
+	for (i = 64; i < 64 * 4; i++)
+		cl_git_pass(git_bitmap_set(&in, i));
+	cl_git_pass(git_bitmap_set(&in, 64 * 10 + 7));
+
+	cl_git_pass(git_ewah_write(&buf, &in));
+	cl_git_pass(git_ewah_read(&out, &consumed, (const unsigned char *)buf.ptr, buf.size));
+
+	cl_assert_equal_i(buf.size, consumed);
+	cl_assert_equal_i(git_bitmap_popcount(&in), git_bitmap_popcount(&out));
+
+	for (i = 0; i < 64 * 12; i++)
+		cl_assert_equal_b(git_bitmap_get(&in, i), git_bitmap_get(&out, i));
+
+	git_bitmap_dispose(&in);
+	git_bitmap_dispose(&out);
+	git_str_dispose(&buf);
+}